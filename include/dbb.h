@@ -2,14 +2,37 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#ifndef LIBDBB_DBB_H
+#define LIBDBB_DBB_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <stdint.h>
 #include <stdio.h>
 #include <string>
 #include <vector>
 
+#ifdef WIN32
+#include <windows.h>
+#include "mingw/mingw.mutex.h"
+#include "mingw/mingw.condition_variable.h"
+#include "mingw/mingw.thread.h"
+#else
+#include <future>
+#endif
+
+#define DBB_USB_VENDOR_ID 0x03eb
+#define DBB_USB_PRODUCT_ID 0x2402
+
 #define HID_REPORT_SIZE_DEFAULT 4096
 #define HID_BL_BUF_SIZE_W 4098
 #define HID_BL_BUF_SIZE_R 256
+#define HID_MAX_BUF_SIZE 5120
 #define FIRMWARE_CHUNKSIZE 4096
 #define FIRMWARE_SIGLEN (7*64) //7 concatenated signatures
 #define DBB_APP_LENGTH 225280 //flash size minus bootloader length
@@ -19,6 +42,9 @@
 #define BACKUP_KEY_PBKDF2_ROUNDS   20480
 #define BACKUP_KEY_PBKDF2_HMACLEN  64
 
+struct hid_device_;
+class UniValue;
+
 namespace DBB {
 
 enum dbb_device_mode {
@@ -30,33 +56,422 @@ enum dbb_device_mode {
     DBB_DEVICE_MODE_FIRMWARE_U2F_NO_PASSWORD,
     DBB_DEVICE_UNKNOWN,
 };
+
+enum dbb_cmd_status {
+    DBB_CMD_OK = 0,
+    DBB_CMD_FAILED,
+    DBB_CMD_TIMEOUT,
+    DBB_CMD_CANCELED,
+};
+
+//!result of an asynchronous device command
+class CommandResult
+{
+public:
+    enum dbb_cmd_status status;
+    std::string result;
+
+    CommandResult() : status(DBB_CMD_FAILED) {}
+};
+
+//!cancels a queued or running asynchronous command, all copies share the same state
+class CancelToken
+{
+public:
+    CancelToken() : flag(std::make_shared<std::atomic<bool> >(false)) {}
+    void cancel() { *flag = true; }
+    bool isCanceled() const { return *flag; }
+    const std::atomic<bool>* get() const { return flag.get(); }
+
+private:
+    std::shared_ptr<std::atomic<bool> > flag;
+};
+
+typedef std::function<void(const CommandResult&)> CommandCallback;
+
+struct IOControl;
+
+//!a single enumerated DBB device
+class DeviceInfo
+{
+public:
+    std::string path;
+    std::string serial;
+    std::string version; //!< firmware/bootloader version part of the serial
+    enum dbb_device_mode mode;
+};
+
+//!timing of the last U2FHID frame transfer
+class FrameStats
+{
+public:
+    unsigned int frames;
+    int64_t totalMicros;
+    int64_t maxFrameMicros;
+
+    FrameStats() : frames(0), totalMicros(0), maxFrameMicros(0) {}
+};
+
+//!a connection to one digital bitbox
+// owns the HID handle, the report buffer and the device mode,
+// calls on one session are serialized, different sessions can be used in parallel
+class DeviceSession
+{
+public:
+    DeviceSession();
+    ~DeviceSession();
+
+    //!open the device at the given path, returns false if no connection could be made
+    bool open(enum dbb_device_mode mode, const std::string& devicePath);
+
+    //!close the connection, returns false if the session was not open
+    bool close();
+
+    //!return true if the USBHID connection is open
+    bool isOpen();
+
+    //!keep-alive: make sure the session is open, (re)opens the first available device if required
+    // the handle stays open across commands and is only dropped on an I/O error or by close()
+    bool ensureOpen();
+
+    //!number of times ensureOpen() had to (re)open the device
+    unsigned int getReconnectCount();
+
+    //!per frame timing of the last command sent over U2FHID
+    FrameStats getLastFrameStats();
+
+    //!send a json command to the device
+    bool sendCommand(const std::string& json, std::string& resultOut);
+
+    //!send a json command and read the response straight into a caller provided buffer
+    // no NUL termination is added, resultLenOut is the number of response bytes
+    // (U2F message length, legacy HID: up to the report padding)
+    bool sendCommand(const std::string& json, unsigned char* resultBuf, size_t resultBufSize, size_t& resultLenOut);
+
+    //!send a binary chunk (used for firmware updates)
+    bool sendChunk(unsigned int chunknum, const std::vector<unsigned char>& data, std::string& resultOut);
+
+    //!send a binary chunk straight from the given memory (max. FIRMWARE_CHUNKSIZE bytes)
+    bool sendChunk(unsigned int chunknum, const unsigned char* data, size_t dataLen, std::string& resultOut);
+
+    //!queue a json command on the sessions I/O thread, the callback is called on the I/O thread
+    // timeoutMs is the deadline for the whole call (including queueing), 0 uses the default HID read timeout
+    // a command aborted by the deadline or the token while waiting for the device closes the session
+    void sendCommandAsync(const std::string& json, CommandCallback callback, int timeoutMs = 0, CancelToken cancel = CancelToken());
+
+    //!queue a firmware chunk on the sessions I/O thread (no deadline if timeoutMs is 0)
+    void sendChunkAsync(unsigned int chunknum, const std::vector<unsigned char>& data, CommandCallback callback, int timeoutMs = 0, CancelToken cancel = CancelToken());
+
+#ifndef WIN32
+    //!future based variants of the above
+    std::future<CommandResult> sendCommandAsync(const std::string& json, int timeoutMs = 0, CancelToken cancel = CancelToken());
+    std::future<CommandResult> sendChunkAsync(unsigned int chunknum, const std::vector<unsigned char>& data, int timeoutMs = 0, CancelToken cancel = CancelToken());
+#endif
+
+    enum dbb_device_mode getMode();
+    std::string getPath();
+
+private:
+    DeviceSession(const DeviceSession&);
+    DeviceSession& operator=(const DeviceSession&);
+
+    std::recursive_mutex cs_session;
+    struct hid_device_* handle;
+    enum dbb_device_mode mode;
+    std::string path;
+    unsigned int readBufSize;
+    unsigned int writeBufSize;
+    unsigned int reconnectCount;
+    unsigned char report[HID_MAX_BUF_SIZE];
+    std::vector<unsigned char> frameBuffer; //!< preassembled U2FHID frames, reused across commands
+    FrameStats lastFrameStats;
+
+    // asynchronous I/O, the thread is started with the first queued call
+    std::thread ioThread;
+    std::mutex cs_ioQueue;
+    std::condition_variable ioCondVar;
+    std::deque<std::function<void()> > ioQueue;
+    std::atomic<bool> ioStop;
+
+    void postIO(std::function<void()> task);
+    void stopIO();
+
+    bool sendCommandInternal(const std::string& json, unsigned char* resultBuf, size_t resultBufSize, size_t& resultLenOut, IOControl& ctl);
+    bool sendCommandInternal(const std::string& json, std::string& resultOut, IOControl& ctl);
+    bool sendChunkInternal(unsigned int chunknum, const unsigned char* data, size_t dataLen, std::string& resultOut, IOControl& ctl);
+    void dropAfterAbortedRead(const IOControl& ctl);
+};
+
+//!enumerate all connected DBB devices (firmware and bootloader mode)
+std::vector<DeviceInfo> enumerateDevices();
+
+//!get the session for the device at the given path, creates a new (closed) session if required
+// thread-safe, returns the same session for the same path (the default session if it uses the path)
+std::shared_ptr<DeviceSession> getSession(const std::string& devicePath);
+
+//!close and forget the session for the given path (device removed)
+void releaseSession(const std::string& devicePath);
+
+//!the session used by the single device functions below
+// it can't open a device that another session of getSession() is using
+DeviceSession& defaultSession();
+
 //!open a connection to the digital bitbox device
 // retruns false if no connection could be made, keeps connection handling
-// internal
+// internal (uses the default session)
 bool openConnection(enum dbb_device_mode mode, const std::string& devicePath);
 
 //!close the connection to the dbb device
 bool closeConnection();
 
-//!check if a DBB device is available
+//!check if a DBB device is available (returns the first device found)
 enum dbb_device_mode deviceAvailable(std::string& devicePathOut);
 
+//!enumeration cache: if enabled, deviceAvailable() and enumerateDevices() reuse the last
+// enumeration until invalidateDeviceCache() is called, only enable it if something reports
+// topology changes (hotplug events), otherwise every call enumerates
+void setDeviceCacheEnabled(bool enabled);
+
+//!the device topology has changed, re-enumerate with the next lookup (cheap, can be called from any thread)
+void invalidateDeviceCache();
+
+//!amount of hid enumerations done so far
+unsigned int getDeviceEnumerationCount();
+
 //!return true if a USBHID connection is open
 bool isConnectionOpen();
 
+//!persistent connection mode: (re)open the default session only if required
+bool ensureConnection();
+
 //!send a json command to the device which is currently open
 bool sendCommand(const std::string &json, std::string &resultOut);
 
+//!send a json command to the device which is currently open, reads the response into resultBuf
+// (at least HID_REPORT_SIZE_DEFAULT bytes), see DeviceSession::sendCommand
+bool sendCommand(const std::string& json, unsigned char* resultBuf, size_t resultBufSize, size_t& resultLenOut);
+
 //!send a binary chunk (used for firmware updates)
 bool sendChunk(unsigned int chunknum, const std::vector<unsigned char>& data, std::string& resultOut);
 
+//!queue a json command on the I/O thread of the default session, see DeviceSession::sendCommandAsync
+void sendCommandAsync(const std::string& json, CommandCallback callback, int timeoutMs = 0, CancelToken cancel = CancelToken());
+
+#ifndef WIN32
+std::future<CommandResult> sendCommandAsync(const std::string& json, int timeoutMs = 0, CancelToken cancel = CancelToken());
+#endif
+
+//!statistics of an executed command batch
+class BatchStats
+{
+public:
+    unsigned int commands;   //!< commands sent to the device
+    unsigned int inputs;     //!< sign inputs (hashes) sent
+    int64_t elapsedMicros;
+
+    BatchStats() : commands(0), inputs(0), elapsedMicros(0) {}
+    double inputsPerSecond() const { return (elapsedMicros > 0) ? inputs * 1000000.0 / elapsedMicros : 0; }
+};
+
+//!queues commands and sends them back-to-back over one open session
+// every command is its own round-trip, sign commands need the echo and the
+// second sign command of the caller and can't be combined
+class CommandBatch
+{
+public:
+    CommandBatch(DeviceSession& sessionIn);
+
+    //!queue a json command, a non-empty password encrypts the command and decrypts the response
+    // the callback gets the (decrypted) response in the order the commands have been added
+    void add(const std::string& json, const std::string& password, CommandCallback callback);
+
+    //!amount of queued commands
+    size_t size();
+
+    //!send all queued commands, returns false if any command failed
+    bool execute();
+
+    BatchStats getStats();
+
+private:
+    class Entry
+    {
+    public:
+        std::string json;
+        std::string password;
+        CommandCallback callback;
+    };
+
+    DeviceSession& session;
+    std::vector<Entry> entries;
+    BatchStats stats;
+};
+
+//!a firmware image (optionally prefixed with FIRMWARE_SIGLEN signature bytes)
+// files are memory mapped where possible, buffers are used without copying
+class FirmwareImage
+{
+public:
+    FirmwareImage();
+    ~FirmwareImage();
+
+    //!map the given file, returns false if the file can't be read or exceeds DBB_APP_LENGTH
+    bool open(const std::string& filename, bool hasSignature = true);
+
+    //!use the given buffer, it needs to outlive the image
+    bool setBuffer(const unsigned char* buffer, size_t length, bool hasSignature = true);
+
+    void close();
+
+    //!hex of the prefixed signatures, empty if the image has none
+    std::string signatureHex() const;
+
+    //!the firmware binary without signatures and without 0xFF padding
+    const unsigned char* appData() const;
+    size_t appSize() const;
+
+    //!amount of bytes to send, the 0xFF tail is skipped (flash is 0xFF after the erase)
+    size_t uploadSize() const;
+
+    bool isMapped() const;
+
+private:
+    FirmwareImage(const FirmwareImage&);
+    FirmwareImage& operator=(const FirmwareImage&);
+
+    const unsigned char* data;
+    size_t size;
+    bool hasSig;
+    void* mapping;
+    size_t mappingLength;
+    std::vector<unsigned char> ownedBuffer; //!< fallback if mmap is not available
+};
+
+//!timing of a firmware upload
+class FirmwareUploadStats
+{
+public:
+    size_t bytes;
+    unsigned int chunks;
+    unsigned int skippedChunks; //!< 0xFF chunks not sent
+    int64_t elapsedMicros;
+
+    FirmwareUploadStats() : bytes(0), chunks(0), skippedChunks(0), elapsedMicros(0) {}
+    double kbPerSecond() const { return (elapsedMicros > 0) ? (bytes / 1024.0) * 1000000.0 / elapsedMicros : 0; }
+};
+
 //!creates a (dummy) signature to allows to run custom compiled firmware on development devices
 //!WILL ONLY RUN ON DEVELOPMENT DEVICES (only those accept dummy signatures)
 const std::string dummySig(const std::vector<char>& firmwareBuffer);
+const std::string dummySig(const FirmwareImage& image);
 
 //!send firmware
 bool upgradeFirmware(const std::vector<char>& firmware, size_t firmwareSize, const std::string& sigCmpStr, std::function<void(const std::string&, float)> progressCallback);
 
+//!stream a firmware image to the first device in bootloader mode (default session)
+bool upgradeFirmware(const FirmwareImage& image, const std::string& sigCmpStr, std::function<void(const std::string&, float)> progressCallback, FirmwareUploadStats* statsOut = NULL);
+
+//!stream a firmware image over an open bootloader session, chunks are sent directly from the image
+// the session is closed when done
+bool upgradeFirmware(DeviceSession& session, const FirmwareImage& image, const std::string& sigCmpStr, std::function<void(const std::string&, float)> progressCallback, FirmwareUploadStats* statsOut = NULL);
+
+//!largest plain text command/response CommandCipher accepts
+#define DBB_CIPHER_MAX_MESSAGE (4 * 1024 * 1024)
+
+//!reusable working memory for CommandCipher::encrypt/decrypt
+// the buffer grows to the largest message seen (bounded by DBB_CIPHER_MAX_MESSAGE),
+// it is kept in locked memory and wiped when freed. Not thread safe, use one per thread.
+class CipherScratch
+{
+public:
+    CipherScratch();
+    ~CipherScratch();
+
+    //!returns a buffer of at least len bytes, NULL if len exceeds the limit or the allocation fails
+    unsigned char* reserve(size_t len);
+
+    //!wipes the first len bytes of the buffer
+    void wipe(size_t len);
+
+    size_t capacity() const;
+
+private:
+    unsigned char* buffer;
+    size_t bufferSize;
+
+    CipherScratch(const CipherScratch&);
+    CipherScratch& operator=(const CipherScratch&);
+};
+
+//!AES-256-CBC cipher for the encrypted device commands of one password
+// the key and the expanded key schedule are derived once and kept in locked memory,
+// they get wiped when the cipher is destroyed.
+// encrypt/decrypt don't modify the cipher and can be called from multiple threads
+class CommandCipher
+{
+public:
+    CommandCipher(const std::string& password, bool stretch = true);
+    ~CommandCipher();
+
+    //!returns true if the key could be derived (non empty password, locked memory available)
+    bool isValid() const;
+
+    //!returns true if this cipher was derived from password (in the given mode), constant time
+    bool matches(const std::string& password, bool stretch) const;
+
+    //!encrypts a json command (random IV, PKCS7 padded, base64 encoded)
+    // padding and encryption happen in place in the scratch buffer (a pooled one if NULL)
+    bool encrypt(const std::string& cmd, std::string& base64strOut, CipherScratch* scratch = NULL) const;
+
+    //!decrypt a json result (stretched: {"ciphertext":...} object, otherwise plain base64)
+    // the base64 data is decoded and decrypted in place in the scratch buffer (a pooled one if NULL)
+    bool decrypt(const std::string& cmdIn, std::string& stringOut, CipherScratch* scratch = NULL) const;
+
+private:
+    struct KeyState;
+    KeyState* state;
+    bool stretched;
+
+    CommandCipher(const CommandCipher&);
+    CommandCipher& operator=(const CommandCipher&);
+};
+
+//!version byte of the authenticated channel format
+#define DBB_CHANNEL_CIPHER_VERSION 0x02
+
+//!authenticated cipher for the smart verification channel (AES-256-CTR, encrypt-then-MAC with HMAC-SHA256)
+// base64( version | timestamp (8 bytes, big endian) | counter block (16) | ciphertext | tag (32) )
+// the encryption and the MAC key are derived from the channel key, the tag covers everything before it.
+// Messages are authenticated (and checked for staleness) before anything gets decrypted.
+class ChannelCipher
+{
+public:
+    ChannelCipher(const unsigned char* key, size_t keyLen);
+    ~ChannelCipher();
+
+    bool isValid() const;
+
+    //!returns true if the payload starts with the version byte (doesn't authenticate it)
+    static bool isVersioned(const std::string& base64In);
+
+    //!encrypts plaintext, timestamp is the senders time (e.g. ms since epoch)
+    bool encrypt(const std::string& plaintext, uint64_t timestamp, std::string& base64Out, CipherScratch* scratch = NULL) const;
+
+    //!authenticates and decrypts a payload, rejects it if the tag is invalid or the timestamp is older than minTimestamp
+    bool decrypt(const std::string& base64In, std::string& plaintextOut, uint64_t minTimestamp = 0, uint64_t* timestampOut = NULL, CipherScratch* scratch = NULL) const;
+
+private:
+    struct KeyState;
+    KeyState* state;
+
+    ChannelCipher(const ChannelCipher&);
+    ChannelCipher& operator=(const ChannelCipher&);
+};
+
+//!wipes the ciphers cached by decryptAndDecodeCommand/encryptAndEncodeCommand
+// (call when the session password gets cleared)
+void clearCommandCipherCache();
+
 //!decrypt a json result
 bool decryptAndDecodeCommand(const std::string &cmdIn,
                              const std::string &password,
@@ -69,5 +484,8 @@ bool encryptAndEncodeCommand(const std::string &cmd,
                              std::string &base64strOut,
                              bool stretch = true);
 
-std::string getStretchedBackupHexKey(const std::string &passphrase);
+//!PBKDF2-HMAC-SHA512 stretched backup key as hex string, empty if the key could not be derived
+std::string getStretchedBackupHexKey(const std::string &passphrase, unsigned int rounds = BACKUP_KEY_PBKDF2_ROUNDS);
 } //end namespace DBB
+
+#endif // LIBDBB_DBB_H
@@ -0,0 +1,178 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench_dbb.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "libdbb/crypto.h"
+
+#define BENCH_BASE64_TOTAL (64 * 1024 * 1024)
+
+// the former char by char codec, kept as baseline
+static const std::string legacy_base64_chars =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "abcdefghijklmnopqrstuvwxyz"
+    "0123456789+/";
+
+
+static inline bool legacy_is_base64(unsigned char c)
+{
+    return (isalnum(c) || (c == '+') || (c == '/'));
+}
+
+static std::string legacy_base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len)
+{
+    std::string ret;
+    int i = 0;
+    int j = 0;
+    unsigned char char_array_3[3];
+    unsigned char char_array_4[4];
+
+    while (in_len--) {
+        char_array_3[i++] = *(bytes_to_encode++);
+        if (i == 3) {
+            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
+            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
+            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
+            char_array_4[3] = char_array_3[2] & 0x3f;
+
+            for (i = 0; (i < 4); i++)
+                ret += legacy_base64_chars[char_array_4[i]];
+            i = 0;
+        }
+    }
+
+    if (i) {
+        for (j = i; j < 3; j++)
+            char_array_3[j] = '\0';
+
+        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
+        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
+        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
+        char_array_4[3] = char_array_3[2] & 0x3f;
+
+        for (j = 0; (j < i + 1); j++)
+            ret += legacy_base64_chars[char_array_4[j]];
+
+        while ((i++ < 3))
+            ret += '=';
+    }
+
+    return ret;
+}
+
+static std::string legacy_base64_decode(std::string const& encoded_string)
+{
+    int in_len = encoded_string.size();
+    int i = 0;
+    int j = 0;
+    int in_ = 0;
+    unsigned char char_array_4[4], char_array_3[3];
+    std::string ret;
+
+    while (in_len-- && (encoded_string[in_] != '=')) {
+
+        if (!legacy_is_base64(encoded_string[in_]))
+            return std::string();
+
+        char_array_4[i++] = encoded_string[in_];
+        in_++;
+        if (i == 4) {
+            for (i = 0; i < 4; i++)
+                char_array_4[i] = legacy_base64_chars.find(char_array_4[i]);
+
+            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
+            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
+            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+
+            for (i = 0; (i < 3); i++)
+                ret += char_array_3[i];
+            i = 0;
+        }
+    }
+
+    if (i) {
+        for (j = i; j < 4; j++)
+            char_array_4[j] = 0;
+
+        for (j = 0; j < 4; j++)
+            char_array_4[j] = legacy_base64_chars.find(char_array_4[j]);
+
+        char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
+        char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
+        char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+
+        for (j = 0; (j < i - 1); j++)
+            ret += char_array_3[j];
+    }
+
+    return ret;
+}
+
+void benchBase64()
+{
+    // typical encrypted command/response sizes
+    static const size_t sizes[] = {1024, 2048, 5120};
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        std::vector<unsigned char> payload(sizes[s]);
+        for (size_t i = 0; i < payload.size(); i++)
+            payload[i] = (unsigned char)rand();
+        std::string encoded = base64_encode(&payload[0], payload.size());
+        if (legacy_base64_encode(&payload[0], payload.size()) != encoded || base64_decode(encoded) != std::string(payload.begin(), payload.end())) {
+            printf("base64 mismatch\n");
+            return;
+        }
+
+        char name[32];
+        uint64_t start, done;
+        size_t chars = 0;
+
+        snprintf(name, sizeof(name), "base64_encode_%uk", (unsigned int)(sizes[s] / 1024));
+        start = benchTimeMicros();
+        for (done = 0; done < BENCH_BASE64_TOTAL / 8; done += payload.size())
+            chars += legacy_base64_encode(&payload[0], payload.size()).size();
+        benchReportMbps(name, "legacy", done, benchTimeMicros() - start);
+
+        start = benchTimeMicros();
+        for (done = 0; done < BENCH_BASE64_TOTAL; done += payload.size())
+            chars += base64_encode(&payload[0], payload.size()).size();
+        benchReportMbps(name, "table", done, benchTimeMicros() - start);
+
+        std::vector<char> out(base64_encoded_size(payload.size()));
+        start = benchTimeMicros();
+        for (done = 0; done < BENCH_BASE64_TOTAL; done += payload.size())
+            chars += base64_encode(&payload[0], payload.size(), &out[0]);
+        benchReportMbps(name, "presized", done, benchTimeMicros() - start);
+
+        snprintf(name, sizeof(name), "base64_decode_%uk", (unsigned int)(sizes[s] / 1024));
+        start = benchTimeMicros();
+        for (done = 0; done < BENCH_BASE64_TOTAL / 8; done += payload.size())
+            chars += legacy_base64_decode(encoded).size();
+        benchReportMbps(name, "legacy", done, benchTimeMicros() - start);
+
+        start = benchTimeMicros();
+        for (done = 0; done < BENCH_BASE64_TOTAL; done += payload.size())
+            chars += base64_decode(encoded).size();
+        benchReportMbps(name, "table", done, benchTimeMicros() - start);
+
+        std::vector<unsigned char> dec(base64_decoded_max_size(encoded.size()));
+        start = benchTimeMicros();
+        for (done = 0; done < BENCH_BASE64_TOTAL; done += payload.size()) {
+            size_t len = 0;
+            base64_decode(encoded.data(), encoded.size(), &dec[0], &len);
+            chars += len;
+        }
+        benchReportMbps(name, "presized", done, benchTimeMicros() - start);
+
+        // keeps the loops from being optimized away
+        if (chars == 0)
+            printf("\n");
+    }
+}
@@ -0,0 +1,30 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench_dbb.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+uint64_t benchTimeMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void benchReportMbps(const char* name, const char* variant, uint64_t bytes, uint64_t elapsedMicros)
+{
+    double mbps = elapsedMicros ? ((double)bytes / (1024.0 * 1024.0)) / (elapsedMicros / 1000000.0) : 0;
+    printf("%-28s %-10s %10.1f MB/s\n", name, variant, mbps);
+}
+
+int main(int argc, char** argv)
+{
+    // optional filter: run only the benchmarks with a matching name
+    const char* filter = (argc > 1) ? argv[1] : NULL;
+
+    if (!filter || strcmp(filter, "base64") == 0)
+        benchBase64();
+    return 0;
+}
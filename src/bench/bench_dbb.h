@@ -0,0 +1,18 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef DBBAPP_BENCH_DBB_H
+#define DBBAPP_BENCH_DBB_H
+
+#include <stdint.h>
+
+// monotonic time in microseconds
+uint64_t benchTimeMicros();
+
+// print one result line with the throughput in MB/s
+void benchReportMbps(const char* name, const char* variant, uint64_t bytes, uint64_t elapsedMicros);
+
+void benchBase64();
+
+#endif // DBBAPP_BENCH_DBB_H
@@ -0,0 +1,275 @@
+// Copyright (c) 2016 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bpresponsecache.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+#include "dbb_httpclient.h"
+#include "dbb_util.h"
+
+#include <univalue.h>
+
+// seconds a response is served without a request (fee levels change slowly)
+static const struct {
+    const char* path;
+    int ttl;
+} endpointTTLs[] = {
+    {"/v1/feelevels/", 600},
+    {"/v2/wallets/", 10},
+    {"/v1/txhistory/", 10},
+};
+
+BitPayResponseCache::~BitPayResponseCache()
+{
+    logStats();
+}
+
+int BitPayResponseCache::endpointTTL(const std::string& key)
+{
+    for (const auto& endpoint : endpointTTLs) {
+        if (key.find(endpoint.path) != std::string::npos)
+            return endpoint.ttl;
+    }
+    return -1;
+}
+
+std::string BitPayResponseCache::cacheKey(const std::string& method, const std::string& baseURL, const std::string& url)
+{
+    if (method != "get")
+        return "";
+
+    // remove the r=<random> parameter, the wallet server cache buster
+    std::string path = url;
+    size_t queryStart = path.find('?');
+    if (queryStart != std::string::npos) {
+        std::string query = path.substr(queryStart + 1);
+        std::string keptQuery;
+        size_t pos = 0;
+        while (pos <= query.size()) {
+            size_t end = query.find('&', pos);
+            if (end == std::string::npos)
+                end = query.size();
+            std::string param = query.substr(pos, end - pos);
+            if (!param.empty() && param.compare(0, 2, "r=") != 0)
+                keptQuery += (keptQuery.empty() ? "" : "&") + param;
+            pos = end + 1;
+        }
+        path = path.substr(0, queryStart) + (keptQuery.empty() ? "" : "?" + keptQuery);
+    }
+
+    std::string key = baseURL + path;
+    if (endpointTTL(key) < 0)
+        return "";
+    return key;
+}
+
+bool BitPayResponseCache::prepare(const std::string& key, DBBHTTPRequest& request, std::string& responseOut, std::shared_ptr<BitPayResponseValidators>& validatorsOut)
+{
+    {
+        std::unique_lock<std::mutex> lock(cs_cache);
+        stats.requests++;
+        std::map<std::string, Entry>::iterator it = entries.find(key);
+        if (it != entries.end()) {
+            const Entry& entry = it->second;
+            if (!entry.stale && std::time(0) - entry.fetched < endpointTTL(key)) {
+                stats.hits++;
+                responseOut = entry.body;
+                return true;
+            }
+            if (!entry.validators.etag.empty())
+                request.headers.push_back("If-None-Match: " + entry.validators.etag);
+            if (!entry.validators.lastModified.empty())
+                request.headers.push_back("If-Modified-Since: " + entry.validators.lastModified);
+        }
+    }
+
+    validatorsOut = captureValidators(request);
+    return false;
+}
+
+std::shared_ptr<BitPayResponseValidators> BitPayResponseCache::captureValidators(DBBHTTPRequest& request)
+{
+    // collect the validators of the response (called on the HTTP reactor thread)
+    std::shared_ptr<BitPayResponseValidators> validators = std::make_shared<BitPayResponseValidators>();
+    request.headerCallback = [validators](const std::string& line) {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            return;
+        std::string name = line.substr(0, colon);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        size_t valueStart = line.find_first_not_of(" \t", colon + 1);
+        size_t valueEnd = line.find_last_not_of(" \t\r\n");
+        std::string value = (valueStart == std::string::npos || valueEnd < valueStart) ? "" : line.substr(valueStart, valueEnd - valueStart + 1);
+        if (name == "etag")
+            validators->etag = value;
+        else if (name == "last-modified")
+            validators->lastModified = value;
+    };
+    return validators;
+}
+
+bool BitPayResponseCache::update(const std::string& key, long& httpCode, std::string& response, const BitPayResponseValidators& validators)
+{
+    std::unique_lock<std::mutex> lock(cs_cache);
+    std::map<std::string, Entry>::iterator it = entries.find(key);
+    if (httpCode == 304) {
+        if (it == entries.end()) {
+            // nothing to serve, don't pass the empty body on as a response
+            stats.misses++;
+            response.clear();
+            return false;
+        }
+        stats.notModified++;
+        it->second.fetched = std::time(0);
+        it->second.stale = false;
+        httpCode = 200;
+        response = it->second.body;
+        return false;
+    }
+
+    stats.misses++;
+    if (httpCode != 200)
+        return false;
+
+    Entry& entry = entries[key];
+    bool changed = (entry.body != response);
+    entry.validators = validators;
+    entry.body = response;
+    entry.fetched = std::time(0);
+    entry.stale = false;
+    if (changed)
+        dirty = true;
+    return changed;
+}
+
+bool BitPayResponseCache::getCached(const std::string& key, std::string& responseOut)
+{
+    std::unique_lock<std::mutex> lock(cs_cache);
+    std::map<std::string, Entry>::iterator it = entries.find(key);
+    if (it == entries.end())
+        return false;
+
+    responseOut = it->second.body;
+    return true;
+}
+
+void BitPayResponseCache::invalidate()
+{
+    std::unique_lock<std::mutex> lock(cs_cache);
+    for (std::map<std::string, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+        it->second.stale = true;
+}
+
+void BitPayResponseCache::setFilename(const std::string& filenameIn)
+{
+    std::unique_lock<std::mutex> lock(cs_cache);
+    filename = filenameIn;
+    entries.clear();
+    dirty = false;
+
+    FILE* readFile = fopen(filename.c_str(), "r");
+    std::string json;
+    if (readFile) {
+        fseek(readFile, 0, SEEK_END);
+        long size = ftell(readFile);
+        if (size > 0) {
+            json.resize(size);
+            fseek(readFile, 0, SEEK_SET);
+            json.resize(fread(&json[0], 1, size, readFile));
+        }
+        fclose(readFile);
+    }
+
+    UniValue objData(UniValue::VOBJ);
+    if (!objData.read(json) || !objData.isObject())
+        return;
+
+    const std::vector<std::string>& keys = objData.getKeys();
+    const std::vector<UniValue>& values = objData.getValues();
+    for (size_t i = 0; i < keys.size(); i++) {
+        UniValue bodyU = find_value(values[i], "body");
+        UniValue fetchedU = find_value(values[i], "fetched");
+        if (!bodyU.isStr() || !fetchedU.isNum())
+            continue;
+
+        Entry& entry = entries[keys[i]];
+        entry.body = bodyU.get_str();
+        entry.fetched = fetchedU.get_int64();
+        entry.stale = false;
+        UniValue etagU = find_value(values[i], "etag");
+        if (etagU.isStr())
+            entry.validators.etag = etagU.get_str();
+        UniValue lastModifiedU = find_value(values[i], "lastModified");
+        if (lastModifiedU.isStr())
+            entry.validators.lastModified = lastModifiedU.get_str();
+    }
+}
+
+void BitPayResponseCache::clear()
+{
+    {
+        std::unique_lock<std::mutex> lock(cs_cache);
+        filename.clear();
+        entries.clear();
+        dirty = false;
+    }
+    // wait for a write in progress, the file can be removed afterwards
+    std::unique_lock<std::mutex> lock(cs_save);
+}
+
+void BitPayResponseCache::save()
+{
+    std::string writeFilename;
+    UniValue objData(UniValue::VOBJ);
+    {
+        std::unique_lock<std::mutex> lock(cs_cache);
+        if (filename.empty() || !dirty)
+            return;
+        writeFilename = filename;
+        dirty = false;
+
+        for (std::map<std::string, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+            UniValue entryU(UniValue::VOBJ);
+            entryU.pushKV("body", it->second.body);
+            entryU.pushKV("fetched", (int64_t)it->second.fetched);
+            if (!it->second.validators.etag.empty())
+                entryU.pushKV("etag", it->second.validators.etag);
+            if (!it->second.validators.lastModified.empty())
+                entryU.pushKV("lastModified", it->second.validators.lastModified);
+            objData.pushKV(it->first, entryU);
+        }
+    }
+
+    // refreshes of several threads can save, write one at a time
+    std::unique_lock<std::mutex> lock(cs_save);
+    {
+        // cleared in the meantime
+        std::unique_lock<std::mutex> cacheLock(cs_cache);
+        if (filename != writeFilename)
+            return;
+    }
+    std::string json = objData.write();
+    FILE* writeFile = fopen(writeFilename.c_str(), "w");
+    if (writeFile) {
+        fwrite(&json[0], 1, json.size(), writeFile);
+        fclose(writeFile);
+    }
+}
+
+BitPayCacheStats BitPayResponseCache::getStats()
+{
+    std::unique_lock<std::mutex> lock(cs_cache);
+    return stats;
+}
+
+void BitPayResponseCache::logStats()
+{
+    BitPayCacheStats currentStats = getStats();
+    if (currentStats.requests == 0)
+        return;
+
+    DBB::LogPrint("Wallet server cache: %u requests, %u hits, %u not modified, %u misses, %.0f%% hit rate\n", currentStats.requests, currentStats.hits, currentStats.notModified, currentStats.misses, currentStats.hitRate() * 100.0);
+}
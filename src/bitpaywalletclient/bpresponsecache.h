@@ -0,0 +1,104 @@
+// Copyright (c) 2016 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BP_RESPONSE_CACHE_H
+#define BP_RESPONSE_CACHE_H
+
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef WIN32
+#include <windows.h>
+#include "mingw/mingw.mutex.h"
+#endif
+
+struct DBBHTTPRequest;
+
+//!validators of a response (sent back as If-None-Match / If-Modified-Since)
+struct BitPayResponseValidators
+{
+    std::string etag;
+    std::string lastModified;
+};
+
+struct BitPayCacheStats
+{
+    unsigned int requests;
+    unsigned int hits;        //!< served from the cache without a request
+    unsigned int notModified; //!< revalidated with a 304 response
+    unsigned int misses;      //!< full response loaded
+
+    BitPayCacheStats() : requests(0), hits(0), notModified(0), misses(0) {}
+    double hitRate() const { return requests ? (double)(hits + notModified) / requests : 0; }
+};
+
+// cache for the wallet server GET responses (wallets, fee levels, transaction history)
+// - responses younger than the endpoint TTL are served without a request
+// - older ones are revalidated with conditional requests
+// - the cache is persisted, the last known state is available right after the start
+class BitPayResponseCache
+{
+private:
+    struct Entry
+    {
+        BitPayResponseValidators validators;
+        std::string body;
+        std::time_t fetched;
+        bool stale; //!< must be revalidated, independent of the TTL
+    };
+
+    std::mutex cs_cache;
+    std::mutex cs_save;
+    std::map<std::string, Entry> entries;
+    std::string filename;
+    bool dirty; //!< entries changed since the last save
+    BitPayCacheStats stats;
+
+    //!TTL in seconds for the endpoint of a cache key, negative if the endpoint isn't cached
+    static int endpointTTL(const std::string& key);
+
+public:
+    BitPayResponseCache() : dirty(false) {}
+    ~BitPayResponseCache();
+
+    //!cache key of a request (the random cache buster parameter is removed), empty if the endpoint isn't cached
+    static std::string cacheKey(const std::string& method, const std::string& baseURL, const std::string& url);
+
+    //!returns true with the cached response if it's still fresh (no request needed)
+    //!otherwise the request gets the conditional headers and captures the validators of the response
+    bool prepare(const std::string& key, DBBHTTPRequest& request, std::string& responseOut, std::shared_ptr<BitPayResponseValidators>& validatorsOut);
+
+    //!captures the validators of the response without adding conditional headers
+    static std::shared_ptr<BitPayResponseValidators> captureValidators(DBBHTTPRequest& request);
+
+    //!processes a response, a 304 is replaced by the cached response (and becomes a 200)
+    //!a 304 without a cached response (cleared in the meantime) stays a 304 with an empty body,
+    //!the request has to be repeated without the conditional headers
+    //!returns true if the response body has changed, the file is written by save()
+    bool update(const std::string& key, long& httpCode, std::string& response, const BitPayResponseValidators& validators);
+
+    //!last known response, independent of its age
+    bool getCached(const std::string& key, std::string& responseOut);
+
+    //!marks everything stale, call after requests changing the wallet state (new tx proposal, broadcast, ...)
+    void invalidate();
+
+    //!sets the file to persist the cache in and loads it
+    void setFilename(const std::string& filenameIn);
+
+    //!writes the cache file if something has changed (not on the HTTP reactor, it blocks all transfers)
+    void save();
+
+    //!drops all entries and stops persisting (until setFilename() is called again)
+    void clear();
+
+    BitPayCacheStats getStats();
+    void logStats();
+};
+
+#endif //BP_RESPONSE_CACHE_H
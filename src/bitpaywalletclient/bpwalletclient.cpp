@@ -15,11 +15,14 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <condition_variable>
 #include <ctime>
+#include <map>
 #include <string.h>
 
 #include "libdbb/crypto.h"
 #include "dbb_util.h"
+#include "dbb_httpclient.h"
 
 #include <btc/base58.h>
 #include <btc/ecc_key.h>
@@ -63,6 +66,8 @@ BitPayWalletClient::BitPayWalletClient(std::string dataDirIn, bool testnetIn) :
     baseURL = "https://bws.bitpay.com/bws/api";
     filenameBase.clear();
     socks5ProxyURL.clear();
+    btc_privkey_init(&requestKey);
+    btc_pubkey_init(&requestPubKey);
 }
 
 void BitPayWalletClient::setBaseURL(const std::string& baseURLnew)
@@ -136,31 +141,36 @@ bool BitPayWalletClient::GetCopayerSignature(const std::string& stringToHash, co
     uint8_t hash[32];
     Hash(stringToHash, hash);
 
-    btc_key key;
-    btc_privkey_init(&key);
-    memcpy(&key.privkey, privKey, 32);
+    // signing threads don't share an ECC context
+    btc_ecc_context* ecc = btc_ecc_context_acquire();
+
     btc_pubkey pubkey;
     btc_pubkey_init(&pubkey);
-    btc_pubkey_from_key(&key, &pubkey);
+    {
+        std::unique_lock<std::recursive_mutex> lock(this->cs_client);
+        if (memcmp(privKey, requestKey.privkey, 32) == 0)
+            pubkey = requestPubKey;
+    }
+    if (!pubkey.compressed) {
+        size_t pubkeylen = BTC_ECKEY_COMPRESSED_LENGTH;
+        btc_ecc_get_pubkey_ctx(ecc, privKey, pubkey.pubkey, &pubkeylen, true);
+        pubkey.compressed = true;
+    }
 
     unsigned char sig[74];
     size_t outlen = 74;
     memset(sig, 0, 74);
-    uint8_t hash2[32];
-    memcpy(hash2, hash, 32);
 
-    btc_key_sign_hash(&key, hash, sig, &outlen);
+    btc_ecc_sign_ctx(ecc, privKey, hash, sig, &outlen);
 
-    if (btc_pubkey_verify_sig(&pubkey, hash2, sig, outlen) == 1) {
-        std::vector<unsigned char> signature;
-        signature.assign(sig, sig + outlen);
+    if (btc_ecc_verify_sig_ctx(ecc, pubkey.pubkey, true, hash, sig, outlen) == 1) {
         sigHexOut = DBB::HexStr(sig, sig + outlen);
         success = true;
     } else {
         success = false;
     }
 
-    btc_privkey_cleanse(&key);
+    btc_ecc_context_release(ecc);
     btc_pubkey_cleanse(&pubkey);
     return success;
 };
@@ -191,41 +201,37 @@ void BitPayWalletClient::setRequestPubKey(const std::string& xPubKeyRequestKeyEn
     bool r = btc_hdnode_deserialize(xPubKeyRequestKeyEntropy.c_str(), (testnet ? &btc_chain_test : &btc_chain_main), &node);
 
     memcpy(requestKey.privkey, node.public_key + 1, 32);
+    updateRequestPubKey();
     std::vector<unsigned char> hash = DBB::ParseHex("26db47a48a10b9b0b697b793f5c0231aa35fe192c9d063d7b03a55e3c302850a");
 
     unsigned char sig[74];
     size_t outlen = 74;
     assert(btc_key_sign_hash(&requestKey, &hash.front(), sig, &outlen) == 1);
 
-
-    btc_pubkey pubkey;
-    btc_pubkey_init(&pubkey);
-    btc_pubkey_from_key(&requestKey, &pubkey);
-
     unsigned int i;
     for (i = 33; i < BTC_ECKEY_UNCOMPRESSED_LENGTH; i++)
-        assert(pubkey.pubkey[i] == 0);
+        assert(requestPubKey.pubkey[i] == 0);
 
-    assert(btc_pubkey_verify_sig(&pubkey, &hash.front(), sig, outlen) == 1);
-    btc_pubkey_cleanse(&pubkey);
+    assert(btc_pubkey_verify_sig(&requestPubKey, &hash.front(), sig, outlen) == 1);
 
     SaveLocalData();
 }
 
-//returns the request pubkey
-//TODO: requires caching
-bool BitPayWalletClient::GetRequestPubKey(std::string& pubKeyOut)
+void BitPayWalletClient::updateRequestPubKey()
 {
     std::unique_lock<std::recursive_mutex> lock(this->cs_client);
 
-    btc_pubkey pubkey;
-    btc_pubkey_init(&pubkey);
-    btc_pubkey_from_key(&requestKey, &pubkey);
-
-    pubKeyOut = DBB::HexStr(pubkey.pubkey, pubkey.pubkey + 33);
+    btc_pubkey_init(&requestPubKey);
+    if (btc_privkey_is_valid(&requestKey))
+        btc_pubkey_from_key(&requestKey, &requestPubKey);
+}
 
-    btc_pubkey_cleanse(&pubkey);
+//returns the request pubkey
+bool BitPayWalletClient::GetRequestPubKey(std::string& pubKeyOut)
+{
+    std::unique_lock<std::recursive_mutex> lock(this->cs_client);
 
+    pubKeyOut = DBB::HexStr(requestPubKey.pubkey, requestPubKey.pubkey + 33);
     return true;
 }
 
@@ -591,6 +597,7 @@ bool BitPayWalletClient::GetFeeLevels()
     if (httpStatusCode != 200)
         return false;
 
+    std::unique_lock<std::recursive_mutex> lock(this->cs_client);
     feeLevelsObject.read(response);
     return true;
 }
@@ -659,6 +666,117 @@ bool BitPayWalletClient::GetTransactionHistory(std::string& response)
     return true;
 }
 
+bool BitPayWalletClient::RefreshWallet(std::string& walletsResponse, bool withTxHistory, std::string& txHistoryResponse, bool& txHistoryAvailable)
+{
+    // the endpoints are independent, the refresh takes as long as the slowest one
+    std::vector<std::string> urls;
+    urls.push_back("/v2/wallets/?r="+std::to_string(CheapRandom()));
+    urls.push_back("/v1/feelevels/?network=livenet&r="+std::to_string(CheapRandom()));
+    if (withTxHistory)
+        urls.push_back("/v1/txhistory/?r="+std::to_string(CheapRandom()));
+
+    std::vector<std::string> responses(urls.size());
+    std::vector<long> httpStatusCodes(urls.size(), 0);
+    std::vector<bool> changed(urls.size(), false);
+    std::mutex cs_pending;
+    std::condition_variable pendingCondVar;
+    size_t pending = 0;
+
+    for (size_t i = 0; i < urls.size(); i++) {
+        DBBHTTPRequest request;
+        if (!CreateRequest("get", urls[i], "{}", request))
+            continue;
+
+        // fresh responses don't need a request, the others are revalidated
+        std::string cacheKey = BitPayResponseCache::cacheKey("get", baseURL, urls[i]);
+        std::shared_ptr<BitPayResponseValidators> validators;
+        if (responseCache.prepare(cacheKey, request, responses[i], validators)) {
+            httpStatusCodes[i] = 200;
+            continue;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(cs_pending);
+            pending++;
+        }
+        bool queued = DBBHTTPClient::Shared().performAsync(request, [&, i, cacheKey, validators](bool success, long httpCode, const std::string& response) {
+            std::string body = response;
+            bool bodyChanged = false;
+            if (success)
+                bodyChanged = responseCache.update(cacheKey, httpCode, body, *validators);
+
+            std::unique_lock<std::mutex> lock(cs_pending);
+            if (success) {
+                httpStatusCodes[i] = httpCode;
+                responses[i] = body;
+                changed[i] = bodyChanged;
+            }
+            pending--;
+            pendingCondVar.notify_one();
+        });
+        if (!queued) {
+            std::unique_lock<std::mutex> lock(cs_pending);
+            pending--;
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(cs_pending);
+        while (pending > 0)
+            pendingCondVar.wait(lock);
+    }
+
+    // the cached response of a 304 was cleared while revalidating, load it again
+    for (size_t i = 0; i < urls.size(); i++) {
+        if (httpStatusCodes[i] != 304)
+            continue;
+        changed[i] = true;
+        if (!RefetchUncached(urls[i], BitPayResponseCache::cacheKey("get", baseURL, urls[i]), responses[i], httpStatusCodes[i]))
+            httpStatusCodes[i] = 0;
+    }
+    // the cache file is written here, not on the HTTP reactor
+    responseCache.save();
+
+    // merge the results, unchanged fee levels don't need to be parsed again
+    if (httpStatusCodes[1] == 200) {
+        std::unique_lock<std::recursive_mutex> lock(this->cs_client);
+        if (changed[1] || feeLevelsObject.isNull())
+            feeLevelsObject.read(responses[1]);
+    }
+
+    txHistoryAvailable = false;
+    if (withTxHistory) {
+        txHistoryAvailable = (httpStatusCodes[2] == 200);
+        txHistoryResponse = responses[2];
+        BP_LOG_MSG("Response: %s\n", txHistoryResponse.c_str());
+    }
+
+    walletsResponse = responses[0];
+    DBB::LogPrintDebug("response: "+walletsResponse, "");
+    return (httpStatusCodes[0] == 200);
+}
+
+bool BitPayWalletClient::RefetchUncached(const std::string& url, const std::string& cacheKey, std::string& responseOut, long& httpStatusCodeOut)
+{
+    DBBHTTPRequest request;
+    if (!CreateRequest("get", url, "{}", request))
+        return false;
+
+    std::shared_ptr<BitPayResponseValidators> validators = BitPayResponseCache::captureValidators(request);
+    if (!DBBHTTPClient::Shared().perform(request, responseOut, httpStatusCodeOut))
+        return false;
+
+    responseCache.update(cacheKey, httpStatusCodeOut, responseOut, *validators);
+    return (httpStatusCodeOut != 304);
+}
+
+bool BitPayWalletClient::GetCachedResponse(const std::string& url, std::string& responseOut)
+{
+    std::unique_lock<std::recursive_mutex> lock(this->cs_client);
+    std::string cacheKey = BitPayResponseCache::cacheKey("get", baseURL, url);
+    return !cacheKey.empty() && responseCache.getCached(cacheKey, responseOut);
+}
+
 void BitPayWalletClient::ParseTxProposal(const UniValue& txProposal, UniValue& changeAddressData, std::string& serTx, std::vector<std::pair<std::string, std::vector<unsigned char> > >& vInputTxHashes, bool noScriptPubKey)
 {
     btc_tx* tx = btc_tx_new();
@@ -989,6 +1107,72 @@ bool BitPayWalletClient::DeleteTxProposal(const UniValue& txProposal)
     return true;
 }
 
+bool BitPayWalletClient::VerifyTxProposalSignatures(const std::vector<std::pair<std::string, std::vector<unsigned char> > >& vInputTxHashes, const std::vector<std::string>& vHexSigs)
+{
+    if (vInputTxHashes.size() != vHexSigs.size())
+        return false;
+
+    btc_hdnode rootNode;
+    {
+        std::unique_lock<std::recursive_mutex> lock(this->cs_client);
+        if (!btc_hdnode_deserialize(masterPubKey.c_str(), (testnet ? &btc_chain_test : &btc_chain_main), &rootNode))
+            return false;
+    }
+
+    // derive the input pubkeys, inputs share the chain node ("0" / "1")
+    std::map<std::string, btc_hdnode> derivedNodes;
+    std::vector<std::vector<unsigned char> > pubKeys, sigs;
+    for (size_t i = 0; i < vInputTxHashes.size(); i++) {
+        const std::string& keypath = vInputTxHashes[i].first;
+        if (vInputTxHashes[i].second.size() != 32)
+            return false;
+
+        btc_hdnode node = rootNode;
+        size_t pos = 0;
+        while (pos < keypath.size()) {
+            size_t end = keypath.find('/', pos);
+            if (end == std::string::npos)
+                end = keypath.size();
+            std::string component = keypath.substr(pos, end - pos);
+            if (component.empty() || component.find_first_not_of("0123456789") != std::string::npos)
+                return false;
+
+            std::string prefix = keypath.substr(0, end);
+            std::map<std::string, btc_hdnode>::iterator it = derivedNodes.find(prefix);
+            if (it != derivedNodes.end())
+                node = it->second;
+            else {
+                if (!btc_hdnode_public_ckd(&node, (uint32_t)strtoul(component.c_str(), NULL, 10)))
+                    return false;
+                derivedNodes[prefix] = node;
+            }
+            pos = end + 1;
+        }
+        pubKeys.push_back(std::vector<unsigned char>(node.public_key, node.public_key + BTC_ECKEY_COMPRESSED_LENGTH));
+
+        sigs.push_back(DBB::ParseHex(vHexSigs[i]));
+        if (sigs.back().size() != 64)
+            return false;
+    }
+
+    std::vector<const uint8_t*> vPubKeys, vHashes;
+    std::vector<const unsigned char*> vSigs;
+    for (size_t i = 0; i < vInputTxHashes.size(); i++) {
+        vPubKeys.push_back(&pubKeys[i][0]);
+        vHashes.push_back(&vInputTxHashes[i].second[0]);
+        vSigs.push_back(&sigs[i][0]);
+    }
+
+    std::vector<btc_bool> results(vSigs.size());
+    if (vSigs.empty() || btc_ecc_verify_batch(&vPubKeys[0], true, &vHashes[0], &vSigs[0], vSigs.size(), &results[0]))
+        return true;
+
+    for (size_t i = 0; i < results.size(); i++)
+        if (!results[i])
+            DBB::LogPrint("Invalid signature for input %d (keypath %s)\n", (int)i, vInputTxHashes[i].first.c_str());
+    return false;
+}
+
 bool BitPayWalletClient::PostSignaturesForTxProposal(const UniValue& txProposal, const std::vector<std::string>& vHexSigs)
 {
     //parse out the txpid
@@ -1053,67 +1237,50 @@ std::string BitPayWalletClient::SignRequest(const std::string& method,
 
     BP_LOG_MSG("signing message: %s, hash: %s\n", message.c_str(), DBB::HexStr(hash, hash + 32).c_str());
 
+    // the signature is checked against the cached request pubkey
     unsigned char sig[74];
     size_t outlen = 74;
-    btc_key_sign_hash(&requestKey, hash, sig, &outlen);
+    btc_ecc_context* ecc = btc_ecc_context_acquire();
+    bool valid = btc_ecc_sign_ctx(ecc, requestKey.privkey, hash, sig, &outlen) &&
+                 btc_ecc_verify_sig_ctx(ecc, requestPubKey.pubkey, true, hash, sig, outlen) == 1;
+    btc_ecc_context_release(ecc);
 
-    btc_pubkey pubkey;
-    btc_pubkey_init(&pubkey);
-    btc_pubkey_from_key(&requestKey, &pubkey);
-
-    if (btc_pubkey_verify_sig(&pubkey, hash, sig, outlen) != 1)
+    if (!valid)
         return std::string();
 
-    btc_pubkey_cleanse(&pubkey);
-
     hashOut = DBB::HexStr(hash, hash + 32);
     return DBB::HexStr(sig, sig + outlen);
 };
 
-static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp)
+bool BitPayWalletClient::CreateRequest(const std::string& method,
+                                       const std::string& url,
+                                       const std::string& args,
+                                       DBBHTTPRequest& request)
 {
-    ((std::string*)userp)->append((char*)contents, size * nmemb);
-    return size * nmemb;
-}
-
-static
-int logprint_cb(CURL *handle, curl_infotype type,
-             char *data, size_t size,
-             void *userp)
-{
-    const char *text;
-    (void)handle; /* prevent compiler warning */
-
-    switch (type) {
-        case CURLINFO_TEXT:
-            DBB::LogPrintDebug(std::string(data));
-            printf(data);
-        default: /* in case a new one is introduced to shock us */
-            return 0;
-
-        case CURLINFO_HEADER_OUT:
-            text = "=> Send header";
-            break;
-        case CURLINFO_DATA_OUT:
-            text = "=> Send data";
-            break;
-        case CURLINFO_SSL_DATA_OUT:
-            text = "=> Send SSL data";
-            break;
-        case CURLINFO_HEADER_IN:
-            text = "<= Recv header";
-            break;
-        case CURLINFO_DATA_IN:
-            text = "<= Recv data";
-            break;
-        case CURLINFO_SSL_DATA_IN:
-            text = "<= Recv SSL data";
-            break;
+    std::string hashOut;
+    std::string signature = SignRequest(method, url, args, hashOut);
+    if (signature.empty()) {
+        BP_LOG_MSG("SignRequest failed.");
+        DBB::LogPrint("SignRequest failed.", "");
+        return false;
     }
 
-    DBB::LogPrintDebug(std::string(data));
-    printf(data);
-    return 0;
+    request.method = method;
+    request.url = baseURL + url;
+    request.body = args;
+    request.headers.push_back("x-identity: " + GetCopayerId());
+    request.headers.push_back("x-signature: " + signature);
+    request.headers.push_back("x-client-version: dbb-1.0.0");
+    request.headers.push_back("Content-Type: application/json");
+    request.proxy = socks5ProxyURL;
+    request.timeout = 45;
+
+#if defined(__linux__) || defined(__unix__)
+    //need to libcurl, load it once, set the CA path at runtime
+    //we assume only linux needs CA fixing
+    request.caFile = ca_file;
+#endif
+    return true;
 }
 
 bool BitPayWalletClient::SendRequest(const std::string& method,
@@ -1122,71 +1289,28 @@ bool BitPayWalletClient::SendRequest(const std::string& method,
                                      std::string& responseOut,
                                      long& httpcodeOut)
 {
-    CURL* curl;
-    CURLcode res;
-
-    bool success = false;
-
-    curl_global_init(CURL_GLOBAL_ALL);
-    curl = curl_easy_init();
-    if (curl) {
-        struct curl_slist* chunk = NULL;
-        std::string hashOut;
-        std::string signature = SignRequest(method, url, args, hashOut);
-        if (signature.empty()) {
-            BP_LOG_MSG("SignRequest failed.");
-            DBB::LogPrint("SignRequest failed.", "");
-            success = false;
-        } else {
-            chunk = curl_slist_append(chunk, ("x-identity: " + GetCopayerId()).c_str()); //requestPubKey).c_str());
-            chunk = curl_slist_append(chunk, ("x-signature: " + signature).c_str());
-            chunk = curl_slist_append(chunk, ("x-client-version: dbb-1.0.0"));
-            chunk = curl_slist_append(chunk, "Content-Type: application/json");
-            res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk);
-            curl_easy_setopt(curl, CURLOPT_URL, (baseURL + url).c_str());
-            if (method == "post")
-                curl_easy_setopt(curl, CURLOPT_POSTFIELDS, args.c_str());
-
-            if (method == "delete") {
-                curl_easy_setopt(curl, CURLOPT_POSTFIELDS, args.c_str());
-                curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
-            }
-
-            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &responseOut);
-            curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
-
-            if (socks5ProxyURL.size())
-                curl_easy_setopt(curl, CURLOPT_PROXY, socks5ProxyURL.c_str());
-
-            curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-            curl_easy_setopt(curl, CURLOPT_TIMEOUT, 45L);
-
-#if defined(__linux__) || defined(__unix__)
-            //need to libcurl, load it once, set the CA path at runtime
-            //we assume only linux needs CA fixing
-            curl_easy_setopt(curl, CURLOPT_CAINFO, ca_file.c_str());
-#endif
+    DBBHTTPRequest request;
+    if (!CreateRequest(method, url, args, request))
+        return false;
 
-#ifdef DBB_ENABLE_NETDEBUG
-            curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-            curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, logprint_cb);
-#endif
+    std::string cacheKey = BitPayResponseCache::cacheKey(method, baseURL, url);
+    std::shared_ptr<BitPayResponseValidators> validators;
+    if (!cacheKey.empty() && responseCache.prepare(cacheKey, request, responseOut, validators)) {
+        httpcodeOut = 200;
+        return true;
+    }
 
-            res = curl_easy_perform(curl);
-            if (res != CURLE_OK) {
-                BP_LOG_MSG("curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
-                DBB::LogPrint("curl_easy_perform() failed "+ ( curl_easy_strerror(res) ? std::string(curl_easy_strerror(res)) : "") + "\n", "");
-                success = false;
-            } else {
-                curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpcodeOut);
-                success = true;
-            }
-        }
-        curl_slist_free_all(chunk);
-        curl_easy_cleanup(curl);
+    bool success = DBBHTTPClient::Shared().perform(request, responseOut, httpcodeOut);
+    if (!success)
+        DBB::LogPrint("Request to the wallet server failed (%s)\n", url.c_str());
+    else if (!cacheKey.empty()) {
+        responseCache.update(cacheKey, httpcodeOut, responseOut, *validators);
+        if (httpcodeOut == 304)
+            success = RefetchUncached(url, cacheKey, responseOut, httpcodeOut);
+        responseCache.save();
     }
-    curl_global_cleanup();
+    else if (method != "get")
+        responseCache.invalidate(); // balances, proposals or the history may have changed
 
     BP_LOG_MSG("response: %s", responseOut.c_str());
     DBB::LogPrintDebug("response: "+responseOut, "");
@@ -1210,6 +1334,11 @@ const std::string BitPayWalletClient::localDataFilename(const std::string& dataD
    return dataDir + "/" + (testnet ? "testnet_" : "" ) + filenameBase + ".dat";
 }
 
+const std::string BitPayWalletClient::cacheFilename(const std::string& dataDir)
+{
+   return dataDir + "/" + (testnet ? "testnet_" : "" ) + filenameBase + "_cache.json";
+}
+
 void BitPayWalletClient::SaveLocalData()
 {
     std::unique_lock<std::recursive_mutex> lock(this->cs_client);
@@ -1236,6 +1365,8 @@ void BitPayWalletClient::SaveLocalData()
 void BitPayWalletClient::LoadLocalData()
 {
     std::unique_lock<std::recursive_mutex> lock(this->cs_client);
+    responseCache.setFilename(cacheFilename(dataDir));
+
     FILE* fh = fopen(localDataFilename(dataDir).c_str(), "rb");
 
     //TODO: better error handling, misses fclose!
@@ -1248,6 +1379,7 @@ void BitPayWalletClient::LoadLocalData()
 
         if (fread(&requestKey.privkey, 1, 32, fh) != 32)
             return;
+        updateRequestPubKey();
 
         uint32_t masterPubKeylen = 0;
         if (fread(&masterPubKeylen, 1, sizeof(masterPubKeylen), fh) != sizeof(masterPubKeylen))
@@ -1282,6 +1414,9 @@ void BitPayWalletClient::RemoveLocalData()
 {
     std::unique_lock<std::recursive_mutex> lock(this->cs_client);
     remove(localDataFilename(dataDir).c_str());
+    // an in-flight refresh must not write the removed wallet back to disk
+    responseCache.clear();
+    remove(cacheFilename(dataDir).c_str());
     setNull();
 }
 
@@ -1293,6 +1428,7 @@ void BitPayWalletClient::setNull()
     masterPubKey.clear();
     masterPubKey.clear();
     memset(requestKey.privkey,0, 32);
+    btc_pubkey_init(&requestPubKey);
     walletJoined = false;
 }
 
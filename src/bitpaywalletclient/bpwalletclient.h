@@ -50,7 +50,11 @@
 
 #include <btc/ecc_key.h>
 
+#include "bpresponsecache.h"
+
 //!tiny class for a bitpay wallet service wallet invitation
+struct DBBHTTPRequest;
+
 class BitpayWalletInvitation
 {
 public:
@@ -118,9 +122,20 @@ public:
     //!load transaction history
     bool GetTransactionHistory(std::string& response);
 
+    //!last known response of a wallet server endpoint (e.g. "/v2/wallets/"), also from a previous session
+    bool GetCachedResponse(const std::string& url, std::string& responseOut);
+
+    //!loads the wallets, the fee levels and (optional) the transaction history with concurrent requests
+    //!returns when all responses are in, the fee levels are stored like GetFeeLevels() does
+    bool RefreshWallet(std::string& walletsResponse, bool withTxHistory, std::string& txHistoryResponse, bool& txHistoryAvailable);
+
     //!parse a transaction proposal, export inputs keypath/hashes ready for signing
     void ParseTxProposal(const UniValue& txProposal, UniValue& changeAddressData, std::string& serTx, std::vector<std::pair<std::string, std::vector<unsigned char> > >& vInputTxHashes, bool noScriptPubKey = false);
 
+    //!verifies the (compact hex) signatures of all inputs against their sighash and the pubkey derived from the xpub
+    //!vInputTxHashes as returned by ParseTxProposal, vHexSigs in the same order
+    bool VerifyTxProposalSignatures(const std::vector<std::pair<std::string, std::vector<unsigned char> > >& vInputTxHashes, const std::vector<std::string>& vHexSigs);
+
     //!post signatures for a transaction proposal to the wallet server
     bool PostSignaturesForTxProposal(const UniValue& txProposal, const std::vector<std::string>& vHexSigs);
 
@@ -142,6 +157,12 @@ public:
                             const std::string& args,
                             std::string& hashOut);
 
+    //!creates a signed request to the wallet server
+    bool CreateRequest(const std::string& method,
+                       const std::string& url,
+                       const std::string& args,
+                       DBBHTTPRequest& requestOut);
+
     //!send a request to the wallet server
     bool SendRequest(const std::string& method,
                      const std::string& url,
@@ -164,6 +185,9 @@ public:
     //!local filename (absolute)
     const std::string localDataFilename(const std::string& dataDir);
 
+    //!response cache filename (absolute)
+    const std::string cacheFilename(const std::string& dataDir);
+
     //!store local data (xpub key, request key, etc.)
     void SaveLocalData();
 
@@ -193,15 +217,23 @@ private:
     std::string masterPrivKey; // "m/45'"
     std::string masterPubKey;  // "m/45'"
     btc_key requestKey;        //"m/1'/0"
+    btc_pubkey requestPubKey;  //!< cached public key of requestKey (saves a point multiplication per request)
 
     std::string filenameBase;
     std::string baseURL;              //!< base URL for the wallet server
     std::string lastKnownAddressJson; //!< base URL for the wallet server
 
+    //!derives the cached requestPubKey, call whenever requestKey changes
+    void updateRequestPubKey();
+
     std::vector<std::string> split(const std::string& str, std::vector<int> indexes);
     std::string _copayerHash(const std::string& name, const std::string& xPubKey, const std::string& requestPubKey);
 
     UniValue feeLevelsObject;
+    BitPayResponseCache responseCache; //!< conditional requests and TTLs for the wallet server GET endpoints
+
+    //!repeats a GET without conditional headers (the cached response to a 304 is gone)
+    bool RefetchUncached(const std::string& url, const std::string& cacheKey, std::string& responseOut, long& httpStatusCodeOut);
     //!Wrapper for libbtcs doubla sha
     void Hash(const std::string& stringIn, uint8_t* hashout);
 
@@ -42,6 +42,9 @@
 #include <thread>
 
 #include "dbb.h"
+#include "dbb_devicewatcher.h"
+#include "dbb_httpclient.h"
+#include "dbb_netthread.h"
 #include "dbb_util.h"
 
 #include "univalue.h"
@@ -103,9 +106,18 @@ std::atomic<bool> notified(false);
 
 std::atomic<bool> firmwareUpdateHID(false);
 
+static bool persistentHID = true;
+// set by the device watcher, the command thread drops the kept-alive connection before the next command
+static std::atomic<bool> connectionInvalidated(false);
+static std::atomic<unsigned int> commandCount(0);
+
+static DBBDeviceWatcher* deviceWatcher = NULL;
+
 void setFirmwareUpdateHID(bool state)
 {
     firmwareUpdateHID = state;
+    if (deviceWatcher)
+        deviceWatcher->setPaused(state);
 }
 
 //executeCommand adds a command to the thread queue and notifies the tread to work down the queue
@@ -121,8 +133,13 @@ int main(int argc, char** argv)
 {
     DBB::ParseParameters(argc, argv);
 
+    // keep the HID connection open between commands (-persistenthid=0 to open/close per command)
+    persistentHID = (DBB::GetArg("-persistenthid", "1") != "0");
+
     //TODO: factor out thread
     std::thread cmdThread([&]() {
+        unsigned int lastReconnectCount = 0;
+
         //TODO, the locking is to broad at the moment
         //  during executing a command the queue is locked
         //  and therefore no new commands can be added
@@ -135,86 +152,69 @@ int main(int argc, char** argv)
                 queueCondVar.wait(lock);
             }
             while (!cmdQueue.empty()) {
-                std::string cmdOut;
-                t_cmdCB cmdCB = cmdQueue.front();
-                std::string cmd = std::get<0>(cmdCB);
-                std::string password = std::get<1>(cmdCB);
-                dbb_cmd_execution_status_t status = DBB_CMD_EXECUTION_STATUS_OK;
-
-                std::string devicePath;
-                enum DBB::dbb_device_mode deviceType = DBB::deviceAvailable(devicePath);
-
-                DebugOut("sendcmd", "Opening HID...\n");
-                bool openSuccess = DBB::openConnection(deviceType, devicePath);
-                if (!openSuccess) {
-                    status = DBB_CMD_EXECUTION_DEVICE_OPEN_FAILED;
+                bool openSuccess = false;
+                if (connectionInvalidated.exchange(false))
+                    DBB::closeConnection();
+                if (persistentHID) {
+                    // keep the HID handle open across commands, only reconnect if it got invalidated
+                    openSuccess = DBB::ensureConnection();
+                    unsigned int reconnects = DBB::defaultSession().getReconnectCount();
+                    if (reconnects != lastReconnectCount) {
+                        DBB::LogPrintDebug("HID reconnected (reconnects: %d, commands: %d)\n", reconnects, (unsigned int)commandCount);
+                        lastReconnectCount = reconnects;
+                    }
                 }
                 else {
-                    if (!password.empty())
-                    {
-                        std::string base64str;
-                        std::string unencryptedJson;
-                        try
-                        {
-                            DebugOut("sendcmd", "encrypt&send: %s\n", cmd.c_str());
-                            DBB::encryptAndEncodeCommand(cmd, password, base64str);
-                            if (!DBB::sendCommand(base64str, cmdOut))
-                            {
-                                DebugOut("sendcmd", "sending command failed\n");
+                    std::string devicePath;
+                    enum DBB::dbb_device_mode deviceType = DBB::deviceAvailable(devicePath);
+
+                    DebugOut("sendcmd", "Opening HID...\n");
+                    openSuccess = DBB::openConnection(deviceType, devicePath);
+                }
+                if (openSuccess) {
+                    // send everything queued so far back-to-back over the open session
+                    DBB::CommandBatch batch(DBB::defaultSession());
+                    while (!cmdQueue.empty()) {
+                        t_cmdCB cmdCB = cmdQueue.front();
+                        std::string cmd = std::get<0>(cmdCB);
+                        std::string password = std::get<1>(cmdCB);
+                        std::function<void(const std::string&, dbb_cmd_execution_status_t status)> cmdFinished = std::get<2>(cmdCB);
+
+                        DebugOut("sendcmd", "%s: %s\n", password.empty() ? "send unencrypted" : "encrypt&send", cmd.c_str());
+                        batch.add(cmd, password, [cmdFinished, password](const DBB::CommandResult& result) {
+                            dbb_cmd_execution_status_t status = DBB_CMD_EXECUTION_STATUS_OK;
+                            if (result.status != DBB::DBB_CMD_OK && !password.empty()) {
+                                DebugOut("sendcmd", "sending or response decryption failed: %s\n", result.result.c_str());
                                 status = DBB_CMD_EXECUTION_STATUS_ENCRYPTION_FAILED;
                             }
-                            else
-                                DBB::decryptAndDecodeCommand(cmdOut, password, unencryptedJson);
-                        }
-                        catch (const std::exception& ex) {
-                            unencryptedJson = cmdOut;
-                            DebugOut("sendcmd", "response decryption failed: %s\n", unencryptedJson.c_str());
-                            status = DBB_CMD_EXECUTION_STATUS_ENCRYPTION_FAILED;
-                        }
-
-                        cmdOut = unencryptedJson;
-                    }
-                    else
-                    {
-                        DebugOut("sendcmd", "send unencrypted: %s\n", cmd.c_str());
-                        DBB::sendCommand(cmd, cmdOut);
+                            cmdFinished(result.result, status);
+                        });
+                        cmdQueue.pop();
+                        commandCount++;
                     }
-                    std::get<2>(cmdCB)(cmdOut, status);
-                    cmdQueue.pop();
+                    batch.execute();
 
-                    DebugOut("sendcmd", "Closing HID\n");
-                    DBB::closeConnection();
-                }
-            }
-            notified = false;
-        }
-    });
+                    DBB::BatchStats batchStats = batch.getStats();
+                    if (batchStats.commands > 1 || batchStats.inputs > 0)
+                        DBB::LogPrintDebug("HID batch: %d commands, %d inputs, %.2f inputs/s\n", batchStats.commands, batchStats.inputs, batchStats.inputsPerSecond());
 
-    //create a thread for the http handling
-    std::thread usbCheckThread([&]() {
-        while (!stopThread)
-        {
-            enum DBB::dbb_device_mode oldDeviceType;
-            //check devices
-            if (firmwareUpdateHID) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-                continue;
-            }
-            {
-                std::unique_lock<std::mutex> lock(cs_queue);
-                std::string devicePath;
-                enum DBB::dbb_device_mode deviceType = DBB::deviceAvailable(devicePath);
-
-                if (dbbGUI && oldDeviceType != deviceType) {
-                    dbbGUI->deviceStateHasChanged( (deviceType != DBB::DBB_DEVICE_UNKNOWN && deviceType != DBB::DBB_DEVICE_NO_DEVICE), deviceType);
-                    oldDeviceType = deviceType;
+                    DBB::FrameStats frameStats = DBB::defaultSession().getLastFrameStats();
+                    if (frameStats.frames > 0)
+                        DBB::LogPrintDebug("HID frames written: %d, total: %lld us, avg: %lld us, max: %lld us\n", frameStats.frames, (long long)frameStats.totalMicros, (long long)(frameStats.totalMicros / frameStats.frames), (long long)frameStats.maxFrameMicros);
+
+                    if (!persistentHID) {
+                        DebugOut("sendcmd", "Closing HID\n");
+                        DBB::closeConnection();
+                    }
                 }
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+            notified = false;
         }
     });
 
     btc_ecc_start();
+    // libcurl must be initialized before the first network thread
+    DBBHTTPClient::Init();
     // Generate high-dpi pixmaps
     QApplication::setAttribute(Qt::AA_UseHighDpiPixmaps);
 #if QT_VERSION >= QT_VERSION_CHECK(5, 6, 0)
@@ -239,16 +239,33 @@ int main(int argc, char** argv)
     DBB::LogPrint("\n\n\n\nStarting DBB App %s - %s\n", DBB_PACKAGE_VERSION, VERSION);
     dbbGUI = new DBBDaemonGui(bitcoinURL);
     dbbGUI->show();
+
+    // watch for device arrival/removal (hotplug events, polling as fallback)
+    deviceWatcher = new DBBDeviceWatcher([](bool state, enum DBB::dbb_device_mode deviceType) {
+        // device removed or switched its mode, invalidate the kept-alive connection
+        // (closing it here would wait for a running command, e.g. one waiting for the touch button)
+        connectionInvalidated = true;
+        if (dbbGUI)
+            dbbGUI->deviceStateHasChanged(state, deviceType);
+    });
+    deviceWatcher->setPaused(firmwareUpdateHID);
+    deviceWatcher->start();
     //set style sheets
     app.exec();
 
     stopThread = true;
     notified = true;
     queueCondVar.notify_one();
-    usbCheckThread.join();
+    deviceWatcher->stop();
     cmdThread.join();
 
+    DBB::LogPrint("HID commands: %d, reconnects: %d, enumerations: %d\n", (unsigned int)commandCount, DBB::defaultSession().getReconnectCount(), DBB::getDeviceEnumerationCount());
     DBB::closeConnection(); //clean up HID
+    delete deviceWatcher; deviceWatcher = NULL;
+
+    // the network tasks and the pending HTTP callbacks (e.g. the update check) reference the GUI, let them finish first
+    DBBNetThread::Shutdown();
+    DBBHTTPClient::Shutdown();
     delete dbbGUI; dbbGUI = NULL;
 
     btc_ecc_stop();
@@ -33,7 +33,10 @@
 #include <unistd.h>
 #include <time.h>
 
+#include <atomic>
+#include <chrono>
 #include <string>
+#include <thread>
 
 #include "dbb.h"
 #include "libdbb/crypto.h"
@@ -155,6 +158,7 @@ static const CDBBCommand vCommands[] =
     { "bootloaderunlock"  , "{\"bootloader\" : \"unlock\"}",                              "", true},
     { "bootloaderlock"    , "{\"bootloader\" : \"lock\"}",                                "", true},
     { "firmware"          , "%filename%",                                                 "", true},
+    { "firmwarefleet"     , "%filename%",                                                 "", true},
     { "signmessage"       , "%!password% %!message% %!keypath%",                          "", true},
     /*{ "decryptbackup"     , "%filename%",                                                 "", true},*//* no longer valid for firmware v2 */
     { "hidden_password"   , "{\"hidden_password\" : \"%!hiddenpassword%\"}",              "", true},
@@ -163,50 +167,98 @@ static const CDBBCommand vCommands[] =
 };
 
 
-#define strlens(s) (s == NULL ? 0 : strlen(s))
-#define PBKDF2_SALT     "Digital Bitbox"
-#define PBKDF2_SALTLEN  14
+// the backup key of the cli uses less rounds than the app (DBB::BACKUP_KEY_PBKDF2_ROUNDS)
 #define PBKDF2_ROUNDS   2048
-#define PBKDF2_HMACLEN  64
 
-extern "C" {
-    extern void hmac_sha512(const uint8_t* key, const uint32_t keylen, const uint8_t* msg, const uint32_t msglen, uint8_t* hmac);
-    extern char* utils_uint8_to_hex(const uint8_t* bin, size_t l);
-}
-void pbkdf2_hmac_sha512(const uint8_t *pass, int passlen, uint8_t *key, int keylen)
+//! state of one device during a fleet firmware upgrade
+class CFleetJob
 {
-    uint32_t i, j, k;
-    uint8_t f[PBKDF2_HMACLEN], g[PBKDF2_HMACLEN];
-    uint32_t blocks = keylen / PBKDF2_HMACLEN;
+public:
+    DBB::DeviceInfo device;
+    std::atomic<float> progress;
+    bool success;
+    int64_t elapsedMillis;
+    DBB::FirmwareUploadStats stats;
 
-    static uint8_t salt[PBKDF2_SALTLEN + 4];
-    memset(salt, 0, sizeof(salt));
-    memcpy(salt, PBKDF2_SALT, strlens(PBKDF2_SALT));
+    CFleetJob() : progress(0), success(false), elapsedMillis(0) {}
+};
 
-    if (keylen & (PBKDF2_HMACLEN - 1)) {
-        blocks++;
+// flash every connected bootloader-mode device in parallel, one worker per device
+static int upgradeFirmwareFleet(const std::string& filename)
+{
+    DBB::FirmwareImage firmwareImage;
+    bool readSig = (DBB::GetArg("-noreadsig", "") == "");
+    if (!firmwareImage.open(filename, readSig)) {
+        printf("Can't open firmware file!\n");
+        return 1;
     }
-    for (i = 1; i <= blocks; i++) {
-        salt[PBKDF2_SALTLEN    ] = (i >> 24) & 0xFF;
-        salt[PBKDF2_SALTLEN + 1] = (i >> 16) & 0xFF;
-        salt[PBKDF2_SALTLEN + 2] = (i >> 8) & 0xFF;
-        salt[PBKDF2_SALTLEN + 3] = i & 0xFF;
-        hmac_sha512(pass, passlen, salt, PBKDF2_SALTLEN + 4, g);
-        memcpy(f, g, PBKDF2_HMACLEN);
-        for (j = 1; j < PBKDF2_ROUNDS; j++) {
-            hmac_sha512(pass, passlen, g, PBKDF2_HMACLEN, g);
-            for (k = 0; k < PBKDF2_HMACLEN; k++) {
-                f[k] ^= g[k];
-            }
-        }
-        if (i == blocks && (keylen & (PBKDF2_HMACLEN - 1))) {
-            memcpy(key + PBKDF2_HMACLEN * (i - 1), f, keylen & (PBKDF2_HMACLEN - 1));
-        } else {
-            memcpy(key + PBKDF2_HMACLEN * (i - 1), f, PBKDF2_HMACLEN);
-        }
+
+    std::string sigStr;
+    if (readSig)
+        sigStr = firmwareImage.signatureHex();
+
+    if (DBB::GetArg("-dummysigwrite", "") != "")
+    {
+        btc_ecc_start();
+        sigStr = DBB::dummySig(firmwareImage);
+        btc_ecc_stop();
+    }
+
+    std::vector<DBB::DeviceInfo> devices;
+    for (const DBB::DeviceInfo& device : DBB::enumerateDevices())
+        if (device.mode == DBB::DBB_DEVICE_MODE_BOOTLOADER)
+            devices.push_back(device);
+
+    if (devices.empty()) {
+        printf("Error: No Digital Bitbox is Bootloader-Mode detected\n");
+        return 1;
     }
-    memset(f, 0, sizeof(f));
-    memset(g, 0, sizeof(g));
+    printf("Upgrading %d devices...\n", (int)devices.size());
+
+    // the image is shared read-only between the workers
+    std::vector<CFleetJob> jobs(devices.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < devices.size(); i++) {
+        jobs[i].device = devices[i];
+        workers.push_back(std::thread([&firmwareImage, &sigStr, &jobs, i]() {
+            CFleetJob& job = jobs[i];
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            std::shared_ptr<DBB::DeviceSession> session = DBB::getSession(job.device.path);
+            if (session->open(job.device.mode, job.device.path))
+                job.success = DBB::upgradeFirmware(*session, firmwareImage, sigStr, [&job](const std::string& infotext, float progress) {
+                    job.progress = progress;
+                }, &job.stats);
+            DBB::releaseSession(job.device.path);
+
+            job.elapsedMillis = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            job.progress = 1.0;
+        }));
+    }
+
+    // aggregated progress
+    while (true) {
+        float total = 0;
+        for (const CFleetJob& job : jobs)
+            total += job.progress;
+        printf("\rUpgrading firmware... %3.0f%%", total / jobs.size() * 100);
+        fflush(stdout);
+        if (total >= jobs.size())
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+    for (std::thread& worker : workers)
+        worker.join();
+
+    int failed = 0;
+    printf("\n\n%-32s %-24s %-8s %10s %10s %8s\n", "Device", "Serial", "Result", "Time (s)", "KB/s", "Chunks");
+    for (const CFleetJob& job : jobs) {
+        if (!job.success)
+            failed++;
+        printf("%-32s %-24s %-8s %10.1f %10.1f %8u\n", job.device.path.c_str(), job.device.serial.c_str(), job.success ? "OK" : "FAILED", job.elapsedMillis / 1000.0, job.stats.kbPerSecond(), job.stats.chunks);
+    }
+    printf("\n%d of %d devices successfully upgraded\n", (int)jobs.size() - failed, (int)jobs.size());
+    return (failed > 0) ? 1 : 0;
 }
 
 int main(int argc, char* argv[])
@@ -285,6 +337,14 @@ int main(int argc, char* argv[])
         }
         return 1;
     }
+    if (userCmd == "firmwarefleet")
+    {
+        std::string possibleFilename = DBB::mapArgs["-filename"];
+        if (possibleFilename.empty() && cmdArgs.size() > 1)
+            possibleFilename = cmdArgs[1];
+        return upgradeFirmwareFleet(possibleFilename);
+    }
+
     std::string devicePath;
     enum DBB::dbb_device_mode deviceMode = DBB::deviceAvailable(devicePath);
     if (userCmd == "firmware" && deviceMode != DBB::DBB_DEVICE_MODE_BOOTLOADER)
@@ -408,7 +468,6 @@ int main(int argc, char* argv[])
             }
 
             std::string password = DBB::GetArg("-password", "0000");
-            std::string key;
 
             // load the file
             std::string possibleFilename = DBB::mapArgs["-filename"];
@@ -426,13 +485,17 @@ int main(int argc, char* argv[])
             backupFile.seekg(0, std::ios::beg);
 
             //PBKDF2 key stretching
-            key.resize(PBKDF2_HMACLEN);
-            pbkdf2_hmac_sha512((uint8_t *)password.c_str(), password.size(), (uint8_t *)&key[0], PBKDF2_HMACLEN);
+            std::string hexKey = DBB::getStretchedBackupHexKey(password, PBKDF2_ROUNDS);
+            if (hexKey.empty())
+            {
+                printf("Could not derive the backup key\n");
+                return 0;
+            }
 
             std::string backupBuffer((std::istreambuf_iterator<char>(backupFile)), std::istreambuf_iterator<char>());
             backupBuffer = "{\"ciphertext\" : \""+backupBuffer+"\"}";
             std::string unencryptedBackup;
-            DBB::decryptAndDecodeCommand(backupBuffer, std::string(utils_uint8_to_hex((uint8_t *)&key[0], PBKDF2_HMACLEN)), unencryptedBackup);
+            DBB::decryptAndDecodeCommand(backupBuffer, hexKey, unencryptedBackup);
             printf("%s\n", unencryptedBackup.c_str());
         }
         else if (userCmd == "firmware")
@@ -446,52 +509,37 @@ int main(int argc, char* argv[])
             if (possibleFilename.empty() || possibleFilename == "")
                 possibleFilename = cmdArgs[1].c_str();
 
-            std::ifstream firmwareFile(possibleFilename, std::ios::binary | std::ios::ate);
-            std::streamsize firmwareSize = firmwareFile.tellg();
-            if (firmwareSize > 0)
+            // map the file, the chunks are streamed directly from the image
+            DBB::FirmwareImage firmwareImage;
+            bool readSig = (DBB::GetArg("-noreadsig", "") == "");
+            if (firmwareImage.open(possibleFilename, readSig))
             {
                 std::string sigStr;
-                firmwareFile.seekg(0, std::ios::beg);
                 //read signatures
-                if (DBB::GetArg("-noreadsig", "") == "")
+                if (readSig)
                 {
-                    unsigned char sigByte[FIRMWARE_SIGLEN];
-                    firmwareFile.read((char *)&sigByte[0], FIRMWARE_SIGLEN);
-                    sigStr = DBB::HexStr(sigByte, sigByte + FIRMWARE_SIGLEN);
+                    sigStr = firmwareImage.signatureHex();
                     printf("Reading signature... %s\n", sigStr.c_str());
                 }
 
-                //read firmware
-                std::vector<char> firmwareBuffer(DBB_APP_LENGTH);
-                unsigned int pos = 0;
-                while (true)
-                {
-                    firmwareFile.read(&firmwareBuffer[0]+pos, FIRMWARE_CHUNKSIZE);
-                    std::streamsize bytes = firmwareFile.gcount();
-                    if (bytes == 0)
-                        break;
-
-                    pos += bytes;
-                }
-                firmwareFile.close();
-
-                // append 0xff to the rest of the firmware buffer
-                memset((void *)(&firmwareBuffer[0]+pos), 0xff, DBB_APP_LENGTH-pos);
-
                 if (DBB::GetArg("-dummysigwrite", "") != "")
                 {
                     printf("Creating dummy signature...");
                     btc_ecc_start();
-                    sigStr = DBB::dummySig(firmwareBuffer);
+                    sigStr = DBB::dummySig(firmwareImage);
                     printf("%s\n", sigStr.c_str());
                     btc_ecc_stop();
                 }
 
                 // send firmware blob to DBB
-                if (!DBB::upgradeFirmware(firmwareBuffer, firmwareSize, sigStr, [](const std::string& infotext, float progress) {}))
-                    printf("Firmware upgrade failed!\n");
+                DBB::FirmwareUploadStats uploadStats;
+                if (!DBB::upgradeFirmware(DBB::defaultSession(), firmwareImage, sigStr, [](const std::string& infotext, float progress) {
+                        printf("\rUpgrading firmware... %3.0f%% %s", progress * 100, infotext.c_str());
+                        fflush(stdout);
+                    }, &uploadStats))
+                    printf("\nFirmware upgrade failed!\n");
                 else
-                    printf("Firmware successfully upgraded!\n");
+                    printf("\nFirmware successfully upgraded! (%u chunks, %u skipped, %.1f KB/s)\n", uploadStats.chunks, uploadStats.skippedChunks, uploadStats.kbPerSecond());
             }
             else
                 printf("Can't open firmware file!\n");
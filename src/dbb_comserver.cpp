@@ -4,66 +4,41 @@
 
 #include "dbb_comserver.h"
 
-#include <curl/curl.h>
-
 #include <btc/base58.h>
 #include <btc/ecc_key.h>
 #include <btc/hash.h>
 
 #include "libdbb/crypto.h"
 
+#include "dbb_httpclient.h"
 #include "dbb_util.h"
 #include "dbb.h"
 #include "univalue.h"
 
+#include <algorithm>
 #include <string.h>
 
 static const char *aesKeyHMAC_Key = "DBBAesKey";
 
-// add definition of two non public libbtc functions
+// add definition of a non public libbtc function
 extern "C" {
-extern void ripemd160(const uint8_t* msg, uint32_t msg_len, uint8_t* hash);
 extern void hmac_sha256(const uint8_t* key, const uint32_t keylen, const uint8_t* msg, const uint32_t msglen, uint8_t* hmac);
 }
 
-static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp)
+static uint64_t currentTimeMillis()
 {
-    ((std::string*)userp)->append((char*)contents, size * nmemb);
-    return size * nmemb;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 }
 
-/* this is how the CURLOPT_XFERINFOFUNCTION callback works */
-static int xferinfo(void *p,
-                    curl_off_t dltotal, curl_off_t dlnow,
-                    curl_off_t ultotal, curl_off_t ulnow)
-{
-    if (p)
-    {
-        DBBComServer *cs = (DBBComServer *)p;
-        return cs->shouldCancelLongPoll();
-    }
-
-    return 0;
-}
-
-static int progress_cb(void *p,
-                          double dltotal, double dlnow,
-                          double ultotal, double ulnow)
-{
-    return xferinfo(p,
-                    (curl_off_t)dltotal,
-                    (curl_off_t)dlnow,
-                    (curl_off_t)ultotal,
-                    (curl_off_t)ulnow);
-}
-
-DBBComServer::DBBComServer(const std::string& comServerURLIn) : longPollThread(0), comServerURL(comServerURLIn)
+DBBComServer::DBBComServer(const std::string& comServerURLIn) : comServerURL(comServerURLIn)
 {
     channelID.clear();
     parseMessageCB = nullptr;
     nSequence = 0;
     mobileAppConnected = false;
     shouldCancel = false;
+    peerUsesChannelCipher = false;
+    lastRemoteTimestamp = 0;
     ca_file = "";
     socks5ProxyURL.clear();
 }
@@ -71,8 +46,9 @@ DBBComServer::DBBComServer(const std::string& comServerURLIn) : longPollThread(0
 DBBComServer::~DBBComServer()
 {
     shouldCancel = true;
-    if (longPollThread) {
-        longPollThread->join();
+    if (longPollTask) {
+        longPollTask->cancel();
+        longPollTask->join();
     }
 }
 
@@ -92,6 +68,7 @@ bool DBBComServer::generateNewKey()
 
     // remove the current enc key
     encryptionKey.clear();
+    resetChannelCipher();
 
     // copy over the privatekey and clean libbtc privkey
     std::copy(key.privkey,key.privkey+BTC_ECKEY_PKEY_LENGTH,std::back_inserter(encryptionKey));
@@ -100,11 +77,9 @@ bool DBBComServer::generateNewKey()
     // generate hash160(hash(pubkey))
     // create base58c string with 0x91 as base58 identifier
     size_t len = 67;
-    uint8_t hashout[32];
     uint8_t hash160[21];
     hash160[0] = CHANNEL_ID_BASE58_PREFIX;
-    btc_hash_sngl_sha256(pubkey.pubkey, BTC_ECKEY_COMPRESSED_LENGTH, hashout);
-    ripemd160(hashout, 32, hash160+1);
+    btc_hash160(pubkey.pubkey, BTC_ECKEY_COMPRESSED_LENGTH, hash160+1);
 
     // make enought space for the base58c channel ID
     channelID.resize(100);
@@ -113,87 +88,36 @@ bool DBBComServer::generateNewKey()
     return true;
 }
 
+DBBHTTPRequest DBBComServer::createRequest(const std::string& method,
+                                           const std::string& url,
+                                           const std::string& args)
+{
+    DBBHTTPRequest request;
+    request.method = method;
+    request.url = url;
+    request.body = args;
+    request.headers.push_back("Content-Type: text/plain");
+    request.proxy = socks5ProxyURL;
+    request.timeout = 35;
+
+#if defined(__linux__) || defined(__unix__)
+    //need to libcurl, load it once, set the CA path at runtime
+    //we assume only linux needs CA fixing
+    request.caFile = ca_file;
+#endif
+    return request;
+}
+
 bool DBBComServer::SendRequest(const std::string& method,
                                const std::string& url,
                                const std::string& args,
                                std::string& responseOut,
                                long& httpcodeOut)
 {
-    CURL* curl;
-    CURLcode res;
-
-    bool success = false;
-
-    curl_global_init(CURL_GLOBAL_ALL);
-    curl = curl_easy_init();
-    if (curl) {
-        struct curl_slist* chunk = NULL;
-        chunk = curl_slist_append(chunk, "Content-Type: text/plain");
-        res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk);
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_PROGRESSFUNCTION, progress_cb);
-        curl_easy_setopt(curl, CURLOPT_PROGRESSDATA, this);
-#if LIBCURL_VERSION_NUM >= 0x072000
-        /* xferinfo was introduced in 7.32.0, no earlier libcurl versions will
-         compile as they won't have the symbols around.
-
-         If built with a newer libcurl, but running with an older libcurl:
-         curl_easy_setopt() will fail in run-time trying to set the new
-         callback, making the older callback get used.
-
-         New libcurls will prefer the new callback and instead use that one even
-         if both callbacks are set. */
-
-        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, xferinfo);
-        /* pass the struct pointer into the xferinfo function, note that this is
-         an alias to CURLOPT_PROGRESSDATA */
-        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, this);
-#endif
-        if (method == "post")
-        {
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, args.c_str());
-            curl_easy_setopt(curl, CURLOPT_POST, 1L);
-        }
-
-        if (method == "delete") {
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, args.c_str());
-            curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
-        }
-
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &responseOut);
-        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
-
-        if (socks5ProxyURL.size())
-            curl_easy_setopt(curl, CURLOPT_PROXY, socks5ProxyURL.c_str());
-        
-        curl_easy_setopt(curl, CURLOPT_TIMEOUT, 35L);
-        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-
-#if defined(__linux__) || defined(__unix__)
-        //need to libcurl, load it once, set the CA path at runtime
-        //we assume only linux needs CA fixing
-        curl_easy_setopt(curl, CURLOPT_CAINFO, ca_file.c_str());
-#endif
-
-#ifdef DBB_ENABLE_NETDEBUG
-        curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-#endif
-
-        res = curl_easy_perform(curl);
-        if (res != CURLE_OK) {
-            DBB::LogPrintDebug("curl_easy_perform() failed "+ ( curl_easy_strerror(res) ? std::string(curl_easy_strerror(res)) : ""), "");
-            success = false;
-        } else {
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpcodeOut);
-            success = true;
-        }
+    DBBHTTPRequest request = createRequest(method, url, args);
+    request.shouldCancel = [this]() { return shouldCancelLongPoll(); };
 
-        curl_slist_free_all(chunk);
-        curl_easy_cleanup(curl);
-    }
-    curl_global_cleanup();
+    bool success = DBBHTTPClient::Shared().perform(request, responseOut, httpcodeOut);
 
     DBB::LogPrintDebug("response: "+responseOut, "");
     return success;
@@ -211,11 +135,11 @@ void DBBComServer::startLongPollThread()
 {
     std::unique_lock<std::mutex> lock(cs_com);
 
-    if (longPollThread)
+    if (longPollTask)
         return;
 
-    longPollThread = DBBNetThread::DetachThread();
-    longPollThread->currentThread = std::thread([this]() {
+    // runs for the lifetime of the comserver, on its own thread to keep the pool workers free
+    longPollTask = DBBNetThread::SubmitDedicated([this](const DBBNetCancelToken& token) {
         std::string response;
         long httpStatusCode;
         long sequence = 0;
@@ -234,7 +158,7 @@ void DBBComServer::startLongPollThread()
             }
             SendRequest("post", currentLongPollURL, "c=gd&uuid="+currentLongPollChannelID+"&dt=0&s="+std::to_string(sequence), response, httpStatusCode);
             sequence++;
-            if (shouldCancel)
+            if (shouldCancel || token.isCancelled())
                 return;
 
             if (httpStatusCode >= 300)
@@ -244,10 +168,10 @@ void DBBComServer::startLongPollThread()
                 {
                     DBB::LogPrintDebug("Error, can't connect to the smart verification server");
                     // wait 10 seconds before the next try
-                    std::this_thread::sleep_for(std::chrono::milliseconds(10000));
+                    token.sleepFor(10000);
                 }
                 else
-                    std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+                    token.sleepFor(2000);
             }
             else
                 errorCounts = 0;
@@ -271,24 +195,17 @@ void DBBComServer::startLongPollThread()
                         if (payload.isStr())
                         {
                             std::string plaintextPayload;
-                            std::string keyS(encryptionKey.begin(), encryptionKey.end());
-                            if (DBB::decryptAndDecodeCommand(payload.get_str(), keyS, plaintextPayload, false))
+                            if (decryptPayload(payload.get_str(), plaintextPayload))
                             {
                                 std::unique_lock<std::mutex> lock(cs_com);
                                 if (parseMessageCB)
                                     parseMessageCB(this, plaintextPayload, ctx);
                             }
-
-                            // mem-cleanse the key
-                            std::fill(keyS.begin(), keyS.end(), 0);
-                            keyS.clear();
                         }
                     }
                 }
             }
         }
-        std::unique_lock<std::mutex> lock(cs_com);
-        longPollThread->completed();
     });
 }
 
@@ -297,37 +214,98 @@ bool DBBComServer::postNotification(const std::string& payload)
     if (channelID.empty())
         return false;
 
-    DBBNetThread *postThread = DBBNetThread::DetachThread();
-    postThread->currentThread = std::thread([this, postThread, payload]() {
-        std::string response;
-        long httpStatusCode;
-        UniValue jsonOut;
-
-        response = "";
-        httpStatusCode = 0;
-
-        // encrypt the payload
-        std::string encryptedPayload;
+    // encrypt the payload, authenticated if the peer supports it
+    std::string encryptedPayload;
+    std::shared_ptr<DBB::ChannelCipher> cipher = getChannelCipher();
+    if (peerUsesChannelCipher && cipher)
+    {
+        if (!cipher->encrypt(payload, currentTimeMillis(), encryptedPayload))
+        {
+            DBB::LogPrintDebug("Could not encrypt the notification, dropping it");
+            return false;
+        }
+    }
+    else
+    {
         std::string keyS(encryptionKey.begin(), encryptionKey.end());
         DBB::encryptAndEncodeCommand(payload, keyS, encryptedPayload, false);
         // mem-cleanse the key
         std::fill(keyS.begin(), keyS.end(), 0);
         keyS.clear();
+    }
 
-        // send the payload
-        SendRequest("post", comServerURL, "c=data&s="+std::to_string(nSequence)+"&uuid="+channelID+"&dt=0&pl="+encryptedPayload, response, httpStatusCode);
-        nSequence++; // increase the sequence number
+    // send the payload on the HTTP reactor, no thread per notification
+    DBBHTTPRequest request = createRequest("post", comServerURL, "c=data&s="+std::to_string(nSequence)+"&uuid="+channelID+"&dt=0&pl="+encryptedPayload);
+    nSequence++; // increase the sequence number
 
-        // ignore the response for now
-        postThread->completed();
+    // ignore the response for now
+    return DBBHTTPClient::Shared().performAsync(request, [](bool success, long httpCode, const std::string& response) {
+        DBB::LogPrintDebug("response: "+response, "");
     });
+}
 
-    return true;
+std::shared_ptr<DBB::ChannelCipher> DBBComServer::getChannelCipher()
+{
+    std::unique_lock<std::mutex> lock(cs_com);
+    if (!channelCipher && !encryptionKey.empty())
+        channelCipher.reset(new DBB::ChannelCipher(&encryptionKey[0], encryptionKey.size()));
+    return channelCipher;
+}
+
+void DBBComServer::resetChannelCipher()
+{
+    std::unique_lock<std::mutex> lock(cs_com);
+    channelCipher.reset();
+    peerUsesChannelCipher = false;
+    lastRemoteTimestamp = 0;
+}
+
+bool DBBComServer::decryptPayload(const std::string& payload, std::string& plaintextOut)
+{
+    std::shared_ptr<DBB::ChannelCipher> cipher = getChannelCipher();
+    if (cipher && DBB::ChannelCipher::isVersioned(payload))
+    {
+        // reject replays and payloads older than COMSERVER_MAX_MESSAGE_AGE before decrypting
+        uint64_t now = currentTimeMillis();
+        uint64_t minTimestamp;
+        {
+            std::unique_lock<std::mutex> lock(cs_com);
+            minTimestamp = std::max(lastRemoteTimestamp + 1, now > COMSERVER_MAX_MESSAGE_AGE ? now - COMSERVER_MAX_MESSAGE_AGE : 0);
+        }
+        uint64_t timestamp = 0;
+        if (cipher->decrypt(payload, plaintextOut, minTimestamp, &timestamp))
+        {
+            // re-check, another payload may have been accepted (or the channel reset) while decrypting
+            std::unique_lock<std::mutex> lock(cs_com);
+            if (cipher != channelCipher || timestamp <= lastRemoteTimestamp)
+            {
+                plaintextOut.clear();
+                return false;
+            }
+            lastRemoteTimestamp = timestamp;
+            peerUsesChannelCipher = true;
+            return true;
+        }
+    }
+
+    // no downgrade once the peer has switched to the authenticated format
+    if (peerUsesChannelCipher)
+        return false;
+
+    // legacy payload (its random IV can start with the version byte as well)
+    std::string keyS(encryptionKey.begin(), encryptionKey.end());
+    bool ret = DBB::decryptAndDecodeCommand(payload, keyS, plaintextOut, false);
+
+    // mem-cleanse the key
+    std::fill(keyS.begin(), keyS.end(), 0);
+    keyS.clear();
+    return ret;
 }
 
 const std::string DBBComServer::getPairData()
 {
-    std::string channelData = "{\"id\":\""+getChannelID()+"\",\"key\":\""+getAESKeyBase58()+"\"}";
+    // "v" announces the authenticated payload format
+    std::string channelData = "{\"id\":\""+getChannelID()+"\",\"key\":\""+getAESKeyBase58()+"\",\"v\":"+std::to_string(DBB_CHANNEL_CIPHER_VERSION)+"}";
     return channelData;
 }
 
@@ -370,6 +348,7 @@ const std::vector<unsigned char> DBBComServer::getEncryptionKey()
 void DBBComServer::setEncryptionKey(const std::vector<unsigned char> encryptionKeyIn)
 {
     encryptionKey = encryptionKeyIn;
+    resetChannelCipher();
 }
 
 void DBBComServer::setParseMessageCB(void (*fpIn)(DBBComServer*, const std::string&, void*), void *ctxIn)
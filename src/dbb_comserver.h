@@ -9,6 +9,7 @@
 #include <chrono>
 #include <condition_variable>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -22,6 +23,8 @@
 #include "mingw/mingw.thread.h"
 #endif
 
+struct DBBHTTPRequest;
+
 // this class manages push notification from and to the smart verification device
 // the push messages will be sent to a proxy server script.
 // receiving push messages is done with http long polling.
@@ -30,24 +33,53 @@
 #define CHANNEL_ID_BASE58_PREFIX 0x91
 #define AES_KEY_BASE57_PREFIX 0x56
 
+// authenticated payloads older than this (sender clock, ms) are rejected
+#define COMSERVER_MAX_MESSAGE_AGE (10 * 60 * 1000)
+
+namespace DBB {
+class ChannelCipher;
+}
+
 /*
    symetric key and channel ID derivation
 
    channelID = base58check(RIPEMD160(SHA256(pubkey)))
    aeskey = sha256_hmac(key="DBBAesKey", encryption_ec_private_key)
+
+   payload encryption
+   legacy peers use AES-256-CBC (without a MAC) with the encryption key.
+   Peers that understand the versioned format (DBB::ChannelCipher, advertised with "v" in the
+   pair data) send authenticated payloads. Once the peer has sent one, we answer in the
+   same format and no longer accept legacy payloads on this key.
 */
 class DBBComServer
 {
 private:
-    DBBNetThread* longPollThread; //!< the thread to handle the long polling (will run endless)
+    std::shared_ptr<DBBNetTask> longPollTask; //!< the dedicated task handling the long polling (will run endless)
     std::string comServerURL; //!< the url to call
     std::string ca_file; //<!ca_file to use
     std::string socks5ProxyURL; //<!socks5 URL or empty for no proxy
     std::atomic<bool> shouldCancel;
 
+    /* fills a request with the comserver defaults (proxy, CA file, timeout) */
+    DBBHTTPRequest createRequest(const std::string& method, const std::string& url, const std::string& args);
+
     /* send a synchronous http request */
     bool SendRequest(const std::string& method, const std::string& url, const std::string& args, std::string& responseOut, long& httpcodeOut);
 
+    std::shared_ptr<DBB::ChannelCipher> channelCipher; //!< authenticated cipher for the current key
+    std::atomic<bool> peerUsesChannelCipher; //!< peer has sent an authenticated payload
+    uint64_t lastRemoteTimestamp; //!< timestamp of the last accepted authenticated payload (replay protection)
+
+    /* returns the authenticated cipher of the current encryption key (created on first use) */
+    std::shared_ptr<DBB::ChannelCipher> getChannelCipher();
+
+    /* drops the cipher and the negotiated format, call when the encryption key changes */
+    void resetChannelCipher();
+
+    /* decrypts a received payload in the negotiated format */
+    bool decryptPayload(const std::string& payload, std::string& plaintextOut);
+
 public:
     DBBComServer(const std::string& comServerURL);
     ~DBBComServer();
@@ -76,7 +108,7 @@ public:
     /* generates a new encryption key => new AES key, new channel ID */
     bool generateNewKey();
 
-    /* starts the longPollThread, needs only be done once */
+    /* starts the long poll task, needs only be done once */
     void startLongPollThread();
 
     /* can be called during long poll idle to see if the channelID poll still makes sense */
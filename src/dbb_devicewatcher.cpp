@@ -0,0 +1,171 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "dbb_devicewatcher.h"
+
+#include "dbb_util.h"
+
+#include <string>
+
+// after an arrival event the device can take a moment until it shows up as HID interface
+#define DEVICEWATCHER_ARRIVAL_RETRIES 10
+#define DEVICEWATCHER_ARRIVAL_RETRY_DELAY 100
+
+DBBDeviceWatcher::DBBDeviceWatcher(std::function<void(bool, enum DBB::dbb_device_mode)> stateChangedCBIn) : stateChangedCB(stateChangedCBIn)
+{
+    shouldStop = false;
+    paused = false;
+    rescanRequested = false;
+    lastDeviceMode = DBB::DBB_DEVICE_NO_DEVICE;
+#ifdef DBB_USE_LIBUSB_HOTPLUG
+    usbContext = NULL;
+    hotplugActive = false;
+#endif
+}
+
+DBBDeviceWatcher::~DBBDeviceWatcher()
+{
+    stop();
+}
+
+#ifdef DBB_USE_LIBUSB_HOTPLUG
+int LIBUSB_CALL DBBDeviceWatcher::HotplugCallback(libusb_context* ctx, libusb_device* device, libusb_hotplug_event event, void* userData)
+{
+    // called from libusb_handle_events on the watcher thread
+    // don't enumerate here, libusb does not allow synchronous calls within the callback
+    DBBDeviceWatcher* watcher = (DBBDeviceWatcher*)userData;
+    DBB::LogPrintDebug("USB hotplug event: %d\n", (int)event);
+    DBB::invalidateDeviceCache();
+    watcher->rescan();
+    return 0; // keep the callback registered
+}
+#endif
+
+void DBBDeviceWatcher::checkDevices()
+{
+    if (paused)
+        return;
+
+    int retries = 0;
+    std::string devicePath;
+    enum DBB::dbb_device_mode deviceMode = DBB::deviceAvailable(devicePath);
+    while (usesHotplug() && deviceMode == lastDeviceMode && retries < DEVICEWATCHER_ARRIVAL_RETRIES && !shouldStop) {
+        // event without a visible change, give the device some time to settle
+        std::this_thread::sleep_for(std::chrono::milliseconds(DEVICEWATCHER_ARRIVAL_RETRY_DELAY));
+        // the cached enumeration would return the same result again
+        DBB::invalidateDeviceCache();
+        deviceMode = DBB::deviceAvailable(devicePath);
+        retries++;
+    }
+
+    if (deviceMode != lastDeviceMode) {
+        lastDeviceMode = deviceMode;
+        stateChangedCB((deviceMode != DBB::DBB_DEVICE_UNKNOWN && deviceMode != DBB::DBB_DEVICE_NO_DEVICE), deviceMode);
+    }
+}
+
+void DBBDeviceWatcher::start()
+{
+    if (watchThread.joinable())
+        return;
+
+    shouldStop = false;
+#ifdef DBB_USE_LIBUSB_HOTPLUG
+    hotplugActive = false;
+    if (libusb_init(&usbContext) == 0) {
+        if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) &&
+            libusb_hotplug_register_callback(usbContext,
+                                             (libusb_hotplug_event)(LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
+                                             (libusb_hotplug_flag)0, DBB_USB_VENDOR_ID, DBB_USB_PRODUCT_ID, LIBUSB_HOTPLUG_MATCH_ANY,
+                                             HotplugCallback, this, &hotplugHandle) == LIBUSB_SUCCESS)
+            hotplugActive = true;
+        else {
+            libusb_exit(usbContext);
+            usbContext = NULL;
+        }
+    }
+    DBB::LogPrint("Device watcher uses %s\n", hotplugActive ? "libusb hotplug events" : "polling");
+
+    // topology changes are reported, the enumeration can be cached
+    if (hotplugActive)
+        DBB::setDeviceCacheEnabled(true);
+#endif
+
+    watchThread = std::thread([this]() {
+        // report the initial state
+        {
+            std::unique_lock<std::mutex> lock(cs_watcher);
+            rescanRequested = false;
+        }
+        checkDevices();
+
+        while (!shouldStop) {
+#ifdef DBB_USE_LIBUSB_HOTPLUG
+            if (hotplugActive) {
+                // dispatches the hotplug callback, wakes up regularly to handle stop/rescan requests
+                struct timeval tv = {0, 250000};
+                libusb_handle_events_timeout_completed(usbContext, &tv, NULL);
+            }
+#endif
+            bool doCheck = false;
+            {
+                std::unique_lock<std::mutex> lock(cs_watcher);
+                if (!usesHotplug() && !rescanRequested && !shouldStop)
+                    rescanCondVar.wait_for(lock, std::chrono::milliseconds(DEVICEWATCHER_POLL_INTERVAL));
+
+                // polling fallback checks on every wakeup
+                doCheck = rescanRequested || !usesHotplug();
+                rescanRequested = false;
+            }
+            if (doCheck && !shouldStop)
+                checkDevices();
+        }
+    });
+}
+
+void DBBDeviceWatcher::stop()
+{
+    {
+        std::unique_lock<std::mutex> lock(cs_watcher);
+        shouldStop = true;
+        rescanCondVar.notify_one();
+    }
+    if (watchThread.joinable())
+        watchThread.join();
+
+#ifdef DBB_USE_LIBUSB_HOTPLUG
+    if (usbContext) {
+        if (hotplugActive) {
+            libusb_hotplug_deregister_callback(usbContext, hotplugHandle);
+            DBB::setDeviceCacheEnabled(false);
+        }
+        libusb_exit(usbContext);
+        usbContext = NULL;
+    }
+    hotplugActive = false;
+#endif
+}
+
+void DBBDeviceWatcher::setPaused(bool state)
+{
+    paused = state;
+    if (!state)
+        rescan();
+}
+
+void DBBDeviceWatcher::rescan()
+{
+    std::unique_lock<std::mutex> lock(cs_watcher);
+    rescanRequested = true;
+    rescanCondVar.notify_one();
+}
+
+bool DBBDeviceWatcher::usesHotplug()
+{
+#ifdef DBB_USE_LIBUSB_HOTPLUG
+    return hotplugActive;
+#else
+    return false;
+#endif
+}
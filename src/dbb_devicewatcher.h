@@ -0,0 +1,85 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef DBBAPP_DEVICEWATCHER_H
+#define DBBAPP_DEVICEWATCHER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#ifdef WIN32
+#include <windows.h>
+#include "mingw/mingw.mutex.h"
+#include "mingw/mingw.condition_variable.h"
+#include "mingw/mingw.thread.h"
+#endif
+
+#ifndef _SRC_CONFIG__DBB_CONFIG_H
+#include "config/_dbb-config.h"
+#endif
+
+#include "dbb.h"
+
+#ifdef DBB_USE_LIBUSB_HOTPLUG
+#include <libusb.h>
+#endif
+
+#define DEVICEWATCHER_POLL_INTERVAL 1000
+
+// this class watches for DBB arrival/removal and reports device state changes
+// with libusb hotplug support the state change is reported right after the
+// kernel has enumerated the device, otherwise the devices are polled
+// (DEVICEWATCHER_POLL_INTERVAL ms).
+// the callback is called on the watcher thread, never while holding the command queue lock
+class DBBDeviceWatcher
+{
+private:
+    std::thread watchThread;
+    std::atomic<bool> shouldStop;
+    std::atomic<bool> paused;
+
+    std::mutex cs_watcher;
+    std::condition_variable rescanCondVar;
+    bool rescanRequested;
+
+    enum DBB::dbb_device_mode lastDeviceMode;
+    std::function<void(bool, enum DBB::dbb_device_mode)> stateChangedCB;
+
+#ifdef DBB_USE_LIBUSB_HOTPLUG
+    libusb_context* usbContext;
+    libusb_hotplug_callback_handle hotplugHandle;
+    bool hotplugActive;
+
+    static int LIBUSB_CALL HotplugCallback(libusb_context* ctx, libusb_device* device, libusb_hotplug_event event, void* userData);
+#endif
+
+    /* enumerate the devices and call back if the state has changed */
+    void checkDevices();
+
+public:
+    /* state changed callback, same contract as DBBDaemonGui::deviceStateHasChanged(state, deviceType) */
+    DBBDeviceWatcher(std::function<void(bool, enum DBB::dbb_device_mode)> stateChangedCBIn);
+    ~DBBDeviceWatcher();
+
+    /* starts the watcher thread, reports the current state immediately */
+    void start();
+
+    /* stops and joins the watcher thread */
+    void stop();
+
+    /* pause the watching (during firmware upgrades), resuming triggers a rescan */
+    void setPaused(bool state);
+
+    /* request an immediate rescan */
+    void rescan();
+
+    /* returns true if device changes are event driven (no polling) */
+    bool usesHotplug();
+};
+
+#endif //DBBAPP_DEVICEWATCHER_H
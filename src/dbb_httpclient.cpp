@@ -0,0 +1,488 @@
+// Copyright (c) 2016 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "dbb_httpclient.h"
+
+#include "dbb_netthread.h"
+#include "dbb_util.h"
+
+#include <algorithm>
+
+DBBHTTPClient* DBBHTTPClient::sharedClient = NULL;
+std::once_flag DBBHTTPClient::initFlag;
+
+static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp)
+{
+    ((std::string*)userp)->append((char*)contents, size * nmemb);
+    return size * nmemb;
+}
+
+static size_t HeaderCallback(char* buffer, size_t size, size_t nitems, void* userp)
+{
+    const std::function<void(const std::string&)>* headerCallback = (const std::function<void(const std::string&)>*)userp;
+    (*headerCallback)(std::string(buffer, size * nitems));
+    return size * nitems;
+}
+
+/* this is how the CURLOPT_XFERINFOFUNCTION callback works */
+static int xferinfo(void* p,
+                    curl_off_t dltotal, curl_off_t dlnow,
+                    curl_off_t ultotal, curl_off_t ulnow)
+{
+    const std::function<bool()>* shouldCancel = (const std::function<bool()>*)p;
+    if (shouldCancel && *shouldCancel && (*shouldCancel)())
+        return 1;
+
+    return 0;
+}
+
+static int progress_cb(void* p,
+                       double dltotal, double dlnow,
+                       double ultotal, double ulnow)
+{
+    return xferinfo(p,
+                    (curl_off_t)dltotal,
+                    (curl_off_t)dlnow,
+                    (curl_off_t)ultotal,
+                    (curl_off_t)ulnow);
+}
+
+#ifdef DBB_ENABLE_NETDEBUG
+static int logprint_cb(CURL* handle, curl_infotype type,
+                       char* data, size_t size,
+                       void* userp)
+{
+    (void)handle; /* prevent compiler warning */
+
+    switch (type) {
+    case CURLINFO_TEXT:
+    case CURLINFO_HEADER_OUT:
+    case CURLINFO_HEADER_IN:
+        DBB::LogPrintDebug(std::string(data, size), "");
+    default:
+        return 0;
+    }
+}
+#endif
+
+struct DBBHTTPTransfer
+{
+    DBBHTTPRequest request;
+    DBBHTTPCallback callback;
+    std::string host;
+    std::string endpoint;
+    std::string response;
+    CURL* handle;
+    struct curl_slist* headers;
+
+    DBBHTTPTransfer() : handle(NULL), headers(NULL) {}
+};
+
+DBBHTTPClient::DBBHTTPClient() : stopped(false)
+{
+    share = curl_share_init();
+    if (share) {
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, shareLock);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, shareUnlock);
+        curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+
+    multi = curl_multi_init();
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)HTTPCLIENT_MAX_HOST_CONNECTIONS);
+#if LIBCURL_VERSION_NUM >= 0x072b00
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+#endif
+
+    reactorThread = std::thread([this]() { reactorLoop(); });
+}
+
+DBBHTTPClient::~DBBHTTPClient()
+{
+    stop();
+}
+
+void DBBHTTPClient::stop()
+{
+    {
+        // performAsync only wakes up the reactor under the lock, the multi handle stays valid for it
+        std::unique_lock<std::mutex> lock(cs_queue);
+        if (!multi || stopped)
+            return;
+        stopped = true;
+        queueCondVar.notify_one();
+#if LIBCURL_VERSION_NUM >= 0x074400
+        curl_multi_wakeup(multi);
+#endif
+    }
+    if (reactorThread.joinable())
+        reactorThread.join();
+
+    std::unique_lock<std::mutex> lock(cs_pool);
+    for (std::map<std::string, std::vector<CURL*> >::iterator it = idleHandles.begin(); it != idleHandles.end(); ++it)
+        for (CURL* handle : it->second)
+            curl_easy_cleanup(handle);
+    idleHandles.clear();
+
+    curl_multi_cleanup(multi);
+    multi = NULL;
+    if (share)
+        curl_share_cleanup(share);
+    share = NULL;
+}
+
+void DBBHTTPClient::shareLock(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr)
+{
+    DBBHTTPClient* client = (DBBHTTPClient*)userptr;
+    client->cs_share[data].lock();
+}
+
+void DBBHTTPClient::shareUnlock(CURL* handle, curl_lock_data data, void* userptr)
+{
+    DBBHTTPClient* client = (DBBHTTPClient*)userptr;
+    client->cs_share[data].unlock();
+}
+
+void DBBHTTPClient::Init()
+{
+    Shared();
+}
+
+DBBHTTPClient& DBBHTTPClient::Shared()
+{
+    // curl_global_init is not thread safe, make sure it runs exactly once
+    std::call_once(initFlag, []() {
+        curl_global_init(CURL_GLOBAL_ALL);
+        sharedClient = new DBBHTTPClient();
+    });
+    return *sharedClient;
+}
+
+void DBBHTTPClient::Shutdown()
+{
+    if (!sharedClient)
+        return;
+
+    sharedClient->logStats();
+
+    // the reactor fails the remaining transfers, their callers return
+    // the client stays allocated, later requests from detached threads fail right away
+    sharedClient->stop();
+    curl_global_cleanup();
+}
+
+CURL* DBBHTTPClient::acquireHandle(const std::string& host)
+{
+    {
+        std::unique_lock<std::mutex> lock(cs_pool);
+        std::vector<CURL*>& handles = idleHandles[host];
+        if (!handles.empty()) {
+            CURL* handle = handles.back();
+            handles.pop_back();
+            return handle;
+        }
+    }
+    return curl_easy_init();
+}
+
+void DBBHTTPClient::releaseHandle(const std::string& host, CURL* handle)
+{
+    // reset the options, the connections, the session and the DNS cache stay
+    curl_easy_reset(handle);
+
+    {
+        std::unique_lock<std::mutex> lock(cs_pool);
+        std::vector<CURL*>& handles = idleHandles[host];
+        if (handles.size() < HTTPCLIENT_MAX_IDLE_HANDLES_PER_HOST) {
+            handles.push_back(handle);
+            return;
+        }
+    }
+    curl_easy_cleanup(handle);
+}
+
+void DBBHTTPClient::splitURL(const std::string& url, std::string& hostOut, std::string& pathOut)
+{
+    size_t hostStart = url.find("://");
+    hostStart = (hostStart == std::string::npos) ? 0 : hostStart + 3;
+    size_t pathStart = url.find('/', hostStart);
+    if (pathStart == std::string::npos)
+        pathStart = url.size();
+
+    hostOut = url.substr(0, pathStart);
+    pathOut = url.substr(pathStart, url.find('?', pathStart) - pathStart);
+    if (pathOut.empty())
+        pathOut = "/";
+}
+
+// endpoint name for the statistics, identifiers in the path (txp ids, etc.) are collapsed
+static std::string endpointName(const std::string& method, const std::string& host, const std::string& path)
+{
+    std::string name = method;
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    name += " " + host;
+
+    size_t pos = 0;
+    while (pos < path.size()) {
+        size_t end = path.find('/', pos + 1);
+        if (end == std::string::npos)
+            end = path.size();
+        std::string segment = path.substr(pos, end - pos);
+        if (segment.size() > 16 && segment.find_first_not_of("/0123456789abcdefABCDEF-") == std::string::npos)
+            segment = "/*";
+        name += segment;
+        pos = end;
+    }
+    return name;
+}
+
+void DBBHTTPClient::setupTransfer(DBBHTTPTransfer* transfer)
+{
+    const DBBHTTPRequest& request = transfer->request;
+    CURL* curl = transfer->handle;
+
+    for (const std::string& header : request.headers)
+        transfer->headers = curl_slist_append(transfer->headers, header.c_str());
+    if (transfer->headers)
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, transfer->headers);
+    curl_easy_setopt(curl, CURLOPT_URL, request.url.c_str());
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, transfer);
+
+    if (request.method == "post") {
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request.body.c_str());
+        curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    }
+
+    if (request.method == "delete") {
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request.body.c_str());
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+    }
+
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer->response);
+    if (request.headerCallback) {
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &request.headerCallback);
+    }
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+    if (request.proxy.size())
+        curl_easy_setopt(curl, CURLOPT_PROXY, request.proxy.c_str());
+
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, request.timeout);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+#if LIBCURL_VERSION_NUM >= 0x072f00
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072b00
+    // rather wait for a multiplexed HTTP/2 stream than opening another connection
+    // (HTTP/2 is only negotiated over TLS, plain HTTP transfers would just be serialized)
+    if (request.url.compare(0, 8, "https://") == 0)
+        curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+#endif
+    if (share)
+        curl_easy_setopt(curl, CURLOPT_SHARE, share);
+
+    if (request.caFile.size())
+        curl_easy_setopt(curl, CURLOPT_CAINFO, request.caFile.c_str());
+
+    if (request.shouldCancel) {
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+        curl_easy_setopt(curl, CURLOPT_PROGRESSFUNCTION, progress_cb);
+        curl_easy_setopt(curl, CURLOPT_PROGRESSDATA, &request.shouldCancel);
+#if LIBCURL_VERSION_NUM >= 0x072000
+        /* xferinfo was introduced in 7.32.0, newer libcurls prefer it if both callbacks are set */
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, xferinfo);
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &request.shouldCancel);
+#endif
+    }
+
+#ifdef DBB_ENABLE_NETDEBUG
+    curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+    curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, logprint_cb);
+#endif
+}
+
+void DBBHTTPClient::finishTransfer(DBBHTTPTransfer* transfer, CURLcode result)
+{
+    bool success = false;
+    long httpCode = 0;
+    long newConnections = 0;
+    double ttfb = 0;
+
+    if (result != CURLE_OK) {
+        DBB::LogPrintDebug("curl transfer failed " + (curl_easy_strerror(result) ? std::string(curl_easy_strerror(result)) : "") + "\n", "");
+    } else {
+        curl_easy_getinfo(transfer->handle, CURLINFO_RESPONSE_CODE, &httpCode);
+        curl_easy_getinfo(transfer->handle, CURLINFO_NUM_CONNECTS, &newConnections);
+        curl_easy_getinfo(transfer->handle, CURLINFO_STARTTRANSFER_TIME, &ttfb);
+        success = true;
+    }
+
+    curl_slist_free_all(transfer->headers);
+    transfer->headers = NULL;
+    releaseHandle(transfer->host, transfer->handle);
+    transfer->handle = NULL;
+
+    {
+        std::unique_lock<std::mutex> lock(cs_stats);
+        DBBHTTPEndpointStats& endpointStats = stats[transfer->endpoint];
+        endpointStats.requests++;
+        if (!success)
+            endpointStats.failed++;
+        else {
+            if (newConnections == 0)
+                endpointStats.reused++;
+            endpointStats.totalTTFB += ttfb;
+        }
+    }
+    if (success)
+        DBB::LogPrintDebug("%s: %ld, %s connection, TTFB %.1f ms\n", transfer->endpoint.c_str(), httpCode, (newConnections == 0) ? "reused" : "new", ttfb * 1000.0);
+
+    if (transfer->callback)
+        transfer->callback(success, httpCode, transfer->response);
+    delete transfer;
+}
+
+void DBBHTTPClient::reactorLoop()
+{
+    while (true) {
+        std::vector<DBBHTTPTransfer*> added;
+        {
+            std::unique_lock<std::mutex> lock(cs_queue);
+            // idle, sleep until something gets submitted
+            if (activeTransfers.empty() && submittedTransfers.empty() && !stopped)
+                queueCondVar.wait(lock);
+            if (stopped)
+                break;
+            added.swap(submittedTransfers);
+        }
+
+        for (DBBHTTPTransfer* transfer : added) {
+            transfer->handle = acquireHandle(transfer->host);
+            if (!transfer->handle) {
+                finishTransfer(transfer, CURLE_FAILED_INIT);
+                continue;
+            }
+            setupTransfer(transfer);
+            curl_multi_add_handle(multi, transfer->handle);
+            activeTransfers.insert(transfer);
+        }
+
+        int running = 0;
+        curl_multi_perform(multi, &running);
+
+        CURLMsg* msg;
+        int msgsLeft = 0;
+        while ((msg = curl_multi_info_read(multi, &msgsLeft))) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            DBBHTTPTransfer* transfer = NULL;
+            CURLcode result = msg->data.result;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&transfer);
+            curl_multi_remove_handle(multi, msg->easy_handle);
+            activeTransfers.erase(transfer);
+            finishTransfer(transfer, result);
+        }
+
+        if (activeTransfers.empty())
+            continue;
+
+        // wait for socket activity, curl_multi_wakeup interrupts it for new transfers
+#if LIBCURL_VERSION_NUM >= 0x074400
+        curl_multi_poll(multi, NULL, 0, 1000, NULL);
+#else
+        curl_multi_wait(multi, NULL, 0, HTTPCLIENT_REACTOR_POLL_INTERVAL, NULL);
+#endif
+    }
+
+    // shutdown, fail everything that is still queued or running
+    std::vector<DBBHTTPTransfer*> remaining;
+    {
+        std::unique_lock<std::mutex> lock(cs_queue);
+        remaining.swap(submittedTransfers);
+    }
+    for (DBBHTTPTransfer* transfer : activeTransfers) {
+        curl_multi_remove_handle(multi, transfer->handle);
+        finishTransfer(transfer, CURLE_ABORTED_BY_CALLBACK);
+    }
+    activeTransfers.clear();
+    for (DBBHTTPTransfer* transfer : remaining) {
+        if (transfer->callback)
+            transfer->callback(false, 0, "");
+        delete transfer;
+    }
+}
+
+bool DBBHTTPClient::performAsync(const DBBHTTPRequest& request, DBBHTTPCallback callback)
+{
+    DBBHTTPTransfer* transfer = new DBBHTTPTransfer();
+    transfer->request = request;
+    transfer->callback = callback;
+
+    // requests submitted from a network task are aborted when the task gets cancelled
+    DBBNetCancelToken token = DBBNetThread::CurrentCancelToken();
+    std::function<bool()> shouldCancel = request.shouldCancel;
+    transfer->request.shouldCancel = [token, shouldCancel]() { return token.isCancelled() || (shouldCancel && shouldCancel()); };
+
+    std::string path;
+    splitURL(request.url, transfer->host, path);
+    transfer->endpoint = endpointName(request.method, transfer->host, path);
+
+    {
+        std::unique_lock<std::mutex> lock(cs_queue);
+        if (stopped) {
+            delete transfer;
+            return false;
+        }
+        submittedTransfers.push_back(transfer);
+        queueCondVar.notify_one();
+#if LIBCURL_VERSION_NUM >= 0x074400
+        // under the lock, stop() can't clean up the multi handle in the meantime
+        curl_multi_wakeup(multi);
+#endif
+    }
+    return true;
+}
+
+bool DBBHTTPClient::perform(const DBBHTTPRequest& request, std::string& responseOut, long& httpcodeOut)
+{
+    std::mutex cs_done;
+    std::condition_variable doneCondVar;
+    bool done = false;
+    bool success = false;
+
+    bool queued = performAsync(request, [&](bool successIn, long httpCode, const std::string& response) {
+        std::unique_lock<std::mutex> lock(cs_done);
+        success = successIn;
+        if (successIn)
+            httpcodeOut = httpCode;
+        responseOut.append(response);
+        done = true;
+        doneCondVar.notify_one();
+    });
+    if (!queued)
+        return false;
+
+    std::unique_lock<std::mutex> lock(cs_done);
+    while (!done)
+        doneCondVar.wait(lock);
+    return success;
+}
+
+std::map<std::string, DBBHTTPEndpointStats> DBBHTTPClient::getStats()
+{
+    std::unique_lock<std::mutex> lock(cs_stats);
+    return stats;
+}
+
+void DBBHTTPClient::logStats()
+{
+    std::map<std::string, DBBHTTPEndpointStats> currentStats = getStats();
+    for (std::map<std::string, DBBHTTPEndpointStats>::const_iterator it = currentStats.begin(); it != currentStats.end(); ++it)
+        DBB::LogPrint("HTTP %s: %u requests, %.0f%% reused, avg. TTFB %.1f ms, %u failed\n", it->first.c_str(), it->second.requests, it->second.reuseRatio() * 100.0, it->second.avgTTFBMillis(), it->second.failed);
+}
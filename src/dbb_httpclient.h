@@ -0,0 +1,139 @@
+// Copyright (c) 2016 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef DBBAPP_HTTPCLIENT_H
+#define DBBAPP_HTTPCLIENT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef WIN32
+#include <windows.h>
+#include "mingw/mingw.mutex.h"
+#include "mingw/mingw.condition_variable.h"
+#include "mingw/mingw.thread.h"
+#endif
+
+#include <curl/curl.h>
+
+// idle easy handles kept per host (saves the handle setup)
+#define HTTPCLIENT_MAX_IDLE_HANDLES_PER_HOST 4
+
+// parallel connections per host, further transfers wait (or are multiplexed over HTTP/2)
+#define HTTPCLIENT_MAX_HOST_CONNECTIONS 6
+
+// reactor wakeup interval if libcurl can't be woken up (< 7.68)
+#define HTTPCLIENT_REACTOR_POLL_INTERVAL 50
+
+struct DBBHTTPRequest
+{
+    std::string method; //!< "get", "post" or "delete"
+    std::string url;
+    std::string body;
+    std::vector<std::string> headers;
+    std::string proxy;  //!< socks5 proxy URL, empty for a direct connection
+    std::string caFile; //!< CA bundle, empty for the libcurl default
+    long timeout;       //!< seconds
+
+    //!called during the transfer, returning true aborts the request
+    std::function<bool()> shouldCancel;
+
+    //!called for every received header line (on the reactor thread)
+    std::function<void(const std::string& line)> headerCallback;
+
+    DBBHTTPRequest() : method("get"), timeout(45) {}
+};
+
+//!completion callback (success = a HTTP response was received), called on the reactor thread
+typedef std::function<void(bool success, long httpCode, const std::string& response)> DBBHTTPCallback;
+
+struct DBBHTTPTransfer;
+
+struct DBBHTTPEndpointStats
+{
+    unsigned int requests;
+    unsigned int reused; //!< requests that didn't open a new connection
+    unsigned int failed;
+    double totalTTFB;    //!< sum of the time to first byte (seconds)
+
+    DBBHTTPEndpointStats() : requests(0), reused(0), failed(0), totalTTFB(0) {}
+    double reuseRatio() const { return requests ? (double)reused / requests : 0; }
+    double avgTTFBMillis() const { return (requests - failed) ? totalTTFB * 1000.0 / (requests - failed) : 0; }
+};
+
+// process wide HTTP client for the wallet server, the comserver and the update check
+// - curl_global_init runs once (Init() at startup, or on the first use)
+// - all transfers run on one reactor thread (curl_multi), any number of requests
+//   can be in flight without a thread per request
+// - connections are kept alive, TLS sessions and DNS lookups are shared
+// - HTTP/2 is used for TLS hosts that support it, parallel requests get multiplexed
+class DBBHTTPClient
+{
+private:
+    CURLSH* share;
+    std::mutex cs_share[CURL_LOCK_DATA_LAST];
+
+    std::mutex cs_pool;
+    std::map<std::string, std::vector<CURL*> > idleHandles;
+
+    CURLM* multi;
+    std::thread reactorThread;
+    std::mutex cs_queue;
+    std::condition_variable queueCondVar;
+    std::vector<DBBHTTPTransfer*> submittedTransfers; //!< waiting to be added to the multi handle
+    std::set<DBBHTTPTransfer*> activeTransfers;       //!< reactor thread only
+    std::atomic<bool> stopped;
+
+    std::mutex cs_stats;
+    std::map<std::string, DBBHTTPEndpointStats> stats;
+
+    static DBBHTTPClient* sharedClient;
+    static std::once_flag initFlag;
+
+    static void shareLock(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr);
+    static void shareUnlock(CURL* handle, curl_lock_data data, void* userptr);
+
+    CURL* acquireHandle(const std::string& host);
+    void releaseHandle(const std::string& host, CURL* handle);
+
+    void setupTransfer(DBBHTTPTransfer* transfer);
+    void finishTransfer(DBBHTTPTransfer* transfer, CURLcode result);
+    void reactorLoop();
+    void stop();
+
+    DBBHTTPClient();
+    ~DBBHTTPClient();
+
+public:
+    //!initializes libcurl and the shared client, call once at startup before any network thread
+    static void Init();
+
+    //!stops the reactor (running transfers fail), frees the handles and libcurl
+    static void Shutdown();
+
+    static DBBHTTPClient& Shared();
+
+    //!queues a request, the callback is called on the reactor thread (keep it short)
+    //!returns false if the client has been shut down
+    bool performAsync(const DBBHTTPRequest& request, DBBHTTPCallback callback);
+
+    //!performs a request and waits for it, returns false if no HTTP response was received
+    bool perform(const DBBHTTPRequest& request, std::string& responseOut, long& httpcodeOut);
+
+    //!statistics per endpoint (method, host and path)
+    std::map<std::string, DBBHTTPEndpointStats> getStats();
+    void logStats();
+
+    //!splits "https://host:port/path?query" into scheme+host+port and the path without query
+    static void splitURL(const std::string& url, std::string& hostOut, std::string& pathOut);
+};
+
+#endif //DBBAPP_HTTPCLIENT_H
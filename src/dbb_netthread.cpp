@@ -4,61 +4,254 @@
 
 #include "dbb_netthread.h"
 
-std::vector<DBBNetThread*> DBBNetThread::netThreads;
+#include "dbb_util.h"
+
+#include <algorithm>
+
+static const char* laneNames[DBB_NET_PRIORITY_COUNT] = {"high", "normal", "background"};
+
+std::vector<std::thread> DBBNetThread::workers;
+std::vector<std::thread> DBBNetThread::dedicatedThreads;
+std::deque<std::shared_ptr<DBBNetTask> > DBBNetThread::queues[DBB_NET_PRIORITY_COUNT];
+DBBNetLaneStats DBBNetThread::laneStats[DBB_NET_PRIORITY_COUNT];
 std::mutex DBBNetThread::cs_netThreads;
+std::condition_variable DBBNetThread::queueCondVar;
+std::condition_variable DBBNetThread::idleCondVar;
+std::set<std::shared_ptr<DBBNetTask> > DBBNetThread::runningTasks;
+bool DBBNetThread::stopped = false;
+
+// task of the current worker thread
+static thread_local DBBNetTask* currentTask = NULL;
 
-void DBBNetThread::completed()
+static double millisSince(const std::chrono::steady_clock::time_point& start)
 {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool DBBNetCancelToken::sleepFor(int millis) const
+{
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::milliseconds(millis);
+    while (!isCancelled()) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now >= end)
+            return true;
+        std::this_thread::sleep_for(std::min(std::chrono::duration_cast<std::chrono::milliseconds>(end - now), std::chrono::milliseconds(100)));
+    }
+    return false;
+}
+
+DBBNetTask::DBBNetTask(std::function<void(const DBBNetCancelToken&)> funcIn, DBBNetPriority priorityIn, const DBBNetCancelToken& tokenIn, std::function<void()> onDroppedIn) : func(funcIn), onDropped(onDroppedIn), priority(priorityIn), finished(false), cancelToken(tokenIn)
+{
+    enqueueTime = std::chrono::steady_clock::now();
+}
+
+void DBBNetTask::cancel()
+{
+    cancelToken.cancel();
+}
+
+void DBBNetTask::markFinished()
+{
+    std::unique_lock<std::mutex> lock(cs_task);
     finished = true;
+    finishedCondVar.notify_all();
 }
 
-bool DBBNetThread::hasCompleted()
+void DBBNetTask::drop()
 {
+    if (onDropped)
+        onDropped();
+    func = nullptr;
+    onDropped = nullptr;
+    markFinished();
+}
+
+bool DBBNetTask::hasCompleted()
+{
+    std::unique_lock<std::mutex> lock(cs_task);
     return finished;
 }
 
-void DBBNetThread::join()
+void DBBNetTask::join()
 {
-    currentThread.join();
+    // joining from within the task itself would deadlock
+    if (currentTask == this)
+        return;
+
+    std::unique_lock<std::mutex> lock(cs_task);
+    while (!finished)
+        finishedCondVar.wait(lock);
 }
 
-DBBNetThread::DBBNetThread()
+std::shared_ptr<DBBNetTask> DBBNetThread::Submit(DBBNetPriority priority, std::function<void(const DBBNetCancelToken&)> func, const DBBNetCancelToken& token, std::function<void()> onDropped)
 {
-    finished = false;
-    starttime = std::time(0);
+    std::shared_ptr<DBBNetTask> task = std::make_shared<DBBNetTask>(func, priority, token, onDropped);
+
+    std::unique_lock<std::mutex> lock(cs_netThreads);
+    if (stopped)
+        return NULL;
+
+    if (workers.empty())
+        for (unsigned int i = 0; i < DBBNETTHREAD_POOL_SIZE; i++)
+            workers.push_back(std::thread(WorkerLoop));
+
+    queues[priority].push_back(task);
+    DBBNetLaneStats& stats = laneStats[priority];
+    stats.submitted++;
+    if (queues[priority].size() > stats.maxQueueDepth)
+        stats.maxQueueDepth = queues[priority].size();
+    queueCondVar.notify_one();
+    return task;
 }
 
-DBBNetThread* DBBNetThread::DetachThread()
+void DBBNetThread::WorkerLoop()
 {
-    CleanupThreads();
+    while (true) {
+        std::shared_ptr<DBBNetTask> task;
+        std::vector<std::shared_ptr<DBBNetTask> > dropped;
+        bool exit = false;
+        {
+            std::unique_lock<std::mutex> lock(cs_netThreads);
+            while (!task) {
+                // highest priority lane first, cancelled tasks are dropped
+                for (int lane = 0; lane < DBB_NET_PRIORITY_COUNT && !task; lane++) {
+                    while (!queues[lane].empty() && !task) {
+                        task = queues[lane].front();
+                        queues[lane].pop_front();
+                        if (task->cancelToken.isCancelled()) {
+                            laneStats[lane].cancelled++;
+                            dropped.push_back(task);
+                            task = NULL;
+                        }
+                    }
+                }
+                if (task)
+                    break;
+                if (stopped)
+                    exit = true;
+                // the drop handlers run without the lock (they may submit new tasks)
+                if (exit || !dropped.empty())
+                    break;
+                queueCondVar.wait(lock);
+            }
+            if (task) {
+                runningTasks.insert(task);
+                laneStats[task->priority].totalWaitMillis += millisSince(task->enqueueTime);
+            }
+        }
 
-    DBBNetThread* thread = new DBBNetThread();
-    {
-        std::unique_lock<std::mutex> lock(cs_netThreads);
-        netThreads.push_back(thread);
+        for (const std::shared_ptr<DBBNetTask>& droppedTask : dropped)
+            droppedTask->drop();
+        if (exit)
+            return;
+        if (!task)
+            continue;
+
+        RunTask(task);
     }
-    return thread;
 }
 
-void DBBNetThread::CleanupThreads()
+void DBBNetThread::RunTask(const std::shared_ptr<DBBNetTask>& task)
 {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    currentTask = task.get();
+    task->func(task->cancelToken);
+    currentTask = NULL;
+    // release the captures of the function on the worker
+    task->func = nullptr;
+    task->onDropped = nullptr;
+    task->markFinished();
+
     std::unique_lock<std::mutex> lock(cs_netThreads);
+    DBBNetLaneStats& stats = laneStats[task->priority];
+    stats.completed++;
+    stats.totalRunMillis += millisSince(start);
+    runningTasks.erase(task);
+    idleCondVar.notify_all();
+}
+
+std::shared_ptr<DBBNetTask> DBBNetThread::SubmitDedicated(std::function<void(const DBBNetCancelToken&)> func, const DBBNetCancelToken& token)
+{
+    std::shared_ptr<DBBNetTask> task = std::make_shared<DBBNetTask>(func, DBB_NET_PRIORITY_BACKGROUND, token);
+
+    std::unique_lock<std::mutex> lock(cs_netThreads);
+    if (stopped)
+        return NULL;
+
+    laneStats[task->priority].submitted++;
+    runningTasks.insert(task);
+    dedicatedThreads.push_back(std::thread([task]() { RunTask(task); }));
+    return task;
+}
+
+DBBNetCancelToken DBBNetThread::CurrentCancelToken()
+{
+    if (currentTask)
+        return currentTask->cancelToken;
+    return DBBNetCancelToken();
+}
+
+void DBBNetThread::Shutdown()
+{
+    std::vector<std::thread> stoppingWorkers;
+    std::vector<std::shared_ptr<DBBNetTask> > dropped;
+    bool drained = false;
+    {
+        std::unique_lock<std::mutex> lock(cs_netThreads);
+        if (stopped)
+            return;
+        stopped = true;
 
-    std::vector<DBBNetThread*>::iterator it = netThreads.begin();
-    while (it != netThreads.end()) {
-        DBBNetThread* netThread = (*it);
-        if (netThread->hasCompleted()) {
-            if (netThread->currentThread.joinable())
-                netThread->currentThread.join();
-
-            delete netThread;
-            it = netThreads.erase(it);
-        } else {
-            ++it;
+        // queued tasks won't run, running ones are asked to stop
+        for (int lane = 0; lane < DBB_NET_PRIORITY_COUNT; lane++) {
+            for (std::shared_ptr<DBBNetTask>& task : queues[lane]) {
+                task->cancel();
+                dropped.push_back(task);
+                laneStats[lane].cancelled++;
+            }
+            queues[lane].clear();
         }
+        for (const std::shared_ptr<DBBNetTask>& task : runningTasks)
+            task->cancel();
+        queueCondVar.notify_all();
+    }
+
+    for (const std::shared_ptr<DBBNetTask>& task : dropped)
+        task->drop();
+
+    {
+        std::unique_lock<std::mutex> lock(cs_netThreads);
+        drained = idleCondVar.wait_for(lock, std::chrono::milliseconds(DBBNETTHREAD_DRAIN_TIMEOUT), []() { return runningTasks.empty(); });
+        stoppingWorkers.swap(workers);
+        for (std::thread& thread : dedicatedThreads)
+            stoppingWorkers.push_back(std::move(thread));
+        dedicatedThreads.clear();
+    }
+
+    if (!drained)
+        DBB::LogPrint("Network tasks still running after %d ms, detaching them\n", DBBNETTHREAD_DRAIN_TIMEOUT);
+
+    for (std::thread& worker : stoppingWorkers) {
+        if (drained)
+            worker.join();
+        else
+            worker.detach();
     }
+    LogStats();
 }
 
-DBBNetThread::~DBBNetThread()
+std::vector<DBBNetLaneStats> DBBNetThread::GetStats()
 {
+    std::unique_lock<std::mutex> lock(cs_netThreads);
+    return std::vector<DBBNetLaneStats>(laneStats, laneStats + DBB_NET_PRIORITY_COUNT);
+}
+
+void DBBNetThread::LogStats()
+{
+    std::vector<DBBNetLaneStats> stats = GetStats();
+    for (int lane = 0; lane < DBB_NET_PRIORITY_COUNT; lane++) {
+        if (stats[lane].submitted == 0)
+            continue;
+        DBB::LogPrint("Network tasks (%s): %u submitted, %u completed, %u cancelled, max. queue depth %u, avg. wait %.1f ms, avg. run %.1f ms\n", laneNames[lane], stats[lane].submitted, stats[lane].completed, stats[lane].cancelled, stats[lane].maxQueueDepth, stats[lane].avgWaitMillis(), stats[lane].avgRunMillis());
+    }
 }
@@ -8,8 +8,11 @@
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <functional>
+#include <memory>
 #include <mutex>
+#include <set>
 #include <thread>
 #include <vector>
 
@@ -22,23 +25,112 @@
 
 #include "univalue.h"
 
-class DBBNetThread
+// worker threads for the network tasks (wallet server, comserver long poll)
+#define DBBNETTHREAD_POOL_SIZE 4
+
+// time the running tasks get to finish on shutdown (ms)
+#define DBBNETTHREAD_DRAIN_TIMEOUT 5000
+
+enum DBBNetPriority {
+    DBB_NET_PRIORITY_HIGH = 0,   //!< user initiated actions (send, sign, new address)
+    DBB_NET_PRIORITY_NORMAL,     //!< user visible refreshes
+    DBB_NET_PRIORITY_BACKGROUND, //!< polling
+    DBB_NET_PRIORITY_COUNT
+};
+
+//!cooperative cancellation flag, copies share the same state
+class DBBNetCancelToken
 {
 private:
+    std::shared_ptr<std::atomic<bool> > cancelled;
+
+public:
+    DBBNetCancelToken() : cancelled(std::make_shared<std::atomic<bool> >(false)) {}
+    void cancel() const { *cancelled = true; }
+    bool isCancelled() const { return *cancelled; }
+
+    //!sleeps up to the given time, returns false if cancelled in the meantime
+    bool sleepFor(int millis) const;
+};
+
+class DBBNetTask
+{
+private:
+    std::function<void(const DBBNetCancelToken&)> func;
+    std::function<void()> onDropped; //!< called instead of func if the task gets dropped
+    DBBNetPriority priority;
+    std::chrono::steady_clock::time_point enqueueTime;
     bool finished;
-    std::time_t starttime;
+    std::mutex cs_task;
+    std::condition_variable finishedCondVar;
+
+    void markFinished();
+    void drop();
+    friend class DBBNetThread;
 
 public:
-    DBBNetThread();
-    ~DBBNetThread();
-    void completed();
-    void join();
+    DBBNetTask(std::function<void(const DBBNetCancelToken&)> funcIn, DBBNetPriority priorityIn, const DBBNetCancelToken& tokenIn, std::function<void()> onDroppedIn = nullptr);
+
+    DBBNetCancelToken cancelToken;
+
+    //!requests cancellation, a queued task won't run at all
+    void cancel();
     bool hasCompleted();
-    std::thread currentThread;
 
-    static DBBNetThread* DetachThread();
-    static void CleanupThreads();
-    static std::vector<DBBNetThread*> netThreads;
+    //!waits until the task has run (or has been dropped)
+    void join();
+};
+
+struct DBBNetLaneStats
+{
+    unsigned int submitted;
+    unsigned int completed;
+    unsigned int cancelled;     //!< dropped before they could run
+    unsigned int maxQueueDepth;
+    double totalWaitMillis;     //!< time in the queue
+    double totalRunMillis;
+
+    DBBNetLaneStats() : submitted(0), completed(0), cancelled(0), maxQueueDepth(0), totalWaitMillis(0), totalRunMillis(0) {}
+    double avgWaitMillis() const { return completed ? totalWaitMillis / completed : 0; }
+    double avgRunMillis() const { return completed ? totalRunMillis / completed : 0; }
+};
+
+// fixed size pool for the blocking network tasks
+// - higher priority lanes are always served first
+// - tasks get a cancel token, blocking HTTP requests of a cancelled task are aborted
+// - Shutdown() drops the queued tasks and waits for the running ones
+class DBBNetThread
+{
+private:
+    static std::vector<std::thread> workers;
+    static std::vector<std::thread> dedicatedThreads; //!< threads of the SubmitDedicated() tasks
+    static std::deque<std::shared_ptr<DBBNetTask> > queues[DBB_NET_PRIORITY_COUNT];
+    static DBBNetLaneStats laneStats[DBB_NET_PRIORITY_COUNT];
     static std::mutex cs_netThreads;
+    static std::condition_variable queueCondVar;
+    static std::condition_variable idleCondVar;
+    static std::set<std::shared_ptr<DBBNetTask> > runningTasks;
+    static bool stopped;
+
+    static void WorkerLoop();
+    static void RunTask(const std::shared_ptr<DBBNetTask>& task);
+
+public:
+    //!queues a task, the workers are started on the first call
+    //!returns NULL after Shutdown(), onDropped is called (without the pool lock) if the task is cancelled before it runs
+    static std::shared_ptr<DBBNetTask> Submit(DBBNetPriority priority, std::function<void(const DBBNetCancelToken&)> func, const DBBNetCancelToken& token = DBBNetCancelToken(), std::function<void()> onDropped = nullptr);
+
+    //!runs a long-lived task (e.g. a long poll) on its own thread, it doesn't occupy one of the pool workers
+    //!the task is cancelled and drained on Shutdown() like the pool tasks, returns NULL after Shutdown()
+    static std::shared_ptr<DBBNetTask> SubmitDedicated(std::function<void(const DBBNetCancelToken&)> func, const DBBNetCancelToken& token = DBBNetCancelToken());
+
+    //!cancel token of the task running on the current thread (a fresh one if called outside the pool)
+    static DBBNetCancelToken CurrentCancelToken();
+
+    //!cancels all tasks, waits up to DBBNETTHREAD_DRAIN_TIMEOUT for the running ones and stops the workers
+    static void Shutdown();
+
+    static std::vector<DBBNetLaneStats> GetStats();
+    static void LogStats();
 };
 #endif
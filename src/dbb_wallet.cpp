@@ -94,3 +94,38 @@ void DBBWallet::setSocks5ProxyURL(const std::string& proxyURL)
 {
     client.setSocks5ProxyURL(proxyURL);
 }
+
+bool DBBWallet::requestRefresh(const DBBWalletRefreshCallback& callback)
+{
+    std::unique_lock<std::mutex> lock(cs_refresh);
+    pendingRefreshes.push_back(callback);
+    if (refreshRunning)
+        return false;
+
+    refreshRunning = true;
+    return true;
+}
+
+std::vector<DBBWalletRefreshCallback> DBBWallet::takeRefreshRequests()
+{
+    std::unique_lock<std::mutex> lock(cs_refresh);
+    std::vector<DBBWalletRefreshCallback> requests;
+    requests.swap(pendingRefreshes);
+    if (requests.empty())
+        refreshRunning = false;
+    return requests;
+}
+
+void DBBWallet::abortRefresh()
+{
+    std::vector<DBBWalletRefreshCallback> requests;
+    {
+        std::unique_lock<std::mutex> lock(cs_refresh);
+        requests.swap(pendingRefreshes);
+        refreshRunning = false;
+    }
+
+    std::string walletsResponse;
+    for (const DBBWalletRefreshCallback& request : requests)
+        request(false, walletsResponse);
+}
@@ -9,8 +9,10 @@
 #include "bitpaywalletclient/bpwalletclient.h"
 
 #include <atomic>
+#include <functional>
 #include <mutex>
 #include <map>
+#include <vector>
 #ifdef WIN32
 #include <windows.h>
 #include "mingw/mingw.mutex.h"
@@ -18,12 +20,19 @@
 #include "mingw/mingw.thread.h"
 #endif
 
+//!called with the getwallets result of a refresh
+typedef std::function<void(bool walletsAvailable, std::string& walletsResponse)> DBBWalletRefreshCallback;
+
 class DBBWallet
 {
 private:
     std::recursive_mutex cs_wallet;
     std::string _baseKeypath;
 
+    std::mutex cs_refresh;
+    bool refreshRunning;
+    std::vector<DBBWalletRefreshCallback> pendingRefreshes; //!< requests the next refresh round serves
+
 public:
     std::map<std::string, std::pair<int, std::string> > mapHashSig;
 
@@ -33,15 +42,23 @@ public:
     UniValue currentPaymentProposals;
     int64_t totalBalance;
     int64_t availableBalance;
-    std::atomic<bool> updatingWallet;
-    std::atomic<bool> shouldUpdateWalletAgain;
     DBBWallet(const std::string& dataDirIn, bool testnetIn) : client(dataDirIn, testnetIn)
     {
         _baseKeypath = "m/131'/45'";
         participationName = "digitalbitbox";
-        updatingWallet = false;
+        refreshRunning = false;
     }
 
+    /* registers a refresh request, returns true if the caller has to start the refresh
+       requests arriving during a running refresh are served by one more round */
+    bool requestRefresh(const DBBWalletRefreshCallback& callback);
+
+    /* takes the requests for the next refresh round, the refresh ends if none are pending */
+    std::vector<DBBWalletRefreshCallback> takeRefreshRequests();
+
+    /* ends the refresh without a response (cancelled or not started), the pending requests fail */
+    void abortRefresh();
+
     /* update wallet data from a getwallet json response */
     void updateData(const UniValue& walletResponse);
 
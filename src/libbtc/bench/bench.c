@@ -0,0 +1,58 @@
+/**********************************************************************
+ * Copyright (c) 2015 Jonas Schnelli                                  *
+ * Distributed under the MIT software license, see the accompanying   *
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.*
+ **********************************************************************/
+
+#if defined HAVE_CONFIG_H
+#include "libbtc-config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "bench.h"
+
+extern void bench_aes();
+extern void bench_sha256();
+extern void bench_pbkdf2();
+extern void bench_hash160();
+extern void bench_ecc();
+
+uint64_t bench_time_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void bench_report_mbps(const char* name, const char* backend, uint64_t bytes, uint64_t elapsed_us)
+{
+    double mbps = elapsed_us ? ((double)bytes / (1024.0 * 1024.0)) / (elapsed_us / 1000000.0) : 0;
+    printf("%-28s %-10s %10.1f MB/s\n", name, backend, mbps);
+}
+
+void bench_report_ops(const char* name, const char* backend, uint64_t ops, uint64_t elapsed_us, const char* unit)
+{
+    double rate = elapsed_us ? (double)ops / (elapsed_us / 1000000.0) : 0;
+    printf("%-28s %-10s %10.1f %s\n", name, backend, rate, unit);
+}
+
+int main(int argc, char** argv)
+{
+    /* optional filter: run only the benchmarks with a matching name */
+    const char* filter = (argc > 1) ? argv[1] : NULL;
+
+    if (!filter || strcmp(filter, "aes") == 0)
+        bench_aes();
+    if (!filter || strcmp(filter, "sha256") == 0)
+        bench_sha256();
+    if (!filter || strcmp(filter, "pbkdf2") == 0)
+        bench_pbkdf2();
+    if (!filter || strcmp(filter, "hash160") == 0)
+        bench_hash160();
+    if (!filter || strcmp(filter, "ecc") == 0)
+        bench_ecc();
+    return 0;
+}
@@ -0,0 +1,22 @@
+/**********************************************************************
+ * Copyright (c) 2015 Jonas Schnelli                                  *
+ * Distributed under the MIT software license, see the accompanying   *
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.*
+ **********************************************************************/
+
+#ifndef __LIBBTC_BENCH_H__
+#define __LIBBTC_BENCH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* monotonic time in microseconds */
+uint64_t bench_time_us(void);
+
+/* print one result line with the throughput in MB/s */
+void bench_report_mbps(const char* name, const char* backend, uint64_t bytes, uint64_t elapsed_us);
+
+/* print one result line with operations per second (unit e.g. "keys/s") */
+void bench_report_ops(const char* name, const char* backend, uint64_t ops, uint64_t elapsed_us, const char* unit);
+
+#endif //__LIBBTC_BENCH_H__
@@ -0,0 +1,61 @@
+/**********************************************************************
+ * Copyright (c) 2015 Jonas Schnelli                                  *
+ * Distributed under the MIT software license, see the accompanying   *
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.*
+ **********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <btc/aes.h>
+
+#include "bench.h"
+
+#define BENCH_AES_TOTAL (64 * 1024 * 1024)
+
+/* mode 0: CBC encryption, 1: CBC decryption, 2: CTR */
+static void bench_aes_size(const char* name, aes_context* ctx, unsigned char* buf, size_t len, int mode)
+{
+    unsigned char iv[N_BLOCK];
+    uint64_t start, done = 0;
+
+    memset(iv, 0, sizeof(iv));
+    start = bench_time_us();
+    while (done < BENCH_AES_TOTAL) {
+        if (mode == 2)
+            aes_ctr_crypt(buf, buf, len, iv, ctx);
+        else if (mode == 1)
+            aes_cbc_decrypt(buf, buf, len / N_BLOCK, iv, ctx);
+        else
+            aes_cbc_encrypt(buf, buf, len / N_BLOCK, iv, ctx);
+        done += len;
+    }
+    bench_report_mbps(name, aes_backend_name(aes_get_backend()), done, bench_time_us() - start);
+}
+
+void bench_aes()
+{
+    static const aes_backend backends[] = {AES_BACKEND_BYTE, AES_BACKEND_TTABLE, AES_BACKEND_AESNI};
+    static unsigned char buf[64 * 1024];
+    unsigned char key[32];
+    aes_context ctx[1];
+    unsigned int i;
+
+    memset(key, 0x42, sizeof(key));
+    memset(buf, 0x17, sizeof(buf));
+    aes_set_key(key, sizeof(key), ctx);
+
+    for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (!aes_set_backend(backends[i])) {
+            printf("%-28s %-10s not available\n", "aes256_cbc", aes_backend_name(backends[i]));
+            continue;
+        }
+        /* 256 bytes is the size of a typical device command */
+        bench_aes_size("aes256_cbc_encrypt_256b", ctx, buf, 256, 0);
+        bench_aes_size("aes256_cbc_decrypt_256b", ctx, buf, 256, 1);
+        bench_aes_size("aes256_cbc_encrypt_64k", ctx, buf, sizeof(buf), 0);
+        bench_aes_size("aes256_cbc_decrypt_64k", ctx, buf, sizeof(buf), 1);
+        bench_aes_size("aes256_ctr_64k", ctx, buf, sizeof(buf), 2);
+    }
+    aes_set_backend(AES_BACKEND_AUTO);
+}
@@ -0,0 +1,107 @@
+/**********************************************************************
+ * Copyright (c) 2015 Jonas Schnelli                                  *
+ * Distributed under the MIT software license, see the accompanying   *
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.*
+ **********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <btc/ecc.h>
+#include <btc/ecc_key.h>
+#include <btc/hash.h>
+
+#include "bench.h"
+
+#define BENCH_ECC_REQUESTS 2000
+
+/* a wallet server request: hash the message, sign it and verify the signature */
+static void bench_ecc_requests(const char* name, btc_key* key, const btc_pubkey* cached_pubkey, btc_ecc_context* ctx)
+{
+    const char* message = "get|/v1/wallets/?r=123456|{}";
+    unsigned char sig[74];
+    uint8_t hash[32];
+    uint64_t start;
+    unsigned int i;
+
+    start = bench_time_us();
+    for (i = 0; i < BENCH_ECC_REQUESTS; i++) {
+        size_t outlen = sizeof(sig);
+        btc_hash((const unsigned char*)message, strlen(message), hash);
+        hash[0] ^= (uint8_t)i;
+        if (cached_pubkey) {
+            btc_ecc_sign_ctx(ctx, key->privkey, hash, sig, &outlen);
+            btc_ecc_verify_sig_ctx(ctx, cached_pubkey->pubkey, true, hash, sig, outlen);
+        } else {
+            /* pubkey derived per request */
+            btc_pubkey pubkey;
+            btc_pubkey_init(&pubkey);
+            btc_key_sign_hash(key, hash, sig, &outlen);
+            btc_pubkey_from_key(key, &pubkey);
+            btc_pubkey_verify_sig(&pubkey, hash, sig, outlen);
+        }
+    }
+    bench_report_ops(name, "secp256k1", BENCH_ECC_REQUESTS, bench_time_us() - start, "req/s");
+}
+
+#define BENCH_ECC_INPUTS 200
+
+/* check the signatures of a proposal with many inputs, one by one and as batch */
+static void bench_ecc_verify_inputs(btc_key* key, const btc_pubkey* pubkey)
+{
+    static uint8_t hashes[BENCH_ECC_INPUTS][32];
+    static unsigned char sigs[BENCH_ECC_INPUTS][64];
+    const uint8_t* batch_pubkeys[BENCH_ECC_INPUTS];
+    const uint8_t* batch_hashes[BENCH_ECC_INPUTS];
+    const unsigned char* batch_sigs[BENCH_ECC_INPUTS];
+    uint64_t start;
+    unsigned int i;
+
+    for (i = 0; i < BENCH_ECC_INPUTS; i++) {
+        size_t outlen = 64;
+        memset(hashes[i], 0, 32);
+        hashes[i][0] = (uint8_t)i;
+        hashes[i][1] = (uint8_t)(i >> 8);
+        btc_key_sign_hash_compact(key, hashes[i], sigs[i], &outlen);
+        batch_pubkeys[i] = pubkey->pubkey;
+        batch_hashes[i] = hashes[i];
+        batch_sigs[i] = sigs[i];
+    }
+
+    start = bench_time_us();
+    for (i = 0; i < BENCH_ECC_INPUTS; i++) {
+        unsigned char sigder[74];
+        size_t sigderlen = sizeof(sigder);
+        btc_ecc_compact_to_der_normalized(sigs[i], sigder, &sigderlen);
+        btc_ecc_verify_sig(pubkey->pubkey, true, hashes[i], sigder, sigderlen);
+    }
+    bench_report_ops("ecc_verify_inputs", "single", BENCH_ECC_INPUTS, bench_time_us() - start, "sig/s");
+
+    start = bench_time_us();
+    btc_ecc_verify_batch(batch_pubkeys, true, batch_hashes, batch_sigs, BENCH_ECC_INPUTS, NULL);
+    bench_report_ops("ecc_verify_inputs", "batch", BENCH_ECC_INPUTS, bench_time_us() - start, "sig/s");
+}
+
+void bench_ecc()
+{
+    btc_key key;
+    btc_pubkey pubkey;
+    btc_ecc_context* ctx;
+
+    btc_ecc_start();
+    btc_privkey_init(&key);
+    btc_privkey_gen(&key);
+    btc_pubkey_init(&pubkey);
+    btc_pubkey_from_key(&key, &pubkey);
+
+    bench_ecc_requests("ecc_sign_request", &key, NULL, NULL);
+
+    ctx = btc_ecc_context_acquire();
+    bench_ecc_requests("ecc_sign_request_cached", &key, &pubkey, ctx);
+    btc_ecc_context_release(ctx);
+
+    bench_ecc_verify_inputs(&key, &pubkey);
+
+    btc_privkey_cleanse(&key);
+    btc_ecc_stop();
+}
@@ -0,0 +1,141 @@
+/**********************************************************************
+ * Copyright (c) 2015 Jonas Schnelli                                  *
+ * Distributed under the MIT software license, see the accompanying   *
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.*
+ **********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <btc/hash.h>
+
+#include "sha2.h"
+
+#include "bench.h"
+
+#define BENCH_SHA256_TOTAL (64 * 1024 * 1024)
+#define BENCH_SHA256_BATCH 256
+#define BENCH_PBKDF2_ROUNDS 20480
+#define BENCH_PBKDF2_BATCH 8
+#define BENCH_HASH160_KEYS 4096
+#define BENCH_HASH160_ROUNDS 64
+
+static void bench_sha256_many(const char* name, size_t msglen)
+{
+    static uint8_t buf[BENCH_SHA256_BATCH * 128];
+    static uint8_t digests[BENCH_SHA256_BATCH][SHA256_DIGEST_LENGTH];
+    const uint8_t* data[BENCH_SHA256_BATCH];
+    size_t lens[BENCH_SHA256_BATCH];
+    uint64_t start, done = 0;
+    unsigned int i;
+
+    for (i = 0; i < BENCH_SHA256_BATCH; i++) {
+        data[i] = buf + i * msglen;
+        lens[i] = msglen;
+    }
+    start = bench_time_us();
+    while (done < BENCH_SHA256_TOTAL / 4) {
+        sha256_many(data, lens, BENCH_SHA256_BATCH, digests);
+        done += BENCH_SHA256_BATCH * msglen;
+    }
+    bench_report_mbps(name, sha256_backend_name(sha256_get_backend()), done, bench_time_us() - start);
+}
+
+void bench_sha256()
+{
+    static const sha256_backend backends[] = {SHA256_BACKEND_SCALAR, SHA256_BACKEND_SHANI, SHA256_BACKEND_AVX2};
+    static uint8_t buf[64 * 1024];
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    uint64_t start, done;
+    unsigned int i;
+
+    memset(buf, 0x17, sizeof(buf));
+    for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (!sha256_set_backend(backends[i])) {
+            printf("%-28s %-10s not available\n", "sha256", sha256_backend_name(backends[i]));
+            continue;
+        }
+
+        start = bench_time_us();
+        for (done = 0; done < BENCH_SHA256_TOTAL; done += sizeof(buf))
+            sha256_Raw(buf, sizeof(buf), digest);
+        bench_report_mbps("sha256_64k", sha256_backend_name(backends[i]), done, bench_time_us() - start);
+
+        /* hash160/double hash inputs and sighash sized messages */
+        bench_sha256_many("sha256_many_32b", 32);
+        bench_sha256_many("sha256_many_128b", 128);
+    }
+    sha256_set_backend(SHA256_BACKEND_AUTO);
+}
+
+void bench_pbkdf2()
+{
+    static const sha256_backend backends[] = {SHA256_BACKEND_SCALAR, SHA256_BACKEND_AVX2};
+    const uint8_t* pass[BENCH_PBKDF2_BATCH];
+    size_t passlen[BENCH_PBKDF2_BATCH];
+    uint8_t keys[BENCH_PBKDF2_BATCH][64];
+    uint8_t* keyptrs[BENCH_PBKDF2_BATCH];
+    uint64_t start, elapsed;
+    unsigned int i, j;
+
+    for (j = 0; j < BENCH_PBKDF2_BATCH; j++) {
+        pass[j] = (const uint8_t*)"correct horse battery staple";
+        passlen[j] = strlen((const char*)pass[j]);
+        keyptrs[j] = keys[j];
+    }
+    for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (!sha256_set_backend(backends[i])) {
+            printf("%-28s %-10s not available\n", "pbkdf2_sha512", sha256_backend_name(backends[i]));
+            continue;
+        }
+
+        /* the backup key stretching of the app (20480 rounds) */
+        start = bench_time_us();
+        for (j = 0; j < BENCH_PBKDF2_BATCH; j++)
+            btc_pbkdf2_hmac_sha512(pass[j], passlen[j], (const uint8_t*)"Digital Bitbox", 14, BENCH_PBKDF2_ROUNDS, keys[j], 64);
+        elapsed = bench_time_us() - start;
+        bench_report_ops("pbkdf2_sha512", sha256_backend_name(backends[i]), BENCH_PBKDF2_BATCH, elapsed, "keys/s");
+
+        start = bench_time_us();
+        btc_pbkdf2_hmac_sha512_many(pass, passlen, BENCH_PBKDF2_BATCH, (const uint8_t*)"Digital Bitbox", 14, BENCH_PBKDF2_ROUNDS, keyptrs, 64);
+        elapsed = bench_time_us() - start;
+        bench_report_ops("pbkdf2_sha512_many", sha256_backend_name(backends[i]), BENCH_PBKDF2_BATCH, elapsed, "keys/s");
+    }
+    sha256_set_backend(SHA256_BACKEND_AUTO);
+}
+
+void bench_hash160()
+{
+    static const sha256_backend backends[] = {SHA256_BACKEND_SCALAR, SHA256_BACKEND_SHANI, SHA256_BACKEND_AVX2};
+    static uint8_t pubkeys[BENCH_HASH160_KEYS][33];
+    static uint160 hashes[BENCH_HASH160_KEYS];
+    const unsigned char* data[BENCH_HASH160_KEYS];
+    size_t lens[BENCH_HASH160_KEYS];
+    uint64_t start;
+    unsigned int i, j;
+
+    /* compressed pubkeys of an address range */
+    for (j = 0; j < BENCH_HASH160_KEYS; j++) {
+        memset(pubkeys[j], (int)j, 33);
+        pubkeys[j][0] = 0x02;
+        data[j] = pubkeys[j];
+        lens[j] = 33;
+    }
+    for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (!sha256_set_backend(backends[i])) {
+            printf("%-28s %-10s not available\n", "hash160", sha256_backend_name(backends[i]));
+            continue;
+        }
+
+        start = bench_time_us();
+        for (j = 0; j < BENCH_HASH160_KEYS * BENCH_HASH160_ROUNDS; j++)
+            btc_hash160(pubkeys[j % BENCH_HASH160_KEYS], 33, hashes[j % BENCH_HASH160_KEYS]);
+        bench_report_ops("hash160_pubkey", sha256_backend_name(backends[i]), BENCH_HASH160_KEYS * BENCH_HASH160_ROUNDS, bench_time_us() - start, "keys/s");
+
+        start = bench_time_us();
+        for (j = 0; j < BENCH_HASH160_ROUNDS; j++)
+            btc_hash160_many(data, lens, BENCH_HASH160_KEYS, hashes);
+        bench_report_ops("hash160_pubkey_many", sha256_backend_name(backends[i]), BENCH_HASH160_KEYS * BENCH_HASH160_ROUNDS, bench_time_us() - start, "keys/s");
+    }
+    sha256_set_backend(SHA256_BACKEND_AUTO);
+}
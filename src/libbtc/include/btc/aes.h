@@ -109,6 +109,18 @@ LIBBTC_API return_type aes_cbc_encrypt(const unsigned char* in,
                             int n_block,
                             unsigned char iv[N_BLOCK],
                             const aes_context ctx[1]);
+
+/*  CTR mode (encryption and decryption are the same operation)
+
+    ctr is a big endian 128-bit counter block, it is incremented per
+    block and returns the next unused counter. len doesn't need to be a
+    multiple of N_BLOCK, in and out may be the same buffer.
+*/
+LIBBTC_API return_type aes_ctr_crypt(const unsigned char* in,
+                          unsigned char* out,
+                          size_t len,
+                          unsigned char ctr[N_BLOCK],
+                          const aes_context ctx[1]);
 #endif
 
 #if defined(AES_DEC_PREKEYED)
@@ -124,6 +136,32 @@ LIBBTC_API return_type aes_cbc_decrypt(const unsigned char* in,
                             const aes_context ctx[1]);
 #endif
 
+/*  Backends for the pre-keyed block and CBC functions
+
+    All backends use the aes_context key schedule from aes_set_key and
+    produce identical output. By default the fastest backend available
+    on the running CPU is used (AES-NI on x86-64, 32-bit T-tables
+    otherwise). The byte oriented implementation is kept as reference.
+*/
+
+typedef enum {
+    AES_BACKEND_AUTO = 0,
+    AES_BACKEND_BYTE,   /* 8-bit byte operations (reference) */
+    AES_BACKEND_TTABLE, /* 32-bit T-table lookups */
+    AES_BACKEND_AESNI   /* x86-64 AES-NI instructions */
+} aes_backend;
+
+/* returns true if the backend can be used on this build/CPU */
+LIBBTC_API btc_bool aes_backend_available(aes_backend backend);
+
+/* selects the backend (AES_BACKEND_AUTO for the fastest), returns false if not available */
+LIBBTC_API btc_bool aes_set_backend(aes_backend backend);
+
+/* returns the backend currently used */
+LIBBTC_API aes_backend aes_get_backend(void);
+
+LIBBTC_API const char* aes_backend_name(aes_backend backend);
+
 /*  The following calls are for 'on the fly' keying.  In this case the
     encryption and decryption keys are different.
 
@@ -71,6 +71,39 @@ LIBBTC_API btc_bool btc_ecc_der_to_compact(unsigned char* sigder_in, size_t sigd
 //!verify DER signature with public key
 LIBBTC_API btc_bool btc_ecc_verify_sig(const uint8_t* public_key, btc_bool compressed, const uint8_t* hash, unsigned char* sigder, size_t siglen);
 
+/*  Pooled contexts
+
+    btc_ecc_context_acquire returns a context that no other thread uses
+    until it gets released. The contexts are cloned from the static one
+    (no table recomputation) and get their own blinding on first use.
+    If all BTC_ECC_CONTEXT_POOL_SIZE contexts are in use, the shared
+    static context is returned (signing and verification don't modify it).
+    Needs btc_ecc_start, btc_ecc_stop frees the pool.
+*/
+#define BTC_ECC_CONTEXT_POOL_SIZE 8
+
+typedef struct btc_ecc_context_ btc_ecc_context;
+
+LIBBTC_API btc_ecc_context* btc_ecc_context_acquire(void);
+LIBBTC_API void btc_ecc_context_release(btc_ecc_context* ctx);
+
+//!same as the functions above on a given context
+LIBBTC_API void btc_ecc_get_pubkey_ctx(const btc_ecc_context* ctx, const uint8_t* private_key, uint8_t* public_key, size_t* public_key_len, btc_bool compressed);
+LIBBTC_API btc_bool btc_ecc_sign_ctx(const btc_ecc_context* ctx, const uint8_t* private_key, const uint8_t* hash, unsigned char* sigder, size_t* outlen);
+LIBBTC_API btc_bool btc_ecc_verify_sig_ctx(const btc_ecc_context* ctx, const uint8_t* public_key, btc_bool compressed, const uint8_t* hash, unsigned char* sigder, size_t siglen);
+
+/*  Batch verification
+
+    Verifies count compact (64 bytes) signatures against their hashes and
+    public keys in one pass on a pooled context. Signatures are checked in
+    their normalized (low S) form, the form btc_ecc_compact_to_der_normalized
+    produces. Consecutive entries with the same public key parse it only once.
+    ECDSA has no batch equation, each signature is still verified on its own.
+    results (optional, count entries) gets the result of every signature.
+    Returns true if all signatures are valid.
+*/
+LIBBTC_API btc_bool btc_ecc_verify_batch(const uint8_t* const public_keys[], btc_bool compressed, const uint8_t* const hashes[], const unsigned char* const sigs_compact[], size_t count, btc_bool* results);
+
 #ifdef __cplusplus
 }
 #endif
@@ -42,6 +42,7 @@ extern "C" {
 #include "vector.h"
 
 typedef uint8_t uint256[32];
+typedef uint8_t uint160[20];
 
 //bitcoin double sha256 hash
 LIBBTC_API void btc_hash(const unsigned char* datain, size_t length, uint256 hashout);
@@ -49,6 +50,22 @@ LIBBTC_API void btc_hash(const unsigned char* datain, size_t length, uint256 has
 //single sha256 hash
 LIBBTC_API void btc_hash_sngl_sha256(const unsigned char* datain, size_t length, uint256 hashout);
 
+//bitcoin double sha256 hash of count independent messages (uses the multi-buffer sha256 backend if available)
+LIBBTC_API void btc_hash_many(const unsigned char* const datain[], const size_t lengths[], size_t count, uint256 hashout[]);
+
+//bitcoin hash160, ripemd160(sha256(data))
+LIBBTC_API void btc_hash160(const unsigned char* datain, size_t length, uint160 hashout);
+
+//hash160 of count independent messages (uses the multi-buffer sha256/ripemd160 backends if available)
+LIBBTC_API void btc_hash160_many(const unsigned char* const datain[], const size_t lengths[], size_t count, uint160 hashout[]);
+
+//PBKDF2-HMAC-SHA512, the HMAC key states are computed once per passphrase
+//returns 0 if the key states could not be allocated (the key is left untouched)
+LIBBTC_API int btc_pbkdf2_hmac_sha512(const uint8_t* pass, size_t passlen, const uint8_t* salt, size_t saltlen, uint32_t iterations, uint8_t* key, size_t keylen);
+
+//PBKDF2-HMAC-SHA512 for count passphrases with the same salt, up to four run in parallel (AVX2)
+LIBBTC_API int btc_pbkdf2_hmac_sha512_many(const uint8_t* const pass[], const size_t passlen[], size_t count, const uint8_t* salt, size_t saltlen, uint32_t iterations, uint8_t* const keys[], size_t keylen);
+
 #ifdef __cplusplus
 }
 #endif
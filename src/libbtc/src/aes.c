@@ -501,11 +501,506 @@ return_type aes_set_key(const unsigned char key[], length_type keylen, aes_conte
 
 #endif
 
+/*  Backend selection
+
+    aes_cbc_encrypt/aes_cbc_decrypt (and the single block functions)
+    dispatch to one of the backends below. The selection is resolved once
+    (on the first call or through aes_set_backend) and is process wide.
+*/
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_AESNI
+#include <cpuid.h>
+#include <wmmintrin.h>
+#define AESNI_TARGET __attribute__((target("aes,sse2")))
+#endif
+
+#if defined(USE_TABLES) && defined(HAVE_UINT_32T)
+#define HAVE_TTABLE
+#endif
+
+/* read and written by several threads, only through the __atomic builtins */
+static aes_backend aes_active_backend = AES_BACKEND_AUTO;
+
+/* wipe round keys copied to the stack (not optimized away) */
+static void aes_wipe(void* p, size_t len)
+{
+    volatile uint_8t* v = (volatile uint_8t*)p;
+    while (len--)
+        *v++ = 0;
+}
+
+/* increment a big endian 128-bit counter block */
+static void ctr_increment(uint_8t ctr[N_BLOCK])
+{
+    int i = N_BLOCK;
+    while (i-- > 0 && ++ctr[i] == 0)
+        ;
+}
+
+/* xor a key stream block into the output, the last block may be partial */
+static void ctr_xor(unsigned char* out, const unsigned char* in, const uint_8t ks[N_BLOCK], size_t len)
+{
+    size_t i;
+    for (i = 0; i < len; i++)
+        out[i] = in[i] ^ ks[i];
+}
+
+#if defined(HAVE_AESNI)
+static int aesni_supported(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return (ecx & bit_AES) != 0;
+}
+#endif
+
+btc_bool aes_backend_available(aes_backend backend)
+{
+    switch (backend) {
+    case AES_BACKEND_AUTO:
+    case AES_BACKEND_BYTE:
+        return true;
+    case AES_BACKEND_TTABLE:
+#if defined(HAVE_TTABLE)
+        return true;
+#else
+        return false;
+#endif
+    case AES_BACKEND_AESNI:
+#if defined(HAVE_AESNI)
+        return aesni_supported() ? true : false;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+static aes_backend aes_best_backend(void)
+{
+    if (aes_backend_available(AES_BACKEND_AESNI))
+        return AES_BACKEND_AESNI;
+    if (aes_backend_available(AES_BACKEND_TTABLE))
+        return AES_BACKEND_TTABLE;
+    return AES_BACKEND_BYTE;
+}
+
+btc_bool aes_set_backend(aes_backend backend)
+{
+    if (!aes_backend_available(backend))
+        return false;
+    __atomic_store_n(&aes_active_backend, (backend == AES_BACKEND_AUTO) ? aes_best_backend() : backend, __ATOMIC_RELEASE);
+    return true;
+}
+
+aes_backend aes_get_backend(void)
+{
+    aes_backend backend = __atomic_load_n(&aes_active_backend, __ATOMIC_ACQUIRE);
+    if (backend == AES_BACKEND_AUTO) {
+        /* the first caller selects the backend, a concurrent aes_set_backend() wins */
+        aes_backend expected = AES_BACKEND_AUTO;
+        backend = aes_best_backend();
+        if (!__atomic_compare_exchange_n(&aes_active_backend, &expected, backend, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            backend = expected;
+    }
+    return backend;
+}
+
+const char* aes_backend_name(aes_backend backend)
+{
+    switch (backend) {
+    case AES_BACKEND_AUTO:
+        return "auto";
+    case AES_BACKEND_BYTE:
+        return "byte";
+    case AES_BACKEND_TTABLE:
+        return "t-table";
+    case AES_BACKEND_AESNI:
+        return "aes-ni";
+    }
+    return "unknown";
+}
+
+#if defined(HAVE_TTABLE)
+
+/*  32-bit T-tables, the state columns are big endian words
+
+    te0[x] = (2.s, s, s, 3.s) with s = sbox[x]
+    td0[x] = (e.i, 9.i, d.i, b.i) with i = isbox[x]
+    te1..3/td1..3 are te0/td0 rotated right by 8, 16 and 24 bits
+*/
+
+#define gf8(x) ((uint_32t)((x) & 0xff))
+#define te0_w(x) ((gf8(f2(x)) << 24) | (gf8(x) << 16) | (gf8(x) << 8) | gf8(f3(x)))
+#define te1_w(x) ((gf8(f3(x)) << 24) | (gf8(f2(x)) << 16) | (gf8(x) << 8) | gf8(x))
+#define te2_w(x) ((gf8(x) << 24) | (gf8(f3(x)) << 16) | (gf8(f2(x)) << 8) | gf8(x))
+#define te3_w(x) ((gf8(x) << 24) | (gf8(x) << 16) | (gf8(f3(x)) << 8) | gf8(f2(x)))
+#define td0_w(x) ((gf8(fe(x)) << 24) | (gf8(f9(x)) << 16) | (gf8(fd(x)) << 8) | gf8(fb(x)))
+#define td1_w(x) ((gf8(fb(x)) << 24) | (gf8(fe(x)) << 16) | (gf8(f9(x)) << 8) | gf8(fd(x)))
+#define td2_w(x) ((gf8(fd(x)) << 24) | (gf8(fb(x)) << 16) | (gf8(fe(x)) << 8) | gf8(f9(x)))
+#define td3_w(x) ((gf8(f9(x)) << 24) | (gf8(fd(x)) << 16) | (gf8(fb(x)) << 8) | gf8(fe(x)))
+
+static const uint_32t te0[256] = sb_data(te0_w);
+static const uint_32t te1[256] = sb_data(te1_w);
+static const uint_32t te2[256] = sb_data(te2_w);
+static const uint_32t te3[256] = sb_data(te3_w);
+static const uint_32t td0[256] = isb_data(td0_w);
+static const uint_32t td1[256] = isb_data(td1_w);
+static const uint_32t td2[256] = isb_data(td2_w);
+static const uint_32t td3[256] = isb_data(td3_w);
+
+#define load_be32(p) (((uint_32t)(p)[0] << 24) | ((uint_32t)(p)[1] << 16) | ((uint_32t)(p)[2] << 8) | (uint_32t)(p)[3])
+#define store_be32(p, v)              \
+    do {                              \
+        (p)[0] = (uint_8t)((v) >> 24); \
+        (p)[1] = (uint_8t)((v) >> 16); \
+        (p)[2] = (uint_8t)((v) >> 8);  \
+        (p)[3] = (uint_8t)(v);         \
+    } while (0)
+
+#define b0(x) ((x) >> 24)
+#define b1(x) (((x) >> 16) & 0xff)
+#define b2(x) (((x) >> 8) & 0xff)
+#define b3(x) ((x)&0xff)
+
+/* round key words of the encryption schedule */
+static void ttable_enc_key(uint_32t rk[4 * (N_MAX_ROUNDS + 1)], const aes_context* ctx)
+{
+    int i;
+    for (i = 0; i < 4 * (ctx->rnd + 1); i++)
+        rk[i] = load_be32(ctx->ksch + 4 * i);
+}
+
+/* round keys for the equivalent inverse cipher (reversed, inverse mix columns applied) */
+static void ttable_dec_key(uint_32t dk[4 * (N_MAX_ROUNDS + 1)], const aes_context* ctx)
+{
+    int r, c;
+    uint_32t rk[4 * (N_MAX_ROUNDS + 1)];
+    ttable_enc_key(rk, ctx);
+    for (r = 0; r <= ctx->rnd; r++) {
+        for (c = 0; c < 4; c++) {
+            uint_32t w = rk[4 * (ctx->rnd - r) + c];
+            if (r > 0 && r < ctx->rnd)
+                w = td0[s_box(b0(w))] ^ td1[s_box(b1(w))] ^ td2[s_box(b2(w))] ^ td3[s_box(b3(w))];
+            dk[4 * r + c] = w;
+        }
+    }
+    aes_wipe(rk, sizeof(rk));
+}
+
+static void ttable_encrypt_block(uint_32t s[4], const uint_32t* rk, int rnd)
+{
+    uint_32t t0, t1, t2, t3;
+    int r;
+
+    s[0] ^= rk[0];
+    s[1] ^= rk[1];
+    s[2] ^= rk[2];
+    s[3] ^= rk[3];
+    for (r = 1; r < rnd; r++) {
+        rk += 4;
+        t0 = te0[b0(s[0])] ^ te1[b1(s[1])] ^ te2[b2(s[2])] ^ te3[b3(s[3])] ^ rk[0];
+        t1 = te0[b0(s[1])] ^ te1[b1(s[2])] ^ te2[b2(s[3])] ^ te3[b3(s[0])] ^ rk[1];
+        t2 = te0[b0(s[2])] ^ te1[b1(s[3])] ^ te2[b2(s[0])] ^ te3[b3(s[1])] ^ rk[2];
+        t3 = te0[b0(s[3])] ^ te1[b1(s[0])] ^ te2[b2(s[1])] ^ te3[b3(s[2])] ^ rk[3];
+        s[0] = t0;
+        s[1] = t1;
+        s[2] = t2;
+        s[3] = t3;
+    }
+    rk += 4;
+    t0 = ((uint_32t)s_box(b0(s[0])) << 24 | (uint_32t)s_box(b1(s[1])) << 16 | (uint_32t)s_box(b2(s[2])) << 8 | s_box(b3(s[3]))) ^ rk[0];
+    t1 = ((uint_32t)s_box(b0(s[1])) << 24 | (uint_32t)s_box(b1(s[2])) << 16 | (uint_32t)s_box(b2(s[3])) << 8 | s_box(b3(s[0]))) ^ rk[1];
+    t2 = ((uint_32t)s_box(b0(s[2])) << 24 | (uint_32t)s_box(b1(s[3])) << 16 | (uint_32t)s_box(b2(s[0])) << 8 | s_box(b3(s[1]))) ^ rk[2];
+    t3 = ((uint_32t)s_box(b0(s[3])) << 24 | (uint_32t)s_box(b1(s[0])) << 16 | (uint_32t)s_box(b2(s[1])) << 8 | s_box(b3(s[2]))) ^ rk[3];
+    s[0] = t0;
+    s[1] = t1;
+    s[2] = t2;
+    s[3] = t3;
+}
+
+static void ttable_decrypt_block(uint_32t s[4], const uint_32t* dk, int rnd)
+{
+    uint_32t t0, t1, t2, t3;
+    int r;
+
+    s[0] ^= dk[0];
+    s[1] ^= dk[1];
+    s[2] ^= dk[2];
+    s[3] ^= dk[3];
+    for (r = 1; r < rnd; r++) {
+        dk += 4;
+        t0 = td0[b0(s[0])] ^ td1[b1(s[3])] ^ td2[b2(s[2])] ^ td3[b3(s[1])] ^ dk[0];
+        t1 = td0[b0(s[1])] ^ td1[b1(s[0])] ^ td2[b2(s[3])] ^ td3[b3(s[2])] ^ dk[1];
+        t2 = td0[b0(s[2])] ^ td1[b1(s[1])] ^ td2[b2(s[0])] ^ td3[b3(s[3])] ^ dk[2];
+        t3 = td0[b0(s[3])] ^ td1[b1(s[2])] ^ td2[b2(s[1])] ^ td3[b3(s[0])] ^ dk[3];
+        s[0] = t0;
+        s[1] = t1;
+        s[2] = t2;
+        s[3] = t3;
+    }
+    dk += 4;
+    t0 = ((uint_32t)is_box(b0(s[0])) << 24 | (uint_32t)is_box(b1(s[3])) << 16 | (uint_32t)is_box(b2(s[2])) << 8 | is_box(b3(s[1]))) ^ dk[0];
+    t1 = ((uint_32t)is_box(b0(s[1])) << 24 | (uint_32t)is_box(b1(s[0])) << 16 | (uint_32t)is_box(b2(s[3])) << 8 | is_box(b3(s[2]))) ^ dk[1];
+    t2 = ((uint_32t)is_box(b0(s[2])) << 24 | (uint_32t)is_box(b1(s[1])) << 16 | (uint_32t)is_box(b2(s[0])) << 8 | is_box(b3(s[3]))) ^ dk[2];
+    t3 = ((uint_32t)is_box(b0(s[3])) << 24 | (uint_32t)is_box(b1(s[2])) << 16 | (uint_32t)is_box(b2(s[1])) << 8 | is_box(b3(s[0]))) ^ dk[3];
+    s[0] = t0;
+    s[1] = t1;
+    s[2] = t2;
+    s[3] = t3;
+}
+
+static return_type aes_cbc_encrypt_ttable(const unsigned char* in, unsigned char* out, int n_block, unsigned char iv[N_BLOCK], const aes_context ctx[1])
+{
+    uint_32t rk[4 * (N_MAX_ROUNDS + 1)];
+    uint_32t s[4];
+    int c;
+
+    ttable_enc_key(rk, ctx);
+    for (c = 0; c < 4; c++)
+        s[c] = load_be32(iv + 4 * c);
+
+    while (n_block--) {
+        for (c = 0; c < 4; c++)
+            s[c] ^= load_be32(in + 4 * c);
+        ttable_encrypt_block(s, rk, ctx->rnd);
+        for (c = 0; c < 4; c++)
+            store_be32(out + 4 * c, s[c]);
+        in += N_BLOCK;
+        out += N_BLOCK;
+    }
+
+    for (c = 0; c < 4; c++)
+        store_be32(iv + 4 * c, s[c]);
+    aes_wipe(rk, sizeof(rk));
+    aes_wipe(s, sizeof(s));
+    return EXIT_SUCCESS;
+}
+
+static return_type aes_cbc_decrypt_ttable(const unsigned char* in, unsigned char* out, int n_block, unsigned char iv[N_BLOCK], const aes_context ctx[1])
+{
+    uint_32t dk[4 * (N_MAX_ROUNDS + 1)];
+    uint_32t s[4], prev[4], cur[4];
+    int c;
+
+    ttable_dec_key(dk, ctx);
+    for (c = 0; c < 4; c++)
+        prev[c] = load_be32(iv + 4 * c);
+
+    while (n_block--) {
+        /* read the ciphertext first, in and out may overlap */
+        for (c = 0; c < 4; c++)
+            s[c] = cur[c] = load_be32(in + 4 * c);
+        ttable_decrypt_block(s, dk, ctx->rnd);
+        for (c = 0; c < 4; c++) {
+            store_be32(out + 4 * c, s[c] ^ prev[c]);
+            prev[c] = cur[c];
+        }
+        in += N_BLOCK;
+        out += N_BLOCK;
+    }
+
+    for (c = 0; c < 4; c++)
+        store_be32(iv + 4 * c, prev[c]);
+    aes_wipe(dk, sizeof(dk));
+    aes_wipe(s, sizeof(s));
+    return EXIT_SUCCESS;
+}
+
+static return_type aes_ctr_crypt_ttable(const unsigned char* in, unsigned char* out, size_t len, unsigned char ctr[N_BLOCK], const aes_context ctx[1])
+{
+    uint_32t rk[4 * (N_MAX_ROUNDS + 1)];
+    uint_32t s[4];
+    uint_8t ks[N_BLOCK];
+    size_t n;
+    int c;
+
+    ttable_enc_key(rk, ctx);
+    while (len > 0) {
+        for (c = 0; c < 4; c++)
+            s[c] = load_be32(ctr + 4 * c);
+        ttable_encrypt_block(s, rk, ctx->rnd);
+        for (c = 0; c < 4; c++)
+            store_be32(ks + 4 * c, s[c]);
+        ctr_increment(ctr);
+
+        n = len < N_BLOCK ? len : N_BLOCK;
+        ctr_xor(out, in, ks, n);
+        in += n;
+        out += n;
+        len -= n;
+    }
+    aes_wipe(rk, sizeof(rk));
+    aes_wipe(s, sizeof(s));
+    aes_wipe(ks, sizeof(ks));
+    return EXIT_SUCCESS;
+}
+
+#endif /* HAVE_TTABLE */
+
+#if defined(HAVE_AESNI)
+
+AESNI_TARGET static return_type aes_cbc_encrypt_aesni(const unsigned char* in, unsigned char* out, int n_block, unsigned char iv[N_BLOCK], const aes_context ctx[1])
+{
+    __m128i rk[N_MAX_ROUNDS + 1];
+    __m128i b;
+    int r, rnd = ctx->rnd;
+
+    for (r = 0; r <= rnd; r++)
+        rk[r] = _mm_loadu_si128((const __m128i*)(ctx->ksch + r * N_BLOCK));
+
+    /* CBC encryption is sequential, one block at a time */
+    b = _mm_loadu_si128((const __m128i*)iv);
+    while (n_block--) {
+        b = _mm_xor_si128(b, _mm_loadu_si128((const __m128i*)in));
+        b = _mm_xor_si128(b, rk[0]);
+        for (r = 1; r < rnd; r++)
+            b = _mm_aesenc_si128(b, rk[r]);
+        b = _mm_aesenclast_si128(b, rk[rnd]);
+        _mm_storeu_si128((__m128i*)out, b);
+        in += N_BLOCK;
+        out += N_BLOCK;
+    }
+    _mm_storeu_si128((__m128i*)iv, b);
+    aes_wipe(rk, sizeof(rk));
+    return EXIT_SUCCESS;
+}
+
+AESNI_TARGET static return_type aes_cbc_decrypt_aesni(const unsigned char* in, unsigned char* out, int n_block, unsigned char iv[N_BLOCK], const aes_context ctx[1])
+{
+    __m128i dk[N_MAX_ROUNDS + 1];
+    __m128i prev, c0, c1, c2, c3, b0, b1, b2, b3;
+    int r, rnd = ctx->rnd;
+
+    /* equivalent inverse cipher schedule */
+    dk[0] = _mm_loadu_si128((const __m128i*)(ctx->ksch + rnd * N_BLOCK));
+    for (r = 1; r < rnd; r++)
+        dk[r] = _mm_aesimc_si128(_mm_loadu_si128((const __m128i*)(ctx->ksch + (rnd - r) * N_BLOCK)));
+    dk[rnd] = _mm_loadu_si128((const __m128i*)ctx->ksch);
+
+    prev = _mm_loadu_si128((const __m128i*)iv);
+
+    /* CBC decryption is parallel, keep four blocks in the pipeline */
+    while (n_block >= 4) {
+        c0 = _mm_loadu_si128((const __m128i*)(in + 0 * N_BLOCK));
+        c1 = _mm_loadu_si128((const __m128i*)(in + 1 * N_BLOCK));
+        c2 = _mm_loadu_si128((const __m128i*)(in + 2 * N_BLOCK));
+        c3 = _mm_loadu_si128((const __m128i*)(in + 3 * N_BLOCK));
+        b0 = _mm_xor_si128(c0, dk[0]);
+        b1 = _mm_xor_si128(c1, dk[0]);
+        b2 = _mm_xor_si128(c2, dk[0]);
+        b3 = _mm_xor_si128(c3, dk[0]);
+        for (r = 1; r < rnd; r++) {
+            b0 = _mm_aesdec_si128(b0, dk[r]);
+            b1 = _mm_aesdec_si128(b1, dk[r]);
+            b2 = _mm_aesdec_si128(b2, dk[r]);
+            b3 = _mm_aesdec_si128(b3, dk[r]);
+        }
+        b0 = _mm_aesdeclast_si128(b0, dk[rnd]);
+        b1 = _mm_aesdeclast_si128(b1, dk[rnd]);
+        b2 = _mm_aesdeclast_si128(b2, dk[rnd]);
+        b3 = _mm_aesdeclast_si128(b3, dk[rnd]);
+        _mm_storeu_si128((__m128i*)(out + 0 * N_BLOCK), _mm_xor_si128(b0, prev));
+        _mm_storeu_si128((__m128i*)(out + 1 * N_BLOCK), _mm_xor_si128(b1, c0));
+        _mm_storeu_si128((__m128i*)(out + 2 * N_BLOCK), _mm_xor_si128(b2, c1));
+        _mm_storeu_si128((__m128i*)(out + 3 * N_BLOCK), _mm_xor_si128(b3, c2));
+        prev = c3;
+        in += 4 * N_BLOCK;
+        out += 4 * N_BLOCK;
+        n_block -= 4;
+    }
+    while (n_block-- > 0) {
+        c0 = _mm_loadu_si128((const __m128i*)in);
+        b0 = _mm_xor_si128(c0, dk[0]);
+        for (r = 1; r < rnd; r++)
+            b0 = _mm_aesdec_si128(b0, dk[r]);
+        b0 = _mm_aesdeclast_si128(b0, dk[rnd]);
+        _mm_storeu_si128((__m128i*)out, _mm_xor_si128(b0, prev));
+        prev = c0;
+        in += N_BLOCK;
+        out += N_BLOCK;
+    }
+    _mm_storeu_si128((__m128i*)iv, prev);
+    aes_wipe(dk, sizeof(dk));
+    return EXIT_SUCCESS;
+}
+
+AESNI_TARGET static return_type aes_ctr_crypt_aesni(const unsigned char* in, unsigned char* out, size_t len, unsigned char ctr[N_BLOCK], const aes_context ctx[1])
+{
+    __m128i rk[N_MAX_ROUNDS + 1];
+    __m128i b0, b1, b2, b3;
+    uint_8t ctrs[4 * N_BLOCK], ks[N_BLOCK];
+    size_t n;
+    int r, rnd = ctx->rnd;
+
+    for (r = 0; r <= rnd; r++)
+        rk[r] = _mm_loadu_si128((const __m128i*)(ctx->ksch + r * N_BLOCK));
+
+    /* the counter blocks are independent, keep four of them in the pipeline */
+    while (len >= 4 * N_BLOCK) {
+        if (ctr[N_BLOCK - 1] <= 0xff - 4) {
+            /* no carry out of the last byte (the common case) */
+            for (r = 0; r < 4; r++) {
+                memcpy(ctrs + r * N_BLOCK, ctr, N_BLOCK);
+                ctrs[r * N_BLOCK + N_BLOCK - 1] += r;
+            }
+            ctr[N_BLOCK - 1] += 4;
+        } else {
+            for (r = 0; r < 4; r++) {
+                memcpy(ctrs + r * N_BLOCK, ctr, N_BLOCK);
+                ctr_increment(ctr);
+            }
+        }
+        b0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(ctrs + 0 * N_BLOCK)), rk[0]);
+        b1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(ctrs + 1 * N_BLOCK)), rk[0]);
+        b2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(ctrs + 2 * N_BLOCK)), rk[0]);
+        b3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(ctrs + 3 * N_BLOCK)), rk[0]);
+        for (r = 1; r < rnd; r++) {
+            b0 = _mm_aesenc_si128(b0, rk[r]);
+            b1 = _mm_aesenc_si128(b1, rk[r]);
+            b2 = _mm_aesenc_si128(b2, rk[r]);
+            b3 = _mm_aesenc_si128(b3, rk[r]);
+        }
+        b0 = _mm_aesenclast_si128(b0, rk[rnd]);
+        b1 = _mm_aesenclast_si128(b1, rk[rnd]);
+        b2 = _mm_aesenclast_si128(b2, rk[rnd]);
+        b3 = _mm_aesenclast_si128(b3, rk[rnd]);
+        _mm_storeu_si128((__m128i*)(out + 0 * N_BLOCK), _mm_xor_si128(b0, _mm_loadu_si128((const __m128i*)(in + 0 * N_BLOCK))));
+        _mm_storeu_si128((__m128i*)(out + 1 * N_BLOCK), _mm_xor_si128(b1, _mm_loadu_si128((const __m128i*)(in + 1 * N_BLOCK))));
+        _mm_storeu_si128((__m128i*)(out + 2 * N_BLOCK), _mm_xor_si128(b2, _mm_loadu_si128((const __m128i*)(in + 2 * N_BLOCK))));
+        _mm_storeu_si128((__m128i*)(out + 3 * N_BLOCK), _mm_xor_si128(b3, _mm_loadu_si128((const __m128i*)(in + 3 * N_BLOCK))));
+        in += 4 * N_BLOCK;
+        out += 4 * N_BLOCK;
+        len -= 4 * N_BLOCK;
+    }
+    while (len > 0) {
+        b0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)ctr), rk[0]);
+        for (r = 1; r < rnd; r++)
+            b0 = _mm_aesenc_si128(b0, rk[r]);
+        b0 = _mm_aesenclast_si128(b0, rk[rnd]);
+        _mm_storeu_si128((__m128i*)ks, b0);
+        ctr_increment(ctr);
+
+        n = len < N_BLOCK ? len : N_BLOCK;
+        ctr_xor(out, in, ks, n);
+        in += n;
+        out += n;
+        len -= n;
+    }
+    aes_wipe(rk, sizeof(rk));
+    aes_wipe(ks, sizeof(ks));
+    return EXIT_SUCCESS;
+}
+
+#endif /* HAVE_AESNI */
+
 #if defined(AES_ENC_PREKEYED)
 
-/*  Encrypt a single block of 16 bytes */
+/*  Encrypt a single block of 16 bytes (byte backend) */
 
-return_type aes_encrypt(const unsigned char in[N_BLOCK], unsigned char out[N_BLOCK], const aes_context ctx[1])
+static return_type aes_encrypt_byte(const unsigned char in[N_BLOCK], unsigned char out[N_BLOCK], const aes_context ctx[1])
 {
     if (ctx->rnd) {
         uint_8t s1[N_BLOCK], r;
@@ -532,13 +1027,11 @@ return_type aes_encrypt(const unsigned char in[N_BLOCK], unsigned char out[N_BLO
     return 0;
 }
 
-/* CBC encrypt a number of blocks (input and return an IV) */
-
-return_type aes_cbc_encrypt(const unsigned char* in, unsigned char* out, int n_block, unsigned char iv[N_BLOCK], const aes_context ctx[1])
+static return_type aes_cbc_encrypt_byte(const unsigned char* in, unsigned char* out, int n_block, unsigned char iv[N_BLOCK], const aes_context ctx[1])
 {
     while (n_block--) {
         xor_block(iv, in);
-        if (aes_encrypt(iv, iv, ctx) != EXIT_SUCCESS) {
+        if (aes_encrypt_byte(iv, iv, ctx) != EXIT_SUCCESS) {
             return EXIT_FAILURE;
         }
         memcpy(out, iv, N_BLOCK);
@@ -548,13 +1041,84 @@ return_type aes_cbc_encrypt(const unsigned char* in, unsigned char* out, int n_b
     return EXIT_SUCCESS;
 }
 
+/* CBC encrypt a number of blocks (input and return an IV) */
+
+return_type aes_cbc_encrypt(const unsigned char* in, unsigned char* out, int n_block, unsigned char iv[N_BLOCK], const aes_context ctx[1])
+{
+    if (!ctx->rnd)
+        return EXIT_FAILURE;
+
+    switch (aes_get_backend()) {
+#if defined(HAVE_AESNI)
+    case AES_BACKEND_AESNI:
+        return aes_cbc_encrypt_aesni(in, out, n_block, iv, ctx);
+#endif
+#if defined(HAVE_TTABLE)
+    case AES_BACKEND_TTABLE:
+        return aes_cbc_encrypt_ttable(in, out, n_block, iv, ctx);
+#endif
+    default:
+        return aes_cbc_encrypt_byte(in, out, n_block, iv, ctx);
+    }
+}
+
+/*  Encrypt a single block of 16 bytes */
+
+return_type aes_encrypt(const unsigned char in[N_BLOCK], unsigned char out[N_BLOCK], const aes_context ctx[1])
+{
+    /* a single CBC block with a zero IV */
+    uint_8t iv[N_BLOCK] = {0};
+    return aes_cbc_encrypt(in, out, 1, iv, ctx) == EXIT_SUCCESS ? 0 : -1;
+}
+
+static return_type aes_ctr_crypt_byte(const unsigned char* in, unsigned char* out, size_t len, unsigned char ctr[N_BLOCK], const aes_context ctx[1])
+{
+    uint_8t ks[N_BLOCK];
+    size_t n;
+
+    while (len > 0) {
+        if (aes_encrypt_byte(ctr, ks, ctx) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+        ctr_increment(ctr);
+
+        n = len < N_BLOCK ? len : N_BLOCK;
+        ctr_xor(out, in, ks, n);
+        in += n;
+        out += n;
+        len -= n;
+    }
+    aes_wipe(ks, sizeof(ks));
+    return EXIT_SUCCESS;
+}
+
+/* CTR encrypt/decrypt len bytes (input and return the next counter block) */
+
+return_type aes_ctr_crypt(const unsigned char* in, unsigned char* out, size_t len, unsigned char ctr[N_BLOCK], const aes_context ctx[1])
+{
+    if (!ctx->rnd)
+        return EXIT_FAILURE;
+
+    switch (aes_get_backend()) {
+#if defined(HAVE_AESNI)
+    case AES_BACKEND_AESNI:
+        return aes_ctr_crypt_aesni(in, out, len, ctr, ctx);
+#endif
+#if defined(HAVE_TTABLE)
+    case AES_BACKEND_TTABLE:
+        return aes_ctr_crypt_ttable(in, out, len, ctr, ctx);
+#endif
+    default:
+        return aes_ctr_crypt_byte(in, out, len, ctr, ctx);
+    }
+}
+
 #endif
 
 #if defined(AES_DEC_PREKEYED)
 
-/*  Decrypt a single block of 16 bytes */
+/*  Decrypt a single block of 16 bytes (byte backend) */
 
-return_type aes_decrypt(const unsigned char in[N_BLOCK], unsigned char out[N_BLOCK], const aes_context ctx[1])
+static return_type aes_decrypt_byte(const unsigned char in[N_BLOCK], unsigned char out[N_BLOCK], const aes_context ctx[1])
 {
     if (ctx->rnd) {
         uint_8t s1[N_BLOCK], r;
@@ -581,15 +1145,13 @@ return_type aes_decrypt(const unsigned char in[N_BLOCK], unsigned char out[N_BLO
     return 0;
 }
 
-/* CBC decrypt a number of blocks (input and return an IV) */
-
-return_type aes_cbc_decrypt(const unsigned char* in, unsigned char* out, int n_block, unsigned char iv[N_BLOCK], const aes_context ctx[1])
+static return_type aes_cbc_decrypt_byte(const unsigned char* in, unsigned char* out, int n_block, unsigned char iv[N_BLOCK], const aes_context ctx[1])
 {
     while (n_block--) {
         uint_8t tmp[N_BLOCK];
 
         memcpy(tmp, in, N_BLOCK);
-        if (aes_decrypt(in, out, ctx) != EXIT_SUCCESS) {
+        if (aes_decrypt_byte(in, out, ctx) != EXIT_SUCCESS) {
             return EXIT_FAILURE;
         }
         xor_block(out, iv);
@@ -600,6 +1162,35 @@ return_type aes_cbc_decrypt(const unsigned char* in, unsigned char* out, int n_b
     return EXIT_SUCCESS;
 }
 
+/* CBC decrypt a number of blocks (input and return an IV) */
+
+return_type aes_cbc_decrypt(const unsigned char* in, unsigned char* out, int n_block, unsigned char iv[N_BLOCK], const aes_context ctx[1])
+{
+    if (!ctx->rnd)
+        return EXIT_FAILURE;
+
+    switch (aes_get_backend()) {
+#if defined(HAVE_AESNI)
+    case AES_BACKEND_AESNI:
+        return aes_cbc_decrypt_aesni(in, out, n_block, iv, ctx);
+#endif
+#if defined(HAVE_TTABLE)
+    case AES_BACKEND_TTABLE:
+        return aes_cbc_decrypt_ttable(in, out, n_block, iv, ctx);
+#endif
+    default:
+        return aes_cbc_decrypt_byte(in, out, n_block, iv, ctx);
+    }
+}
+
+/*  Decrypt a single block of 16 bytes */
+
+return_type aes_decrypt(const unsigned char in[N_BLOCK], unsigned char out[N_BLOCK], const aes_context ctx[1])
+{
+    uint_8t iv[N_BLOCK] = {0};
+    return aes_cbc_decrypt(in, out, 1, iv, ctx) == EXIT_SUCCESS ? 0 : -1;
+}
+
 #endif
 
 #if defined(AES_ENC_128_OTFK)
@@ -36,7 +36,6 @@
 #include "btc/ecc.h"
 #include "btc/ecc_key.h"
 
-#include "ripemd160.h"
 #include "sha2.h"
 #include "utils.h"
 
@@ -95,8 +94,7 @@ btc_bool btc_hdnode_public_ckd(btc_hdnode* inout, uint32_t i)
     }
     write_be(data + BTC_ECKEY_COMPRESSED_LENGTH, i);
 
-    sha256_Raw(inout->public_key, BTC_ECKEY_COMPRESSED_LENGTH, fingerprint);
-    ripemd160(fingerprint, 32, fingerprint);
+    btc_hash160(inout->public_key, BTC_ECKEY_COMPRESSED_LENGTH, fingerprint);
     inout->fingerprint = (fingerprint[0] << 24) + (fingerprint[1] << 16) + (fingerprint[2] << 8) + fingerprint[3];
 
     memset(inout->private_key, 0, 32);
@@ -138,8 +136,7 @@ btc_bool btc_hdnode_private_ckd(btc_hdnode* inout, uint32_t i)
     }
     write_be(data + BTC_ECKEY_COMPRESSED_LENGTH, i);
 
-    sha256_Raw(inout->public_key, BTC_ECKEY_COMPRESSED_LENGTH, fingerprint);
-    ripemd160(fingerprint, 32, fingerprint);
+    btc_hash160(inout->public_key, BTC_ECKEY_COMPRESSED_LENGTH, fingerprint);
     inout->fingerprint = (fingerprint[0] << 24) + (fingerprint[1] << 16) +
                          (fingerprint[2] << 8) + fingerprint[3];
 
@@ -216,11 +213,9 @@ void btc_hdnode_serialize_private(const btc_hdnode* node, const btc_chain* chain
 
 void btc_hdnode_get_p2pkh_address(const btc_hdnode* node, const btc_chain* chain, char* str, int strsize)
 {
-    uint8_t hashout[32];
     uint8_t hash160[21];
     hash160[0] = chain->b58prefix_pubkey_address;
-    btc_hash_sngl_sha256(node->public_key, BTC_ECKEY_COMPRESSED_LENGTH, hashout);
-    ripemd160(hashout, 32, hash160+1);
+    btc_hash160(node->public_key, BTC_ECKEY_COMPRESSED_LENGTH, hash160+1);
     btc_base58_encode_check(hash160, 21, str, strsize);
 }
 
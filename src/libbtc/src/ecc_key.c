@@ -35,7 +35,6 @@
 #include "btc/hash.h"
 #include "btc/random.h"
 
-#include "ripemd160.h"
 #include "utils.h"
 
 
@@ -111,10 +110,7 @@ void btc_pubkey_cleanse(btc_pubkey* pubkey)
 
 void btc_pubkey_get_hash160(const btc_pubkey* pubkey, uint8_t* hash160)
 {
-    uint8_t hashout[32];
-    btc_hash_sngl_sha256(pubkey->pubkey, pubkey->compressed ? BTC_ECKEY_COMPRESSED_LENGTH : BTC_ECKEY_UNCOMPRESSED_LENGTH, hashout);
-
-    ripemd160(hashout, 32, hash160);
+    btc_hash160(pubkey->pubkey, pubkey->compressed ? BTC_ECKEY_COMPRESSED_LENGTH : BTC_ECKEY_UNCOMPRESSED_LENGTH, hash160);
 }
 
 
@@ -5,51 +5,123 @@
 #include <string.h>
 
 #include "btc/btc.h"
+#include "btc/ecc.h"
 #include "btc/random.h"
 
 static secp256k1_context* secp256k1_ctx = NULL;
 
+struct btc_ecc_context_ {
+    secp256k1_context* ctx;
+    volatile int in_use;
+};
+
+/* the static context for callers without an own one (and a full pool) */
+static btc_ecc_context ecc_shared_ctx = {NULL, 0};
+static btc_ecc_context ecc_ctx_pool[BTC_ECC_CONTEXT_POOL_SIZE];
+
+#if defined(__GNUC__) || defined(__clang__)
+#define HAVE_ECC_CONTEXT_POOL
+#endif
+
+static void ecc_randomize(secp256k1_context* ctx)
+{
+    uint8_t seed[32];
+    random_bytes(seed, 32, 0);
+    int ret = secp256k1_context_randomize(ctx, seed);
+    assert(ret);
+    (void)ret;
+    memset(seed, 0, sizeof(seed));
+}
+
 void btc_ecc_start(void)
 {
     secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_SIGN | SECP256K1_CONTEXT_VERIFY);
     assert(secp256k1_ctx != NULL);
 
-    uint8_t seed[32];
-    random_bytes(seed, 32, 0);
-    int ret = secp256k1_context_randomize(secp256k1_ctx, seed);
-    assert(ret);
+    ecc_randomize(secp256k1_ctx);
+    ecc_shared_ctx.ctx = secp256k1_ctx;
 }
 
 
 void btc_ecc_stop(void)
 {
     secp256k1_context* ctx = secp256k1_ctx;
+    int i;
+
     secp256k1_ctx = NULL;
+    ecc_shared_ctx.ctx = NULL;
+
+    /* pooled contexts must have been released */
+    for (i = 0; i < BTC_ECC_CONTEXT_POOL_SIZE; i++) {
+        if (ecc_ctx_pool[i].ctx)
+            secp256k1_context_destroy(ecc_ctx_pool[i].ctx);
+        ecc_ctx_pool[i].ctx = NULL;
+        ecc_ctx_pool[i].in_use = 0;
+    }
 
     if (ctx) {
         secp256k1_context_destroy(ctx);
     }
 }
 
+btc_ecc_context* btc_ecc_context_acquire(void)
+{
+    assert(secp256k1_ctx);
+#if defined(HAVE_ECC_CONTEXT_POOL)
+    int i;
+    for (i = 0; i < BTC_ECC_CONTEXT_POOL_SIZE; i++) {
+        btc_ecc_context* entry = &ecc_ctx_pool[i];
+        if (!__sync_bool_compare_and_swap(&entry->in_use, 0, 1))
+            continue;
+
+        /* only the owner of the slot creates its context */
+        if (!entry->ctx) {
+            entry->ctx = secp256k1_context_clone(secp256k1_ctx);
+            if (!entry->ctx) {
+                __sync_lock_release(&entry->in_use);
+                break;
+            }
+            ecc_randomize(entry->ctx);
+        }
+        return entry;
+    }
+#endif
+    return &ecc_shared_ctx;
+}
 
-void btc_ecc_get_pubkey(const uint8_t* private_key, uint8_t* public_key, size_t* in_outlen, btc_bool compressed)
+void btc_ecc_context_release(btc_ecc_context* ctx)
+{
+    if (!ctx || ctx == &ecc_shared_ctx)
+        return;
+#if defined(HAVE_ECC_CONTEXT_POOL)
+    __sync_lock_release(&ctx->in_use);
+#endif
+}
+
+
+void btc_ecc_get_pubkey_ctx(const btc_ecc_context* ctx, const uint8_t* private_key, uint8_t* public_key, size_t* in_outlen, btc_bool compressed)
 {
     secp256k1_pubkey pubkey;
-    assert(secp256k1_ctx);
+    assert(ctx && ctx->ctx);
     assert((int)*in_outlen == (compressed ? 33 : 65));
     memset(public_key, 0, *in_outlen);
 
-    if (!secp256k1_ec_pubkey_create(secp256k1_ctx, &pubkey, (const unsigned char*)private_key)) {
+    if (!secp256k1_ec_pubkey_create(ctx->ctx, &pubkey, (const unsigned char*)private_key)) {
         return;
     }
 
-    if (!secp256k1_ec_pubkey_serialize(secp256k1_ctx, public_key, in_outlen, &pubkey, compressed ? SECP256K1_EC_COMPRESSED : SECP256K1_EC_UNCOMPRESSED)) {
+    if (!secp256k1_ec_pubkey_serialize(ctx->ctx, public_key, in_outlen, &pubkey, compressed ? SECP256K1_EC_COMPRESSED : SECP256K1_EC_UNCOMPRESSED)) {
         return;
     }
 
     return;
 }
 
+void btc_ecc_get_pubkey(const uint8_t* private_key, uint8_t* public_key, size_t* in_outlen, btc_bool compressed)
+{
+    btc_ecc_get_pubkey_ctx(&ecc_shared_ctx, private_key, public_key, in_outlen, compressed);
+}
+
 btc_bool btc_ecc_private_key_tweak_add(uint8_t* private_key, const uint8_t* tweak)
 {
     assert(secp256k1_ctx);
@@ -95,20 +167,25 @@ btc_bool btc_ecc_verify_pubkey(const uint8_t* public_key, btc_bool compressed)
     return true;
 }
 
-btc_bool btc_ecc_sign(const uint8_t* private_key, const uint8_t* hash, unsigned char* sigder, size_t* outlen)
+btc_bool btc_ecc_sign_ctx(const btc_ecc_context* ctx, const uint8_t* private_key, const uint8_t* hash, unsigned char* sigder, size_t* outlen)
 {
-    assert(secp256k1_ctx);
+    assert(ctx && ctx->ctx);
 
     secp256k1_ecdsa_signature sig;
-    if (!secp256k1_ecdsa_sign(secp256k1_ctx, &sig, hash, private_key, NULL, NULL))
+    if (!secp256k1_ecdsa_sign(ctx->ctx, &sig, hash, private_key, NULL, NULL))
         return 0;
 
-    if (!secp256k1_ecdsa_signature_serialize_der(secp256k1_ctx, sigder, outlen, &sig))
+    if (!secp256k1_ecdsa_signature_serialize_der(ctx->ctx, sigder, outlen, &sig))
         return 0;
 
     return 1;
 }
 
+btc_bool btc_ecc_sign(const uint8_t* private_key, const uint8_t* hash, unsigned char* sigder, size_t* outlen)
+{
+    return btc_ecc_sign_ctx(&ecc_shared_ctx, private_key, hash, sigder, outlen);
+}
+
 btc_bool btc_ecc_sign_compact(const uint8_t* private_key, const uint8_t* hash, unsigned char* sigder, size_t* outlen)
 {
     assert(secp256k1_ctx);
@@ -124,20 +201,58 @@ btc_bool btc_ecc_sign_compact(const uint8_t* private_key, const uint8_t* hash, u
     return 1;
 }
 
-btc_bool btc_ecc_verify_sig(const uint8_t* public_key, btc_bool compressed, const uint8_t* hash, unsigned char* sigder, size_t siglen)
+btc_bool btc_ecc_verify_sig_ctx(const btc_ecc_context* ctx, const uint8_t* public_key, btc_bool compressed, const uint8_t* hash, unsigned char* sigder, size_t siglen)
 {
-    assert(secp256k1_ctx);
+    assert(ctx && ctx->ctx);
 
     secp256k1_ecdsa_signature sig;
     secp256k1_pubkey pubkey;
 
-    if (!secp256k1_ec_pubkey_parse(secp256k1_ctx, &pubkey, public_key, compressed ? 33 : 65))
+    if (!secp256k1_ec_pubkey_parse(ctx->ctx, &pubkey, public_key, compressed ? 33 : 65))
         return false;
 
-    if (!secp256k1_ecdsa_signature_parse_der(secp256k1_ctx, &sig, sigder, siglen))
+    if (!secp256k1_ecdsa_signature_parse_der(ctx->ctx, &sig, sigder, siglen))
         return false;
 
-    return secp256k1_ecdsa_verify(secp256k1_ctx, &sig, hash, &pubkey);
+    return secp256k1_ecdsa_verify(ctx->ctx, &sig, hash, &pubkey);
+}
+
+btc_bool btc_ecc_verify_sig(const uint8_t* public_key, btc_bool compressed, const uint8_t* hash, unsigned char* sigder, size_t siglen)
+{
+    return btc_ecc_verify_sig_ctx(&ecc_shared_ctx, public_key, compressed, hash, sigder, siglen);
+}
+
+btc_bool btc_ecc_verify_batch(const uint8_t* const public_keys[], btc_bool compressed, const uint8_t* const hashes[], const unsigned char* const sigs_compact[], size_t count, btc_bool* results)
+{
+    btc_ecc_context* ctx = btc_ecc_context_acquire();
+    const size_t pubkeylen = compressed ? 33 : 65;
+    const uint8_t* parsed_key = NULL;
+    btc_bool parsed_valid = false;
+    btc_bool all_valid = true;
+    secp256k1_pubkey pubkey;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        secp256k1_ecdsa_signature sig;
+        btc_bool valid = false;
+
+        if (!parsed_key || (public_keys[i] != parsed_key && memcmp(public_keys[i], parsed_key, pubkeylen) != 0)) {
+            parsed_key = public_keys[i];
+            parsed_valid = secp256k1_ec_pubkey_parse(ctx->ctx, &pubkey, parsed_key, pubkeylen);
+        }
+
+        if (parsed_valid && secp256k1_ecdsa_signature_parse_compact(ctx->ctx, &sig, sigs_compact[i])) {
+            secp256k1_ecdsa_signature_normalize(ctx->ctx, &sig, &sig);
+            valid = secp256k1_ecdsa_verify(ctx->ctx, &sig, hashes[i], &pubkey);
+        }
+
+        if (results)
+            results[i] = valid;
+        all_valid = all_valid && valid;
+    }
+
+    btc_ecc_context_release(ctx);
+    return all_valid;
 }
 
 btc_bool btc_ecc_compact_to_der_normalized(unsigned char* sigcomp_in, unsigned char* sigder_out, size_t* sigder_len_out)
@@ -25,6 +25,9 @@
 #include <string.h>
 
 #include "ripemd160.h"
+#include "sha2.h"
+
+#include "btc/hash.h"
 
 #define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
 
@@ -42,25 +45,25 @@
     }
 #define GG(a, b, c, d, e, x, s)                       \
     {                                                 \
-        (a) += G((b), (c), (d)) + (x) + 0x5a827999UL; \
+        (a) += G((b), (c), (d)) + (x) + 0x5a827999U; \
         (a) = ROL((a), (s)) + (e);                    \
         (c) = ROL((c), 10);                           \
     }
 #define HH(a, b, c, d, e, x, s)                       \
     {                                                 \
-        (a) += H((b), (c), (d)) + (x) + 0x6ed9eba1UL; \
+        (a) += H((b), (c), (d)) + (x) + 0x6ed9eba1U; \
         (a) = ROL((a), (s)) + (e);                    \
         (c) = ROL((c), 10);                           \
     }
 #define II(a, b, c, d, e, x, s)                        \
     {                                                  \
-        (a) += IQ((b), (c), (d)) + (x) + 0x8f1bbcdcUL; \
+        (a) += IQ((b), (c), (d)) + (x) + 0x8f1bbcdcU; \
         (a) = ROL((a), (s)) + (e);                     \
         (c) = ROL((c), 10);                            \
     }
 #define JJ(a, b, c, d, e, x, s)                       \
     {                                                 \
-        (a) += J((b), (c), (d)) + (x) + 0xa953fd4eUL; \
+        (a) += J((b), (c), (d)) + (x) + 0xa953fd4eU; \
         (a) = ROL((a), (s)) + (e);                    \
         (c) = ROL((c), 10);                           \
     }
@@ -72,213 +75,219 @@
     }
 #define GGG(a, b, c, d, e, x, s)                      \
     {                                                 \
-        (a) += G((b), (c), (d)) + (x) + 0x7a6d76e9UL; \
+        (a) += G((b), (c), (d)) + (x) + 0x7a6d76e9U; \
         (a) = ROL((a), (s)) + (e);                    \
         (c) = ROL((c), 10);                           \
     }
 #define HHH(a, b, c, d, e, x, s)                      \
     {                                                 \
-        (a) += H((b), (c), (d)) + (x) + 0x6d703ef3UL; \
+        (a) += H((b), (c), (d)) + (x) + 0x6d703ef3U; \
         (a) = ROL((a), (s)) + (e);                    \
         (c) = ROL((c), 10);                           \
     }
 #define III(a, b, c, d, e, x, s)                       \
     {                                                  \
-        (a) += IQ((b), (c), (d)) + (x) + 0x5c4dd124UL; \
+        (a) += IQ((b), (c), (d)) + (x) + 0x5c4dd124U; \
         (a) = ROL((a), (s)) + (e);                     \
         (c) = ROL((c), 10);                            \
     }
 #define JJJ(a, b, c, d, e, x, s)                      \
     {                                                 \
-        (a) += J((b), (c), (d)) + (x) + 0x50a28be6UL; \
+        (a) += J((b), (c), (d)) + (x) + 0x50a28be6U; \
         (a) = ROL((a), (s)) + (e);                    \
         (c) = ROL((c), 10);                           \
     }
 
+/* the 160 steps of both lines, on aa..ee / aaa..eee and the message words X */
+#define RIPEMD160_ROUNDS                      \
+    /* round 1 */                             \
+    FF(aa, bb, cc, dd, ee, X[0], 11);         \
+    FF(ee, aa, bb, cc, dd, X[1], 14);         \
+    FF(dd, ee, aa, bb, cc, X[2], 15);         \
+    FF(cc, dd, ee, aa, bb, X[3], 12);         \
+    FF(bb, cc, dd, ee, aa, X[4], 5);          \
+    FF(aa, bb, cc, dd, ee, X[5], 8);          \
+    FF(ee, aa, bb, cc, dd, X[6], 7);          \
+    FF(dd, ee, aa, bb, cc, X[7], 9);          \
+    FF(cc, dd, ee, aa, bb, X[8], 11);         \
+    FF(bb, cc, dd, ee, aa, X[9], 13);         \
+    FF(aa, bb, cc, dd, ee, X[10], 14);        \
+    FF(ee, aa, bb, cc, dd, X[11], 15);        \
+    FF(dd, ee, aa, bb, cc, X[12], 6);         \
+    FF(cc, dd, ee, aa, bb, X[13], 7);         \
+    FF(bb, cc, dd, ee, aa, X[14], 9);         \
+    FF(aa, bb, cc, dd, ee, X[15], 8);         \
+                                              \
+    /* round 2 */                             \
+    GG(ee, aa, bb, cc, dd, X[7], 7);          \
+    GG(dd, ee, aa, bb, cc, X[4], 6);          \
+    GG(cc, dd, ee, aa, bb, X[13], 8);         \
+    GG(bb, cc, dd, ee, aa, X[1], 13);         \
+    GG(aa, bb, cc, dd, ee, X[10], 11);        \
+    GG(ee, aa, bb, cc, dd, X[6], 9);          \
+    GG(dd, ee, aa, bb, cc, X[15], 7);         \
+    GG(cc, dd, ee, aa, bb, X[3], 15);         \
+    GG(bb, cc, dd, ee, aa, X[12], 7);         \
+    GG(aa, bb, cc, dd, ee, X[0], 12);         \
+    GG(ee, aa, bb, cc, dd, X[9], 15);         \
+    GG(dd, ee, aa, bb, cc, X[5], 9);          \
+    GG(cc, dd, ee, aa, bb, X[2], 11);         \
+    GG(bb, cc, dd, ee, aa, X[14], 7);         \
+    GG(aa, bb, cc, dd, ee, X[11], 13);        \
+    GG(ee, aa, bb, cc, dd, X[8], 12);         \
+                                              \
+    /* round 3 */                             \
+    HH(dd, ee, aa, bb, cc, X[3], 11);         \
+    HH(cc, dd, ee, aa, bb, X[10], 13);        \
+    HH(bb, cc, dd, ee, aa, X[14], 6);         \
+    HH(aa, bb, cc, dd, ee, X[4], 7);          \
+    HH(ee, aa, bb, cc, dd, X[9], 14);         \
+    HH(dd, ee, aa, bb, cc, X[15], 9);         \
+    HH(cc, dd, ee, aa, bb, X[8], 13);         \
+    HH(bb, cc, dd, ee, aa, X[1], 15);         \
+    HH(aa, bb, cc, dd, ee, X[2], 14);         \
+    HH(ee, aa, bb, cc, dd, X[7], 8);          \
+    HH(dd, ee, aa, bb, cc, X[0], 13);         \
+    HH(cc, dd, ee, aa, bb, X[6], 6);          \
+    HH(bb, cc, dd, ee, aa, X[13], 5);         \
+    HH(aa, bb, cc, dd, ee, X[11], 12);        \
+    HH(ee, aa, bb, cc, dd, X[5], 7);          \
+    HH(dd, ee, aa, bb, cc, X[12], 5);         \
+                                              \
+    /* round 4 */                             \
+    II(cc, dd, ee, aa, bb, X[1], 11);         \
+    II(bb, cc, dd, ee, aa, X[9], 12);         \
+    II(aa, bb, cc, dd, ee, X[11], 14);        \
+    II(ee, aa, bb, cc, dd, X[10], 15);        \
+    II(dd, ee, aa, bb, cc, X[0], 14);         \
+    II(cc, dd, ee, aa, bb, X[8], 15);         \
+    II(bb, cc, dd, ee, aa, X[12], 9);         \
+    II(aa, bb, cc, dd, ee, X[4], 8);          \
+    II(ee, aa, bb, cc, dd, X[13], 9);         \
+    II(dd, ee, aa, bb, cc, X[3], 14);         \
+    II(cc, dd, ee, aa, bb, X[7], 5);          \
+    II(bb, cc, dd, ee, aa, X[15], 6);         \
+    II(aa, bb, cc, dd, ee, X[14], 8);         \
+    II(ee, aa, bb, cc, dd, X[5], 6);          \
+    II(dd, ee, aa, bb, cc, X[6], 5);          \
+    II(cc, dd, ee, aa, bb, X[2], 12);         \
+                                              \
+    /* round 5 */                             \
+    JJ(bb, cc, dd, ee, aa, X[4], 9);          \
+    JJ(aa, bb, cc, dd, ee, X[0], 15);         \
+    JJ(ee, aa, bb, cc, dd, X[5], 5);          \
+    JJ(dd, ee, aa, bb, cc, X[9], 11);         \
+    JJ(cc, dd, ee, aa, bb, X[7], 6);          \
+    JJ(bb, cc, dd, ee, aa, X[12], 8);         \
+    JJ(aa, bb, cc, dd, ee, X[2], 13);         \
+    JJ(ee, aa, bb, cc, dd, X[10], 12);        \
+    JJ(dd, ee, aa, bb, cc, X[14], 5);         \
+    JJ(cc, dd, ee, aa, bb, X[1], 12);         \
+    JJ(bb, cc, dd, ee, aa, X[3], 13);         \
+    JJ(aa, bb, cc, dd, ee, X[8], 14);         \
+    JJ(ee, aa, bb, cc, dd, X[11], 11);        \
+    JJ(dd, ee, aa, bb, cc, X[6], 8);          \
+    JJ(cc, dd, ee, aa, bb, X[15], 5);         \
+    JJ(bb, cc, dd, ee, aa, X[13], 6);         \
+                                              \
+    /* parallel round 1 */                    \
+    JJJ(aaa, bbb, ccc, ddd, eee, X[5], 8);    \
+    JJJ(eee, aaa, bbb, ccc, ddd, X[14], 9);   \
+    JJJ(ddd, eee, aaa, bbb, ccc, X[7], 9);    \
+    JJJ(ccc, ddd, eee, aaa, bbb, X[0], 11);   \
+    JJJ(bbb, ccc, ddd, eee, aaa, X[9], 13);   \
+    JJJ(aaa, bbb, ccc, ddd, eee, X[2], 15);   \
+    JJJ(eee, aaa, bbb, ccc, ddd, X[11], 15);  \
+    JJJ(ddd, eee, aaa, bbb, ccc, X[4], 5);    \
+    JJJ(ccc, ddd, eee, aaa, bbb, X[13], 7);   \
+    JJJ(bbb, ccc, ddd, eee, aaa, X[6], 7);    \
+    JJJ(aaa, bbb, ccc, ddd, eee, X[15], 8);   \
+    JJJ(eee, aaa, bbb, ccc, ddd, X[8], 11);   \
+    JJJ(ddd, eee, aaa, bbb, ccc, X[1], 14);   \
+    JJJ(ccc, ddd, eee, aaa, bbb, X[10], 14);  \
+    JJJ(bbb, ccc, ddd, eee, aaa, X[3], 12);   \
+    JJJ(aaa, bbb, ccc, ddd, eee, X[12], 6);   \
+                                              \
+    /* parallel round 2 */                    \
+    III(eee, aaa, bbb, ccc, ddd, X[6], 9);    \
+    III(ddd, eee, aaa, bbb, ccc, X[11], 13);  \
+    III(ccc, ddd, eee, aaa, bbb, X[3], 15);   \
+    III(bbb, ccc, ddd, eee, aaa, X[7], 7);    \
+    III(aaa, bbb, ccc, ddd, eee, X[0], 12);   \
+    III(eee, aaa, bbb, ccc, ddd, X[13], 8);   \
+    III(ddd, eee, aaa, bbb, ccc, X[5], 9);    \
+    III(ccc, ddd, eee, aaa, bbb, X[10], 11);  \
+    III(bbb, ccc, ddd, eee, aaa, X[14], 7);   \
+    III(aaa, bbb, ccc, ddd, eee, X[15], 7);   \
+    III(eee, aaa, bbb, ccc, ddd, X[8], 12);   \
+    III(ddd, eee, aaa, bbb, ccc, X[12], 7);   \
+    III(ccc, ddd, eee, aaa, bbb, X[4], 6);    \
+    III(bbb, ccc, ddd, eee, aaa, X[9], 15);   \
+    III(aaa, bbb, ccc, ddd, eee, X[1], 13);   \
+    III(eee, aaa, bbb, ccc, ddd, X[2], 11);   \
+                                              \
+    /* parallel round 3 */                    \
+    HHH(ddd, eee, aaa, bbb, ccc, X[15], 9);   \
+    HHH(ccc, ddd, eee, aaa, bbb, X[5], 7);    \
+    HHH(bbb, ccc, ddd, eee, aaa, X[1], 15);   \
+    HHH(aaa, bbb, ccc, ddd, eee, X[3], 11);   \
+    HHH(eee, aaa, bbb, ccc, ddd, X[7], 8);    \
+    HHH(ddd, eee, aaa, bbb, ccc, X[14], 6);   \
+    HHH(ccc, ddd, eee, aaa, bbb, X[6], 6);    \
+    HHH(bbb, ccc, ddd, eee, aaa, X[9], 14);   \
+    HHH(aaa, bbb, ccc, ddd, eee, X[11], 12);  \
+    HHH(eee, aaa, bbb, ccc, ddd, X[8], 13);   \
+    HHH(ddd, eee, aaa, bbb, ccc, X[12], 5);   \
+    HHH(ccc, ddd, eee, aaa, bbb, X[2], 14);   \
+    HHH(bbb, ccc, ddd, eee, aaa, X[10], 13);  \
+    HHH(aaa, bbb, ccc, ddd, eee, X[0], 13);   \
+    HHH(eee, aaa, bbb, ccc, ddd, X[4], 7);    \
+    HHH(ddd, eee, aaa, bbb, ccc, X[13], 5);   \
+                                              \
+    /* parallel round 4 */                    \
+    GGG(ccc, ddd, eee, aaa, bbb, X[8], 15);   \
+    GGG(bbb, ccc, ddd, eee, aaa, X[6], 5);    \
+    GGG(aaa, bbb, ccc, ddd, eee, X[4], 8);    \
+    GGG(eee, aaa, bbb, ccc, ddd, X[1], 11);   \
+    GGG(ddd, eee, aaa, bbb, ccc, X[3], 14);   \
+    GGG(ccc, ddd, eee, aaa, bbb, X[11], 14);  \
+    GGG(bbb, ccc, ddd, eee, aaa, X[15], 6);   \
+    GGG(aaa, bbb, ccc, ddd, eee, X[0], 14);   \
+    GGG(eee, aaa, bbb, ccc, ddd, X[5], 6);    \
+    GGG(ddd, eee, aaa, bbb, ccc, X[12], 9);   \
+    GGG(ccc, ddd, eee, aaa, bbb, X[2], 12);   \
+    GGG(bbb, ccc, ddd, eee, aaa, X[13], 9);   \
+    GGG(aaa, bbb, ccc, ddd, eee, X[9], 12);   \
+    GGG(eee, aaa, bbb, ccc, ddd, X[7], 5);    \
+    GGG(ddd, eee, aaa, bbb, ccc, X[10], 15);  \
+    GGG(ccc, ddd, eee, aaa, bbb, X[14], 8);   \
+                                              \
+    /* parallel round 5 */                    \
+    FFF(bbb, ccc, ddd, eee, aaa, X[12], 8);   \
+    FFF(aaa, bbb, ccc, ddd, eee, X[15], 5);   \
+    FFF(eee, aaa, bbb, ccc, ddd, X[10], 12);  \
+    FFF(ddd, eee, aaa, bbb, ccc, X[4], 9);    \
+    FFF(ccc, ddd, eee, aaa, bbb, X[1], 12);   \
+    FFF(bbb, ccc, ddd, eee, aaa, X[5], 5);    \
+    FFF(aaa, bbb, ccc, ddd, eee, X[8], 14);   \
+    FFF(eee, aaa, bbb, ccc, ddd, X[7], 6);    \
+    FFF(ddd, eee, aaa, bbb, ccc, X[6], 8);    \
+    FFF(ccc, ddd, eee, aaa, bbb, X[2], 13);   \
+    FFF(bbb, ccc, ddd, eee, aaa, X[13], 6);   \
+    FFF(aaa, bbb, ccc, ddd, eee, X[14], 5);   \
+    FFF(eee, aaa, bbb, ccc, ddd, X[0], 15);   \
+    FFF(ddd, eee, aaa, bbb, ccc, X[3], 13);   \
+    FFF(ccc, ddd, eee, aaa, bbb, X[9], 11);   \
+    FFF(bbb, ccc, ddd, eee, aaa, X[11], 11);
+
+static const uint32_t ripemd160_initial_hash_value[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0UL};
+
 static void compress(uint32_t* MDbuf, uint32_t* X)
 {
     uint32_t aa = MDbuf[0], bb = MDbuf[1], cc = MDbuf[2], dd = MDbuf[3], ee = MDbuf[4];
     uint32_t aaa = MDbuf[0], bbb = MDbuf[1], ccc = MDbuf[2], ddd = MDbuf[3], eee = MDbuf[4];
 
-    /* round 1 */
-    FF(aa, bb, cc, dd, ee, X[0], 11);
-    FF(ee, aa, bb, cc, dd, X[1], 14);
-    FF(dd, ee, aa, bb, cc, X[2], 15);
-    FF(cc, dd, ee, aa, bb, X[3], 12);
-    FF(bb, cc, dd, ee, aa, X[4], 5);
-    FF(aa, bb, cc, dd, ee, X[5], 8);
-    FF(ee, aa, bb, cc, dd, X[6], 7);
-    FF(dd, ee, aa, bb, cc, X[7], 9);
-    FF(cc, dd, ee, aa, bb, X[8], 11);
-    FF(bb, cc, dd, ee, aa, X[9], 13);
-    FF(aa, bb, cc, dd, ee, X[10], 14);
-    FF(ee, aa, bb, cc, dd, X[11], 15);
-    FF(dd, ee, aa, bb, cc, X[12], 6);
-    FF(cc, dd, ee, aa, bb, X[13], 7);
-    FF(bb, cc, dd, ee, aa, X[14], 9);
-    FF(aa, bb, cc, dd, ee, X[15], 8);
-
-    /* round 2 */
-    GG(ee, aa, bb, cc, dd, X[7], 7);
-    GG(dd, ee, aa, bb, cc, X[4], 6);
-    GG(cc, dd, ee, aa, bb, X[13], 8);
-    GG(bb, cc, dd, ee, aa, X[1], 13);
-    GG(aa, bb, cc, dd, ee, X[10], 11);
-    GG(ee, aa, bb, cc, dd, X[6], 9);
-    GG(dd, ee, aa, bb, cc, X[15], 7);
-    GG(cc, dd, ee, aa, bb, X[3], 15);
-    GG(bb, cc, dd, ee, aa, X[12], 7);
-    GG(aa, bb, cc, dd, ee, X[0], 12);
-    GG(ee, aa, bb, cc, dd, X[9], 15);
-    GG(dd, ee, aa, bb, cc, X[5], 9);
-    GG(cc, dd, ee, aa, bb, X[2], 11);
-    GG(bb, cc, dd, ee, aa, X[14], 7);
-    GG(aa, bb, cc, dd, ee, X[11], 13);
-    GG(ee, aa, bb, cc, dd, X[8], 12);
-
-    /* round 3 */
-    HH(dd, ee, aa, bb, cc, X[3], 11);
-    HH(cc, dd, ee, aa, bb, X[10], 13);
-    HH(bb, cc, dd, ee, aa, X[14], 6);
-    HH(aa, bb, cc, dd, ee, X[4], 7);
-    HH(ee, aa, bb, cc, dd, X[9], 14);
-    HH(dd, ee, aa, bb, cc, X[15], 9);
-    HH(cc, dd, ee, aa, bb, X[8], 13);
-    HH(bb, cc, dd, ee, aa, X[1], 15);
-    HH(aa, bb, cc, dd, ee, X[2], 14);
-    HH(ee, aa, bb, cc, dd, X[7], 8);
-    HH(dd, ee, aa, bb, cc, X[0], 13);
-    HH(cc, dd, ee, aa, bb, X[6], 6);
-    HH(bb, cc, dd, ee, aa, X[13], 5);
-    HH(aa, bb, cc, dd, ee, X[11], 12);
-    HH(ee, aa, bb, cc, dd, X[5], 7);
-    HH(dd, ee, aa, bb, cc, X[12], 5);
-
-    /* round 4 */
-    II(cc, dd, ee, aa, bb, X[1], 11);
-    II(bb, cc, dd, ee, aa, X[9], 12);
-    II(aa, bb, cc, dd, ee, X[11], 14);
-    II(ee, aa, bb, cc, dd, X[10], 15);
-    II(dd, ee, aa, bb, cc, X[0], 14);
-    II(cc, dd, ee, aa, bb, X[8], 15);
-    II(bb, cc, dd, ee, aa, X[12], 9);
-    II(aa, bb, cc, dd, ee, X[4], 8);
-    II(ee, aa, bb, cc, dd, X[13], 9);
-    II(dd, ee, aa, bb, cc, X[3], 14);
-    II(cc, dd, ee, aa, bb, X[7], 5);
-    II(bb, cc, dd, ee, aa, X[15], 6);
-    II(aa, bb, cc, dd, ee, X[14], 8);
-    II(ee, aa, bb, cc, dd, X[5], 6);
-    II(dd, ee, aa, bb, cc, X[6], 5);
-    II(cc, dd, ee, aa, bb, X[2], 12);
-
-    /* round 5 */
-    JJ(bb, cc, dd, ee, aa, X[4], 9);
-    JJ(aa, bb, cc, dd, ee, X[0], 15);
-    JJ(ee, aa, bb, cc, dd, X[5], 5);
-    JJ(dd, ee, aa, bb, cc, X[9], 11);
-    JJ(cc, dd, ee, aa, bb, X[7], 6);
-    JJ(bb, cc, dd, ee, aa, X[12], 8);
-    JJ(aa, bb, cc, dd, ee, X[2], 13);
-    JJ(ee, aa, bb, cc, dd, X[10], 12);
-    JJ(dd, ee, aa, bb, cc, X[14], 5);
-    JJ(cc, dd, ee, aa, bb, X[1], 12);
-    JJ(bb, cc, dd, ee, aa, X[3], 13);
-    JJ(aa, bb, cc, dd, ee, X[8], 14);
-    JJ(ee, aa, bb, cc, dd, X[11], 11);
-    JJ(dd, ee, aa, bb, cc, X[6], 8);
-    JJ(cc, dd, ee, aa, bb, X[15], 5);
-    JJ(bb, cc, dd, ee, aa, X[13], 6);
-
-    /* parallel round 1 */
-    JJJ(aaa, bbb, ccc, ddd, eee, X[5], 8);
-    JJJ(eee, aaa, bbb, ccc, ddd, X[14], 9);
-    JJJ(ddd, eee, aaa, bbb, ccc, X[7], 9);
-    JJJ(ccc, ddd, eee, aaa, bbb, X[0], 11);
-    JJJ(bbb, ccc, ddd, eee, aaa, X[9], 13);
-    JJJ(aaa, bbb, ccc, ddd, eee, X[2], 15);
-    JJJ(eee, aaa, bbb, ccc, ddd, X[11], 15);
-    JJJ(ddd, eee, aaa, bbb, ccc, X[4], 5);
-    JJJ(ccc, ddd, eee, aaa, bbb, X[13], 7);
-    JJJ(bbb, ccc, ddd, eee, aaa, X[6], 7);
-    JJJ(aaa, bbb, ccc, ddd, eee, X[15], 8);
-    JJJ(eee, aaa, bbb, ccc, ddd, X[8], 11);
-    JJJ(ddd, eee, aaa, bbb, ccc, X[1], 14);
-    JJJ(ccc, ddd, eee, aaa, bbb, X[10], 14);
-    JJJ(bbb, ccc, ddd, eee, aaa, X[3], 12);
-    JJJ(aaa, bbb, ccc, ddd, eee, X[12], 6);
-
-    /* parallel round 2 */
-    III(eee, aaa, bbb, ccc, ddd, X[6], 9);
-    III(ddd, eee, aaa, bbb, ccc, X[11], 13);
-    III(ccc, ddd, eee, aaa, bbb, X[3], 15);
-    III(bbb, ccc, ddd, eee, aaa, X[7], 7);
-    III(aaa, bbb, ccc, ddd, eee, X[0], 12);
-    III(eee, aaa, bbb, ccc, ddd, X[13], 8);
-    III(ddd, eee, aaa, bbb, ccc, X[5], 9);
-    III(ccc, ddd, eee, aaa, bbb, X[10], 11);
-    III(bbb, ccc, ddd, eee, aaa, X[14], 7);
-    III(aaa, bbb, ccc, ddd, eee, X[15], 7);
-    III(eee, aaa, bbb, ccc, ddd, X[8], 12);
-    III(ddd, eee, aaa, bbb, ccc, X[12], 7);
-    III(ccc, ddd, eee, aaa, bbb, X[4], 6);
-    III(bbb, ccc, ddd, eee, aaa, X[9], 15);
-    III(aaa, bbb, ccc, ddd, eee, X[1], 13);
-    III(eee, aaa, bbb, ccc, ddd, X[2], 11);
-
-    /* parallel round 3 */
-    HHH(ddd, eee, aaa, bbb, ccc, X[15], 9);
-    HHH(ccc, ddd, eee, aaa, bbb, X[5], 7);
-    HHH(bbb, ccc, ddd, eee, aaa, X[1], 15);
-    HHH(aaa, bbb, ccc, ddd, eee, X[3], 11);
-    HHH(eee, aaa, bbb, ccc, ddd, X[7], 8);
-    HHH(ddd, eee, aaa, bbb, ccc, X[14], 6);
-    HHH(ccc, ddd, eee, aaa, bbb, X[6], 6);
-    HHH(bbb, ccc, ddd, eee, aaa, X[9], 14);
-    HHH(aaa, bbb, ccc, ddd, eee, X[11], 12);
-    HHH(eee, aaa, bbb, ccc, ddd, X[8], 13);
-    HHH(ddd, eee, aaa, bbb, ccc, X[12], 5);
-    HHH(ccc, ddd, eee, aaa, bbb, X[2], 14);
-    HHH(bbb, ccc, ddd, eee, aaa, X[10], 13);
-    HHH(aaa, bbb, ccc, ddd, eee, X[0], 13);
-    HHH(eee, aaa, bbb, ccc, ddd, X[4], 7);
-    HHH(ddd, eee, aaa, bbb, ccc, X[13], 5);
-
-    /* parallel round 4 */
-    GGG(ccc, ddd, eee, aaa, bbb, X[8], 15);
-    GGG(bbb, ccc, ddd, eee, aaa, X[6], 5);
-    GGG(aaa, bbb, ccc, ddd, eee, X[4], 8);
-    GGG(eee, aaa, bbb, ccc, ddd, X[1], 11);
-    GGG(ddd, eee, aaa, bbb, ccc, X[3], 14);
-    GGG(ccc, ddd, eee, aaa, bbb, X[11], 14);
-    GGG(bbb, ccc, ddd, eee, aaa, X[15], 6);
-    GGG(aaa, bbb, ccc, ddd, eee, X[0], 14);
-    GGG(eee, aaa, bbb, ccc, ddd, X[5], 6);
-    GGG(ddd, eee, aaa, bbb, ccc, X[12], 9);
-    GGG(ccc, ddd, eee, aaa, bbb, X[2], 12);
-    GGG(bbb, ccc, ddd, eee, aaa, X[13], 9);
-    GGG(aaa, bbb, ccc, ddd, eee, X[9], 12);
-    GGG(eee, aaa, bbb, ccc, ddd, X[7], 5);
-    GGG(ddd, eee, aaa, bbb, ccc, X[10], 15);
-    GGG(ccc, ddd, eee, aaa, bbb, X[14], 8);
-
-    /* parallel round 5 */
-    FFF(bbb, ccc, ddd, eee, aaa, X[12], 8);
-    FFF(aaa, bbb, ccc, ddd, eee, X[15], 5);
-    FFF(eee, aaa, bbb, ccc, ddd, X[10], 12);
-    FFF(ddd, eee, aaa, bbb, ccc, X[4], 9);
-    FFF(ccc, ddd, eee, aaa, bbb, X[1], 12);
-    FFF(bbb, ccc, ddd, eee, aaa, X[5], 5);
-    FFF(aaa, bbb, ccc, ddd, eee, X[8], 14);
-    FFF(eee, aaa, bbb, ccc, ddd, X[7], 6);
-    FFF(ddd, eee, aaa, bbb, ccc, X[6], 8);
-    FFF(ccc, ddd, eee, aaa, bbb, X[2], 13);
-    FFF(bbb, ccc, ddd, eee, aaa, X[13], 6);
-    FFF(aaa, bbb, ccc, ddd, eee, X[14], 5);
-    FFF(eee, aaa, bbb, ccc, ddd, X[0], 15);
-    FFF(ddd, eee, aaa, bbb, ccc, X[3], 13);
-    FFF(ccc, ddd, eee, aaa, bbb, X[9], 11);
-    FFF(bbb, ccc, ddd, eee, aaa, X[11], 11);
+    RIPEMD160_ROUNDS
 
     /* combine results */
     ddd += cc + MDbuf[1];
@@ -293,7 +302,9 @@ void ripemd160(const uint8_t* msg, uint32_t msg_len, uint8_t* hash)
 {
     uint32_t i;
     int j;
-    uint32_t digest[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0UL};
+    uint32_t digest[5];
+
+    memcpy(digest, ripemd160_initial_hash_value, sizeof(digest));
 
     for (i = 0; i < (msg_len >> 6); ++i) {
         uint32_t chunk[16];
@@ -335,3 +346,136 @@ void ripemd160(const uint8_t* msg, uint32_t msg_len, uint8_t* hash)
         *(hash++) = digest[i] >> 24;
     }
 }
+
+#define LOAD32_LE(p) ((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8) | ((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[3] << 24))
+#define STORE32_LE(p, v)               \
+    {                                  \
+        (p)[0] = (uint8_t)(v);         \
+        (p)[1] = (uint8_t)((v) >> 8);  \
+        (p)[2] = (uint8_t)((v) >> 16); \
+        (p)[3] = (uint8_t)((v) >> 24); \
+    }
+
+/* a 32 byte message (a sha256 digest) fits into one block with a fixed padding */
+void ripemd160_32(const uint8_t* msg, uint8_t* hash)
+{
+    uint32_t digest[5];
+    uint32_t chunk[16] = {0};
+    int j;
+
+    memcpy(digest, ripemd160_initial_hash_value, sizeof(digest));
+    for (j = 0; j < 8; j++)
+        chunk[j] = LOAD32_LE(msg + 4 * j);
+    chunk[8] = 0x80;
+    chunk[14] = 32 << 3;
+    compress(digest, chunk);
+
+    for (j = 0; j < 5; j++)
+        STORE32_LE(hash + 4 * j, digest[j]);
+}
+
+/*
+ * AVX2: eight 32 byte messages in parallel, one per 32bit lane.
+ * The round macros work on the vector type as they are.
+ */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_RIPEMD160_AVX2
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+typedef uint32_t ripemd160_v8 __attribute__((vector_size(32)));
+
+AVX2_TARGET static void ripemd160_32_avx2_8way(const uint8_t* const msgs[8], uint8_t* const hashes[8])
+{
+    const ripemd160_v8 zero = {0};
+    ripemd160_v8 MDbuf[5], X[16];
+    ripemd160_v8 aa, bb, cc, dd, ee, aaa, bbb, ccc, ddd, eee;
+    int j, l;
+
+    for (j = 0; j < 5; j++)
+        MDbuf[j] = zero + ripemd160_initial_hash_value[j];
+    for (j = 0; j < 8; j++)
+        for (l = 0; l < 8; l++)
+            X[j][l] = LOAD32_LE(msgs[l] + 4 * j);
+    for (j = 8; j < 16; j++)
+        X[j] = zero;
+    X[8] = zero + 0x80;
+    X[14] = zero + (32 << 3);
+
+    aa = aaa = MDbuf[0];
+    bb = bbb = MDbuf[1];
+    cc = ccc = MDbuf[2];
+    dd = ddd = MDbuf[3];
+    ee = eee = MDbuf[4];
+
+    RIPEMD160_ROUNDS
+
+    ddd += cc + MDbuf[1];
+    MDbuf[1] = MDbuf[2] + dd + eee;
+    MDbuf[2] = MDbuf[3] + ee + aaa;
+    MDbuf[3] = MDbuf[4] + aa + bbb;
+    MDbuf[4] = MDbuf[0] + bb + ccc;
+    MDbuf[0] = ddd;
+
+    for (l = 0; l < 8; l++)
+        for (j = 0; j < 5; j++)
+            STORE32_LE(hashes[l] + 4 * j, MDbuf[j][l]);
+}
+#endif
+
+static int ripemd160_use_avx2(void)
+{
+#if defined(HAVE_RIPEMD160_AVX2)
+    /* follows the sha256 backend selection, "scalar" disables both */
+    return sha256_get_backend() != SHA256_BACKEND_SCALAR && sha256_backend_available(SHA256_BACKEND_AVX2);
+#else
+    return 0;
+#endif
+}
+
+void ripemd160_32_many(const uint8_t (*msgs)[32], size_t count, uint8_t (*hashes)[20])
+{
+    size_t i = 0;
+
+#if defined(HAVE_RIPEMD160_AVX2)
+    if (count > 1 && ripemd160_use_avx2()) {
+        static const uint8_t zero_msg[32] = {0};
+        uint8_t dummy_hash[20];
+        const uint8_t* in[8];
+        uint8_t* out[8];
+        int l;
+
+        /* a short last batch fills the idle lanes with a dummy message */
+        for (; i < count; i += 8) {
+            for (l = 0; l < 8; l++) {
+                in[l] = (i + l < count) ? msgs[i + l] : zero_msg;
+                out[l] = (i + l < count) ? hashes[i + l] : dummy_hash;
+            }
+            ripemd160_32_avx2_8way(in, out);
+        }
+        return;
+    }
+#endif
+    for (; i < count; i++)
+        ripemd160_32(msgs[i], hashes[i]);
+}
+
+void btc_hash160(const unsigned char* datain, size_t length, uint160 hashout)
+{
+    uint256 hash;
+    sha256_Raw(datain, length, hash);
+    ripemd160_32(hash, hashout);
+}
+
+void btc_hash160_many(const unsigned char* const datain[], const size_t lengths[], size_t count, uint160 hashout[])
+{
+    /* digests of a part of the messages, keeps the batch on the stack */
+    uint256 hashes[64];
+    size_t i, part;
+
+    for (i = 0; i < count; i += part) {
+        part = (count - i < 64) ? count - i : 64;
+        sha256_many((const uint8_t* const*)datain + i, lengths + i, part, hashes);
+        ripemd160_32_many((const uint8_t(*)[32])hashes, part, hashout + i);
+    }
+    memset(hashes, 0, sizeof(hashes));
+}
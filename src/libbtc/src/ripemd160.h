@@ -25,8 +25,15 @@
 #ifndef __RIPEMD160_H__
 #define __RIPEMD160_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
 void ripemd160(const uint8_t* msg, uint32_t msg_len, uint8_t* hash);
 
+//!ripemd160 of a 32 byte message (single block)
+void ripemd160_32(const uint8_t* msg, uint8_t* hash);
+
+//!ripemd160 of count 32 byte messages, eight in parallel with AVX2
+void ripemd160_32_many(const uint8_t (*msgs)[32], size_t count, uint8_t (*hashes)[20]);
+
 #endif
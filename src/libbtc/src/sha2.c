@@ -29,6 +29,7 @@
  * SUCH DAMAGE.
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include "sha2.h"
@@ -124,6 +125,16 @@ typedef uint64_t sha2_word64; /* Exactly 8 bytes */
     }
 #endif /* BYTE_ORDER == LITTLE_ENDIAN */
 
+/* load/store big endian words from/to byte buffers (no alignment or aliasing requirements) */
+#define LOAD32_BE(p) (((sha2_word32)(p)[0] << 24) | ((sha2_word32)(p)[1] << 16) | ((sha2_word32)(p)[2] << 8) | (sha2_word32)(p)[3])
+#define STORE32_BE(p, v)                   \
+    {                                      \
+        (p)[0] = (sha2_byte)((v) >> 24);   \
+        (p)[1] = (sha2_byte)((v) >> 16);   \
+        (p)[2] = (sha2_byte)((v) >> 8);    \
+        (p)[3] = (sha2_byte)(v);           \
+    }
+
 /*
  * Macro for incrementally adding the unsigned 64-bit integer n to the
  * unsigned 128-bit integer (represented using a two-element array of
@@ -371,26 +382,13 @@ void sha256_Init(SHA256_CTX* context)
 
 /* Unrolled SHA-256 round macros: */
 
-#if BYTE_ORDER == LITTLE_ENDIAN
-
 #define ROUND256_0_TO_15(a, b, c, d, e, f, g, h)                      \
-    REVERSE32(*data++, W256[j]);                                      \
+    W256[j] = LOAD32_BE(data + 4 * j);                                \
     T1 = (h) + Sigma1_256(e) + Ch((e), (f), (g)) + K256[j] + W256[j]; \
     (d) += T1;                                                        \
     (h) = T1 + Sigma0_256(a) + Maj((a), (b), (c));                    \
     j++
 
-
-#else /* BYTE_ORDER == LITTLE_ENDIAN */
-
-#define ROUND256_0_TO_15(a, b, c, d, e, f, g, h)                                  \
-    T1 = (h) + Sigma1_256(e) + Ch((e), (f), (g)) + K256[j] + (W256[j] = *data++); \
-    (d) += T1;                                                                    \
-    (h) = T1 + Sigma0_256(a) + Maj((a), (b), (c));                                \
-    j++
-
-#endif /* BYTE_ORDER == LITTLE_ENDIAN */
-
 #define ROUND256(a, b, c, d, e, f, g, h)                                                                         \
     s0 = W256[(j + 1) & 0x0f];                                                                                   \
     s0 = sigma0_256(s0);                                                                                         \
@@ -401,23 +399,21 @@ void sha256_Init(SHA256_CTX* context)
     (h) = T1 + Sigma0_256(a) + Maj((a), (b), (c));                                                               \
     j++
 
-void sha256_Transform(SHA256_CTX* context, const sha2_word32* data)
+static void sha256_transform_scalar(sha2_word32 state[8], const sha2_byte* data)
 {
     sha2_word32 a, b, c, d, e, f, g, h, s0, s1;
-    sha2_word32 T1, *W256;
+    sha2_word32 T1, W256[16];
     int j;
 
-    W256 = (sha2_word32*)context->buffer;
-
     /* Initialize registers with the prev. intermediate value */
-    a = context->state[0];
-    b = context->state[1];
-    c = context->state[2];
-    d = context->state[3];
-    e = context->state[4];
-    f = context->state[5];
-    g = context->state[6];
-    h = context->state[7];
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    f = state[5];
+    g = state[6];
+    h = state[7];
 
     j = 0;
     do {
@@ -445,50 +441,44 @@ void sha256_Transform(SHA256_CTX* context, const sha2_word32* data)
     } while (j < 64);
 
     /* Compute the current intermediate hash value */
-    context->state[0] += a;
-    context->state[1] += b;
-    context->state[2] += c;
-    context->state[3] += d;
-    context->state[4] += e;
-    context->state[5] += f;
-    context->state[6] += g;
-    context->state[7] += h;
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
 
     /* Clean up */
     a = b = c = d = e = f = g = h = T1 = 0;
+    MEMSET_BZERO(W256, sizeof(W256));
 }
 
 #else /* SHA2_UNROLL_TRANSFORM */
 
-void sha256_Transform(SHA256_CTX* context, const sha2_word32* data)
+static void sha256_transform_scalar(sha2_word32 state[8], const sha2_byte* data)
 {
     sha2_word32 a, b, c, d, e, f, g, h, s0, s1;
-    sha2_word32 T1, T2, *W256;
+    sha2_word32 T1, T2, W256[16];
     int j;
 
-    W256 = (sha2_word32*)context->buffer;
-
     /* Initialize registers with the prev. intermediate value */
-    a = context->state[0];
-    b = context->state[1];
-    c = context->state[2];
-    d = context->state[3];
-    e = context->state[4];
-    f = context->state[5];
-    g = context->state[6];
-    h = context->state[7];
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    f = state[5];
+    g = state[6];
+    h = state[7];
 
     j = 0;
     do {
-#if BYTE_ORDER == LITTLE_ENDIAN
         /* Copy data while converting to host byte order */
-        REVERSE32(*data++, W256[j]);
+        W256[j] = LOAD32_BE(data + 4 * j);
         /* Apply the SHA-256 compression function to update a..h */
         T1 = h + Sigma1_256(e) + Ch(e, f, g) + K256[j] + W256[j];
-#else  /* BYTE_ORDER == LITTLE_ENDIAN */
-        /* Apply the SHA-256 compression function to update a..h with copy */
-        T1 = h + Sigma1_256(e) + Ch(e, f, g) + K256[j] + (W256[j] = *data++);
-#endif /* BYTE_ORDER == LITTLE_ENDIAN */
         T2 = Sigma0_256(a) + Maj(a, b, c);
         h = g;
         g = f;
@@ -526,21 +516,401 @@ void sha256_Transform(SHA256_CTX* context, const sha2_word32* data)
     } while (j < 64);
 
     /* Compute the current intermediate hash value */
-    context->state[0] += a;
-    context->state[1] += b;
-    context->state[2] += c;
-    context->state[3] += d;
-    context->state[4] += e;
-    context->state[5] += f;
-    context->state[6] += g;
-    context->state[7] += h;
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
 
     /* Clean up */
     a = b = c = d = e = f = g = h = T1 = T2 = 0;
+    MEMSET_BZERO(W256, sizeof(W256));
 }
 
 #endif /* SHA2_UNROLL_TRANSFORM */
 
+/*** SHA-256 backends *************************************************/
+/*
+ * The compression function is dispatched at runtime:
+ * - SHA-NI (x86-64 SHA extensions), single buffer
+ * - AVX2, 8 independent messages in parallel (sha256_many only, single
+ *   messages use the scalar code)
+ * - scalar C (reference, all platforms)
+ * The selection is resolved once (on the first use or through
+ * sha256_set_backend) and is process wide.
+ */
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_SHA256_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHANI_TARGET __attribute__((target("sha,sse4.1")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+/* read and written by several threads, only through the __atomic builtins */
+static sha256_backend sha256_active_backend = SHA256_BACKEND_AUTO;
+
+#if defined(HAVE_SHA256_X86)
+static int sha256_cpu_has(sha256_backend backend)
+{
+    unsigned int eax, ebx, ecx, edx, xcr0_lo, xcr0_hi;
+
+    if (__get_cpuid_max(0, NULL) < 7)
+        return 0;
+    __cpuid(1, eax, ebx, ecx, edx);
+    if (backend == SHA256_BACKEND_SHANI) {
+        if (!(ecx & bit_SSE4_1))
+            return 0;
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        return (ebx & (1 << 29)) != 0;
+    }
+    if (backend == SHA256_BACKEND_AVX2) {
+        /* the OS must save the ymm registers */
+        if (!(ecx & bit_OSXSAVE))
+            return 0;
+        __asm__ __volatile__("xgetbv"
+                             : "=a"(xcr0_lo), "=d"(xcr0_hi)
+                             : "c"(0));
+        if ((xcr0_lo & 6) != 6)
+            return 0;
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        return (ebx & (1 << 5)) != 0;
+    }
+    return 0;
+}
+#endif
+
+int sha256_backend_available(sha256_backend backend)
+{
+    switch (backend) {
+    case SHA256_BACKEND_AUTO:
+    case SHA256_BACKEND_SCALAR:
+        return 1;
+    case SHA256_BACKEND_SHANI:
+    case SHA256_BACKEND_AVX2:
+#if defined(HAVE_SHA256_X86)
+        return sha256_cpu_has(backend);
+#else
+        return 0;
+#endif
+    }
+    return 0;
+}
+
+static sha256_backend sha256_best_backend(void)
+{
+    /* SHA-NI hashes a single message about as fast as AVX2 does per message with eight */
+    if (sha256_backend_available(SHA256_BACKEND_SHANI))
+        return SHA256_BACKEND_SHANI;
+    if (sha256_backend_available(SHA256_BACKEND_AVX2))
+        return SHA256_BACKEND_AVX2;
+    return SHA256_BACKEND_SCALAR;
+}
+
+int sha256_set_backend(sha256_backend backend)
+{
+    if (!sha256_backend_available(backend))
+        return 0;
+    __atomic_store_n(&sha256_active_backend, (backend == SHA256_BACKEND_AUTO) ? sha256_best_backend() : backend, __ATOMIC_RELEASE);
+    return 1;
+}
+
+sha256_backend sha256_get_backend(void)
+{
+    sha256_backend backend = __atomic_load_n(&sha256_active_backend, __ATOMIC_ACQUIRE);
+    if (backend == SHA256_BACKEND_AUTO) {
+        /* the first caller selects the backend, a concurrent sha256_set_backend() wins */
+        sha256_backend expected = SHA256_BACKEND_AUTO;
+        backend = sha256_best_backend();
+        if (!__atomic_compare_exchange_n(&sha256_active_backend, &expected, backend, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            backend = expected;
+    }
+    return backend;
+}
+
+const char* sha256_backend_name(sha256_backend backend)
+{
+    switch (backend) {
+    case SHA256_BACKEND_AUTO:
+        return "auto";
+    case SHA256_BACKEND_SCALAR:
+        return "scalar";
+    case SHA256_BACKEND_SHANI:
+        return "sha-ni";
+    case SHA256_BACKEND_AVX2:
+        return "avx2-8way";
+    }
+    return "unknown";
+}
+
+#if defined(HAVE_SHA256_X86)
+
+/* four rounds, msg holds the next four message words */
+#define SHANI_RNDS(k, msg)                                                        \
+    MSG = _mm_add_epi32(msg, _mm_loadu_si128((const __m128i*)&K256[4 * (k)])); \
+    STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);                         \
+    MSG = _mm_shuffle_epi32(MSG, 0x0E);                                          \
+    STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG)
+
+/* message schedule steps */
+#define SHANI_MSG1(prev, cur) prev = _mm_sha256msg1_epu32(prev, cur)
+#define SHANI_MSG2(next, cur, prev) next = _mm_sha256msg2_epu32(_mm_add_epi32(next, _mm_alignr_epi8(cur, prev, 4)), cur)
+
+#define SHANI_LOAD(i) _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16 * (i))), BSWAP)
+
+SHANI_TARGET static void sha256_transform_shani(sha2_word32 state[8], const sha2_byte* data, size_t blocks)
+{
+    const __m128i BSWAP = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i STATE0, STATE1, MSG, TMP, MSG0, MSG1, MSG2, MSG3, ABEF_SAVE, CDGH_SAVE;
+
+    /* a..h to the ABEF/CDGH layout used by sha256rnds2 */
+    TMP = _mm_loadu_si128((const __m128i*)&state[0]);
+    STATE1 = _mm_loadu_si128((const __m128i*)&state[4]);
+    TMP = _mm_shuffle_epi32(TMP, 0xB1);          /* CDAB */
+    STATE1 = _mm_shuffle_epi32(STATE1, 0x1B);    /* EFGH */
+    STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);    /* ABEF */
+    STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0); /* CDGH */
+
+    while (blocks--) {
+        ABEF_SAVE = STATE0;
+        CDGH_SAVE = STATE1;
+
+        MSG0 = SHANI_LOAD(0);
+        SHANI_RNDS(0, MSG0);
+        MSG1 = SHANI_LOAD(1);
+        SHANI_RNDS(1, MSG1);
+        SHANI_MSG1(MSG0, MSG1);
+        MSG2 = SHANI_LOAD(2);
+        SHANI_RNDS(2, MSG2);
+        SHANI_MSG1(MSG1, MSG2);
+        MSG3 = SHANI_LOAD(3);
+        SHANI_RNDS(3, MSG3);
+        SHANI_MSG2(MSG0, MSG3, MSG2);
+        SHANI_MSG1(MSG2, MSG3);
+
+        SHANI_RNDS(4, MSG0);
+        SHANI_MSG2(MSG1, MSG0, MSG3);
+        SHANI_MSG1(MSG3, MSG0);
+        SHANI_RNDS(5, MSG1);
+        SHANI_MSG2(MSG2, MSG1, MSG0);
+        SHANI_MSG1(MSG0, MSG1);
+        SHANI_RNDS(6, MSG2);
+        SHANI_MSG2(MSG3, MSG2, MSG1);
+        SHANI_MSG1(MSG1, MSG2);
+        SHANI_RNDS(7, MSG3);
+        SHANI_MSG2(MSG0, MSG3, MSG2);
+        SHANI_MSG1(MSG2, MSG3);
+
+        SHANI_RNDS(8, MSG0);
+        SHANI_MSG2(MSG1, MSG0, MSG3);
+        SHANI_MSG1(MSG3, MSG0);
+        SHANI_RNDS(9, MSG1);
+        SHANI_MSG2(MSG2, MSG1, MSG0);
+        SHANI_MSG1(MSG0, MSG1);
+        SHANI_RNDS(10, MSG2);
+        SHANI_MSG2(MSG3, MSG2, MSG1);
+        SHANI_MSG1(MSG1, MSG2);
+        SHANI_RNDS(11, MSG3);
+        SHANI_MSG2(MSG0, MSG3, MSG2);
+        SHANI_MSG1(MSG2, MSG3);
+
+        SHANI_RNDS(12, MSG0);
+        SHANI_MSG2(MSG1, MSG0, MSG3);
+        SHANI_MSG1(MSG3, MSG0);
+        SHANI_RNDS(13, MSG1);
+        SHANI_MSG2(MSG2, MSG1, MSG0);
+        SHANI_RNDS(14, MSG2);
+        SHANI_MSG2(MSG3, MSG2, MSG1);
+        SHANI_RNDS(15, MSG3);
+
+        STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+        STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+        data += SHA256_BLOCK_LENGTH;
+    }
+
+    /* back to a..h */
+    TMP = _mm_shuffle_epi32(STATE0, 0x1B);       /* FEBA */
+    STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);    /* DCHG */
+    STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0); /* DCBA */
+    STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);    /* HGFE */
+    _mm_storeu_si128((__m128i*)&state[0], STATE0);
+    _mm_storeu_si128((__m128i*)&state[4], STATE1);
+}
+
+#define AVX2_ROTR(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+#define AVX2_ADD3(x, y, z) _mm256_add_epi32(_mm256_add_epi32(x, y), z)
+#define AVX2_SIGMA0(x) _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(x, 2), AVX2_ROTR(x, 13)), AVX2_ROTR(x, 22))
+#define AVX2_SIGMA1(x) _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(x, 6), AVX2_ROTR(x, 11)), AVX2_ROTR(x, 25))
+#define AVX2_sigma0(x) _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(x, 7), AVX2_ROTR(x, 18)), _mm256_srli_epi32(x, 3))
+#define AVX2_sigma1(x) _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(x, 17), AVX2_ROTR(x, 19)), _mm256_srli_epi32(x, 10))
+#define AVX2_CH(x, y, z) _mm256_xor_si256(_mm256_and_si256(x, y), _mm256_andnot_si256(x, z))
+#define AVX2_MAJ(x, y, z) _mm256_or_si256(_mm256_and_si256(x, y), _mm256_and_si256(z, _mm256_or_si256(x, y)))
+
+/* one block of eight independent messages, st[word][lane] holds the lane states */
+AVX2_TARGET static void sha256_transform_avx2_8way(sha2_word32 st[8][8], const sha2_byte* const blocks[8])
+{
+    __m256i a, b, c, d, e, f, g, h, T1, T2, W[16];
+    int j;
+
+    a = _mm256_loadu_si256((const __m256i*)st[0]);
+    b = _mm256_loadu_si256((const __m256i*)st[1]);
+    c = _mm256_loadu_si256((const __m256i*)st[2]);
+    d = _mm256_loadu_si256((const __m256i*)st[3]);
+    e = _mm256_loadu_si256((const __m256i*)st[4]);
+    f = _mm256_loadu_si256((const __m256i*)st[5]);
+    g = _mm256_loadu_si256((const __m256i*)st[6]);
+    h = _mm256_loadu_si256((const __m256i*)st[7]);
+
+    for (j = 0; j < 64; j++) {
+        if (j < 16) {
+            W[j] = _mm256_set_epi32(LOAD32_BE(blocks[7] + 4 * j), LOAD32_BE(blocks[6] + 4 * j),
+                                    LOAD32_BE(blocks[5] + 4 * j), LOAD32_BE(blocks[4] + 4 * j),
+                                    LOAD32_BE(blocks[3] + 4 * j), LOAD32_BE(blocks[2] + 4 * j),
+                                    LOAD32_BE(blocks[1] + 4 * j), LOAD32_BE(blocks[0] + 4 * j));
+        } else {
+            W[j & 0x0f] = _mm256_add_epi32(AVX2_ADD3(AVX2_sigma1(W[(j + 14) & 0x0f]), W[(j + 9) & 0x0f], AVX2_sigma0(W[(j + 1) & 0x0f])), W[j & 0x0f]);
+        }
+        T1 = _mm256_add_epi32(AVX2_ADD3(h, AVX2_SIGMA1(e), AVX2_CH(e, f, g)), _mm256_add_epi32(_mm256_set1_epi32(K256[j]), W[j & 0x0f]));
+        T2 = _mm256_add_epi32(AVX2_SIGMA0(a), AVX2_MAJ(a, b, c));
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi32(d, T1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi32(T1, T2);
+    }
+
+    _mm256_storeu_si256((__m256i*)st[0], _mm256_add_epi32(a, _mm256_loadu_si256((const __m256i*)st[0])));
+    _mm256_storeu_si256((__m256i*)st[1], _mm256_add_epi32(b, _mm256_loadu_si256((const __m256i*)st[1])));
+    _mm256_storeu_si256((__m256i*)st[2], _mm256_add_epi32(c, _mm256_loadu_si256((const __m256i*)st[2])));
+    _mm256_storeu_si256((__m256i*)st[3], _mm256_add_epi32(d, _mm256_loadu_si256((const __m256i*)st[3])));
+    _mm256_storeu_si256((__m256i*)st[4], _mm256_add_epi32(e, _mm256_loadu_si256((const __m256i*)st[4])));
+    _mm256_storeu_si256((__m256i*)st[5], _mm256_add_epi32(f, _mm256_loadu_si256((const __m256i*)st[5])));
+    _mm256_storeu_si256((__m256i*)st[6], _mm256_add_epi32(g, _mm256_loadu_si256((const __m256i*)st[6])));
+    _mm256_storeu_si256((__m256i*)st[7], _mm256_add_epi32(h, _mm256_loadu_si256((const __m256i*)st[7])));
+}
+
+/* a message in an AVX2 lane: full blocks are read from the message, the padded tail from tail[] */
+typedef struct _sha256_lane {
+    const sha2_byte* data;
+    size_t full_blocks;
+    sha2_byte tail[2 * SHA256_BLOCK_LENGTH];
+    unsigned int tail_blocks;
+    unsigned int tail_used;
+    size_t msg;
+    int active;
+} sha256_lane;
+
+static void sha256_lane_start(sha256_lane* lane, sha2_word32 st[8][8], int l, const sha2_byte* data, size_t len, size_t msg)
+{
+    size_t rem = len % SHA256_BLOCK_LENGTH;
+    sha2_word64 bits = (sha2_word64)len << 3;
+    int w;
+
+    lane->data = data;
+    lane->full_blocks = len / SHA256_BLOCK_LENGTH;
+    lane->tail_blocks = (rem < SHA256_SHORT_BLOCK_LENGTH) ? 1 : 2;
+    lane->tail_used = 0;
+    MEMSET_BZERO(lane->tail, sizeof(lane->tail));
+    if (rem > 0)
+        MEMCPY_BCOPY(lane->tail, data + len - rem, rem);
+    lane->tail[rem] = 0x80;
+    STORE32_BE(lane->tail + lane->tail_blocks * SHA256_BLOCK_LENGTH - 8, (sha2_word32)(bits >> 32));
+    STORE32_BE(lane->tail + lane->tail_blocks * SHA256_BLOCK_LENGTH - 4, (sha2_word32)bits);
+    lane->msg = msg;
+    lane->active = 1;
+
+    for (w = 0; w < 8; w++)
+        st[w][l] = sha256_initial_hash_value[w];
+}
+
+static void sha256_many_avx2(const sha2_byte* const data[], const size_t lens[], size_t count, sha2_byte digests[][SHA256_DIGEST_LENGTH])
+{
+    static const sha2_byte zero_block[SHA256_BLOCK_LENGTH] = {0};
+    sha256_lane lanes[8];
+    sha2_word32 st[8][8];
+    const sha2_byte* blocks[8];
+    int last[8];
+    size_t next = 0;
+    int l, w, active;
+
+    MEMSET_BZERO(st, sizeof(st));
+    for (l = 0; l < 8; l++) {
+        lanes[l].active = 0;
+        if (next < count) {
+            sha256_lane_start(&lanes[l], st, l, data[next], lens[next], next);
+            next++;
+        }
+    }
+
+    do {
+        /* collect the next block of every lane, idle lanes hash a dummy block */
+        for (l = 0; l < 8; l++) {
+            sha256_lane* lane = &lanes[l];
+            last[l] = 0;
+            if (!lane->active) {
+                blocks[l] = zero_block;
+            } else if (lane->full_blocks > 0) {
+                blocks[l] = lane->data;
+                lane->data += SHA256_BLOCK_LENGTH;
+                lane->full_blocks--;
+            } else {
+                blocks[l] = lane->tail + lane->tail_used * SHA256_BLOCK_LENGTH;
+                lane->tail_used++;
+                last[l] = (lane->tail_used == lane->tail_blocks);
+            }
+        }
+
+        sha256_transform_avx2_8way(st, blocks);
+
+        /* write finished digests and refill the lanes */
+        active = 0;
+        for (l = 0; l < 8; l++) {
+            if (last[l]) {
+                for (w = 0; w < 8; w++)
+                    STORE32_BE(digests[lanes[l].msg] + 4 * w, st[w][l]);
+                lanes[l].active = 0;
+                if (next < count) {
+                    sha256_lane_start(&lanes[l], st, l, data[next], lens[next], next);
+                    next++;
+                }
+            }
+            active |= lanes[l].active;
+        }
+    } while (active);
+
+    MEMSET_BZERO(lanes, sizeof(lanes));
+    MEMSET_BZERO(st, sizeof(st));
+}
+
+#endif /* HAVE_SHA256_X86 */
+
+/* compress a number of consecutive blocks into state */
+static void sha256_compress(sha2_word32 state[8], const sha2_byte* data, size_t blocks)
+{
+#if defined(HAVE_SHA256_X86)
+    if (sha256_get_backend() == SHA256_BACKEND_SHANI) {
+        sha256_transform_shani(state, data, blocks);
+        return;
+    }
+#endif
+    while (blocks--) {
+        sha256_transform_scalar(state, data);
+        data += SHA256_BLOCK_LENGTH;
+    }
+}
+
+void sha256_Transform(SHA256_CTX* context, const sha2_word32* data)
+{
+    sha256_compress(context->state, (const sha2_byte*)data, 1);
+}
+
 void sha256_Update(SHA256_CTX* context, const sha2_byte* data, size_t len)
 {
     unsigned int freespace, usedspace;
@@ -561,7 +931,7 @@ void sha256_Update(SHA256_CTX* context, const sha2_byte* data, size_t len)
             context->bitcount += freespace << 3;
             len -= freespace;
             data += freespace;
-            sha256_Transform(context, (sha2_word32*)context->buffer);
+            sha256_compress(context->state, context->buffer, 1);
         } else {
             /* The buffer is not yet full */
             MEMCPY_BCOPY(&context->buffer[usedspace], data, len);
@@ -571,12 +941,13 @@ void sha256_Update(SHA256_CTX* context, const sha2_byte* data, size_t len)
             return;
         }
     }
-    while (len >= SHA256_BLOCK_LENGTH) {
-        /* Process as many complete blocks as we can */
-        sha256_Transform(context, (const sha2_word32*)data);
-        context->bitcount += SHA256_BLOCK_LENGTH << 3;
-        len -= SHA256_BLOCK_LENGTH;
-        data += SHA256_BLOCK_LENGTH;
+    if (len >= SHA256_BLOCK_LENGTH) {
+        /* Process as many complete blocks as we can (in one call, the backend keeps the state in registers) */
+        size_t blocks = len / SHA256_BLOCK_LENGTH;
+        sha256_compress(context->state, data, blocks);
+        context->bitcount += (sha2_word64)blocks * (SHA256_BLOCK_LENGTH << 3);
+        len -= blocks * SHA256_BLOCK_LENGTH;
+        data += blocks * SHA256_BLOCK_LENGTH;
     }
     if (len > 0) {
         /* There's left-overs, so save 'em */
@@ -589,7 +960,6 @@ void sha256_Update(SHA256_CTX* context, const sha2_byte* data, size_t len)
 
 void sha256_Final(sha2_byte digest[], SHA256_CTX* context)
 {
-    sha2_word32* d = (sha2_word32*)digest;
     unsigned int usedspace;
 
     /* If no digest buffer is passed, we don't bother doing this: */
@@ -611,7 +981,7 @@ void sha256_Final(sha2_byte digest[], SHA256_CTX* context)
                     MEMSET_BZERO(&context->buffer[usedspace], SHA256_BLOCK_LENGTH - usedspace);
                 }
                 /* Do second-to-last transform: */
-                sha256_Transform(context, (sha2_word32*)context->buffer);
+                sha256_compress(context->state, context->buffer, 1);
 
                 /* And set-up for the last transform: */
                 MEMSET_BZERO(context->buffer, SHA256_SHORT_BLOCK_LENGTH);
@@ -623,25 +993,19 @@ void sha256_Final(sha2_byte digest[], SHA256_CTX* context)
             /* Begin padding with a 1 bit: */
             *context->buffer = 0x80;
         }
-        /* Set the bit count: */
-        sha2_word64* t = (sha2_word64*)&context->buffer[SHA256_SHORT_BLOCK_LENGTH];
-        *t = context->bitcount;
+        /* Set the bit count (memcpy, the buffer is read as bytes by the transform) */
+        MEMCPY_BCOPY(&context->buffer[SHA256_SHORT_BLOCK_LENGTH], &context->bitcount, sizeof(context->bitcount));
 
         /* Final transform: */
-        sha256_Transform(context, (sha2_word32*)context->buffer);
+        sha256_compress(context->state, context->buffer, 1);
 
-#if BYTE_ORDER == LITTLE_ENDIAN
         {
-            /* Convert TO host byte order */
+            /* Convert TO big endian */
             int j;
             for (j = 0; j < 8; j++) {
-                REVERSE32(context->state[j], context->state[j]);
-                *d++ = context->state[j];
+                STORE32_BE(digest + 4 * j, context->state[j]);
             }
         }
-#else
-        MEMCPY_BCOPY(d, context->state, SHA256_DIGEST_LENGTH);
-#endif
     }
 
     /* Clean up state data: */
@@ -657,6 +1021,20 @@ void sha256_Raw(const sha2_byte* data, size_t len, uint8_t digest[SHA256_DIGEST_
     sha256_Final(digest, &context);
 }
 
+void sha256_many(const uint8_t* const data[], const size_t lens[], size_t count, uint8_t digests[][SHA256_DIGEST_LENGTH])
+{
+    size_t i;
+
+#if defined(HAVE_SHA256_X86)
+    if (count > 1 && sha256_get_backend() == SHA256_BACKEND_AVX2) {
+        sha256_many_avx2(data, lens, count, digests);
+        return;
+    }
+#endif
+    for (i = 0; i < count; i++)
+        sha256_Raw(data[i], lens[i], digests[i]);
+}
+
 
 /*** SHA-512: *********************************************************/
 void sha512_Init(SHA512_CTX* context)
@@ -1023,6 +1401,320 @@ void hmac_sha512(const uint8_t* key, const uint32_t keylen, const uint8_t* msg,
     sha512_Final(hmac, &ctx);
 }
 
+/*** PBKDF2-HMAC-SHA512 ***********************************************/
+/*
+ * The HMAC key blocks are hashed once per passphrase (inner/outer
+ * states), every iteration then needs exactly two compressions: the
+ * 64 byte U value and the digest always fit into one padded block.
+ * With AVX2 up to four passphrases are stretched in lockstep.
+ */
+
+#define LOAD64_BE(p) (((sha2_word64)LOAD32_BE(p) << 32) | (sha2_word64)LOAD32_BE((p) + 4))
+#define PBKDF2_SHA512_LANES 4
+
+/* the padded second block of an HMAC-SHA512 hash over a 64 byte message (128 + 64 bytes in total) */
+#define PBKDF2_SHA512_PAD_WORD 0x8000000000000000ULL
+#define PBKDF2_SHA512_LEN_BITS ((SHA512_BLOCK_LENGTH + SHA512_DIGEST_LENGTH) * 8)
+
+typedef struct _pbkdf2_sha512_key {
+    SHA512_CTX inner; /* state after the ipad block */
+    SHA512_CTX outer; /* state after the opad block */
+} pbkdf2_sha512_key;
+
+static void pbkdf2_sha512_prepare(pbkdf2_sha512_key* k, const uint8_t* pass, size_t passlen)
+{
+    uint8_t buf[SHA512_BLOCK_LENGTH], pad[SHA512_BLOCK_LENGTH];
+    int i;
+
+    memset(buf, 0, sizeof(buf));
+    if (passlen > SHA512_BLOCK_LENGTH)
+        sha512_Raw(pass, passlen, buf);
+    else
+        memcpy(buf, pass, passlen);
+
+    for (i = 0; i < SHA512_BLOCK_LENGTH; i++)
+        pad[i] = buf[i] ^ 0x36;
+    sha512_Init(&k->inner);
+    sha512_Update(&k->inner, pad, SHA512_BLOCK_LENGTH);
+
+    for (i = 0; i < SHA512_BLOCK_LENGTH; i++)
+        pad[i] = buf[i] ^ 0x5c;
+    sha512_Init(&k->outer);
+    sha512_Update(&k->outer, pad, SHA512_BLOCK_LENGTH);
+
+    MEMSET_BZERO(buf, sizeof(buf));
+    MEMSET_BZERO(pad, sizeof(pad));
+}
+
+/* U1 = HMAC(pass, salt || INT(block)) as host order words */
+static void pbkdf2_sha512_first(const pbkdf2_sha512_key* k, const uint8_t* salt, size_t saltlen, uint32_t block, sha2_word64 u[8])
+{
+    SHA512_CTX ctx;
+    uint8_t be[4], digest[SHA512_DIGEST_LENGTH];
+    int i;
+
+    STORE32_BE(be, block);
+    ctx = k->inner;
+    sha512_Update(&ctx, salt, saltlen);
+    sha512_Update(&ctx, be, sizeof(be));
+    sha512_Final(digest, &ctx);
+
+    ctx = k->outer;
+    sha512_Update(&ctx, digest, SHA512_DIGEST_LENGTH);
+    sha512_Final(digest, &ctx);
+
+    for (i = 0; i < 8; i++)
+        u[i] = LOAD64_BE(digest + 8 * i);
+    MEMSET_BZERO(digest, sizeof(digest));
+}
+
+/* one SHA-512 compression over a block given as host order words */
+static void sha512_compress_words(sha2_word64 state[8], const sha2_word64 block[16])
+{
+    sha2_word64 a, b, c, d, e, f, g, h, T1, T2, W[16];
+    int j;
+
+    memcpy(W, block, sizeof(W));
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    f = state[5];
+    g = state[6];
+    h = state[7];
+    for (j = 0; j < 80; j++) {
+        if (j >= 16)
+            W[j & 0x0f] += sigma1_512(W[(j + 14) & 0x0f]) + W[(j + 9) & 0x0f] + sigma0_512(W[(j + 1) & 0x0f]);
+        T1 = h + Sigma1_512(e) + Ch(e, f, g) + K512[j] + W[j & 0x0f];
+        T2 = Sigma0_512(a) + Maj(a, b, c);
+        h = g;
+        g = f;
+        f = e;
+        e = d + T1;
+        d = c;
+        c = b;
+        b = a;
+        a = T1 + T2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+    MEMSET_BZERO(W, sizeof(W));
+}
+
+static void pbkdf2_sha512_block(const pbkdf2_sha512_key* k, const uint8_t* salt, size_t saltlen, uint32_t iterations, uint32_t block, sha2_word64 t[8])
+{
+    sha2_word64 msg[16], st[8];
+    uint32_t r;
+    int i;
+
+    pbkdf2_sha512_first(k, salt, saltlen, block, msg);
+    memcpy(t, msg, 8 * sizeof(sha2_word64));
+
+    /* fixed padding, only msg[0..7] changes per iteration */
+    msg[8] = PBKDF2_SHA512_PAD_WORD;
+    for (i = 9; i < 15; i++)
+        msg[i] = 0;
+    msg[15] = PBKDF2_SHA512_LEN_BITS;
+
+    for (r = 1; r < iterations; r++) {
+        memcpy(st, k->inner.state, sizeof(st));
+        sha512_compress_words(st, msg);
+        memcpy(msg, st, sizeof(st));
+        memcpy(st, k->outer.state, sizeof(st));
+        sha512_compress_words(st, msg);
+        for (i = 0; i < 8; i++) {
+            msg[i] = st[i];
+            t[i] ^= st[i];
+        }
+    }
+    MEMSET_BZERO(msg, sizeof(msg));
+    MEMSET_BZERO(st, sizeof(st));
+}
+
+static void pbkdf2_sha512_store(const sha2_word64 t[8], uint8_t* out, size_t len)
+{
+    uint8_t digest[SHA512_DIGEST_LENGTH];
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        STORE32_BE(digest + 8 * i, (sha2_word32)(t[i] >> 32));
+        STORE32_BE(digest + 8 * i + 4, (sha2_word32)t[i]);
+    }
+    memcpy(out, digest, len);
+    MEMSET_BZERO(digest, sizeof(digest));
+}
+
+#if defined(HAVE_SHA256_X86)
+
+#define AVX2_ROTR64(x, n) _mm256_or_si256(_mm256_srli_epi64(x, n), _mm256_slli_epi64(x, 64 - (n)))
+#define AVX2_XOR3(x, y, z) _mm256_xor_si256(_mm256_xor_si256(x, y), z)
+
+/* four independent compressions, st[word][lane] and w[word][lane] */
+AVX2_TARGET static void sha512_compress_words_avx2_4way(sha2_word64 st[8][PBKDF2_SHA512_LANES], const sha2_word64 w[16][PBKDF2_SHA512_LANES])
+{
+    __m256i a, b, c, d, e, f, g, h, T1, T2, W[16];
+    int j;
+
+    for (j = 0; j < 16; j++)
+        W[j] = _mm256_loadu_si256((const __m256i*)w[j]);
+    a = _mm256_loadu_si256((const __m256i*)st[0]);
+    b = _mm256_loadu_si256((const __m256i*)st[1]);
+    c = _mm256_loadu_si256((const __m256i*)st[2]);
+    d = _mm256_loadu_si256((const __m256i*)st[3]);
+    e = _mm256_loadu_si256((const __m256i*)st[4]);
+    f = _mm256_loadu_si256((const __m256i*)st[5]);
+    g = _mm256_loadu_si256((const __m256i*)st[6]);
+    h = _mm256_loadu_si256((const __m256i*)st[7]);
+
+    for (j = 0; j < 80; j++) {
+        if (j >= 16) {
+            __m256i s0 = AVX2_XOR3(AVX2_ROTR64(W[(j + 1) & 0x0f], 1), AVX2_ROTR64(W[(j + 1) & 0x0f], 8), _mm256_srli_epi64(W[(j + 1) & 0x0f], 7));
+            __m256i s1 = AVX2_XOR3(AVX2_ROTR64(W[(j + 14) & 0x0f], 19), AVX2_ROTR64(W[(j + 14) & 0x0f], 61), _mm256_srli_epi64(W[(j + 14) & 0x0f], 6));
+            W[j & 0x0f] = _mm256_add_epi64(_mm256_add_epi64(W[j & 0x0f], s0), _mm256_add_epi64(s1, W[(j + 9) & 0x0f]));
+        }
+        T1 = _mm256_add_epi64(_mm256_add_epi64(h, AVX2_XOR3(AVX2_ROTR64(e, 14), AVX2_ROTR64(e, 18), AVX2_ROTR64(e, 41))),
+                              _mm256_add_epi64(_mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g)),
+                                               _mm256_add_epi64(_mm256_set1_epi64x((long long)K512[j]), W[j & 0x0f])));
+        T2 = _mm256_add_epi64(AVX2_XOR3(AVX2_ROTR64(a, 28), AVX2_ROTR64(a, 34), AVX2_ROTR64(a, 39)),
+                              _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b))));
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi64(d, T1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi64(T1, T2);
+    }
+
+    _mm256_storeu_si256((__m256i*)st[0], _mm256_add_epi64(a, _mm256_loadu_si256((const __m256i*)st[0])));
+    _mm256_storeu_si256((__m256i*)st[1], _mm256_add_epi64(b, _mm256_loadu_si256((const __m256i*)st[1])));
+    _mm256_storeu_si256((__m256i*)st[2], _mm256_add_epi64(c, _mm256_loadu_si256((const __m256i*)st[2])));
+    _mm256_storeu_si256((__m256i*)st[3], _mm256_add_epi64(d, _mm256_loadu_si256((const __m256i*)st[3])));
+    _mm256_storeu_si256((__m256i*)st[4], _mm256_add_epi64(e, _mm256_loadu_si256((const __m256i*)st[4])));
+    _mm256_storeu_si256((__m256i*)st[5], _mm256_add_epi64(f, _mm256_loadu_si256((const __m256i*)st[5])));
+    _mm256_storeu_si256((__m256i*)st[6], _mm256_add_epi64(g, _mm256_loadu_si256((const __m256i*)st[6])));
+    _mm256_storeu_si256((__m256i*)st[7], _mm256_add_epi64(h, _mm256_loadu_si256((const __m256i*)st[7])));
+}
+
+/* the same output block for up to four keys (unused lanes repeat the last key) */
+static void pbkdf2_sha512_block_4way(const pbkdf2_sha512_key* const k[PBKDF2_SHA512_LANES], const uint8_t* salt, size_t saltlen, uint32_t iterations, uint32_t block, sha2_word64 t[PBKDF2_SHA512_LANES][8])
+{
+    sha2_word64 msg[16][PBKDF2_SHA512_LANES], st[8][PBKDF2_SHA512_LANES], u[8];
+    uint32_t r;
+    int i, l;
+
+    for (l = 0; l < PBKDF2_SHA512_LANES; l++) {
+        pbkdf2_sha512_first(k[l], salt, saltlen, block, u);
+        for (i = 0; i < 8; i++)
+            t[l][i] = msg[i][l] = u[i];
+        msg[8][l] = PBKDF2_SHA512_PAD_WORD;
+        for (i = 9; i < 15; i++)
+            msg[i][l] = 0;
+        msg[15][l] = PBKDF2_SHA512_LEN_BITS;
+    }
+
+    for (r = 1; r < iterations; r++) {
+        for (l = 0; l < PBKDF2_SHA512_LANES; l++)
+            for (i = 0; i < 8; i++)
+                st[i][l] = k[l]->inner.state[i];
+        sha512_compress_words_avx2_4way(st, (const sha2_word64(*)[PBKDF2_SHA512_LANES])msg);
+        memcpy(msg, st, sizeof(st));
+        for (l = 0; l < PBKDF2_SHA512_LANES; l++)
+            for (i = 0; i < 8; i++)
+                st[i][l] = k[l]->outer.state[i];
+        sha512_compress_words_avx2_4way(st, (const sha2_word64(*)[PBKDF2_SHA512_LANES])msg);
+        memcpy(msg, st, sizeof(st));
+        for (l = 0; l < PBKDF2_SHA512_LANES; l++)
+            for (i = 0; i < 8; i++)
+                t[l][i] ^= st[i][l];
+    }
+    MEMSET_BZERO(msg, sizeof(msg));
+    MEMSET_BZERO(st, sizeof(st));
+    MEMSET_BZERO(u, sizeof(u));
+}
+
+#endif /* HAVE_SHA256_X86 */
+
+static int pbkdf2_sha512_use_avx2(void)
+{
+#if defined(HAVE_SHA256_X86)
+    /* forcing the scalar SHA-256 backend also disables the SHA-512 lanes */
+    return sha256_get_backend() != SHA256_BACKEND_SCALAR && sha256_backend_available(SHA256_BACKEND_AVX2);
+#else
+    return 0;
+#endif
+}
+
+int btc_pbkdf2_hmac_sha512(const uint8_t* pass, size_t passlen, const uint8_t* salt, size_t saltlen, uint32_t iterations, uint8_t* key, size_t keylen)
+{
+    uint8_t* keys[1];
+
+    keys[0] = key;
+    return btc_pbkdf2_hmac_sha512_many(&pass, &passlen, 1, salt, saltlen, iterations, keys, keylen);
+}
+
+int btc_pbkdf2_hmac_sha512_many(const uint8_t* const pass[], const size_t passlen[], size_t count, const uint8_t* salt, size_t saltlen, uint32_t iterations, uint8_t* const keys[], size_t keylen)
+{
+    pbkdf2_sha512_key* k;
+    sha2_word64 t[PBKDF2_SHA512_LANES][8];
+    uint32_t blocks = (uint32_t)((keylen + SHA512_DIGEST_LENGTH - 1) / SHA512_DIGEST_LENGTH);
+    uint32_t block;
+    size_t i = 0, l;
+
+    if (count == 0 || keylen == 0)
+        return 1;
+    if (iterations == 0)
+        iterations = 1;
+
+    k = malloc(count * sizeof(*k));
+    if (!k)
+        return 0;
+    for (i = 0; i < count; i++)
+        pbkdf2_sha512_prepare(&k[i], pass[i], passlen[i]);
+
+    i = 0;
+#if defined(HAVE_SHA256_X86)
+    if (count > 1 && pbkdf2_sha512_use_avx2()) {
+        /* groups of four, a remainder of two or three still runs in lanes */
+        for (; i + 1 < count; i += PBKDF2_SHA512_LANES) {
+            const pbkdf2_sha512_key* lk[PBKDF2_SHA512_LANES];
+            size_t n = (count - i < PBKDF2_SHA512_LANES) ? count - i : PBKDF2_SHA512_LANES;
+
+            for (l = 0; l < PBKDF2_SHA512_LANES; l++)
+                lk[l] = &k[i + (l < n ? l : n - 1)];
+            for (block = 1; block <= blocks; block++) {
+                size_t off = (size_t)(block - 1) * SHA512_DIGEST_LENGTH;
+                size_t len = (keylen - off < SHA512_DIGEST_LENGTH) ? keylen - off : SHA512_DIGEST_LENGTH;
+                pbkdf2_sha512_block_4way(lk, salt, saltlen, iterations, block, t);
+                for (l = 0; l < n; l++)
+                    pbkdf2_sha512_store(t[l], keys[i + l] + off, len);
+            }
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        for (block = 1; block <= blocks; block++) {
+            size_t off = (size_t)(block - 1) * SHA512_DIGEST_LENGTH;
+            size_t len = (keylen - off < SHA512_DIGEST_LENGTH) ? keylen - off : SHA512_DIGEST_LENGTH;
+            pbkdf2_sha512_block(&k[i], salt, saltlen, iterations, block, t[0]);
+            pbkdf2_sha512_store(t[0], keys[i] + off, len);
+        }
+    }
+
+    MEMSET_BZERO(t, sizeof(t));
+    MEMSET_BZERO(k, count * sizeof(*k));
+    free(k);
+    return 1;
+}
+
 void btc_hash(const unsigned char* datain, size_t length, uint256 hashout)
 {
     //bitcoin double sha256 hash
@@ -1034,3 +1726,32 @@ void btc_hash_sngl_sha256(const unsigned char* datain, size_t length, uint256 ha
 {
     sha256_Raw((const uint8_t*)datain, length, hashout);
 }
+
+void btc_hash_many(const unsigned char* const datain[], const size_t lengths[], size_t count, uint256 hashout[])
+{
+    //bitcoin double sha256 hash of independent messages
+    const uint8_t** second;
+    size_t* second_lens;
+    size_t i;
+
+    if (count == 0)
+        return;
+
+    sha256_many((const uint8_t* const*)datain, lengths, count, hashout);
+
+    second = malloc(count * sizeof(*second));
+    second_lens = malloc(count * sizeof(*second_lens));
+    if (!second || !second_lens) {
+        /* hash them one by one */
+        for (i = 0; i < count; i++)
+            sha256_Raw(hashout[i], 32, hashout[i]);
+    } else {
+        for (i = 0; i < count; i++) {
+            second[i] = hashout[i];
+            second_lens[i] = 32;
+        }
+        sha256_many(second, second_lens, count, hashout);
+    }
+    free(second);
+    free(second_lens);
+}
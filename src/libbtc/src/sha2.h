@@ -58,6 +58,22 @@ void sha256_Update(SHA256_CTX*, const uint8_t*, size_t);
 void sha256_Final(uint8_t[SHA256_DIGEST_LENGTH], SHA256_CTX*);
 void sha256_Raw(const uint8_t*, size_t, uint8_t[SHA256_DIGEST_LENGTH]);
 
+/* hash count independent messages (data[i], lens[i]) into digests[i] */
+void sha256_many(const uint8_t* const data[], const size_t lens[], size_t count, uint8_t digests[][SHA256_DIGEST_LENGTH]);
+
+/* SHA-256 compression backends, see sha2.c */
+typedef enum {
+    SHA256_BACKEND_AUTO = 0,
+    SHA256_BACKEND_SCALAR, /* portable C */
+    SHA256_BACKEND_SHANI,  /* x86-64 SHA extensions */
+    SHA256_BACKEND_AVX2    /* 8-way multi-buffer for sha256_many, scalar otherwise */
+} sha256_backend;
+
+int sha256_backend_available(sha256_backend backend);
+int sha256_set_backend(sha256_backend backend);
+sha256_backend sha256_get_backend(void);
+const char* sha256_backend_name(sha256_backend backend);
+
 void sha512_Init(SHA512_CTX*);
 void sha512_Update(SHA512_CTX*, const uint8_t*, size_t);
 void sha512_Final(uint8_t[SHA512_DIGEST_LENGTH], SHA512_CTX*);
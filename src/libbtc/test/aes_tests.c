@@ -541,7 +541,7 @@ static const struct nist_aes_test_vector nist_aes_test_vectors_decrypt[] =
     {"ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff", "00000000000000000000000000000000", "4bf85f1b5d54adbc307b0a048389adcb", "00000000000000000000000000000000"},
 };
 
-void test_aes()
+static void test_aes_vectors()
 {
     /* TODO: add more NIST test vectors (non CBC / 128) */
     uint8_t key_bin[128], iv_bin[128], plaintext_bin[65], ciphertext_bin[64];
@@ -599,3 +599,86 @@ void test_aes()
         u_assert_str_eq(tv.out, hexout);
     }
 }
+
+void test_aes()
+{
+    static const aes_backend backends[] = {AES_BACKEND_BYTE, AES_BACKEND_TTABLE, AES_BACKEND_AESNI};
+    uint8_t key[32], iv[N_BLOCK], iv_ref[N_BLOCK], iv_chk[N_BLOCK];
+    uint8_t plain[N_BLOCK * 37], enc_ref[sizeof(plain)], enc[sizeof(plain)], dec[sizeof(plain)];
+    unsigned int i, j, keylen;
+
+    for (i = 0; i < sizeof(plain); i++)
+        plain[i] = (uint8_t)(i * 7 + 3);
+    for (i = 0; i < sizeof(key); i++)
+        key[i] = (uint8_t)(i * 13 + 1);
+    for (i = 0; i < sizeof(iv); i++)
+        iv[i] = (uint8_t)(0xa5 ^ i);
+
+    for (j = 0; j < sizeof(backends) / sizeof(backends[0]); j++) {
+        if (!aes_set_backend(backends[j]))
+            continue;
+        u_assert_int_eq(aes_get_backend(), backends[j]);
+
+        /* NIST vectors */
+        test_aes_vectors();
+
+        /* multi block CBC (incl. in-place) must match the byte reference for all key sizes */
+        for (keylen = 16; keylen <= 32; keylen += 8) {
+            aes_context ctx[1];
+            aes_set_key(key, keylen, ctx);
+
+            aes_set_backend(AES_BACKEND_BYTE);
+            memcpy(iv_ref, iv, N_BLOCK);
+            aes_cbc_encrypt(plain, enc_ref, sizeof(plain) / N_BLOCK, iv_ref, ctx);
+
+            aes_set_backend(backends[j]);
+            memcpy(iv_chk, iv, N_BLOCK);
+            aes_cbc_encrypt(plain, enc, sizeof(plain) / N_BLOCK, iv_chk, ctx);
+            u_assert_mem_eq(enc, enc_ref, sizeof(enc));
+            u_assert_mem_eq(iv_chk, iv_ref, N_BLOCK);
+
+            memcpy(iv_chk, iv, N_BLOCK);
+            aes_cbc_decrypt(enc, dec, sizeof(enc) / N_BLOCK, iv_chk, ctx);
+            u_assert_mem_eq(dec, plain, sizeof(plain));
+            u_assert_mem_eq(iv_chk, iv_ref, N_BLOCK);
+
+            memcpy(iv_chk, iv, N_BLOCK);
+            aes_cbc_decrypt(enc, enc, sizeof(enc) / N_BLOCK, iv_chk, ctx);
+            u_assert_mem_eq(enc, plain, sizeof(plain));
+
+            /* CTR with partial blocks and a counter carry over 64 bits, in-place decryption */
+            size_t ctrlen;
+            for (ctrlen = 1; ctrlen <= sizeof(plain); ctrlen += 37) {
+                memset(iv_ref, 0, N_BLOCK);
+                memset(iv_ref + 7, 0xff, N_BLOCK - 7);
+                aes_set_backend(AES_BACKEND_BYTE);
+                aes_ctr_crypt(plain, enc_ref, ctrlen, iv_ref, ctx);
+
+                aes_set_backend(backends[j]);
+                memset(iv_chk, 0, N_BLOCK);
+                memset(iv_chk + 7, 0xff, N_BLOCK - 7);
+                aes_ctr_crypt(plain, enc, ctrlen, iv_chk, ctx);
+                u_assert_mem_eq(enc, enc_ref, ctrlen);
+                u_assert_mem_eq(iv_chk, iv_ref, N_BLOCK);
+
+                memset(iv_chk, 0, N_BLOCK);
+                memset(iv_chk + 7, 0xff, N_BLOCK - 7);
+                aes_ctr_crypt(enc, enc, ctrlen, iv_chk, ctx);
+                u_assert_mem_eq(enc, plain, ctrlen);
+            }
+        }
+
+        /* NIST SP 800-38A F.5.5 CTR-AES256.Encrypt */
+        {
+            aes_context ctx[1];
+            uint8_t ctr[N_BLOCK];
+            aes_set_key(utils_hex_to_uint8("603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4"), 32, ctx);
+            memcpy(ctr, utils_hex_to_uint8("f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff"), N_BLOCK);
+            memcpy(dec, utils_hex_to_uint8("6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e5130c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710"), 64);
+            aes_ctr_crypt(dec, enc, 64, ctr, ctx);
+            u_assert_mem_eq(enc, utils_hex_to_uint8("601ec313775789a5b7a7f504bbf3d228f443e3ca4d62b59aca84e990cacaf5c52b0930daa23de94ce87017ba2d84988ddfc9c58db67aada613c2dd08457941a6"), 64);
+            u_assert_mem_eq(ctr, utils_hex_to_uint8("f0f1f2f3f4f5f6f7f8f9fafbfcfdff03"), N_BLOCK);
+        }
+    }
+    aes_set_backend(AES_BACKEND_AUTO);
+}
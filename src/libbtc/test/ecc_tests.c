@@ -61,4 +61,70 @@ void test_ecc()
     u_assert_int_eq(btc_ecc_compact_to_der_normalized(sigcomp, sigder, &sigderlen),  true);
     u_assert_int_eq(outlen, sigderlen);
     u_assert_int_eq(memcmp(sig,sigder,sigderlen), 0);
+
+    /* pooled contexts (one more than the pool holds gets the shared context) */
+    btc_ecc_context* ctxs[BTC_ECC_CONTEXT_POOL_SIZE + 1];
+    btc_pubkey pubkey;
+    btc_pubkey_init(&pubkey);
+    btc_pubkey_from_key(&key, &pubkey);
+    unsigned int i, j;
+    for (i = 0; i < BTC_ECC_CONTEXT_POOL_SIZE + 1; i++) {
+        ctxs[i] = btc_ecc_context_acquire();
+        u_assert_int_eq(ctxs[i] != NULL, 1);
+        for (j = 0; j < i; j++)
+            u_assert_int_eq(ctxs[i] != ctxs[j], 1);
+
+        uint8_t pub_ctx[33];
+        size_t pub_ctx_len = 33;
+        btc_ecc_get_pubkey_ctx(ctxs[i], key.privkey, pub_ctx, &pub_ctx_len, true);
+        u_assert_mem_eq(pub_ctx, pubkey.pubkey, 33);
+
+        outlen = 74;
+        u_assert_int_eq(btc_ecc_sign_ctx(ctxs[i], key.privkey, hash, sig, &outlen), true);
+        u_assert_int_eq(btc_ecc_verify_sig_ctx(ctxs[i], pubkey.pubkey, true, hash, sig, outlen), true);
+        u_assert_int_eq(btc_ecc_verify_sig(pubkey.pubkey, true, hash, sig, outlen), true);
+        sig[outlen - 1] ^= 1;
+        u_assert_int_eq(btc_ecc_verify_sig_ctx(ctxs[i], pubkey.pubkey, true, hash, sig, outlen), false);
+    }
+    for (i = 0; i < BTC_ECC_CONTEXT_POOL_SIZE + 1; i++)
+        btc_ecc_context_release(ctxs[i]);
+
+    /* released contexts are reused */
+    btc_ecc_context* reused = btc_ecc_context_acquire();
+    u_assert_int_eq(reused == ctxs[0], 1);
+    btc_ecc_context_release(reused);
+
+    /* batch verification, two keys, the first one used twice */
+    btc_key key2;
+    btc_privkey_init(&key2);
+    btc_privkey_gen(&key2);
+    btc_pubkey pubkey2;
+    btc_pubkey_init(&pubkey2);
+    btc_pubkey_from_key(&key2, &pubkey2);
+
+    uint8_t hashes[3][32];
+    unsigned char sigs[3][64];
+    const uint8_t* batch_pubkeys[3] = {pubkey.pubkey, pubkey.pubkey, pubkey2.pubkey};
+    const uint8_t* batch_hashes[3] = {hashes[0], hashes[1], hashes[2]};
+    const unsigned char* batch_sigs[3] = {sigs[0], sigs[1], sigs[2]};
+    btc_bool batch_results[3];
+    for (i = 0; i < 3; i++) {
+        memcpy(hashes[i], hash, 32);
+        hashes[i][0] ^= (uint8_t)i;
+        outlen = 64;
+        u_assert_int_eq(btc_key_sign_hash_compact(i < 2 ? &key : &key2, hashes[i], sigs[i], &outlen), true);
+    }
+    u_assert_int_eq(btc_ecc_verify_batch(batch_pubkeys, true, batch_hashes, batch_sigs, 3, batch_results), true);
+    for (i = 0; i < 3; i++)
+        u_assert_int_eq(batch_results[i], true);
+    u_assert_int_eq(btc_ecc_verify_batch(batch_pubkeys, true, batch_hashes, batch_sigs, 0, NULL), true);
+
+    /* a signature for a wrong hash and a signature of the wrong key */
+    hashes[1][31] ^= 1;
+    batch_pubkeys[2] = pubkey.pubkey;
+    u_assert_int_eq(btc_ecc_verify_batch(batch_pubkeys, true, batch_hashes, batch_sigs, 3, batch_results), false);
+    u_assert_int_eq(batch_results[0], true);
+    u_assert_int_eq(batch_results[1], false);
+    u_assert_int_eq(batch_results[2], false);
+    btc_privkey_cleanse(&key2);
 }
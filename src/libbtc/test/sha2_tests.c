@@ -9,6 +9,9 @@
 #include <string.h>
 #include <assert.h>
 
+#include <btc/hash.h>
+
+#include "ripemd160.h"
 #include "sha2.h"
 #include "utils.h"
 
@@ -410,7 +413,7 @@ static const struct sha_hmac_test_v sha_hmac_test_vectors[] =
         {373, 142, 64, "8a0349d4d1ed8c4af533e9e83468b5859bb68237798038171346684499c9dc2b5970730533eb2ca04d1680630820f58d32ecf0bd7db7cab72ffc27651c94831cd1220e2113aeba6c889092abb3904d8a264b2332f2d9df0f63ac36d7eabb57c85be0c331587f5f330d69c7c91f00e606de9bc49ec22c9ea815203ca2ed867fb65d743a3beca6427f4669c9c432b7", "035f55033df01f670015a828eff154a245e8ca7474b0b3330cabbe5fdd74e89560b8fa075347532aa46ae7ae907888b30ca4653a6419d0d9224944b43181a6a842c1cbc96fcc3b0f1e7b344c2956f2613c652eb27e44e5d773765a9521fb5e0c7125cf31d9a75f7f38ef96ea01b61b159cd52fc4095a7a94c7db0aeaf40a9929", "3780ef695742f09a160c8dd7d35e2758b08284e8150934d222db31df2767d40d7c815c526ecee5f787030c8dc5f050c419ec6ea7563650dcce1480892d3088e6"},
         {374, 142, 64, "f78343071f61ee7d9f791bd53132e6d557928bcfe4b214bebf6f3592e46374c7ab148c3c4d6a1443a4675cf4321298c865b440631947b6b05f2c2a337d1cbb9b3661de974b4604eb41cc77c3659e85470e47e16f22a34619db935d59cbf5e1101ed401c020db069eff1035e9d1bff77bd8b3379e05ac0c20bc0e98aad7d7304dedd3bc5ed4136184649b5e0f7e5b", "d63b50b54e1536e35d5f3c6e29f1e49a78ca43fa22b31232c71f0300bd56517e4cd29ba11ee9f206f1ad31ee8f118c87004d6c6dfe837b70a9a2fa987c8b5b6680720c5dbf8791c1fcd6d59fa16cc20df9bc0fb39f41598a376476e45b9f06add8e34af01b373a9ce6a3d189484cacb6cbe0d3d5ef34d709d72c1dee43dc79da", "086f674d778db491e73b6fbc5126233c6b6e1f066963356d49ea386d9c0868ad25bf6edad0371cde87cea94a18c6dba47535dfce2e40d2246ab17980495d656c"}};
 
-void test_sha_256()
+static void test_sha_256_vectors()
 {
     uint8_t buf[SHA256_DIGEST_LENGTH];
     uint8_t* digest_out; /* use non thread save buffer (optimized for embedded systems) */
@@ -445,6 +448,43 @@ void test_sha_256()
     }
 }
 
+void test_sha_256()
+{
+    static const sha256_backend backends[] = {SHA256_BACKEND_SCALAR, SHA256_BACKEND_SHANI, SHA256_BACKEND_AVX2};
+    uint8_t msgs[300];
+    const uint8_t* data[37];
+    size_t lens[37];
+    uint8_t digests[37][SHA256_DIGEST_LENGTH];
+    uint8_t expected[SHA256_DIGEST_LENGTH];
+    unsigned int i, j, count;
+
+    for (i = 0; i < sizeof(msgs); i++)
+        msgs[i] = (uint8_t)(i * 31 + 7);
+
+    for (j = 0; j < sizeof(backends) / sizeof(backends[0]); j++) {
+        if (!sha256_set_backend(backends[j]))
+            continue;
+        assert(sha256_get_backend() == backends[j]);
+
+        /* NIST vectors */
+        test_sha_256_vectors();
+
+        /* batches of different sizes with messages around the padding boundaries */
+        for (count = 0; count <= 37; count += 6) {
+            for (i = 0; i < count; i++) {
+                lens[i] = (i * 23) % 140;
+                data[i] = msgs + (i * 5) % 100;
+            }
+            sha256_many(data, lens, count, digests);
+            for (i = 0; i < count; i++) {
+                sha256_Raw(data[i], lens[i], expected);
+                assert(memcmp(digests[i], expected, SHA256_DIGEST_LENGTH) == 0);
+            }
+        }
+    }
+    sha256_set_backend(SHA256_BACKEND_AUTO);
+}
+
 void test_sha_512()
 {
     uint8_t buf[SHA512_DIGEST_LENGTH];
@@ -507,6 +547,69 @@ void test_sha_hmac()
     }
 }
 
+void test_pbkdf2_hmac_sha512()
+{
+    static const struct {
+        const char* pass;
+        const char* salt;
+        uint32_t iterations;
+        size_t keylen;
+        const char* key_hex;
+    } vectors[] = {
+        {"password", "salt", 1, 64, "867f70cf1ade02cff3752599a3a53dc4af34c7a669815ae5d513554e1c8cf252c02d470a285a0501bad999bfe943c08f050235d7d68b1da55e63f73b60a57fce"},
+        {"password", "salt", 2, 64, "e1d9c16aa681708a45f5c7c4e215ceb66e011a2e9f0040713f18aefdb866d53cf76cab2868a39b9f7840edce4fef5a82be67335c77a6068e04112754f27ccf4e"},
+        {"password", "salt", 4096, 64, "d197b1b33db0143e018b12f3d1d1479e6cdebdcc97c5c0f87f6902e072f457b5143f30602641b3d55cd335988cb36b84376060ecd532e039b742a239434af2d5"},
+        {"passwordPASSWORDpassword", "saltSALTsaltSALTsaltSALTsaltSALTsalt", 4096, 100, "8c0511f4c6e597c6ac6315d8f0362e225f3c501495ba23b868c005174dc4ee71115b59f9e60cd9532fa33e0f75aefe30225c583a186cd82bd4daea9724a3d3b804f75bdd41494fa324cab24bcc680fb3b96a30cf5d21fac3c2875913919f3399b1d9ce7e"},
+    };
+    static const sha256_backend backends[] = {SHA256_BACKEND_SCALAR, SHA256_BACKEND_SHANI, SHA256_BACKEND_AVX2};
+    uint8_t key[100];
+    unsigned int i, b;
+
+    for (b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+        if (!sha256_set_backend(backends[b]))
+            continue;
+
+        for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+            btc_pbkdf2_hmac_sha512((const uint8_t*)vectors[i].pass, strlen(vectors[i].pass), (const uint8_t*)vectors[i].salt, strlen(vectors[i].salt), vectors[i].iterations, key, vectors[i].keylen);
+            assert(memcmp(key, utils_hex_to_uint8(vectors[i].key_hex), vectors[i].keylen) == 0);
+        }
+
+        /* batches of 1..7 passphrases (incl. one longer than the block size) against the single variant */
+        uint8_t pass[7][150];
+        const uint8_t* passes[7];
+        size_t passlens[7];
+        uint8_t keys[7][100], single[100];
+        uint8_t* keyptrs[7];
+        size_t count, j;
+        for (j = 0; j < 7; j++) {
+            passlens[j] = (j == 3) ? 150 : j * 11 + 1;
+            memset(pass[j], 'a' + (int)j, passlens[j]);
+            passes[j] = pass[j];
+            keyptrs[j] = keys[j];
+        }
+        for (count = 1; count <= 7; count++) {
+            assert(btc_pbkdf2_hmac_sha512_many(passes, passlens, count, (const uint8_t*)"salt", 4, 33, keyptrs, 100) == 1);
+            for (j = 0; j < count; j++) {
+                btc_pbkdf2_hmac_sha512(passes[j], passlens[j], (const uint8_t*)"salt", 4, 33, single, 100);
+                assert(memcmp(keys[j], single, 100) == 0);
+            }
+        }
+    }
+    sha256_set_backend(SHA256_BACKEND_AUTO);
+
+    /* the scalar path is the reference for the lanes */
+    {
+        const uint8_t* passes[3] = {(const uint8_t*)"password", (const uint8_t*)"password", (const uint8_t*)"passwordPASSWORDpassword"};
+        size_t passlens[3] = {8, 8, 24};
+        uint8_t keys[3][64];
+        uint8_t* keyptrs[3] = {keys[0], keys[1], keys[2]};
+        btc_pbkdf2_hmac_sha512_many(passes, passlens, 3, (const uint8_t*)"salt", 4, 4096, keyptrs, 64);
+        assert(memcmp(keys[0], utils_hex_to_uint8(vectors[2].key_hex), 64) == 0);
+        assert(memcmp(keys[1], utils_hex_to_uint8(vectors[2].key_hex), 64) == 0);
+        assert(memcmp(keys[2], utils_hex_to_uint8("c6146060b415145427998c0b539811c809b2b7a8bdf054243ac67bab9411ee9d6f7f9c1135e7fdb6b5b5ba85a0262165155d0f3fd965b3547a2713f98690166f"), 64) == 0);
+    }
+}
+
 void test_bitcoin_hash()
 {
     const char data[] = "cea946542b91ca50e2afecba73cf546ce1383d82668ecb6265f79ffaa07daa49abb43e21a19c6b2b15c8882b4bc01085a8a5b00168139dcb8f4b2bbe22929ce196d43532898d98a3b0ea4d63112ba25e724bb50711e3cf55954cf30b4503b73d785253104c2df8c19b5b63e92bd6b1ff2573751ec9c508085f3f206c719aa4643776bf425344348cbf63f1450389";
@@ -516,6 +619,68 @@ void test_bitcoin_hash()
     digest_expected = utils_hex_to_uint8(expected);
 
     uint8_t hashout[32];
-    btc_hash(data, strlen(data), hashout);
+    btc_hash((const unsigned char*)data, strlen(data), hashout);
     assert(memcmp(hashout, digest_expected, 32) == 0);
-}
\ No newline at end of file
+
+    /* batch of prefixes of data */
+    const unsigned char* datain[20];
+    size_t lengths[20];
+    uint256 hashes[20];
+    unsigned int i;
+    for (i = 0; i < 20; i++) {
+        datain[i] = (const unsigned char*)data;
+        lengths[i] = (i == 19) ? strlen(data) : i * 7;
+    }
+    btc_hash_many(datain, lengths, 20, hashes);
+    for (i = 0; i < 20; i++) {
+        btc_hash((const unsigned char*)data, lengths[i], hashout);
+        assert(memcmp(hashes[i], hashout, 32) == 0);
+    }
+    assert(memcmp(hashes[19], digest_expected, 32) == 0);
+}
+
+void test_hash160()
+{
+    /* ripemd160 reference vectors */
+    uint8_t hash160[20];
+    ripemd160((const uint8_t*)"", 0, hash160);
+    assert(memcmp(hash160, utils_hex_to_uint8("9c1185a5c5e9fc54612808977ee8f548b2258d31"), 20) == 0);
+    ripemd160((const uint8_t*)"abc", 3, hash160);
+    assert(memcmp(hash160, utils_hex_to_uint8("8eb208f7e05d987a9b044a8e98c6b087f15a0bfc"), 20) == 0);
+
+    /* hash160 of the generator point (compressed) */
+    uint8_t pubkey[33];
+    memcpy(pubkey, utils_hex_to_uint8("0279be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798"), 33);
+    btc_hash160(pubkey, 33, hash160);
+    assert(memcmp(hash160, utils_hex_to_uint8("751e76e8199196d454941c45d1b3a323f1433bd6"), 20) == 0);
+
+    /* the single block path matches the generic one */
+    uint8_t digest[32], expected[20];
+    sha256_Raw(pubkey, 33, digest);
+    ripemd160(digest, 32, expected);
+    ripemd160_32(digest, hash160);
+    assert(memcmp(hash160, expected, 20) == 0);
+
+    /* batches with a partial last round of lanes, with every available backend */
+    const sha256_backend backends[] = {SHA256_BACKEND_SCALAR, SHA256_BACKEND_SHANI, SHA256_BACKEND_AVX2};
+    const unsigned char* datain[19];
+    size_t lengths[19];
+    uint160 hashes[19];
+    unsigned int i, b;
+    for (i = 0; i < 19; i++) {
+        datain[i] = pubkey;
+        lengths[i] = 33 - i;
+    }
+    for (b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+        if (!sha256_set_backend(backends[b]))
+            continue;
+        memset(hashes, 0, sizeof(hashes));
+        btc_hash160_many(datain, lengths, 19, hashes);
+        for (i = 0; i < 19; i++) {
+            sha256_Raw(pubkey, lengths[i], digest);
+            ripemd160(digest, 32, expected);
+            assert(memcmp(hashes[i], expected, 20) == 0);
+        }
+    }
+    sha256_set_backend(SHA256_BACKEND_AUTO);
+}
@@ -38,7 +38,9 @@ extern void test_random();
 extern void test_sha_256();
 extern void test_sha_512();
 extern void test_sha_hmac();
+extern void test_pbkdf2_hmac_sha512();
 extern void test_bitcoin_hash();
+extern void test_hash160();
 extern void test_base58check();
 extern void test_bip32();
 extern void test_ecc();
@@ -69,7 +71,9 @@ int main()
     u_run_test(test_sha_256);
     u_run_test(test_sha_512);
     u_run_test(test_sha_hmac);
+    u_run_test(test_pbkdf2_hmac_sha512);
     u_run_test(test_bitcoin_hash);
+    u_run_test(test_hash160);
     u_run_test(test_base58check);
     u_run_test(test_utils);
     u_run_test(test_aes);
@@ -2,105 +2,139 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
-#include <stdio.h>
+#include "crypto.h"
+
+#include <stdint.h>
 #include <string>
 
-static const std::string base64_chars =
+static const char base64_chars[] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
     "abcdefghijklmnopqrstuvwxyz"
     "0123456789+/";
 
+#define BASE64_INVALID 0xff
+
+// character -> 6 bit value, BASE64_INVALID for everything outside the alphabet (incl. '=')
+static const unsigned char base64_values[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+size_t base64_encoded_size(size_t len)
+{
+    return (len + 2) / 3 * 4;
+}
 
-static inline bool is_base64(unsigned char c)
+size_t base64_decoded_max_size(size_t len)
 {
-    return (isalnum(c) || (c == '+') || (c == '/'));
+    size_t rest = len % 4;
+    return len / 4 * 3 + (rest > 1 ? rest - 1 : 0);
 }
 
-std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len)
+size_t base64_encode(const unsigned char* in, size_t len, char* out)
 {
-    std::string ret;
-    int i = 0;
-    int j = 0;
-    unsigned char char_array_3[3];
-    unsigned char char_array_4[4];
-
-    while (in_len--) {
-        char_array_3[i++] = *(bytes_to_encode++);
-        if (i == 3) {
-            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-            char_array_4[3] = char_array_3[2] & 0x3f;
-
-            for (i = 0; (i < 4); i++)
-                ret += base64_chars[char_array_4[i]];
-            i = 0;
-        }
+    char* start = out;
+    size_t i = 0;
+
+    for (; i + 3 <= len; i += 3) {
+        uint32_t v = ((uint32_t)in[i] << 16) | ((uint32_t)in[i + 1] << 8) | in[i + 2];
+        out[0] = base64_chars[(v >> 18) & 0x3f];
+        out[1] = base64_chars[(v >> 12) & 0x3f];
+        out[2] = base64_chars[(v >> 6) & 0x3f];
+        out[3] = base64_chars[v & 0x3f];
+        out += 4;
     }
 
-    if (i) {
-        for (j = i; j < 3; j++)
-            char_array_3[j] = '\0';
-
-        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-        char_array_4[3] = char_array_3[2] & 0x3f;
+    if (i < len) {
+        uint32_t v = (uint32_t)in[i] << 16;
+        if (i + 1 < len)
+            v |= (uint32_t)in[i + 1] << 8;
+        out[0] = base64_chars[(v >> 18) & 0x3f];
+        out[1] = base64_chars[(v >> 12) & 0x3f];
+        out[2] = (i + 1 < len) ? base64_chars[(v >> 6) & 0x3f] : '=';
+        out[3] = '=';
+        out += 4;
+    }
+    return out - start;
+}
 
-        for (j = 0; (j < i + 1); j++)
-            ret += base64_chars[char_array_4[j]];
+bool base64_decode(const char* in, size_t len, unsigned char* out, size_t* outLen)
+{
+    const unsigned char* s = (const unsigned char*)in;
+    unsigned char* start = out;
+    size_t i = 0;
+
+    // full quanta, one check per 4 characters
+    for (; i + 4 <= len; i += 4) {
+        unsigned char a = base64_values[s[i]], b = base64_values[s[i + 1]];
+        unsigned char c = base64_values[s[i + 2]], d = base64_values[s[i + 3]];
+        if ((a | b | c | d) & 0x80)
+            break; // padding or invalid input, handled below
+
+        uint32_t v = ((uint32_t)a << 18) | ((uint32_t)b << 12) | ((uint32_t)c << 6) | d;
+        out[0] = (unsigned char)(v >> 16);
+        out[1] = (unsigned char)(v >> 8);
+        out[2] = (unsigned char)v;
+        out += 3;
+    }
 
-        while ((i++ < 3))
-            ret += '=';
+    // last (partial) quantum, the data ends at the first '=' (anything behind it is ignored)
+    uint32_t v = 0;
+    int n = 0;
+    for (; i < len && s[i] != '='; i++) {
+        unsigned char c = base64_values[s[i]];
+        if (c == BASE64_INVALID)
+            return false;
+        v = (v << 6) | c;
+        if (++n == 4) {
+            out[0] = (unsigned char)(v >> 16);
+            out[1] = (unsigned char)(v >> 8);
+            out[2] = (unsigned char)v;
+            out += 3;
+            v = 0;
+            n = 0;
+        }
     }
+    if (n == 3) {
+        out[0] = (unsigned char)(v >> 10);
+        out[1] = (unsigned char)(v >> 2);
+        out += 2;
+    } else if (n == 2)
+        *out++ = (unsigned char)(v >> 4);
+    // a single leftover character doesn't carry a full byte
+
+    *outLen = out - start;
+    return true;
+}
 
+std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len)
+{
+    std::string ret(base64_encoded_size(in_len), '\0');
+    if (!ret.empty())
+        base64_encode(bytes_to_encode, in_len, &ret[0]);
     return ret;
 }
 
 std::string base64_decode(std::string const& encoded_string)
 {
-    int in_len = encoded_string.size();
-    int i = 0;
-    int j = 0;
-    int in_ = 0;
-    unsigned char char_array_4[4], char_array_3[3];
-    std::string ret;
-
-    while (in_len-- && (encoded_string[in_] != '=')) {
-
-        if (!is_base64(encoded_string[in_]))
-            return std::string();
-
-        char_array_4[i++] = encoded_string[in_];
-        in_++;
-        if (i == 4) {
-            for (i = 0; i < 4; i++)
-                char_array_4[i] = base64_chars.find(char_array_4[i]);
-
-            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-            for (i = 0; (i < 3); i++)
-                ret += char_array_3[i];
-            i = 0;
-        }
-    }
-
-    if (i) {
-        for (j = i; j < 4; j++)
-            char_array_4[j] = 0;
-
-        for (j = 0; j < 4; j++)
-            char_array_4[j] = base64_chars.find(char_array_4[j]);
-
-        char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-        char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-        char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-        for (j = 0; (j < i - 1); j++)
-            ret += char_array_3[j];
-    }
-
+    std::string ret(base64_decoded_max_size(encoded_string.size()), '\0');
+    size_t len = 0;
+    if (ret.empty() || !base64_decode(encoded_string.data(), encoded_string.size(), (unsigned char*)&ret[0], &len))
+        return std::string();
+    ret.resize(len);
     return ret;
 }
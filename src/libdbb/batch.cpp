@@ -0,0 +1,89 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "dbb.h"
+
+#include <chrono>
+#include <stdexcept>
+
+#include "univalue.h"
+
+namespace DBB
+{
+// amount of data items of a {"sign" : {"data" : [...]}} command, 0 for other commands
+static unsigned int signInputs(const std::string& json)
+{
+    UniValue cmd;
+    if (!cmd.read(json) || !cmd.isObject())
+        return 0;
+
+    UniValue data = find_value(find_value(cmd, "sign"), "data");
+    return data.isArray() ? data.size() : 0;
+}
+
+CommandBatch::CommandBatch(DeviceSession& sessionIn) : session(sessionIn)
+{
+}
+
+void CommandBatch::add(const std::string& json, const std::string& password, CommandCallback callback)
+{
+    Entry entry;
+    entry.json = json;
+    entry.password = password;
+    entry.callback = callback;
+    entries.push_back(entry);
+}
+
+size_t CommandBatch::size()
+{
+    return entries.size();
+}
+
+bool CommandBatch::execute()
+{
+    bool success = true;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (Entry& entry : entries) {
+        CommandResult result;
+        std::string cmdOut;
+
+        stats.commands++;
+        stats.inputs += signInputs(entry.json);
+
+        if (entry.password.empty()) {
+            if (session.sendCommand(entry.json, cmdOut))
+                result.status = DBB_CMD_OK;
+            result.result = cmdOut;
+        }
+        else {
+            std::string base64str;
+            try {
+                if (encryptAndEncodeCommand(entry.json, entry.password, base64str) && session.sendCommand(base64str, cmdOut)) {
+                    if (decryptAndDecodeCommand(cmdOut, entry.password, result.result))
+                        result.status = DBB_CMD_OK;
+                    else
+                        result.result = cmdOut; // wrong password or a broken response
+                }
+            }
+            catch (const std::exception& ex) {
+                // report the undecryptable response
+                result.result = cmdOut;
+            }
+        }
+
+        if (result.status != DBB_CMD_OK)
+            success = false;
+
+        entry.callback(result);
+    }
+    stats.elapsedMicros += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    entries.clear();
+    return success;
+}
+
+BatchStats CommandBatch::getStats()
+{
+    return stats;
+}
+} //end namespace DBB
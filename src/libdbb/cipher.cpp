@@ -0,0 +1,442 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "dbb.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include <string.h>
+
+#include "crypto.h"
+#include "univalue.h"
+
+#include <btc/hash.h>
+
+//defined in libbtc sha2.h
+extern "C" {
+    extern void hmac_sha256(const uint8_t* key, const uint32_t keylen, const uint8_t* msg, const uint32_t msglen, uint8_t* hmac);
+}
+
+// first allocation of a scratch buffer
+#define DBB_CIPHER_SCRATCH_MIN 4096
+// pooled scratch buffers above this size are freed after use
+#define DBB_CIPHER_SCRATCH_KEEP (64 * 1024)
+#define DBB_CIPHER_SCRATCH_POOL_SIZE 4
+
+namespace DBB
+{
+//!key material, allocated with secureAlloc
+struct CommandCipher::KeyState
+{
+    aes_context ctx[1];
+    unsigned char key[DBB_AES_KEYSIZE];
+    unsigned char* password; //!< copy for matches(), also in locked memory
+    size_t passwordLen;
+};
+
+CommandCipher::CommandCipher(const std::string& password, bool stretch) : state(NULL), stretched(stretch)
+{
+    if (password.empty())
+        return;
+
+    state = (KeyState*)secureAlloc(sizeof(KeyState));
+    if (!state)
+        return;
+
+    state->passwordLen = password.size();
+    state->password = (unsigned char*)secureAlloc(state->passwordLen);
+    if (!state->password) {
+        secureFree(state, sizeof(KeyState));
+        state = NULL;
+        return;
+    }
+    memcpy(state->password, password.c_str(), state->passwordLen);
+
+    if (stretch)
+        btc_hash((const uint8_t*)password.c_str(), password.size(), state->key);
+    else
+        // the key is used as is, shorter keys are zero padded
+        memcpy(state->key, password.c_str(), std::min(password.size(), (size_t)DBB_AES_KEYSIZE));
+
+    aes_set_key(state->key, DBB_AES_KEYSIZE, state->ctx);
+}
+
+CommandCipher::~CommandCipher()
+{
+    if (!state)
+        return;
+
+    secureFree(state->password, state->passwordLen);
+    secureFree(state, sizeof(KeyState));
+    state = NULL;
+}
+
+bool CommandCipher::isValid() const
+{
+    return (state != NULL);
+}
+
+bool CommandCipher::matches(const std::string& password, bool stretch) const
+{
+    if (!state || stretch != stretched || password.size() != state->passwordLen)
+        return false;
+
+    unsigned char diff = 0;
+    for (size_t i = 0; i < state->passwordLen; i++)
+        diff |= state->password[i] ^ (unsigned char)password[i];
+    return (diff == 0);
+}
+
+CipherScratch::CipherScratch() : buffer(NULL), bufferSize(0)
+{
+}
+
+CipherScratch::~CipherScratch()
+{
+    secureFree(buffer, bufferSize);
+}
+
+unsigned char* CipherScratch::reserve(size_t len)
+{
+    // room for the iv and the padding on top of the largest message
+    if (len > DBB_CIPHER_MAX_MESSAGE + 2 * DBB_AES_BLOCKSIZE)
+        return NULL;
+    if (len <= bufferSize)
+        return buffer;
+
+    size_t newSize = std::max(bufferSize * 2, (size_t)DBB_CIPHER_SCRATCH_MIN);
+    while (newSize < len)
+        newSize *= 2;
+    unsigned char* newBuffer = (unsigned char*)secureAlloc(newSize);
+    if (!newBuffer)
+        return NULL;
+
+    // contents don't need to survive, the old buffer is wiped
+    secureFree(buffer, bufferSize);
+    buffer = newBuffer;
+    bufferSize = newSize;
+    return buffer;
+}
+
+void CipherScratch::wipe(size_t len)
+{
+    if (buffer)
+        memoryCleanse(buffer, std::min(len, bufferSize));
+}
+
+size_t CipherScratch::capacity() const
+{
+    return bufferSize;
+}
+
+// scratch buffers for the callers without their own, larger ones are not kept
+static std::mutex cs_scratchPool;
+static std::vector<CipherScratch*> scratchPool;
+
+class PooledScratch
+{
+public:
+    PooledScratch() : scratch(NULL)
+    {
+        std::unique_lock<std::mutex> lock(cs_scratchPool);
+        if (!scratchPool.empty()) {
+            scratch = scratchPool.back();
+            scratchPool.pop_back();
+        }
+        else
+            scratch = new CipherScratch();
+    }
+
+    ~PooledScratch()
+    {
+        std::unique_lock<std::mutex> lock(cs_scratchPool);
+        if (scratchPool.size() < DBB_CIPHER_SCRATCH_POOL_SIZE && scratch->capacity() <= DBB_CIPHER_SCRATCH_KEEP)
+            scratchPool.push_back(scratch);
+        else
+            delete scratch;
+    }
+
+    CipherScratch* get() { return scratch; }
+
+private:
+    CipherScratch* scratch;
+};
+
+bool CommandCipher::encrypt(const std::string& cmd, std::string& base64strOut, CipherScratch* scratch) const
+{
+    if (!state || cmd.size() > DBB_CIPHER_MAX_MESSAGE)
+        return false;
+
+    if (!scratch) {
+        PooledScratch pooled;
+        return encrypt(cmd, base64strOut, pooled.get());
+    }
+
+    // [ iv0  |  enc ], PKCS7 always adds 1..16 bytes
+    size_t inlen = cmd.size();
+    size_t pads = DBB_AES_BLOCKSIZE - inlen % DBB_AES_BLOCKSIZE;
+    size_t rawLen = DBB_AES_BLOCKSIZE + inlen + pads;
+    unsigned char* raw = scratch->reserve(rawLen);
+    if (!raw)
+        return false;
+
+    unsigned char aesIV[DBB_AES_BLOCKSIZE];
+    getRandIV(aesIV);
+    memcpy(raw, aesIV, DBB_AES_BLOCKSIZE);
+    memcpy(raw + DBB_AES_BLOCKSIZE, cmd.data(), inlen);
+    memset(raw + DBB_AES_BLOCKSIZE + inlen, (int)pads, pads);
+
+    // encrypt in place behind the iv, no plain text is left in the scratch buffer
+    aesEncryptPrekeyed(state->ctx, aesIV, raw + DBB_AES_BLOCKSIZE, inlen + pads, raw + DBB_AES_BLOCKSIZE);
+
+    base64strOut.resize(base64_encoded_size(rawLen));
+    base64_encode(raw, rawLen, &base64strOut[0]);
+    return true;
+}
+
+bool CommandCipher::decrypt(const std::string& cmdIn, std::string& stringOut, CipherScratch* scratch) const
+{
+    if (!state)
+        return false;
+
+    if (!scratch) {
+        PooledScratch pooled;
+        return decrypt(cmdIn, stringOut, pooled.get());
+    }
+
+    const std::string* textToDecodeAndDecrypt = &cmdIn;
+    UniValue valRead(UniValue::VSTR);
+    if (stretched)
+    {
+        if (!valRead.read(cmdIn))
+            throw std::runtime_error("failed deserializing json");
+
+        UniValue input = find_value(valRead, "input");
+        if (!input.isNull() && input.isObject()) {
+            UniValue error = find_value(input, "error");
+            if (!error.isNull() && error.isStr())
+                throw std::runtime_error("Error decrypting: " + error.get_str());
+        }
+
+        const UniValue& ctext = find_value(valRead, "ciphertext");
+        if (!ctext.isStr())
+            throw std::runtime_error("failed deserializing json");
+
+        // reference the string inside valRead, no copy
+        textToDecodeAndDecrypt = &ctext.getValStr();
+    }
+
+    size_t maxLen = base64_decoded_max_size(textToDecodeAndDecrypt->size());
+    if (maxLen <= DBB_AES_BLOCKSIZE)
+        return false;
+
+    unsigned char* raw = scratch->reserve(maxLen);
+    if (!raw)
+        return false;
+
+    size_t rawLen = 0;
+    if (!base64_decode(textToDecodeAndDecrypt->data(), textToDecodeAndDecrypt->size(), raw, &rawLen) ||
+        rawLen <= DBB_AES_BLOCKSIZE || (rawLen - DBB_AES_BLOCKSIZE) % DBB_AES_BLOCKSIZE != 0)
+        return false;
+
+    //first 16 bytes are the IV, decrypt the rest in place
+    unsigned char aesIV[DBB_AES_BLOCKSIZE];
+    memcpy(aesIV, raw, DBB_AES_BLOCKSIZE);
+    unsigned char* decrypted = raw + DBB_AES_BLOCKSIZE;
+    size_t encLen = rawLen - DBB_AES_BLOCKSIZE;
+    aesDecryptPrekeyed(state->ctx, aesIV, decrypted, encLen, decrypted);
+
+    size_t padlen = decrypted[encLen - 1];
+    if (encLen <= padlen) {
+        scratch->wipe(rawLen);
+        return false;
+    }
+
+    // the plaintext is a C string, stop at the first null byte (as before)
+    size_t len = strnlen((const char*)decrypted, encLen - padlen);
+    stringOut.assign((const char*)decrypted, len);
+
+    scratch->wipe(rawLen);
+    return true;
+}
+
+// channel format: version | timestamp | counter block | ciphertext | tag
+#define CHANNEL_TIMESTAMP_SIZE 8
+#define CHANNEL_HEADER_SIZE (1 + CHANNEL_TIMESTAMP_SIZE + DBB_AES_BLOCKSIZE)
+#define CHANNEL_TAG_SIZE DBB_SHA256_DIGEST_LENGTH
+
+static const char* channelEncKeyLabel = "DBBChannelEncKey";
+static const char* channelMacKeyLabel = "DBBChannelMacKey";
+
+struct ChannelCipher::KeyState
+{
+    aes_context ctx[1];
+    unsigned char encKey[DBB_AES_KEYSIZE];
+    unsigned char macKey[DBB_SHA256_DIGEST_LENGTH];
+};
+
+ChannelCipher::ChannelCipher(const unsigned char* key, size_t keyLen) : state(NULL)
+{
+    if (!key || keyLen == 0)
+        return;
+
+    state = (KeyState*)secureAlloc(sizeof(KeyState));
+    if (!state)
+        return;
+
+    // independent keys for encryption and authentication
+    hmac_sha256(key, keyLen, (const uint8_t*)channelEncKeyLabel, strlen(channelEncKeyLabel), state->encKey);
+    hmac_sha256(key, keyLen, (const uint8_t*)channelMacKeyLabel, strlen(channelMacKeyLabel), state->macKey);
+    aes_set_key(state->encKey, DBB_AES_KEYSIZE, state->ctx);
+}
+
+ChannelCipher::~ChannelCipher()
+{
+    secureFree(state, sizeof(KeyState));
+    state = NULL;
+}
+
+bool ChannelCipher::isValid() const
+{
+    return (state != NULL);
+}
+
+bool ChannelCipher::isVersioned(const std::string& base64In)
+{
+    // the first four characters carry the version byte
+    unsigned char head[3];
+    size_t headLen = 0;
+    if (base64In.size() < 4 || !base64_decode(base64In.data(), 4, head, &headLen) || headLen < 1)
+        return false;
+    return (head[0] == DBB_CHANNEL_CIPHER_VERSION);
+}
+
+bool ChannelCipher::encrypt(const std::string& plaintext, uint64_t timestamp, std::string& base64Out, CipherScratch* scratch) const
+{
+    if (!state || plaintext.size() > DBB_CIPHER_MAX_MESSAGE)
+        return false;
+
+    if (!scratch) {
+        PooledScratch pooled;
+        return encrypt(plaintext, timestamp, base64Out, pooled.get());
+    }
+
+    size_t rawLen = CHANNEL_HEADER_SIZE + plaintext.size() + CHANNEL_TAG_SIZE;
+    unsigned char* raw = scratch->reserve(rawLen);
+    if (!raw)
+        return false;
+
+    raw[0] = DBB_CHANNEL_CIPHER_VERSION;
+    for (int i = 0; i < CHANNEL_TIMESTAMP_SIZE; i++)
+        raw[1 + i] = (unsigned char)(timestamp >> (8 * (CHANNEL_TIMESTAMP_SIZE - 1 - i)));
+
+    // random initial counter block
+    unsigned char ctr[DBB_AES_BLOCKSIZE];
+    getRandIV(ctr);
+    memcpy(raw + 1 + CHANNEL_TIMESTAMP_SIZE, ctr, DBB_AES_BLOCKSIZE);
+
+    // encrypt in place, then authenticate header and ciphertext
+    unsigned char* body = raw + CHANNEL_HEADER_SIZE;
+    memcpy(body, plaintext.data(), plaintext.size());
+    aes_ctr_crypt(body, body, plaintext.size(), ctr, state->ctx);
+    hmac_sha256(state->macKey, sizeof(state->macKey), raw, CHANNEL_HEADER_SIZE + plaintext.size(), body + plaintext.size());
+
+    base64Out.resize(base64_encoded_size(rawLen));
+    base64_encode(raw, rawLen, &base64Out[0]);
+    return true;
+}
+
+bool ChannelCipher::decrypt(const std::string& base64In, std::string& plaintextOut, uint64_t minTimestamp, uint64_t* timestampOut, CipherScratch* scratch) const
+{
+    if (!state)
+        return false;
+
+    if (!scratch) {
+        PooledScratch pooled;
+        return decrypt(base64In, plaintextOut, minTimestamp, timestampOut, pooled.get());
+    }
+
+    size_t maxLen = base64_decoded_max_size(base64In.size());
+    if (maxLen < CHANNEL_HEADER_SIZE + CHANNEL_TAG_SIZE)
+        return false;
+
+    unsigned char* raw = scratch->reserve(maxLen);
+    if (!raw)
+        return false;
+
+    size_t rawLen = 0;
+    if (!base64_decode(base64In.data(), base64In.size(), raw, &rawLen) ||
+        rawLen < CHANNEL_HEADER_SIZE + CHANNEL_TAG_SIZE || raw[0] != DBB_CHANNEL_CIPHER_VERSION)
+        return false;
+
+    // stale payloads are dropped right away (a forged timestamp fails the tag check below)
+    uint64_t timestamp = 0;
+    for (int i = 0; i < CHANNEL_TIMESTAMP_SIZE; i++)
+        timestamp = (timestamp << 8) | raw[1 + i];
+    if (timestamp < minTimestamp)
+        return false;
+
+    // authenticate before decrypting (constant time compare), forged payloads are never decrypted
+    size_t bodyLen = rawLen - CHANNEL_HEADER_SIZE - CHANNEL_TAG_SIZE;
+    unsigned char tag[CHANNEL_TAG_SIZE];
+    hmac_sha256(state->macKey, sizeof(state->macKey), raw, CHANNEL_HEADER_SIZE + bodyLen, tag);
+    unsigned char diff = 0;
+    for (size_t i = 0; i < CHANNEL_TAG_SIZE; i++)
+        diff |= tag[i] ^ raw[CHANNEL_HEADER_SIZE + bodyLen + i];
+    if (diff != 0)
+        return false;
+
+    unsigned char ctr[DBB_AES_BLOCKSIZE];
+    memcpy(ctr, raw + 1 + CHANNEL_TIMESTAMP_SIZE, DBB_AES_BLOCKSIZE);
+    unsigned char* body = raw + CHANNEL_HEADER_SIZE;
+    aes_ctr_crypt(body, body, bodyLen, ctr, state->ctx);
+
+    plaintextOut.assign((const char*)body, bodyLen);
+    scratch->wipe(rawLen);
+    if (timestampOut)
+        *timestampOut = timestamp;
+    return true;
+}
+
+// one cached cipher per mode (stretched app password, raw key)
+static std::mutex cs_cipherCache;
+static std::shared_ptr<CommandCipher> cachedCiphers[2];
+
+static std::shared_ptr<CommandCipher> getCommandCipher(const std::string& password, bool stretch)
+{
+    std::unique_lock<std::mutex> lock(cs_cipherCache);
+    std::shared_ptr<CommandCipher>& slot = cachedCiphers[stretch ? 1 : 0];
+    if (!slot || !slot->matches(password, stretch)) {
+        // the previous cipher is wiped once the last user has released it
+        slot.reset(new CommandCipher(password, stretch));
+    }
+    return slot;
+}
+
+void clearCommandCipherCache()
+{
+    std::unique_lock<std::mutex> lock(cs_cipherCache);
+    cachedCiphers[0].reset();
+    cachedCiphers[1].reset();
+}
+
+bool decryptAndDecodeCommand(const std::string& cmdIn, const std::string& password, std::string& stringOut, bool stretch)
+{
+    if (password.empty())
+        return false;
+
+    std::shared_ptr<CommandCipher> cipher = getCommandCipher(password, stretch);
+    return cipher->decrypt(cmdIn, stringOut);
+}
+
+bool encryptAndEncodeCommand(const std::string& cmd, const std::string& password, std::string& base64strOut, bool stretch)
+{
+    if (password.empty())
+        return false;
+
+    std::shared_ptr<CommandCipher> cipher = getCommandCipher(password, stretch);
+    return cipher->encrypt(cmd, base64strOut);
+}
+} //end namespace DBB
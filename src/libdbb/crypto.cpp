@@ -7,8 +7,15 @@
 #include <btc/aes.h>
 #include <btc/random.h>
 
+#include <stdlib.h>
 #include <string.h>
 
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
 //ignore osx depracation warning
 #pragma clang diagnostic ignored "-Wdeprecated-declarations"
 
@@ -30,8 +37,54 @@ void aesEncrypt(unsigned char* aesKey, unsigned char* aesIV, const unsigned char
     memset(ctx, 0, sizeof(ctx)); //clean password
 }
 
+void aesDecryptPrekeyed(const aes_context* ctx, unsigned char* aesIV, const unsigned char* encMsg, size_t encMsgLen, unsigned char* decMsg)
+{
+    aes_cbc_decrypt(encMsg, decMsg, encMsgLen / N_BLOCK, aesIV, ctx);
+}
+
+void aesEncryptPrekeyed(const aes_context* ctx, unsigned char* aesIV, const unsigned char* msg, size_t msgLen, unsigned char* encMsg)
+{
+    aes_cbc_encrypt(msg, encMsg, msgLen / N_BLOCK, aesIV, ctx);
+}
+
 void getRandIV(unsigned char* ivOut)
 {
     random_init();
     random_bytes(ivOut, N_BLOCK, 0);
 }
+
+void memoryCleanse(void* ptr, size_t len)
+{
+    // call memset through a volatile pointer to prevent the compiler from removing it
+    static void* (*const volatile memset_v)(void*, int, size_t) = &memset;
+    memset_v(ptr, 0, len);
+}
+
+void* secureAlloc(size_t len)
+{
+    void* ptr = calloc(1, len);
+    if (!ptr)
+        return NULL;
+
+    // keep the key material out of the swap, failing to lock is not fatal
+#ifdef WIN32
+    VirtualLock(ptr, len);
+#else
+    mlock(ptr, len);
+#endif
+    return ptr;
+}
+
+void secureFree(void* ptr, size_t len)
+{
+    if (!ptr)
+        return;
+
+    memoryCleanse(ptr, len);
+#ifdef WIN32
+    VirtualUnlock(ptr, len);
+#else
+    munlock(ptr, len);
+#endif
+    free(ptr);
+}
@@ -7,16 +7,36 @@
 
 #include <string>
 
+#include <btc/aes.h>
+
 #define DBB_AES_BLOCKSIZE 16
 #define DBB_AES_KEYSIZE 32
 #define DBB_SHA256_DIGEST_LENGTH 32
 
 std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len);
-std::string base64_decode(std::string const& encoded_string);
+std::string base64_decode(std::string const& encoded_string); //empty string on invalid input
+
+//base64 into presized buffers: the encoder writes base64_encoded_size(len) characters,
+//the decoder up to base64_decoded_max_size(len) bytes and returns false on invalid characters
+size_t base64_encoded_size(size_t len);
+size_t base64_decoded_max_size(size_t len);
+size_t base64_encode(const unsigned char* in, size_t len, char* out);
+bool base64_decode(const char* in, size_t len, unsigned char* out, size_t* outLen);
 void aesDecrypt(unsigned char* aesKey, unsigned char* aesIV, unsigned char* encMsg, size_t encMsgLen, unsigned char* decMsg);
 void aesEncrypt(unsigned char* aesKey, unsigned char* aesIV, const unsigned char* msg, size_t msgLen, unsigned char* encMsg);
 
+//AES-256-CBC with a precomputed key schedule (aes_set_key)
+void aesDecryptPrekeyed(const aes_context* ctx, unsigned char* aesIV, const unsigned char* encMsg, size_t encMsgLen, unsigned char* decMsg);
+void aesEncryptPrekeyed(const aes_context* ctx, unsigned char* aesIV, const unsigned char* msg, size_t msgLen, unsigned char* encMsg);
+
 //get random aes IV (16 bytes)
 void getRandIV(unsigned char* ivOut);
 
+//memory for key material, locked into RAM (if possible) and wiped before it gets freed
+void* secureAlloc(size_t len);
+void secureFree(void* ptr, size_t len);
+
+//wipe memory (not optimized away)
+void memoryCleanse(void* ptr, size_t len);
+
 #endif //LIBDBB_CRYPTO_H
@@ -5,6 +5,7 @@
 #include "dbb.h"
 
 #include <assert.h>
+#include <chrono>
 #include <cmath>
 #include <iostream>
 #include <stdio.h>
@@ -16,6 +17,10 @@
 #include <arpa/inet.h>
 #endif
 
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <stdexcept>
 
@@ -32,13 +37,8 @@
 #include <btc/hash.h>
 #include <btc/ecc_key.h>
 
-//defined in libbtc sha2.h
-extern "C" {
-    extern void hmac_sha512(const uint8_t* key, const uint32_t keylen, const uint8_t* msg, const uint32_t msglen, uint8_t* hmac);
-}
-
-#define HID_MAX_BUF_SIZE 5120
 #define HID_READ_TIMEOUT (120 * 1000)
+#define HID_READ_SLICE 100 // reads wait in slices of this many ms to honor cancellation
 
 #ifdef DBB_ENABLE_DEBUG
 #define DBB_DEBUG_INTERNAL(format, args...) printf(format, ##args);
@@ -48,12 +48,11 @@ extern "C" {
 
 namespace DBB
 {
-static hid_device* HID_HANDLE = NULL;
-static enum dbb_device_mode HID_CURRENT_DEVICE_MODE = DBB_DEVICE_UNKNOWN;
-static std::string HID_CURRENT_DEVICE_PATH();
-static unsigned int readBufSize = HID_REPORT_SIZE_DEFAULT;
-static unsigned int writeBufSize = HID_REPORT_SIZE_DEFAULT;
-static unsigned char HID_REPORT[HID_MAX_BUF_SIZE] = {0};
+static std::mutex cs_hid; //!< protects hidapi init/exit, enumeration and open/close
+static int hidOpenHandles = 0;
+
+static std::mutex cs_sessions;
+static std::map<std::string, std::shared_ptr<DeviceSession> > mapSessions;
 
 #define  USB_REPORT_SIZE 64
 #ifndef MIN
@@ -67,7 +66,9 @@ static unsigned char HID_REPORT[HID_MAX_BUF_SIZE] = {0};
 #define TYPE_INIT               0x80    // Initial frame identifier
 #define TYPE_CONT               0x00    // Continuation frame identifier
 
+#define ERR_INVALID_LEN         0x03    // Invalid message length
 #define ERR_INVALID_SEQ         0x04    // Invalid message sequencing
+#define ERR_OTHER               0x7f    // Other unspecified error
 
 #define U2FHID_ERROR        (TYPE_INIT | 0x3f)  // Error response
 #define U2FHID_VENDOR_FIRST (TYPE_INIT | 0x40)  // First vendor defined command
@@ -95,80 +96,134 @@ __extension__ typedef struct {
     };
 } USB_FRAME;
 
-static int api_hid_send_frame(USB_FRAME *f)
-{
-    int res = 0;
-    uint8_t d[sizeof(USB_FRAME) + 1];
-    memset(d, 0, sizeof(d));
-    d[0] = 0;  // un-numbered report
-    f->cid = htonl(f->cid);  // cid is in network order on the wire
-    memcpy(d + 1, f, sizeof(USB_FRAME));
-    f->cid = ntohl(f->cid);
+#define HID_FRAME_SIZE (USB_REPORT_SIZE + 1) // report id + frame
+#define FRAME_INIT_DATA_SIZE (USB_REPORT_SIZE - 7)
+#define FRAME_CONT_DATA_SIZE (USB_REPORT_SIZE - 5)
 
-    DBB_DEBUG_INTERNAL("send frame data %s\n", HexStr(d, d+sizeof(d)).c_str(), res);
-    res = hid_write(HID_HANDLE, d, sizeof(d));
+// serialize a complete U2FHID message in one pass into consecutive, hid_write ready reports
+// (un-numbered report id, cid in network order, payload padded with 0xEE)
+// the buffer is reused across commands and only grows if required
+static size_t api_hid_assemble_frames(uint32_t cid, uint8_t cmd, const void *data, size_t size, std::vector<uint8_t>& framesOut)
+{
+    const uint8_t *pData = (const uint8_t *) data;
+    size_t numFrames = 1;
+    if (size > FRAME_INIT_DATA_SIZE)
+        numFrames += (size - FRAME_INIT_DATA_SIZE + FRAME_CONT_DATA_SIZE - 1) / FRAME_CONT_DATA_SIZE;
+
+    if (framesOut.size() < numFrames * HID_FRAME_SIZE)
+        framesOut.resize(numFrames * HID_FRAME_SIZE);
+    memset(&framesOut[0], 0xEE, numFrames * HID_FRAME_SIZE);
+
+    for (size_t i = 0; i < numFrames; i++) {
+        uint8_t *f = &framesOut[i * HID_FRAME_SIZE];
+        size_t frameLen;
+
+        f[0] = 0; // un-numbered report
+        f[1] = (cid >> 24) & 255;
+        f[2] = (cid >> 16) & 255;
+        f[3] = (cid >> 8) & 255;
+        f[4] = cid & 255;
+        if (i == 0) {
+            f[5] = TYPE_INIT | cmd;
+            f[6] = (size >> 8) & 255;
+            f[7] = (size & 255);
+            frameLen = MIN(size, FRAME_INIT_DATA_SIZE);
+            memcpy(f + 8, pData, frameLen);
+        }
+        else {
+            f[5] = (i - 1) & ~TYPE_MASK; // sequence number
+            frameLen = MIN(size, FRAME_CONT_DATA_SIZE);
+            memcpy(f + 6, pData, frameLen);
+        }
+        size -= frameLen;
+        pData += frameLen;
+    }
+    return numFrames;
+}
 
-    if (res == sizeof(d)) {
-        return 0;
+// stream out preassembled frames, one hid_write per frame without further copies
+static int api_hid_write_frames(hid_device* handle, const std::vector<uint8_t>& frames, size_t numFrames, FrameStats& statsOut)
+{
+    statsOut = FrameStats();
+    for (size_t i = 0; i < numFrames; i++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        int res = hid_write(handle, &frames[i * HID_FRAME_SIZE], HID_FRAME_SIZE);
+        int64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+        DBB_DEBUG_INTERNAL("  send frame %d done in %lld us (result: %d)\n", (int)i, (long long)micros, res);
+        if (res != HID_FRAME_SIZE) {
+            return 1;
+        }
+        statsOut.frames++;
+        statsOut.totalMicros += micros;
+        if (micros > statsOut.maxFrameMicros)
+            statsOut.maxFrameMicros = micros;
     }
-    return 1;
+    return 0;
 }
 
 
-static int api_hid_send_frames(uint32_t cid, uint8_t cmd, const void *data, size_t size)
+//!deadline and cancellation state of one device I/O operation
+struct IOControl
 {
-    USB_FRAME frame;
-    int res;
-    size_t frameLen;
-    uint8_t seq = 0;
-    const uint8_t *pData = (const uint8_t *) data;
-
-    frame.cid = cid;
-    frame.init.cmd = TYPE_INIT | cmd;
-    frame.init.bcnth = (size >> 8) & 255;
-    frame.init.bcntl = (size & 255);
+    bool hasDeadline;
+    std::chrono::steady_clock::time_point deadline;
+    const std::atomic<bool>* canceled;
+    const std::atomic<bool>* shutdown;
+    enum { IO_OK, IO_ERROR, IO_TIMEOUT, IO_CANCELED } status;
 
-    frameLen = MIN(size, sizeof(frame.init.data));
-    memset(frame.init.data, 0xEE, sizeof(frame.init.data));
-    memcpy(frame.init.data, pData, frameLen);
+    IOControl(int timeoutMs) : hasDeadline(timeoutMs > 0), canceled(NULL), shutdown(NULL), status(IO_OK)
+    {
+        deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    }
+};
 
-    do {
-        res = api_hid_send_frame(&frame);
-        DBB_DEBUG_INTERNAL("  send frame done, bytes: %d (result: %d)\n", frameLen, res);
-        if (res != 0) {
-            return res;
+// hid_read_timeout() in short slices until data arrives, the deadline passes or the operation gets canceled
+// returns the number of bytes read, 0 on timeout/cancellation, -1 on error
+static int api_hid_read_timeout(hid_device* handle, unsigned char *data, size_t length, IOControl& ctl)
+{
+    while (true) {
+        if ((ctl.canceled && *ctl.canceled) || (ctl.shutdown && *ctl.shutdown)) {
+            ctl.status = IOControl::IO_CANCELED;
+            return 0;
         }
 
-        size -= frameLen;
-        pData += frameLen;
-
-        frame.cont.seq = seq++;
-        frameLen = MIN(size, sizeof(frame.cont.data));
-        memset(frame.cont.data, 0xEE, sizeof(frame.cont.data));
-        memcpy(frame.cont.data, pData, frameLen);
-    } while (size);
+        int sliceMs = HID_READ_SLICE;
+        if (ctl.hasDeadline) {
+            int64_t remainingMs = std::chrono::duration_cast<std::chrono::milliseconds>(ctl.deadline - std::chrono::steady_clock::now()).count();
+            if (remainingMs <= 0) {
+                ctl.status = IOControl::IO_TIMEOUT;
+                return 0;
+            }
+            sliceMs = MIN(remainingMs, HID_READ_SLICE);
+        }
 
-    return 0;
+        int res = hid_read_timeout(handle, data, length, sliceMs);
+        if (res < 0)
+            ctl.status = IOControl::IO_ERROR;
+        if (res != 0)
+            return res;
+    }
 }
 
-
-static int api_hid_read_frame(USB_FRAME *r)
+static int api_hid_read_frame(hid_device* handle, USB_FRAME *r, IOControl& ctl)
 {
 
     memset((int8_t *)r, 0xEE, sizeof(USB_FRAME));
 
     int res = 0;
-    res = hid_read_timeout(HID_HANDLE, (uint8_t *) r, sizeof(USB_FRAME), HID_READ_TIMEOUT);
+    res = api_hid_read_timeout(handle, (uint8_t *) r, sizeof(USB_FRAME), ctl);
 
     if (res == sizeof(USB_FRAME)) {
         r->cid = ntohl(r->cid);
         return 0;
     }
-    return 1;
+    // short read, timeout or cancelled read
+    return -ERR_OTHER;
 }
 
 
-static int api_hid_read_frames(uint32_t cid, uint8_t cmd, void *data, int max)
+static int api_hid_read_frames(hid_device* handle, uint32_t cid, uint8_t cmd, void *data, int max, IOControl& ctl)
 {
     USB_FRAME frame;
     int res, result;
@@ -179,7 +234,7 @@ static int api_hid_read_frames(uint32_t cid, uint8_t cmd, void *data, int max)
     (void) cmd;
 
     do {
-        res = api_hid_read_frame(&frame);
+        res = api_hid_read_frame(handle, &frame, ctl);
         if (res != 0) {
             return res;
         }
@@ -191,7 +246,13 @@ static int api_hid_read_frames(uint32_t cid, uint8_t cmd, void *data, int max)
         return -frame.init.data[0];
     }
 
-    totalLen = MIN(max, MSG_LEN(frame));
+    // a truncated response would be an invalid (or wrongly decrypted) reply
+    if ((int)MSG_LEN(frame) > max) {
+        DBB_DEBUG_INTERNAL("response too large for the buffer (%d > %d)\n", (int)MSG_LEN(frame), max);
+        return -ERR_INVALID_LEN;
+    }
+
+    totalLen = MSG_LEN(frame);
     frameLen = MIN(sizeof(frame.init.data), totalLen);
 
     result = totalLen;
@@ -201,7 +262,7 @@ static int api_hid_read_frames(uint32_t cid, uint8_t cmd, void *data, int max)
     pData += frameLen;
 
     while (totalLen) {
-        res = api_hid_read_frame(&frame);
+        res = api_hid_read_frame(handle, &frame, ctl);
         if (res != 0) {
             return res;
         }
@@ -226,163 +287,428 @@ static int api_hid_read_frames(uint32_t cid, uint8_t cmd, void *data, int max)
     return result;
 }
 
-static bool api_hid_init(unsigned int writeBufSizeIn = HID_REPORT_SIZE_DEFAULT, unsigned int readBufSizeIn = HID_REPORT_SIZE_DEFAULT, const char *path = NULL)
+static hid_device* api_hid_open(const char *path)
 {
-    readBufSize = readBufSizeIn;
-    writeBufSize = writeBufSizeIn;
+    std::unique_lock<std::mutex> lock(cs_hid);
     DBB_DEBUG_INTERNAL("hid open path: %s\n", path);
-    HID_HANDLE = hid_open_path(path);
-    if (!HID_HANDLE) {
-        return false;
-    }
-    return true;
+    hid_device* handle = hid_open_path(path);
+    if (handle)
+        hidOpenHandles++;
+    return handle;
 }
 
-static bool api_hid_close(void)
+static void api_hid_close(hid_device* handle)
 {
-    //TODO: way to handle multiple DBB
-    if (HID_HANDLE) {
-        hid_close(HID_HANDLE); //vendor-id, product-id
+    std::unique_lock<std::mutex> lock(cs_hid);
+    hid_close(handle);
+
+    // only tear down hidapi once the last device has been closed
+    if (--hidOpenHandles == 0)
         hid_exit();
-        HID_HANDLE = 0;
+}
+
+// parse the mode and firmware version from the serial number ("dbb.fw:v2.1.0", "dbb.bl:...")
+// returns false if the device is not a DBB interface we can talk to
+static bool parseDeviceSerial(DeviceInfo& info)
+{
+    info.mode = DBB_DEVICE_NO_DEVICE;
+    info.version.clear();
+
+    std::vector<std::string> vSNParts = DBB::split(info.serial, ':');
+    if (vSNParts.size() == 2)
+        info.version = vSNParts[1];
+
+    if ((vSNParts.size() == 2 && vSNParts[0] == "dbb.fw") || info.serial == "firmware")
+    {
+        info.mode = DBB_DEVICE_MODE_FIRMWARE;
+        if (vSNParts.size() < 2)
+            return true;
+
+        // for now, only support one digit version numbers
+        if (vSNParts[1].size() >= 6 && vSNParts[1][0] == 'v')
+        {
+            int major = vSNParts[1][1] - '0';
+            int minor = vSNParts[1][3] - '0';
+
+            // if version is greater or equal to then 2.1.0, use U2F protocol
+            if (major > 2 || (major == 2 && minor >= 1))
+            {
+                info.mode = DBB_DEVICE_MODE_FIRMWARE_U2F;
+            }
+        }
+        if (vSNParts[1].size() > 2 && vSNParts[1][vSNParts[1].size()-2] == '-' && vSNParts[1][vSNParts[1].size()-1] == '-') {
+            info.mode = (info.mode == DBB_DEVICE_MODE_FIRMWARE) ? DBB_DEVICE_MODE_FIRMWARE_NO_PASSWORD : DBB_DEVICE_MODE_FIRMWARE_U2F_NO_PASSWORD;
+        }
+        return true;
+    }
+    else if (vSNParts.size() == 2 && vSNParts[0] == "dbb.bl")
+    {
+        info.mode = DBB_DEVICE_MODE_BOOTLOADER;
         return true;
     }
-
     return false;
 }
 
-enum dbb_device_mode deviceAvailable(std::string& devicePathOut)
+// enumeration cache, protected by cs_hid
+// the list of the last enumeration is reused as long as a topology change source
+// (the hotplug watcher) keeps it valid, parse results are kept per path and serial
+static bool deviceCacheEnabled = false;
+static std::atomic<bool> deviceCacheValid(false);
+static std::vector<DeviceInfo> vDeviceCache; //!< DBB interfaces of the last enumeration (incl. unknown ones)
+static std::map<std::string, DeviceInfo> mapParsedDevices;
+static unsigned int deviceEnumerations = 0;
+
+static const std::vector<DeviceInfo>& enumerateCached()
 {
-    struct hid_device_info* devs, *cur_dev;
+    if (deviceCacheEnabled && deviceCacheValid)
+        return vDeviceCache;
 
-    devs = hid_enumerate(0x03eb, 0x2402);
+    // mark valid before enumerating, an invalidation while enumerating triggers another run
+    deviceCacheValid = true;
+    deviceEnumerations++;
 
-    cur_dev = devs;
-    enum dbb_device_mode foundType = DBB_DEVICE_NO_DEVICE;
-    while (cur_dev) {
-        //DBB_DEBUG_INTERNAL("found device with usage_page: %d and ifnum: %d and path: %s\n", cur_dev->usage_page, cur_dev->interface_number, cur_dev->path);
-        if (cur_dev->interface_number == 0 || cur_dev->usage_page == 0xffff) {
-            // get the manufacturer wide string
-            if (!cur_dev || !cur_dev->manufacturer_string || !cur_dev->serial_number || !cur_dev->path)
-            {
-                cur_dev = cur_dev->next;
-                foundType = DBB_DEVICE_UNKNOWN;
-                continue;
-            }
-            devicePathOut.resize(strlen(cur_dev->path));
-            devicePathOut.assign(cur_dev->path);
-            std::wstring wsMF(cur_dev->manufacturer_string);
-            std::string strMF( wsMF.begin(), wsMF.end() );
+    std::map<std::string, DeviceInfo> mapParsed;
+    vDeviceCache.clear();
 
-            // get the setial number wide string
-            std::wstring wsSN(cur_dev->serial_number);
-            std::string strSN( wsSN.begin(), wsSN.end() );
+    struct hid_device_info* devs, *cur_dev;
+    devs = hid_enumerate(DBB_USB_VENDOR_ID, DBB_USB_PRODUCT_ID);
+    for (cur_dev = devs; cur_dev; cur_dev = cur_dev->next) {
+        //DBB_DEBUG_INTERNAL("found device with usage_page: %d and ifnum: %d and path: %s\n", cur_dev->usage_page, cur_dev->interface_number, cur_dev->path);
+        if (cur_dev->interface_number != 0 && cur_dev->usage_page != 0xffff)
+            continue;
 
-            std::vector<std::string> vSNParts = DBB::split(strSN, ':');
+        DeviceInfo info;
+        info.mode = DBB_DEVICE_UNKNOWN;
 
-            if ((vSNParts.size() == 2 && vSNParts[0] == "dbb.fw") || strSN == "firmware")
-            {
-                foundType = DBB_DEVICE_MODE_FIRMWARE;
-                // for now, only support one digit version numbers
-                if (vSNParts[1].size() >= 6 && vSNParts[1][0] == 'v')
-                {
-                    int major = vSNParts[1][1] - '0';
-                    int minor = vSNParts[1][3] - '0';
-                    int patch = vSNParts[1][5] - '0';
-
-                    // if version is greater or equal to then 2.1.0, use U2F protocol
-                    if (major > 2 || (major == 2 && minor >= 1))
-                    {
-                        foundType = DBB_DEVICE_MODE_FIRMWARE_U2F;
-                    }
-                }
-                if (vSNParts[1].size() > 2 && vSNParts[1][vSNParts[1].size()-2] == '-' && vSNParts[1][vSNParts[1].size()-1] == '-') {
-                    foundType = (foundType == DBB_DEVICE_MODE_FIRMWARE) ? DBB_DEVICE_MODE_FIRMWARE_NO_PASSWORD : DBB_DEVICE_MODE_FIRMWARE_U2F_NO_PASSWORD;
-                }
-                break;
-            }
-            else if (vSNParts.size() == 2 && vSNParts[0] == "dbb.bl")
-            {
-                foundType = DBB_DEVICE_MODE_BOOTLOADER;
-                break;
-            }
-            else
-            {
-                cur_dev = cur_dev->next;
-            }
+        // missing strings, most likely no permission to access the device
+        if (!cur_dev->manufacturer_string || !cur_dev->serial_number || !cur_dev->path) {
+            vDeviceCache.push_back(info);
+            continue;
         }
+        info.path.assign(cur_dev->path);
+
+        // get the setial number wide string
+        std::wstring wsSN(cur_dev->serial_number);
+        info.serial.assign(wsSN.begin(), wsSN.end());
+
+        std::string key = info.path + "\n" + info.serial;
+        std::map<std::string, DeviceInfo>::iterator it = mapParsedDevices.find(key);
+        if (it != mapParsedDevices.end())
+            info = it->second;
         else
-        {
-            cur_dev = cur_dev->next;
-        }
+            parseDeviceSerial(info);
+
+        mapParsed[key] = info;
+        vDeviceCache.push_back(info);
     }
     hid_free_enumeration(devs);
-    
+
+    // forget the parse results of removed devices
+    mapParsedDevices.swap(mapParsed);
+    return vDeviceCache;
+}
+
+void setDeviceCacheEnabled(bool enabled)
+{
+    std::unique_lock<std::mutex> lock(cs_hid);
+    deviceCacheEnabled = enabled;
+    deviceCacheValid = false;
+}
+
+void invalidateDeviceCache()
+{
+    deviceCacheValid = false;
+}
+
+unsigned int getDeviceEnumerationCount()
+{
+    std::unique_lock<std::mutex> lock(cs_hid);
+    return deviceEnumerations;
+}
+
+std::vector<DeviceInfo> enumerateDevices()
+{
+    std::vector<DeviceInfo> devices;
+
+    std::unique_lock<std::mutex> lock(cs_hid);
+    for (const DeviceInfo& info : enumerateCached())
+        if (info.mode != DBB_DEVICE_NO_DEVICE && info.mode != DBB_DEVICE_UNKNOWN)
+            devices.push_back(info);
+    return devices;
+}
+
+enum dbb_device_mode deviceAvailable(std::string& devicePathOut)
+{
+    enum dbb_device_mode foundType = DBB_DEVICE_NO_DEVICE;
+
+    std::unique_lock<std::mutex> lock(cs_hid);
+    for (const DeviceInfo& info : enumerateCached()) {
+        if (info.mode == DBB_DEVICE_UNKNOWN)
+            foundType = DBB_DEVICE_UNKNOWN;
+        if (!info.path.empty())
+            devicePathOut = info.path;
+        if (info.mode != DBB_DEVICE_NO_DEVICE && info.mode != DBB_DEVICE_UNKNOWN) {
+            foundType = info.mode;
+            break;
+        }
+    }
+
     //DBB_DEBUG_INTERNAL("found device type: %d\n", foundType);
     return foundType;
 }
 
-bool isConnectionOpen()
+static std::shared_ptr<DeviceSession> defaultSessionPtr()
 {
-    return (HID_HANDLE != NULL);
+    static std::shared_ptr<DeviceSession> session = std::make_shared<DeviceSession>();
+    return session;
 }
 
-bool openConnection(enum dbb_device_mode mode, const std::string& devicePath)
+// one session per device path, otherwise two handles would interleave their frames on the device
+// the default session is registered for the path it opens (and moves with it)
+static bool claimSessionPath(DeviceSession* session, const std::string& oldPath, const std::string& newPath)
 {
-    if (mode == DBB_DEVICE_MODE_BOOTLOADER && api_hid_init(HID_BL_BUF_SIZE_W, HID_BL_BUF_SIZE_R, devicePath.c_str())) {
-        HID_CURRENT_DEVICE_MODE = mode;
+    std::shared_ptr<DeviceSession> defaultPtr = defaultSessionPtr();
+    std::unique_lock<std::mutex> lock(cs_sessions);
+    std::map<std::string, std::shared_ptr<DeviceSession> >::iterator it = mapSessions.find(newPath);
+    if (it != mapSessions.end())
+        return (it->second.get() == session);
+
+    // sessions of getSession() are registered for their path already
+    if (session != defaultPtr.get())
         return true;
+
+    it = mapSessions.find(oldPath);
+    if (it != mapSessions.end() && it->second == defaultPtr)
+        mapSessions.erase(it);
+    mapSessions[newPath] = defaultPtr;
+    return true;
+}
+
+std::shared_ptr<DeviceSession> getSession(const std::string& devicePath)
+{
+    std::unique_lock<std::mutex> lock(cs_sessions);
+    std::shared_ptr<DeviceSession>& session = mapSessions[devicePath];
+    if (!session)
+        session = std::make_shared<DeviceSession>();
+    return session;
+}
+
+void releaseSession(const std::string& devicePath)
+{
+    std::shared_ptr<DeviceSession> session;
+    {
+        std::unique_lock<std::mutex> lock(cs_sessions);
+        std::map<std::string, std::shared_ptr<DeviceSession> >::iterator it = mapSessions.find(devicePath);
+        if (it == mapSessions.end())
+            return;
+        session = it->second;
+        mapSessions.erase(it);
+    }
+    session->close();
+}
+
+DeviceSession& defaultSession()
+{
+    return *defaultSessionPtr();
+}
+
+DeviceSession::DeviceSession() : handle(NULL), mode(DBB_DEVICE_UNKNOWN), readBufSize(HID_REPORT_SIZE_DEFAULT), writeBufSize(HID_REPORT_SIZE_DEFAULT), reconnectCount(0), ioStop(false)
+{
+    memset(report, 0, sizeof(report));
+}
+
+DeviceSession::~DeviceSession()
+{
+    stopIO();
+    close();
+}
+
+bool DeviceSession::isOpen()
+{
+    std::unique_lock<std::recursive_mutex> lock(cs_session);
+    return (handle != NULL);
+}
+
+enum dbb_device_mode DeviceSession::getMode()
+{
+    std::unique_lock<std::recursive_mutex> lock(cs_session);
+    return mode;
+}
+
+std::string DeviceSession::getPath()
+{
+    std::unique_lock<std::recursive_mutex> lock(cs_session);
+    return path;
+}
+
+bool DeviceSession::open(enum dbb_device_mode modeIn, const std::string& devicePath)
+{
+    std::unique_lock<std::recursive_mutex> lock(cs_session);
+    if (!claimSessionPath(this, path, devicePath)) {
+        DBB_DEBUG_INTERNAL("device %s is in use by another session\n", devicePath.c_str());
+        return false;
+    }
+
+    if (handle)
+        close();
+
+    if (modeIn == DBB_DEVICE_MODE_BOOTLOADER || modeIn == DBB_DEVICE_MODE_FIRMWARE_U2F || modeIn == DBB_DEVICE_MODE_FIRMWARE_U2F_NO_PASSWORD) {
+        writeBufSize = HID_BL_BUF_SIZE_W;
+        readBufSize = HID_BL_BUF_SIZE_R;
+        handle = api_hid_open(devicePath.c_str());
+        if (handle) {
+            mode = modeIn;
+            path = devicePath;
+            return true;
+        }
     }
-    else if ((mode == DBB_DEVICE_MODE_FIRMWARE_U2F || mode == DBB_DEVICE_MODE_FIRMWARE_U2F_NO_PASSWORD) && api_hid_init(HID_BL_BUF_SIZE_W, HID_BL_BUF_SIZE_R, devicePath.c_str())) {
-        HID_CURRENT_DEVICE_MODE = mode;
+
+    mode = DBB_DEVICE_MODE_FIRMWARE;
+    writeBufSize = HID_REPORT_SIZE_DEFAULT;
+    readBufSize = HID_REPORT_SIZE_DEFAULT;
+    handle = api_hid_open(devicePath.c_str());
+    path = devicePath;
+    return (handle != NULL);
+}
+
+bool DeviceSession::ensureOpen()
+{
+    std::unique_lock<std::recursive_mutex> lock(cs_session);
+    if (handle)
         return true;
+
+    std::string devicePath;
+    enum dbb_device_mode deviceType = deviceAvailable(devicePath);
+    if (deviceType == DBB_DEVICE_NO_DEVICE || deviceType == DBB_DEVICE_UNKNOWN)
+        return false;
+
+    if (!open(deviceType, devicePath)) {
+        // the cached enumeration may be outdated, try once more with a fresh one
+        invalidateDeviceCache();
+        deviceType = deviceAvailable(devicePath);
+        if (deviceType == DBB_DEVICE_NO_DEVICE || deviceType == DBB_DEVICE_UNKNOWN || !open(deviceType, devicePath))
+            return false;
     }
-    else
-    {
-        HID_CURRENT_DEVICE_MODE = DBB_DEVICE_MODE_FIRMWARE;
-        return api_hid_init(HID_REPORT_SIZE_DEFAULT, HID_REPORT_SIZE_DEFAULT, devicePath.c_str());
+
+    reconnectCount++;
+    DBB_DEBUG_INTERNAL("hid (re)connected, count: %d\n", reconnectCount);
+    return true;
+}
+
+unsigned int DeviceSession::getReconnectCount()
+{
+    std::unique_lock<std::recursive_mutex> lock(cs_session);
+    return reconnectCount;
+}
+
+FrameStats DeviceSession::getLastFrameStats()
+{
+    std::unique_lock<std::recursive_mutex> lock(cs_session);
+    return lastFrameStats;
+}
+
+bool DeviceSession::close()
+{
+    std::unique_lock<std::recursive_mutex> lock(cs_session);
+    if (handle) {
+        api_hid_close(handle);
+        handle = NULL;
+        return true;
     }
+
+    return false;
+}
+
+bool isConnectionOpen()
+{
+    return defaultSession().isOpen();
+}
+
+bool openConnection(enum dbb_device_mode mode, const std::string& devicePath)
+{
+    return defaultSession().open(mode, devicePath);
+}
+
+bool ensureConnection()
+{
+    return defaultSession().ensureOpen();
 }
 
 bool closeConnection()
 {
-    return api_hid_close();
+    return defaultSession().close();
 }
 
-bool sendCommand(const std::string& json, std::string& resultOut)
+bool DeviceSession::sendCommand(const std::string& json, unsigned char* resultBuf, size_t resultBufSize, size_t& resultLenOut)
 {
-    int res, cnt = 0;
+    IOControl ctl(HID_READ_TIMEOUT);
+    return sendCommandInternal(json, resultBuf, resultBufSize, resultLenOut, ctl);
+}
 
-    if (!HID_HANDLE)
+void DeviceSession::dropAfterAbortedRead(const IOControl& ctl)
+{
+    // the device may still answer an aborted command later, drop the handle
+    // so that a stale response can't be read as the reply to the next command
+    if (ctl.status != IOControl::IO_OK)
+        close();
+}
+
+bool DeviceSession::sendCommandInternal(const std::string& json, unsigned char* resultBuf, size_t resultBufSize, size_t& resultLenOut, IOControl& ctl)
+{
+    int res;
+    size_t cnt = 0;
+
+    std::unique_lock<std::recursive_mutex> lock(cs_session);
+    resultLenOut = 0;
+    lastFrameStats = FrameStats();
+    if (!handle)
         return false;
 
     DBB_DEBUG_INTERNAL("Sending command: %s\n", json.c_str());
 
-    memset(HID_REPORT, 0, HID_MAX_BUF_SIZE);
     if (json.size()+1 > HID_MAX_BUF_SIZE)
     {
         DBB_DEBUG_INTERNAL("Buffer to small for string to send");
         return false;
     }
 
-    int reportShift = 0;
-#ifdef DBB_ENABLE_HID_REPORT_SHIFT
-    reportShift = 1;
-#endif
-    HID_REPORT[0] = 0x00;
-    memcpy(HID_REPORT+reportShift, json.c_str(), std::min(HID_MAX_BUF_SIZE, (int)json.size()));
-    if (HID_CURRENT_DEVICE_MODE == DBB_DEVICE_MODE_FIRMWARE_U2F || HID_CURRENT_DEVICE_MODE == DBB_DEVICE_MODE_FIRMWARE_U2F_NO_PASSWORD)
+    if (mode == DBB_DEVICE_MODE_FIRMWARE_U2F || mode == DBB_DEVICE_MODE_FIRMWARE_U2F_NO_PASSWORD)
     {
-        int res = api_hid_send_frames(HWW_CID, HWW_COMMAND, json.c_str(), json.size());
+        size_t numFrames = api_hid_assemble_frames(HWW_CID, HWW_COMMAND, json.c_str(), json.size(), frameBuffer);
+        res = api_hid_write_frames(handle, frameBuffer, numFrames, lastFrameStats);
         DBB_DEBUG_INTERNAL("sending done... %d\n", res);
-        memset(HID_REPORT, 0, HID_MAX_BUF_SIZE);
-        res = api_hid_read_frames(HWW_CID, HWW_COMMAND, HID_REPORT, HID_REPORT_SIZE_DEFAULT);
+        if (res != 0) {
+            // the device is gone or in a bad state, drop the handle to force a reconnect
+            close();
+            return false;
+        }
+
+        // the init frame carries the message length, read the payload straight into the callers buffer
+        res = api_hid_read_frames(handle, HWW_CID, HWW_COMMAND, resultBuf, (int)resultBufSize, ctl);
         DBB_DEBUG_INTERNAL("reading done... %d\n", res);
+        if (res < 0 || ctl.status != IOControl::IO_OK) {
+            dropAfterAbortedRead(ctl);
+            return false;
+        }
+        resultLenOut = res;
     }
     else {
-        if(hid_write(HID_HANDLE, (unsigned char*)HID_REPORT, writeBufSize+reportShift) == -1)
+        if (resultBufSize < readBufSize)
+            return false;
+
+        // the report is sent with a fixed size, only the tail after the command needs to be cleared
+        int reportShift = 0;
+#ifdef DBB_ENABLE_HID_REPORT_SHIFT
+        reportShift = 1;
+#endif
+        report[0] = 0x00;
+        memcpy(report+reportShift, json.c_str(), json.size());
+        if (json.size() < writeBufSize)
+            memset(report+reportShift+json.size(), 0, writeBufSize-json.size());
+
+        if(hid_write(handle, (unsigned char*)report, writeBufSize+reportShift) == -1)
         {
-            const wchar_t *error = hid_error(HID_HANDLE);
+            const wchar_t *error = hid_error(handle);
             if (error)
             {
                 std::wstring wsER(error);
@@ -390,16 +716,16 @@ bool sendCommand(const std::string& json, std::string& resultOut)
 
                 DBB_DEBUG_INTERNAL("Error writing to the usb device: %s\n", strER.c_str());
             }
+            close();
             return false;
         }
 
         DBB_DEBUG_INTERNAL("try to read some bytes...\n");
-        memset(HID_REPORT, 0, HID_MAX_BUF_SIZE);
         while (cnt < readBufSize) {
-            res = hid_read_timeout(HID_HANDLE, HID_REPORT + cnt, readBufSize, HID_READ_TIMEOUT);
-            if (res < 0 || (res == 0 && cnt < readBufSize)) {
+            res = api_hid_read_timeout(handle, resultBuf + cnt, readBufSize - cnt, ctl);
+            if (res <= 0) {
                 std::string errorStr = "";
-                const wchar_t *error = hid_error(HID_HANDLE);
+                const wchar_t *error = hid_error(handle);
 
                 if (error)
                 {
@@ -408,41 +734,89 @@ bool sendCommand(const std::string& json, std::string& resultOut)
                 }
 
                 DBB_DEBUG_INTERNAL("HID Read failed or timed out: %s\n", errorStr.c_str());
+                dropAfterAbortedRead(ctl);
                 return false;
             }
             cnt += res;
         }
 
-        DBB_DEBUG_INTERNAL(" OK, read %d bytes (%s).\n", res, (const char*)HID_REPORT);
+        // legacy HID reports are zero padded, the response ends at the first padding byte
+        const unsigned char* end = (const unsigned char*)memchr(resultBuf, 0, cnt);
+        resultLenOut = end ? (size_t)(end - resultBuf) : cnt;
+        DBB_DEBUG_INTERNAL(" OK, read %d bytes.\n", (int)resultLenOut);
     }
-    
-    resultOut.assign((const char*)HID_REPORT);
+
     return true;
 }
 
-bool sendChunk(unsigned int chunknum, const std::vector<unsigned char>& data, std::string& resultOut)
+bool DeviceSession::sendCommand(const std::string& json, std::string& resultOut)
+{
+    IOControl ctl(HID_READ_TIMEOUT);
+    return sendCommandInternal(json, resultOut, ctl);
+}
+
+bool DeviceSession::sendCommandInternal(const std::string& json, std::string& resultOut, IOControl& ctl)
+{
+    std::unique_lock<std::recursive_mutex> lock(cs_session);
+    size_t len = 0;
+    bool ret = sendCommandInternal(json, report, HID_REPORT_SIZE_DEFAULT, len, ctl);
+
+    // U2F responses may carry a trailing terminator within the message length
+    while (len > 0 && report[len-1] == 0)
+        len--;
+    resultOut.assign((const char*)report, len);
+    return ret;
+}
+
+bool sendCommand(const std::string& json, unsigned char* resultBuf, size_t resultBufSize, size_t& resultLenOut)
+{
+    return defaultSession().sendCommand(json, resultBuf, resultBufSize, resultLenOut);
+}
+
+bool sendCommand(const std::string& json, std::string& resultOut)
+{
+    return defaultSession().sendCommand(json, resultOut);
+}
+
+bool DeviceSession::sendChunk(unsigned int chunknum, const std::vector<unsigned char>& data, std::string& resultOut)
+{
+    return sendChunk(chunknum, data.empty() ? NULL : &data[0], data.size(), resultOut);
+}
+
+bool DeviceSession::sendChunk(unsigned int chunknum, const unsigned char* data, size_t dataLen, std::string& resultOut)
+{
+    IOControl ctl(0); // no deadline, wait until the bootloader has written the chunk
+    return sendChunkInternal(chunknum, data, dataLen, resultOut, ctl);
+}
+
+bool DeviceSession::sendChunkInternal(unsigned int chunknum, const unsigned char* data, size_t dataLen, std::string& resultOut, IOControl& ctl)
 {
     int res, cnt = 0;
 
-    if (!HID_HANDLE)
+    std::unique_lock<std::recursive_mutex> lock(cs_session);
+    if (!handle)
         return false;
 
     DBB_DEBUG_INTERNAL("Sending chunk: %d\n", chunknum);
 
-    assert(data.size() <= HID_MAX_BUF_SIZE-2);
-    memset(HID_REPORT, 0xFF, HID_MAX_BUF_SIZE);
+    assert(dataLen <= HID_MAX_BUF_SIZE-3);
     int reportShift = 0;
 #ifdef DBB_ENABLE_HID_REPORT_SHIFT
     reportShift = 1;
-    HID_REPORT[0] = 0x00;
+    report[0] = 0x00;
 #endif
-    HID_REPORT[0+reportShift] = 0x77;
-    HID_REPORT[1+reportShift] = chunknum % 0xff;
-    memcpy((void *)&HID_REPORT[2+reportShift], (unsigned char*)&data[0], data.size());
+    report[0+reportShift] = 0x77;
+    report[1+reportShift] = chunknum % 0xff;
+    if (dataLen > 0)
+        memcpy((void *)&report[2+reportShift], data, dataLen);
 
-    if(hid_write(HID_HANDLE, (unsigned char*)HID_REPORT, writeBufSize+reportShift) == -1)
+    // pad a short chunk with the erased flash value
+    if (2+dataLen < writeBufSize)
+        memset(&report[2+reportShift+dataLen], 0xFF, writeBufSize-2-dataLen);
+
+    if(hid_write(handle, (unsigned char*)report, writeBufSize+reportShift) == -1)
     {
-        const wchar_t *error = hid_error(HID_HANDLE);
+        const wchar_t *error = hid_error(handle);
         if (error)
         {
             std::wstring wsER(error);
@@ -450,274 +824,174 @@ bool sendChunk(unsigned int chunknum, const std::vector<unsigned char>& data, st
 
             DBB_DEBUG_INTERNAL("Error writing to the usb device: %s\n", strER.c_str());
         }
+        close();
         return false;
     }
 
     DBB_DEBUG_INTERNAL("try to read some bytes...\n");
-    memset(HID_REPORT, 0, HID_MAX_BUF_SIZE);
     while (cnt < readBufSize) {
-        res = hid_read(HID_HANDLE, HID_REPORT + cnt, readBufSize);
+        res = api_hid_read_timeout(handle, report + cnt, readBufSize - cnt, ctl);
         if (res < 0) {
+            close();
             throw std::runtime_error("Error: Unable to read HID(USB) report.\n");
         }
+        if (res == 0) {
+            dropAfterAbortedRead(ctl);
+            return false;
+        }
         cnt += res;
     }
 
     DBB_DEBUG_INTERNAL(" OK, read %d bytes.\n", res);
-    
-    resultOut.assign((const char*)HID_REPORT);
+
+    // the ack is a zero padded string
+    const unsigned char* end = (const unsigned char*)memchr(report, 0, cnt);
+    resultOut.assign((const char*)report, end ? (size_t)(end - report) : (size_t)cnt);
     return true;
 }
 
-const std::string dummySig(const std::vector<char>& firmwareBuffer)
+bool sendChunk(unsigned int chunknum, const std::vector<unsigned char>& data, std::string& resultOut)
 {
-    // dummy sign and get the compact signature
-    // dummy private key to allow current testing
-    // the private key matches the pubkey on the DBB bootloader / FW
-    std::string testing_privkey = "e0178ae94827844042d91584911a6856799a52d89e9d467b83f1cf76a0482a11";
-
-    // generate a double SHA256 of the firmware data
-    uint8_t hashout[32];
-    btc_hash((const uint8_t*)&firmwareBuffer[0], firmwareBuffer.size(), hashout);
-    std::string hashHex = DBB::HexStr(hashout, hashout+32);
-
-    btc_key key;
-    btc_privkey_init(&key);
-    std::vector<unsigned char> privkey = DBB::ParseHex(testing_privkey);
-    memcpy(&key.privkey, &privkey[0], 32);
-
-    size_t sizeout = 64;
-    unsigned char sig[sizeout];
-    int res = btc_key_sign_hash_compact(&key, hashout, sig, &sizeout);
-    return DBB::HexStr(sig, sig+sizeout);
+    return defaultSession().sendChunk(chunknum, data, resultOut);
 }
 
-bool upgradeFirmware(const std::vector<char>& firmwarePadded, size_t firmwareSize, const std::string& sigCmpStr, std::function<void(const std::string&, float progress)> progressCallback)
+void DeviceSession::postIO(std::function<void()> task)
 {
-    std::string devicePath;
-    enum DBB::dbb_device_mode deviceType = DBB::deviceAvailable(devicePath);
-    bool openSuccess = DBB::openConnection(deviceType, devicePath);
-    if (!openSuccess) {
-        return false;
+    std::unique_lock<std::mutex> lock(cs_ioQueue);
+    ioQueue.push_back(task);
+    if (!ioThread.joinable()) {
+        ioThread = std::thread([this]() {
+            std::unique_lock<std::mutex> lock(cs_ioQueue);
+            while (true) {
+                while (ioQueue.empty() && !ioStop)
+                    ioCondVar.wait(lock);
+
+                // on shutdown, the remaining tasks still run to report their cancellation
+                if (ioQueue.empty())
+                    break;
+
+                std::function<void()> next = ioQueue.front();
+                ioQueue.pop_front();
+                lock.unlock();
+                next();
+                lock.lock();
+            }
+        });
     }
+    ioCondVar.notify_one();
+}
 
-    std::string cmdOut;
-    sendCommand("v0", cmdOut);
-    if (cmdOut.size() != 1 || cmdOut[0] != 'v') {
-        DBB::closeConnection();
-        return false;
-    }
-    sendCommand("s0"+sigCmpStr, cmdOut);
-    sendCommand("e", cmdOut);
-
-    int cnt = 0;
-    size_t pos = 0;
-    int nChunks = ceil(firmwareSize / (float)FIRMWARE_CHUNKSIZE);
-    progressCallback("", 0.0);
-    while (pos+FIRMWARE_CHUNKSIZE <= firmwarePadded.size())
+void DeviceSession::stopIO()
+{
     {
-        std::vector<unsigned char> chunk(firmwarePadded.begin()+pos, firmwarePadded.begin()+pos+FIRMWARE_CHUNKSIZE);
-        DBB::sendChunk(cnt,chunk,cmdOut);
-        progressCallback("", 1.0/nChunks*cnt);
-        pos += FIRMWARE_CHUNKSIZE;
-        if (cmdOut != "w0") {
-            DBB::closeConnection();
-            return false;
-        }
-
-        if (pos >= firmwareSize)
-            break;
-        cnt++;
-    }
-
-    sendCommand("s0"+sigCmpStr, cmdOut);
-    if (cmdOut.size() < 2) {
-        DBB::closeConnection();
-        return false;
-    }
-    if (!(cmdOut[0] == 's' && cmdOut[1] == '0')) {
-        DBB::closeConnection();
-        return false;
+        std::unique_lock<std::mutex> lock(cs_ioQueue);
+        if (!ioThread.joinable())
+            return;
+        ioStop = true;
+        ioCondVar.notify_one();
     }
-
-    progressCallback("", 1.0);
-    DBB::closeConnection();
-    return true;
+    ioThread.join();
+    ioStop = false;
 }
 
-bool decryptAndDecodeCommand(const std::string& cmdIn, const std::string& password, std::string& stringOut, bool stretch)
+// set the status of an async call that has been canceled or timed out while queued
+static bool api_io_expired(IOControl& ctl)
 {
-    unsigned char passwordSha256[BTC_HASH_LENGTH];
-    unsigned char aesIV[DBB_AES_BLOCKSIZE];
-    unsigned char aesKey[DBB_AES_KEYSIZE];
+    if ((ctl.canceled && *ctl.canceled) || (ctl.shutdown && *ctl.shutdown))
+        ctl.status = IOControl::IO_CANCELED;
+    else if (ctl.hasDeadline && std::chrono::steady_clock::now() >= ctl.deadline)
+        ctl.status = IOControl::IO_TIMEOUT;
+    return (ctl.status != IOControl::IO_OK);
+}
 
-    if (stretch)
-        btc_hash((const uint8_t *)password.c_str(), password.size(), passwordSha256);
-    else
-        memcpy(passwordSha256, password.c_str(), password.size());
+static enum dbb_cmd_status api_io_result(bool success, const IOControl& ctl)
+{
+    if (ctl.status == IOControl::IO_CANCELED)
+        return DBB_CMD_CANCELED;
+    if (ctl.status == IOControl::IO_TIMEOUT)
+        return DBB_CMD_TIMEOUT;
+    return success ? DBB_CMD_OK : DBB_CMD_FAILED;
+}
 
-    memcpy(aesKey, passwordSha256, DBB_AES_KEYSIZE);
+void DeviceSession::sendCommandAsync(const std::string& json, CommandCallback callback, int timeoutMs, CancelToken cancel)
+{
+    std::shared_ptr<IOControl> ctl = std::make_shared<IOControl>(timeoutMs > 0 ? timeoutMs : HID_READ_TIMEOUT);
+    ctl->canceled = cancel.get();
+    ctl->shutdown = &ioStop;
+
+    // the token is captured to keep the cancel flag alive
+    postIO([this, json, callback, ctl, cancel]() {
+        CommandResult result;
+        bool success = false;
+        if (!api_io_expired(*ctl))
+            success = sendCommandInternal(json, result.result, *ctl);
+        result.status = api_io_result(success, *ctl);
+        callback(result);
+    });
+}
 
-    std::string textToDecodeAndDecrypt;
-    if (stretch)
-    {
-        UniValue valRead(UniValue::VSTR);
-        if (!valRead.read(cmdIn))
-            throw std::runtime_error("failed deserializing json");
-
-        UniValue input = find_value(valRead, "input");
-        if (!input.isNull() && input.isObject()) {
-            UniValue error = find_value(input, "error");
-            if (!error.isNull() && error.isStr())
-                throw std::runtime_error("Error decrypting: " + error.get_str());
+void DeviceSession::sendChunkAsync(unsigned int chunknum, const std::vector<unsigned char>& data, CommandCallback callback, int timeoutMs, CancelToken cancel)
+{
+    std::shared_ptr<IOControl> ctl = std::make_shared<IOControl>(timeoutMs);
+    ctl->canceled = cancel.get();
+    ctl->shutdown = &ioStop;
+
+    postIO([this, chunknum, data, callback, ctl, cancel]() {
+        CommandResult result;
+        bool success = false;
+        if (!api_io_expired(*ctl)) {
+            try {
+                success = sendChunkInternal(chunknum, data.empty() ? NULL : &data[0], data.size(), result.result, *ctl);
+            }
+            catch (const std::exception& ex) {
+                DBB_DEBUG_INTERNAL("Sending chunk failed: %s\n", ex.what());
+            }
         }
-
-        UniValue ctext = find_value(valRead, "ciphertext");
-        if (ctext.isNull())
-            throw std::runtime_error("failed deserializing json");
-
-        textToDecodeAndDecrypt = ctext.get_str();
-    }
-    else
-        textToDecodeAndDecrypt = cmdIn;
-
-    std::string base64dec = base64_decode(textToDecodeAndDecrypt);
-    unsigned int base64_len = base64dec.size();
-
-    if (base64dec.empty() || (base64_len <= DBB_AES_BLOCKSIZE))
-        return false;
-
-    unsigned char* base64dec_c = (unsigned char*)base64dec.c_str();
-
-    unsigned char decryptedStream[base64_len - DBB_AES_BLOCKSIZE];
-    unsigned char* decryptedCommand;
-    memcpy(aesIV, base64dec_c, DBB_AES_BLOCKSIZE); //copy first 16 bytes and take as IV
-    aesDecrypt(aesKey, aesIV, base64dec_c + DBB_AES_BLOCKSIZE, base64_len - DBB_AES_BLOCKSIZE, decryptedStream);
-
-    int decrypt_len = 0;
-    int padlen = decryptedStream[base64_len - DBB_AES_BLOCKSIZE - 1];
-
-    if (base64_len <= DBB_AES_BLOCKSIZE + padlen)
-        return false;
-
-    char* dec = (char*)malloc(base64_len - DBB_AES_BLOCKSIZE - padlen + 1); // +1 for null termination
-    if (!dec) {
-        decrypt_len = 0;;
-        memset(decryptedStream, 0, sizeof(decryptedStream));
-        throw std::runtime_error("decription failed");
-        return false;
-    }
-    int totalLength = (base64_len - DBB_AES_BLOCKSIZE - padlen);
-    if (totalLength  < 0 || totalLength > sizeof(decryptedStream) )
-    {
-        free(dec);
-        throw std::runtime_error("decription failed");
-        return false;
-    }
-
-    memcpy(dec, decryptedStream, base64_len - DBB_AES_BLOCKSIZE - padlen);
-    dec[base64_len - DBB_AES_BLOCKSIZE - padlen] = 0;
-    decrypt_len = base64_len - DBB_AES_BLOCKSIZE - padlen + 1;
-
-    stringOut.assign((const char*)dec);
-
-    memset(decryptedStream, 0, sizeof(decryptedStream));
-    free(dec);
-    return true;
+        result.status = api_io_result(success, *ctl);
+        callback(result);
+    });
 }
 
-bool encryptAndEncodeCommand(const std::string& cmd, const std::string& password, std::string& base64strOut, bool stretch)
+#ifndef WIN32
+std::future<CommandResult> DeviceSession::sendCommandAsync(const std::string& json, int timeoutMs, CancelToken cancel)
 {
-    if (password.empty())
-        return false;
-
-    //double sha256 the password
-    unsigned char passwordSha256[BTC_HASH_LENGTH];
-
-    unsigned char aesIV[DBB_AES_BLOCKSIZE];
-    unsigned char aesKey[DBB_AES_KEYSIZE];
-
-    if (stretch)
-        btc_hash((const uint8_t *)password.c_str(), password.size(), passwordSha256);
-    else
-        memcpy(passwordSha256, password.c_str(), password.size());
-
-    //set random IV
-    getRandIV(aesIV);
-    memcpy(aesKey, passwordSha256, DBB_AES_KEYSIZE);
-
-    int inlen = cmd.size();
-    unsigned int pads = 0;
-    int inpadlen = inlen + DBB_AES_BLOCKSIZE - inlen % DBB_AES_BLOCKSIZE;
-    unsigned char inpad[inpadlen];
-    unsigned char enc[inpadlen];
-    unsigned char enc_cat[inpadlen + DBB_AES_BLOCKSIZE]; // concatenating [ iv0  |  enc ]
-
-    // PKCS7 padding
-    memcpy(inpad, cmd.c_str(), inlen);
-    for (pads = 0; pads < DBB_AES_BLOCKSIZE - inlen % DBB_AES_BLOCKSIZE; pads++) {
-        inpad[inlen + pads] = (DBB_AES_BLOCKSIZE - inlen % DBB_AES_BLOCKSIZE);
-    }
-
-    //add iv to the stream for base64 encoding
-    memcpy(enc_cat, aesIV, DBB_AES_BLOCKSIZE);
-
-    //encrypt
-    unsigned char cypher[inpadlen];
-    aesEncrypt(aesKey, aesIV, inpad, inpadlen, cypher);
-
-    //copy the encypted data to the stream where the iv is already
-    memcpy(enc_cat + DBB_AES_BLOCKSIZE, cypher, inpadlen);
-
-    //base64 encode
-    base64strOut = base64_encode(enc_cat, inpadlen + DBB_AES_BLOCKSIZE);
-
-    return true;
+    std::shared_ptr<std::promise<CommandResult> > promise = std::make_shared<std::promise<CommandResult> >();
+    std::future<CommandResult> future = promise->get_future();
+    sendCommandAsync(json, [promise](const CommandResult& result) { promise->set_value(result); }, timeoutMs, cancel);
+    return future;
 }
 
-void pbkdf2_hmac_sha512(const uint8_t *pass, int passlen, uint8_t *key, int keylen)
+std::future<CommandResult> DeviceSession::sendChunkAsync(unsigned int chunknum, const std::vector<unsigned char>& data, int timeoutMs, CancelToken cancel)
 {
-    uint32_t i, j, k;
-    uint8_t f[BACKUP_KEY_PBKDF2_HMACLEN], g[BACKUP_KEY_PBKDF2_HMACLEN];
-    uint32_t blocks = keylen / BACKUP_KEY_PBKDF2_HMACLEN;
+    std::shared_ptr<std::promise<CommandResult> > promise = std::make_shared<std::promise<CommandResult> >();
+    std::future<CommandResult> future = promise->get_future();
+    sendChunkAsync(chunknum, data, [promise](const CommandResult& result) { promise->set_value(result); }, timeoutMs, cancel);
+    return future;
+}
+#endif
 
-    static uint8_t salt[BACKUP_KEY_PBKDF2_SALTLEN + 4];
-    memset(salt, 0, sizeof(salt));
-    memcpy(salt, BACKUP_KEY_PBKDF2_SALT, strlen(BACKUP_KEY_PBKDF2_SALT));
+void sendCommandAsync(const std::string& json, CommandCallback callback, int timeoutMs, CancelToken cancel)
+{
+    defaultSession().sendCommandAsync(json, callback, timeoutMs, cancel);
+}
 
-    if (keylen & (BACKUP_KEY_PBKDF2_HMACLEN - 1)) {
-        blocks++;
-    }
-    for (i = 1; i <= blocks; i++) {
-        salt[BACKUP_KEY_PBKDF2_SALTLEN    ] = (i >> 24) & 0xFF;
-        salt[BACKUP_KEY_PBKDF2_SALTLEN + 1] = (i >> 16) & 0xFF;
-        salt[BACKUP_KEY_PBKDF2_SALTLEN + 2] = (i >> 8) & 0xFF;
-        salt[BACKUP_KEY_PBKDF2_SALTLEN + 3] = i & 0xFF;
-        hmac_sha512(pass, passlen, salt, BACKUP_KEY_PBKDF2_SALTLEN + 4, g);
-        memcpy(f, g, BACKUP_KEY_PBKDF2_HMACLEN);
-        for (j = 1; j < BACKUP_KEY_PBKDF2_ROUNDS; j++) {
-            hmac_sha512(pass, passlen, g, BACKUP_KEY_PBKDF2_HMACLEN, g);
-            for (k = 0; k < BACKUP_KEY_PBKDF2_HMACLEN; k++) {
-                f[k] ^= g[k];
-            }
-        }
-        if (i == blocks && (keylen & (BACKUP_KEY_PBKDF2_HMACLEN - 1))) {
-            memcpy(key + BACKUP_KEY_PBKDF2_HMACLEN * (i - 1), f, keylen & (BACKUP_KEY_PBKDF2_HMACLEN - 1));
-        } else {
-            memcpy(key + BACKUP_KEY_PBKDF2_HMACLEN * (i - 1), f, BACKUP_KEY_PBKDF2_HMACLEN);
-        }
-    }
-    memset(f, 0, sizeof(f));
-    memset(g, 0, sizeof(g));
+#ifndef WIN32
+std::future<CommandResult> sendCommandAsync(const std::string& json, int timeoutMs, CancelToken cancel)
+{
+    return defaultSession().sendCommandAsync(json, timeoutMs, cancel);
 }
+#endif
 
-std::string getStretchedBackupHexKey(const std::string &passphrase)
+std::string getStretchedBackupHexKey(const std::string &passphrase, unsigned int rounds)
 {
 
     assert(passphrase.size() > 0);
 
     uint8_t key[BACKUP_KEY_PBKDF2_HMACLEN];
-    pbkdf2_hmac_sha512((const uint8_t *)&passphrase[0], passphrase.size(), key, sizeof(key));
-    return DBB::HexStr(key, key+sizeof(key));
+    if (!btc_pbkdf2_hmac_sha512((const uint8_t *)&passphrase[0], passphrase.size(), (const uint8_t *)BACKUP_KEY_PBKDF2_SALT, BACKUP_KEY_PBKDF2_SALTLEN, rounds, key, sizeof(key)))
+        return "";
+    std::string hexKey = DBB::HexStr(key, key+sizeof(key));
+    memoryCleanse(key, sizeof(key));
+    return hexKey;
 }
 }
@@ -0,0 +1,262 @@
+// Copyright (c) 2015 Jonas Schnelli
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "dbb.h"
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <string.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "dbb_util.h"
+
+#include <btc/hash.h>
+#include <btc/ecc_key.h>
+
+namespace DBB
+{
+FirmwareImage::FirmwareImage() : data(NULL), size(0), hasSig(false), mapping(NULL), mappingLength(0)
+{
+}
+
+FirmwareImage::~FirmwareImage()
+{
+    close();
+}
+
+bool FirmwareImage::open(const std::string& filename, bool hasSignature)
+{
+    close();
+
+#ifndef WIN32
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            mapping = map;
+            mappingLength = st.st_size;
+            // the image is read once from start to end
+            madvise(mapping, mappingLength, MADV_SEQUENTIAL);
+        }
+    }
+    ::close(fd);
+
+    if (mapping) {
+        if (setBuffer((const unsigned char*)mapping, mappingLength, hasSignature))
+            return true;
+        close();
+        return false;
+    }
+#endif
+
+    // no mmap, read the file once
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    std::streamsize fileSize = file.tellg();
+    if (fileSize <= 0)
+        return false;
+
+    std::vector<unsigned char> buffer(fileSize);
+    file.seekg(0, std::ios::beg);
+    if (!file.read((char*)&buffer[0], fileSize))
+        return false;
+
+    ownedBuffer.swap(buffer);
+    if (!setBuffer(&ownedBuffer[0], ownedBuffer.size(), hasSignature)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool FirmwareImage::setBuffer(const unsigned char* buffer, size_t length, bool hasSignature)
+{
+    size_t appLength = length;
+    if (hasSignature) {
+        if (length < FIRMWARE_SIGLEN)
+            return false;
+        appLength -= FIRMWARE_SIGLEN;
+    }
+    if (appLength == 0 || appLength > DBB_APP_LENGTH)
+        return false;
+
+    data = buffer;
+    size = length;
+    hasSig = hasSignature;
+    return true;
+}
+
+void FirmwareImage::close()
+{
+#ifndef WIN32
+    if (mapping)
+        munmap(mapping, mappingLength);
+#endif
+    mapping = NULL;
+    mappingLength = 0;
+    ownedBuffer.clear();
+    data = NULL;
+    size = 0;
+    hasSig = false;
+}
+
+std::string FirmwareImage::signatureHex() const
+{
+    if (!data || !hasSig)
+        return "";
+    return HexStr((unsigned char*)data, (unsigned char*)data + FIRMWARE_SIGLEN);
+}
+
+const unsigned char* FirmwareImage::appData() const
+{
+    if (!data)
+        return NULL;
+    return hasSig ? data + FIRMWARE_SIGLEN : data;
+}
+
+size_t FirmwareImage::appSize() const
+{
+    if (!data)
+        return 0;
+    return hasSig ? size - FIRMWARE_SIGLEN : size;
+}
+
+size_t FirmwareImage::uploadSize() const
+{
+    const unsigned char* app = appData();
+    size_t len = appSize();
+    while (len > 0 && app[len - 1] == 0xFF)
+        len--;
+
+    // full chunks, but always at least one
+    size_t chunks = (len + FIRMWARE_CHUNKSIZE - 1) / FIRMWARE_CHUNKSIZE;
+    if (chunks == 0)
+        chunks = 1;
+    return std::min(chunks * FIRMWARE_CHUNKSIZE, appSize());
+}
+
+bool FirmwareImage::isMapped() const
+{
+    return (mapping != NULL);
+}
+
+const std::string dummySig(const std::vector<char>& firmwareBuffer)
+{
+    // dummy sign and get the compact signature
+    // dummy private key to allow current testing
+    // the private key matches the pubkey on the DBB bootloader / FW
+    std::string testing_privkey = "e0178ae94827844042d91584911a6856799a52d89e9d467b83f1cf76a0482a11";
+
+    // generate a double SHA256 of the firmware data
+    uint8_t hashout[32];
+    btc_hash((const uint8_t*)&firmwareBuffer[0], firmwareBuffer.size(), hashout);
+    std::string hashHex = DBB::HexStr(hashout, hashout+32);
+
+    btc_key key;
+    btc_privkey_init(&key);
+    std::vector<unsigned char> privkey = DBB::ParseHex(testing_privkey);
+    memcpy(&key.privkey, &privkey[0], 32);
+
+    size_t sizeout = 64;
+    unsigned char sig[sizeout];
+    int res = btc_key_sign_hash_compact(&key, hashout, sig, &sizeout);
+    return DBB::HexStr(sig, sig+sizeout);
+}
+
+const std::string dummySig(const FirmwareImage& image)
+{
+    // the signature covers the whole 0xFF padded app area
+    std::vector<char> firmwareBuffer(DBB_APP_LENGTH, (char)0xff);
+    if (image.appSize() > 0)
+        memcpy(&firmwareBuffer[0], image.appData(), image.appSize());
+    return dummySig(firmwareBuffer);
+}
+
+bool upgradeFirmware(const std::vector<char>& firmwarePadded, size_t firmwareSize, const std::string& sigCmpStr, std::function<void(const std::string&, float progress)> progressCallback)
+{
+    FirmwareImage image;
+    if (firmwarePadded.empty() || !image.setBuffer((const unsigned char*)&firmwarePadded[0], std::min(firmwarePadded.size(), firmwareSize), false))
+        return false;
+
+    return upgradeFirmware(image, sigCmpStr, progressCallback);
+}
+
+bool upgradeFirmware(const FirmwareImage& image, const std::string& sigCmpStr, std::function<void(const std::string&, float progress)> progressCallback, FirmwareUploadStats* statsOut)
+{
+    std::string devicePath;
+    enum DBB::dbb_device_mode deviceType = DBB::deviceAvailable(devicePath);
+    if (!defaultSession().open(deviceType, devicePath))
+        return false;
+
+    return upgradeFirmware(defaultSession(), image, sigCmpStr, progressCallback, statsOut);
+}
+
+bool upgradeFirmware(DeviceSession& session, const FirmwareImage& image, const std::string& sigCmpStr, std::function<void(const std::string&, float progress)> progressCallback, FirmwareUploadStats* statsOut)
+{
+    FirmwareUploadStats stats;
+    std::string cmdOut;
+
+    if (!session.isOpen() || image.appSize() == 0)
+        return false;
+
+    session.sendCommand("v0", cmdOut);
+    if (cmdOut.size() != 1 || cmdOut[0] != 'v') {
+        session.close();
+        return false;
+    }
+    session.sendCommand("s0"+sigCmpStr, cmdOut);
+    session.sendCommand("e", cmdOut);
+
+    // after the erase the flash is 0xFF, the padding tail doesn't need to be written
+    const unsigned char* app = image.appData();
+    size_t uploadSize = image.uploadSize();
+    unsigned int nChunks = (uploadSize + FIRMWARE_CHUNKSIZE - 1) / FIRMWARE_CHUNKSIZE;
+    stats.skippedChunks = DBB_APP_LENGTH / FIRMWARE_CHUNKSIZE - nChunks;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    progressCallback("", 0.0);
+    for (unsigned int cnt = 0; cnt < nChunks; cnt++)
+    {
+        size_t pos = (size_t)cnt * FIRMWARE_CHUNKSIZE;
+        size_t chunkLen = std::min((size_t)FIRMWARE_CHUNKSIZE, uploadSize - pos);
+
+        // the chunk is copied straight from the image into the HID report
+        if (!session.sendChunk(cnt, app + pos, chunkLen, cmdOut) || cmdOut != "w0") {
+            session.close();
+            return false;
+        }
+        stats.chunks++;
+        stats.bytes += chunkLen;
+        stats.elapsedMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        if (statsOut)
+            *statsOut = stats;
+
+        progressCallback(string_format("%.1f KB/s", stats.kbPerSecond()), 1.0/nChunks*(cnt+1));
+    }
+
+    session.sendCommand("s0"+sigCmpStr, cmdOut);
+    if (cmdOut.size() < 2) {
+        session.close();
+        return false;
+    }
+    if (!(cmdOut[0] == 's' && cmdOut[1] == '0')) {
+        session.close();
+        return false;
+    }
+
+    progressCallback("", 1.0);
+    session.close();
+    return true;
+}
+} //end namespace DBB
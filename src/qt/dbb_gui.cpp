@@ -640,6 +640,7 @@ void DBBDaemonGui::uiUpdateDeviceState(int deviceType)
         setActiveArrow(0);
         resetInfos();
         sessionPassword.clear();
+        DBB::clearCommandCipherCache();
         hideSessionPasswordView();
         setTabbarEnabled(false);
         deviceReadyToInteract = false;
@@ -1050,6 +1051,10 @@ void DBBDaemonGui::resetU2F()
     if (!(version.contains(QString("v2.")) || version.contains(QString("v1.")) || version.contains(QString("v0.")))) {
         // v3+ has a new api.
         std::string hashHex = DBB::getStretchedBackupHexKey(sessionPassword);
+        if (hashHex.empty()) {
+            showAlert(tr("Error"), tr("Could not derive the backup key."));
+            return;
+        }
         cmd = std::string("{\"seed\": { \"source\": \"U2F_create\", \"key\":\""+hashHex+"\", \"filename\": \"" + getBackupString() + ".pdf\" } }");
     }
 
@@ -1107,6 +1112,10 @@ void DBBDaemonGui::seedHardware()
         return;
 
     std::string hashHex = DBB::getStretchedBackupHexKey(sessionPassword);
+    if (hashHex.empty()) {
+        showAlert(tr("Error"), tr("Could not derive the backup key."));
+        return;
+    }
 
     DBB::LogPrint("Request device seeding...\n", "");
     std::string command = "{\"seed\" : {"
@@ -1254,68 +1263,38 @@ void DBBDaemonGui::upgradeFirmwareWithFile(const QString& fileName)
         fwUpgradeThread = new std::thread([this,possibleFilename]() {
             bool upgradeRes = false;
 
-            std::streamsize firmwareSize;
-            std::stringstream buffer;
-
+            // the chunks are streamed directly from the internal buffer or the mapped file
+            DBB::FirmwareImage firmwareImage;
+            bool readSig = (DBB::GetArg("-noreadsig", "") == "");
+            bool imageOk = false;
             if (possibleFilename.empty() || possibleFilename == "" || possibleFilename == "int")
-            {
-                // load internally
-                for (int i = 0; i<firmware_deterministic_3_0_0_signed_bin_len;i++)
-                {
-                    buffer << firmware_deterministic_3_0_0_signed_bin[i];
-                }
-                firmwareSize = firmware_deterministic_3_0_0_signed_bin_len;
-            }
-            else {
-                // load the file
-                std::ifstream firmwareFile(possibleFilename, std::ios::binary);
-                buffer << firmwareFile.rdbuf();
-                firmwareSize = firmwareFile.tellg();
-                firmwareFile.close();
-            }
+                imageOk = firmwareImage.setBuffer(firmware_deterministic_3_0_0_signed_bin, firmware_deterministic_3_0_0_signed_bin_len, readSig);
+            else
+                imageOk = firmwareImage.open(possibleFilename, readSig);
 
-            buffer.seekg(0, std::ios::beg);
-            if (firmwareSize > 0)
+            if (imageOk)
             {
                 std::string sigStr;
 
                 //read signatures
-                if (DBB::GetArg("-noreadsig", "") == "")
-                {
-                    unsigned char sigByte[FIRMWARE_SIGLEN];
-                    buffer.read((char *)&sigByte[0], FIRMWARE_SIGLEN);
-                    sigStr = DBB::HexStr(sigByte, sigByte + FIRMWARE_SIGLEN);
-                }
-
-                //read firmware
-                std::vector<char> firmwareBuffer(DBB_APP_LENGTH);
-                unsigned int pos = 0;
-                while (true)
-                {
-                    buffer.read(&firmwareBuffer[0]+pos, FIRMWARE_CHUNKSIZE);
-                    std::streamsize bytes = buffer.gcount();
-                    if (bytes == 0)
-                        break;
-
-                    pos += bytes;
-                }
-
-                // append 0xff to the rest of the firmware buffer
-                memset((void *)(&firmwareBuffer[0]+pos), 0xff, DBB_APP_LENGTH-pos);
+                if (readSig)
+                    sigStr = firmwareImage.signatureHex();
 
                 if (DBB::GetArg("-dummysigwrite", "") != "")
                 {
-                    sigStr = DBB::dummySig(firmwareBuffer);
+                    sigStr = DBB::dummySig(firmwareImage);
                 }
 
                 emit shouldUpdateModalInfo("<strong>Upgrading Firmware...</strong>");
                 // send firmware blob to DBB
-                if (DBB::upgradeFirmware(firmwareBuffer, firmwareSize, sigStr, [this](const std::string& infotext, float progress) {
+                DBB::FirmwareUploadStats uploadStats;
+                if (DBB::upgradeFirmware(firmwareImage, sigStr, [this](const std::string& infotext, float progress) {
                     emit shouldUpdateModalInfo(tr("<strong>Upgrading Firmware...</strong><br/><br/>%1% complete").arg(QString::number(progress*100, 'f', 1)));
-                }))
+                }, &uploadStats))
                 {
                     upgradeRes = true;
                 }
+                DBB::LogPrint("Firmware upload: %d chunks (%d skipped), %.1f KB/s\n", uploadStats.chunks, uploadStats.skippedChunks, uploadStats.kbPerSecond());
             }
             emit firmwareThreadDone(upgradeRes);
         });
@@ -1451,6 +1430,10 @@ void DBBDaemonGui::showBackupDialog()
 void DBBDaemonGui::addBackup()
 {
     std::string hashHex = DBB::getStretchedBackupHexKey(sessionPassword);
+    if (hashHex.empty()) {
+        showAlert(tr("Error"), tr("Could not derive the backup key."));
+        return;
+    }
     std::string backupFilename = getBackupString();
     std::string command = "{\"backup\" : {\"encrypt\" :\"yes\","
                           "\"key\":\"" + hashHex + "\","
@@ -1504,6 +1487,10 @@ void DBBDaemonGui::verifyBackup(const QString& backupFilename)
         return;
 
     std::string hashHex = DBB::getStretchedBackupHexKey(tempBackupPassword.toStdString());
+    if (hashHex.empty()) {
+        showAlert(tr("Error"), tr("Could not derive the backup key."));
+        return;
+    }
     std::string command = "{\"backup\" : {"
                 "\"check\" :\"" + backupFilename.toStdString() + "\","
                 "\"key\":\""+hashHex+"\""
@@ -1542,6 +1529,10 @@ void DBBDaemonGui::restoreBackup(const QString& backupFilename)
         return;
 
     std::string hashHex = DBB::getStretchedBackupHexKey(tempBackupPassword.toStdString());
+    if (hashHex.empty()) {
+        showAlert(tr("Error"), tr("Could not derive the backup key."));
+        return;
+    }
     std::string command = "{\"seed\" : {"
                                 "\"source\":\"backup\","
                                 "\"filename\" :\"" + backupFilename.toStdString() + "\","
@@ -2091,8 +2082,7 @@ void DBBDaemonGui::createSingleWallet()
 void DBBDaemonGui::getNewAddress()
 {
     if (singleWallet->client.IsSeeded()) {
-        DBBNetThread* thread = DBBNetThread::DetachThread();
-        thread->currentThread = std::thread([this, thread]() {
+        DBBNetThread::Submit(DBB_NET_PRIORITY_HIGH, [this](const DBBNetCancelToken&) {
             std::string walletsResponse;
 
             std::string address;
@@ -2110,8 +2100,6 @@ void DBBDaemonGui::getNewAddress()
                 emit shouldShowAlert("Error", (error.size() > 1) ? QString::fromStdString(error) : tr("Could not get a new receiving address."));
                 setNetLoading(false);
             }
-
-            thread->completed();
         });
 
         setNetLoading(true);
@@ -2184,8 +2172,7 @@ void DBBDaemonGui::createTxProposalPressed()
 
     this->ui->sendToAddress->clearFocus();
     this->ui->sendAmount->clearFocus();
-    DBBNetThread* thread = DBBNetThread::DetachThread();
-    thread->currentThread = std::thread([this, thread, amount]() {
+    DBBNetThread::Submit(DBB_NET_PRIORITY_HIGH, [this, amount](const DBBNetCancelToken&) {
         UniValue proposalOut;
         std::string errorOut;
 
@@ -2207,8 +2194,6 @@ void DBBDaemonGui::createTxProposalPressed()
                 emit createTxProposalDone(singleWallet, "", proposalOut);
             }
         }
-
-        thread->completed();
     });
     setNetLoading(true);
     showModalInfo(tr("Creating Transaction"));
@@ -2313,8 +2298,7 @@ void DBBDaemonGui::joinCopayWallet(int walletIndex)
         wallet = singleWallet;
 
     if (walletIndex == 0) {
-        DBBNetThread* thread = DBBNetThread::DetachThread();
-        thread->currentThread = std::thread([this, thread, wallet]() {
+        DBBNetThread::Submit(DBB_NET_PRIORITY_HIGH, [this, wallet](const DBBNetCancelToken&) {
 
             DBB::LogPrint("Creating Copay wallet...\n", "");
             //single wallet, create wallet first
@@ -2323,8 +2307,6 @@ void DBBDaemonGui::joinCopayWallet(int walletIndex)
                 wallet->client.CreateWallet(wallet->participationName);
             }
             emit joinCopayWalletDone(wallet);
-
-            thread->completed();
         });
 
     } else {
@@ -2388,22 +2370,27 @@ void DBBDaemonGui::MultisigUpdateWallets(bool initialJoin)
 
 void DBBDaemonGui::SingleWalletUpdateWallets(bool showLoading)
 {
-    if (singleWallet->updatingWallet)
-    {
-        if (showLoading) {
-            setNetLoading(true);
-        }
-        singleWallet->shouldUpdateWalletAgain = true;
-        return;
-    }
     if (!singleWallet->client.IsSeeded())
         return;
 
     if (this->ui->balanceLabel->text() == "?") {
-        this->ui->balanceLabel->setText("Loading...");
-        this->ui->singleWalletBalance->setText("Loading...");
+        // show the last known state (previous session) until the wallet server responds
+        std::string cachedWallets;
+        std::string cachedTxHistory;
+        UniValue cachedResponse;
+        if (singleWallet->client.GetCachedResponse("/v2/wallets/", cachedWallets) && cachedResponse.read(cachedWallets) && cachedResponse.isObject()) {
+            // only render it, the wallet server hasn't been reached yet (netLoaded stays unset)
+            updateUISingleWallet(cachedResponse);
+
+            UniValue data;
+            if (singleWallet->client.GetCachedResponse("/v1/txhistory/", cachedTxHistory) && data.read(cachedTxHistory))
+                emit getTransactionHistoryAvailable(singleWallet, true, data);
+        } else {
+            this->ui->balanceLabel->setText("Loading...");
+            this->ui->singleWalletBalance->setText("Loading...");
 
-        this->ui->currentAddress->setText("Loading...");
+            this->ui->currentAddress->setText("Loading...");
+        }
     }
 
     singleWalletIsUpdating = true;
@@ -2564,57 +2551,58 @@ void DBBDaemonGui::updateTransactionTable(DBBWallet *wallet, bool historyAvailab
 
 void DBBDaemonGui::executeNetUpdateWallet(DBBWallet* wallet, bool showLoading, std::function<void(bool, std::string&)> cmdFinished)
 {
-    DBB::LogPrint("Updating copay wallet\n", "");
-    DBBNetThread* thread = DBBNetThread::DetachThread();
-    thread->currentThread = std::thread([this, thread, wallet, cmdFinished]() {
-        std::string walletsResponse;
-        std::string feeLevelResponse;
+    if (showLoading)
+        setNetLoading(true);
 
-        bool walletsAvailable = false;
-        {
-            wallet->updatingWallet = true;
+    // a refresh is already running, it will do one more round for this request
+    if (!wallet->requestRefresh(cmdFinished))
+        return;
 
-            do
+    DBB::LogPrint("Updating copay wallet\n", "");
+    // background refreshes (timer) must not delay user initiated requests
+    std::shared_ptr<DBBNetTask> task = DBBNetThread::Submit(showLoading ? DBB_NET_PRIORITY_NORMAL : DBB_NET_PRIORITY_BACKGROUND, [this, wallet](const DBBNetCancelToken& token) {
+        std::vector<DBBWalletRefreshCallback> requests = wallet->takeRefreshRequests();
+        while (!requests.empty() && !token.isCancelled())
+        {
+            bool isSingleWallet = false;
             {
-                {
-                    std::unique_lock<std::recursive_mutex> lock(this->cs_walletObjects);
-                    wallet->shouldUpdateWalletAgain = false;
-                    walletsAvailable = wallet->client.GetWallets(walletsResponse);
-                }
-                emit getWalletsResponseAvailable(wallet, walletsAvailable, walletsResponse, false);
-                bool isSingleWallet = false;
-                {
-                    std::unique_lock<std::recursive_mutex> lock(this->cs_walletObjects);
-                    wallet->client.GetFeeLevels();
-                    isSingleWallet = (wallet == this->singleWallet);
-                }
-                std::string txHistoryResponse;
-                if (isSingleWallet) {
-                    bool transactionHistoryAvailable  = false;
-                    {
-                        std::unique_lock<std::recursive_mutex> lock(this->cs_walletObjects);
-                        transactionHistoryAvailable = wallet->client.GetTransactionHistory(txHistoryResponse);
-                    }
+                std::unique_lock<std::recursive_mutex> lock(this->cs_walletObjects);
+                isSingleWallet = (wallet == this->singleWallet);
+            }
 
+            // wallets, fee levels and the history are loaded concurrently
+            std::string walletsResponse;
+            std::string txHistoryResponse;
+            bool transactionHistoryAvailable = false;
+            bool walletsAvailable = wallet->client.RefreshWallet(walletsResponse, isSingleWallet, txHistoryResponse, transactionHistoryAvailable);
 
+            // one response serves every request that came in until now
+            for (const DBBWalletRefreshCallback& request : requests)
+                request(walletsAvailable, walletsResponse);
 
-                    UniValue data;
-                    if (transactionHistoryAvailable)
-                        data.read(txHistoryResponse);
+            if (isSingleWallet) {
+                UniValue data;
+                if (transactionHistoryAvailable)
+                    data.read(txHistoryResponse);
 
-                    emit getTransactionHistoryAvailable(wallet, transactionHistoryAvailable, data);
-                }
+                emit getTransactionHistoryAvailable(wallet, transactionHistoryAvailable, data);
+            }
 
-            }while(wallet->shouldUpdateWalletAgain);
+            requests = wallet->takeRefreshRequests();
+        }
 
-            wallet->updatingWallet = false;
+        // cancelled (shutdown), the taken and the pending requests fail
+        if (!requests.empty()) {
+            std::string walletsResponse;
+            for (const DBBWalletRefreshCallback& request : requests)
+                request(false, walletsResponse);
+            wallet->abortRefresh();
         }
-        cmdFinished(walletsAvailable, walletsResponse);
-        thread->completed();
-    });
+    }, DBBNetCancelToken(), [wallet]() { wallet->abortRefresh(); });
 
-    if (showLoading)
-        setNetLoading(true);
+    // the pool is shut down, nobody would ever clear the running state
+    if (!task)
+        wallet->abortRefresh();
 }
 
 void DBBDaemonGui::parseWalletsResponse(DBBWallet* wallet, bool walletsAvailable, const std::string& walletsResponse, bool initialJoin)
@@ -2934,6 +2922,15 @@ void DBBDaemonGui::PaymentProposalAction(DBBWallet* wallet, const QString &tfaCo
                                 pos++;
                             }
 
+                            // check all device signatures before they go to the wallet server
+                            if (!wallet->client.VerifyTxProposalSignatures(inputHashesAndPaths, sigs)) {
+                                wallet->mapHashSig.clear();
+                                DBB::LogPrint("Invalid signature from device\n", "");
+                                emit shouldHideVerificationInfo();
+                                emit shouldShowAlert("Error", tr("Invalid signature from device"));
+                                return;
+                            }
+
                             emit shouldHideVerificationInfo();
                             emit signedProposalAvailable(wallet, paymentProposal, sigs);
                             wallet->mapHashSig.clear();
@@ -2948,9 +2945,7 @@ void DBBDaemonGui::PaymentProposalAction(DBBWallet* wallet, const QString &tfaCo
 
 void DBBDaemonGui::postSignaturesForPaymentProposal(DBBWallet* wallet, const UniValue& proposal, const std::vector<std::string>& vSigs)
 {
-    DBBNetThread* thread = DBBNetThread::DetachThread();
-    thread->currentThread = std::thread([this, thread, wallet, proposal, vSigs]() {
-        //thread->currentThread = ;
+    DBBNetThread::Submit(DBB_NET_PRIORITY_HIGH, [this, wallet, proposal, vSigs](const DBBNetCancelToken&) {
         if (!wallet->client.PostSignaturesForTxProposal(proposal, vSigs))
         {
             DBB::LogPrint("Error posting txp signatures\n", "");
@@ -2982,8 +2977,6 @@ void DBBDaemonGui::postSignaturesForPaymentProposal(DBBWallet* wallet, const Uni
                 emit paymentProposalUpdated(wallet, proposal);
             }
         }
-
-        thread->completed();
     });
     DBB::LogPrint("Broadcast Transaction\n", "");
     showModalInfo(tr("Broadcast Transaction"));
@@ -3120,6 +3113,10 @@ void DBBDaemonGui::updateHiddenPassword(const QString& hiddenPassword)
     if (!(version.contains(QString("v2.")) || version.contains(QString("v1.")) || version.contains(QString("v0.")))) {
         // v3+ has a new api.
         std::string hashHex = DBB::getStretchedBackupHexKey(hiddenPassword.toStdString());
+        if (hashHex.empty()) {
+            showAlert(tr("Error"), tr("Could not derive the backup key."));
+            return;
+        }
         cmd = std::string("{\"hidden_password\": { \"password\": \""+hiddenPassword.toStdString()+"\", \"key\": \""+hashHex+"\"} }");
     }
 
@@ -4,9 +4,7 @@
 
 #include "update.h"
 
-#include <curl/curl.h>
-
-#include <dbb_netthread.h>
+#include <dbb_httpclient.h>
 #include <dbb_util.h>
 
 #include <QDesktopServices>
@@ -17,12 +15,6 @@
 #include <QWidget>
 
 
-static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp)
-{
-    ((std::string*)userp)->append((char*)contents, size * nmemb);
-    return size * nmemb;
-}
-
 DBBUpdateManager::DBBUpdateManager() : QWidget(), checkingForUpdates(0)
 {
     connect(this, SIGNAL(checkForUpdateResponseAvailable(const std::string&, long, bool)), this, SLOT(parseCheckUpdateResponse(const std::string&, long, bool)));
@@ -35,73 +27,6 @@ DBBUpdateManager::~DBBUpdateManager()
     disconnect(this, SIGNAL(checkForUpdateResponseAvailable(const std::string&, long, bool)), this, SLOT(parseCheckUpdateResponse(const std::string&, long, bool)));
 }
 
-bool DBBUpdateManager::SendRequest(const std::string& method,
-                               const std::string& url,
-                               const std::string& args,
-                               std::string& responseOut,
-                               long& httpcodeOut)
-{
-    CURL* curl;
-    CURLcode res;
-
-    bool success = false;
-
-    curl_global_init(CURL_GLOBAL_ALL);
-    curl = curl_easy_init();
-    if (curl) {
-        struct curl_slist* chunk = NULL;
-        chunk = curl_slist_append(chunk, "Content-Type: text/plain");
-        res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk);
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        if (method == "post")
-        {
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, args.c_str());
-            curl_easy_setopt(curl, CURLOPT_POST, 1L);
-        }
-
-        if (method == "delete") {
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, args.c_str());
-            curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
-        }
-
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &responseOut);
-        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
-
-        if (socks5ProxyURL.size())
-            curl_easy_setopt(curl, CURLOPT_PROXY, socks5ProxyURL.c_str());
-        
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(curl, CURLOPT_TIMEOUT, 35L);
-
-#if defined(__linux__) || defined(__unix__)
-        //need to libcurl, load it once, set the CA path at runtime
-        //we assume only linux needs CA fixing
-        curl_easy_setopt(curl, CURLOPT_CAINFO, ca_file.c_str());
-#endif
-
-#ifdef DBB_ENABLE_NETDEBUG
-        curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-#endif
-
-        res = curl_easy_perform(curl);
-        if (res != CURLE_OK) {
-            DBB::LogPrintDebug("curl_easy_perform() failed "+ ( curl_easy_strerror(res) ? std::string(curl_easy_strerror(res)) : ""), "");
-            success = false;
-        } else {
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpcodeOut);
-            success = true;
-        }
-
-        curl_slist_free_all(chunk);
-        curl_easy_cleanup(curl);
-    }
-    curl_global_cleanup();
-
-    DBB::LogPrintDebug("response: "+responseOut, "");
-    return success;
-};
-
 void DBBUpdateManager::checkForUpdateInBackground()
 {
     checkForUpdate(false);
@@ -112,16 +37,25 @@ void DBBUpdateManager::checkForUpdate(bool reportAlways)
     if (checkingForUpdates)
         return;
 
-    DBBNetThread* thread = DBBNetThread::DetachThread();
-    thread->currentThread = std::thread([this, thread, reportAlways]() {
-        std::string response;
-        long httpStatusCode;
-        SendRequest("post", "https://digitalbitbox.com/desktop-app/update.json", "{\"version\":\""+std::string(DBB_PACKAGE_VERSION)+"\",\"target\":\"dbb-app\",\"key\":\"KhT9Lzb6o4EYLOVAqjXVWENt6rVKruFVUVJmtxkXKXG5eDw\"}", response, httpStatusCode);
-        emit checkForUpdateResponseAvailable(response, httpStatusCode, reportAlways);
-        thread->completed();
-    });
+    DBBHTTPRequest request;
+    request.method = "post";
+    request.url = "https://digitalbitbox.com/desktop-app/update.json";
+    request.body = "{\"version\":\""+std::string(DBB_PACKAGE_VERSION)+"\",\"target\":\"dbb-app\",\"key\":\"KhT9Lzb6o4EYLOVAqjXVWENt6rVKruFVUVJmtxkXKXG5eDw\"}";
+    request.headers.push_back("Content-Type: text/plain");
+    request.proxy = socks5ProxyURL;
+    request.timeout = 35;
+
+#if defined(__linux__) || defined(__unix__)
+    //need to libcurl, load it once, set the CA path at runtime
+    //we assume only linux needs CA fixing
+    request.caFile = ca_file;
+#endif
 
-    checkingForUpdates = true;
+    // the signal is queued to the GUI thread
+    checkingForUpdates = DBBHTTPClient::Shared().performAsync(request, [this, reportAlways](bool success, long httpCode, const std::string& response) {
+        DBB::LogPrintDebug("response: "+response, "");
+        emit checkForUpdateResponseAvailable(response, httpCode, reportAlways);
+    });
 }
 
 void DBBUpdateManager::parseCheckUpdateResponse(const std::string &response, long statuscode, bool reportAlways)
@@ -31,7 +31,6 @@ public slots:
     void parseCheckUpdateResponse(const std::string &response, long statusCode, bool reportAlways);
 
 private:
-    bool SendRequest(const std::string& method, const std::string& url, const std::string& args, std::string& responseOut, long& httpcodeOut);
     bool checkingForUpdates;
     std::string ca_file;
 